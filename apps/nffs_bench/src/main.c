@@ -0,0 +1,514 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/**
+ * Benchmarks nffs on the native flash driver, using the same flash area
+ * layout as slinky.  Every result is printed as one CSV line:
+ *
+ *     bench,param,value,unit
+ *
+ * so that runs made before and after a change can be diffed or plotted
+ * directly.  Lines starting with '#' describe the configuration.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
+#include "../src/nffs_priv.h"
+#include <os/os.h>
+#include <fs/fs.h>
+#include <bsp/bsp.h>
+#include <nffs/nffs.h>
+#include <hal/hal_flash.h>
+#include <hal/flash_map.h>
+#ifdef ARCH_sim
+#include <mcu/mcu_sim.h>
+#endif
+
+#define BENCH_SEQ_FILE_SIZE     4096
+#define BENCH_SEQ_ITERS         8
+#define BENCH_RAND_READS        512
+#define BENCH_RAND_READ_LEN     16
+#define BENCH_OPEN_ITERS        4
+#define BENCH_MOUNT_ITERS       4
+#define BENCH_GC_FILES          4
+#define BENCH_GC_FILE_SIZE      2048
+#define BENCH_GC_CYCLES         16
+
+/* The default pools are too small for the many-block and many-file cases. */
+#define BENCH_NUM_INODES        512
+#define BENCH_NUM_BLOCKS        1024
+
+static const char *progname;
+static struct nffs_area_desc area_descs[NFFS_AREA_MAX + 1];
+static uint8_t bench_buf[BENCH_SEQ_FILE_SIZE];
+
+static const uint32_t bench_chunk_sizes[] = { 16, 64, 256, 1024, 4096 };
+static const int bench_dir_sizes[] = { 4, 16, 64, 256 };
+static const int bench_mount_files[] = { 0, 16, 64, 192 };
+
+/**
+ * Returns the current time in microseconds.  When a flash profile is
+ * selected, the emulated flash time is added to the host time, so results
+ * approximate the real part rather than the host's memory bandwidth.
+ */
+static uint64_t
+bench_now(void)
+{
+    struct native_flash_emu_stats stats;
+    struct timespec ts;
+
+    native_flash_emu_stats(&stats);
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000 +
+           stats.nfes_busy_usecs;
+}
+
+static void
+bench_report(const char *bench, const char *param, double value,
+             const char *unit)
+{
+    printf("%s,%s,%.3f,%s\n", bench, param, value, unit);
+}
+
+/**
+ * Returns the throughput in MB/s (10^6 bytes per second).
+ */
+static double
+bench_mbps(uint64_t bytes, uint64_t usecs)
+{
+    if (usecs == 0) {
+        usecs = 1;
+    }
+    return (double)bytes / usecs;
+}
+
+static uint32_t bench_rand_state = 1;
+
+static uint32_t
+bench_rand(void)
+{
+    bench_rand_state = bench_rand_state * 1103515245 + 12345;
+    return bench_rand_state >> 8;
+}
+
+static void
+bench_format(void)
+{
+    int rc;
+
+    rc = nffs_format(area_descs);
+    assert(rc == 0);
+}
+
+static void
+bench_fill(uint8_t *buf, int len, int seed)
+{
+    int i;
+
+    for (i = 0; i < len; i++) {
+        buf[i] = seed + i * 7;
+    }
+}
+
+static void
+bench_write_file(const char *path, const void *data, uint32_t len,
+                 uint32_t chunk)
+{
+    struct fs_file *file;
+    uint32_t off;
+    uint32_t n;
+    int rc;
+
+    rc = fs_open(path, FS_ACCESS_WRITE | FS_ACCESS_TRUNCATE, &file);
+    assert(rc == 0);
+
+    for (off = 0; off < len; off += n) {
+        n = len - off;
+        if (n > chunk) {
+            n = chunk;
+        }
+        rc = fs_write(file, (const uint8_t *)data + off, n);
+        assert(rc == 0);
+    }
+
+    rc = fs_close(file);
+    assert(rc == 0);
+}
+
+/**
+ * Sequential write and read throughput, per chunk size.  Each iteration
+ * rewrites the whole file, so the write figures include the garbage
+ * collection that the rewrites eventually trigger.
+ */
+static void
+bench_seq(void)
+{
+    struct fs_file *file;
+    uint64_t start;
+    uint64_t wr_usecs;
+    uint64_t rd_usecs;
+    uint32_t chunk;
+    uint32_t total;
+    uint32_t len;
+    char param[32];
+    int rc;
+    int i;
+    int j;
+
+    bench_fill(bench_buf, sizeof bench_buf, 0);
+
+    for (i = 0; i < sizeof bench_chunk_sizes / sizeof bench_chunk_sizes[0];
+         i++) {
+
+        chunk = bench_chunk_sizes[i];
+        bench_format();
+
+        wr_usecs = 0;
+        rd_usecs = 0;
+        for (j = 0; j < BENCH_SEQ_ITERS; j++) {
+            start = bench_now();
+            bench_write_file("/seq", bench_buf, sizeof bench_buf, chunk);
+            wr_usecs += bench_now() - start;
+
+            start = bench_now();
+            rc = fs_open("/seq", FS_ACCESS_READ, &file);
+            assert(rc == 0);
+            total = 0;
+            do {
+                rc = fs_read(file, chunk, bench_buf + total, &len);
+                assert(rc == 0);
+                total += len;
+            } while (len > 0 && total < sizeof bench_buf);
+            rc = fs_close(file);
+            assert(rc == 0);
+            rd_usecs += bench_now() - start;
+
+            assert(total == sizeof bench_buf);
+        }
+
+        snprintf(param, sizeof param, "chunk=%u", (unsigned int)chunk);
+        bench_report("seq_write", param,
+                     bench_mbps((uint64_t)BENCH_SEQ_ITERS * sizeof bench_buf,
+                                wr_usecs),
+                     "MB/s");
+        bench_report("seq_read", param,
+                     bench_mbps((uint64_t)BENCH_SEQ_ITERS * sizeof bench_buf,
+                                rd_usecs),
+                     "MB/s");
+    }
+}
+
+/**
+ * Latency of a seek followed by a short read at a random offset in a file
+ * made of many small blocks.
+ */
+static void
+bench_rand_read(void)
+{
+    struct fs_file *file;
+    uint64_t total_usecs;
+    uint64_t max_usecs;
+    uint64_t usecs;
+    uint64_t start;
+    uint32_t off;
+    uint32_t len;
+    uint8_t data[BENCH_RAND_READ_LEN];
+    char param[32];
+    int rc;
+    int i;
+
+    bench_format();
+    bench_fill(bench_buf, sizeof bench_buf, 1);
+    bench_write_file("/rand", bench_buf, sizeof bench_buf, 256);
+
+    rc = fs_open("/rand", FS_ACCESS_READ, &file);
+    assert(rc == 0);
+
+    total_usecs = 0;
+    max_usecs = 0;
+    for (i = 0; i < BENCH_RAND_READS; i++) {
+        off = bench_rand() % (sizeof bench_buf - sizeof data);
+
+        start = bench_now();
+        rc = fs_seek(file, off);
+        assert(rc == 0);
+        rc = fs_read(file, sizeof data, data, &len);
+        assert(rc == 0);
+        usecs = bench_now() - start;
+
+        assert(len == sizeof data);
+        assert(memcmp(data, bench_buf + off, sizeof data) == 0);
+
+        total_usecs += usecs;
+        if (usecs > max_usecs) {
+            max_usecs = usecs;
+        }
+    }
+
+    rc = fs_close(file);
+    assert(rc == 0);
+
+    snprintf(param, sizeof param, "len=%d", BENCH_RAND_READ_LEN);
+    bench_report("rand_read_avg", param,
+                 (double)total_usecs / BENCH_RAND_READS, "us");
+    bench_report("rand_read_max", param, (double)max_usecs, "us");
+}
+
+/**
+ * Latency of opening an existing file, and of failing to open a missing one,
+ * as a function of the number of entries in the parent directory.
+ */
+static void
+bench_open(void)
+{
+    struct fs_file *file;
+    uint64_t hit_usecs;
+    uint64_t miss_usecs;
+    uint64_t start;
+    char param[32];
+    char path[32];
+    int num_files;
+    int rc;
+    int i;
+    int j;
+    int k;
+
+    for (i = 0; i < sizeof bench_dir_sizes / sizeof bench_dir_sizes[0]; i++) {
+        num_files = bench_dir_sizes[i];
+
+        bench_format();
+        rc = fs_mkdir("/dir");
+        assert(rc == 0);
+        for (j = 0; j < num_files; j++) {
+            snprintf(path, sizeof path, "/dir/f%03d", j);
+            bench_write_file(path, NULL, 0, 1);
+        }
+
+        hit_usecs = 0;
+        miss_usecs = 0;
+        for (k = 0; k < BENCH_OPEN_ITERS; k++) {
+            for (j = 0; j < num_files; j++) {
+                snprintf(path, sizeof path, "/dir/f%03d", j);
+
+                start = bench_now();
+                rc = fs_open(path, FS_ACCESS_READ, &file);
+                hit_usecs += bench_now() - start;
+                assert(rc == 0);
+
+                rc = fs_close(file);
+                assert(rc == 0);
+
+                snprintf(path, sizeof path, "/dir/m%03d", j);
+
+                start = bench_now();
+                rc = fs_open(path, FS_ACCESS_READ, &file);
+                miss_usecs += bench_now() - start;
+                assert(rc == FS_ENOENT);
+            }
+        }
+
+        snprintf(param, sizeof param, "dir_size=%d", num_files);
+        bench_report("open_hit", param,
+                     (double)hit_usecs / (BENCH_OPEN_ITERS * num_files), "us");
+        bench_report("open_miss", param,
+                     (double)miss_usecs / (BENCH_OPEN_ITERS * num_files),
+                     "us");
+    }
+}
+
+/**
+ * Time taken by nffs_detect() to restore a file system by scanning flash, as
+ * a function of the number of files.  Each file consists of one inode and
+ * one data block.
+ */
+static void
+bench_mount(void)
+{
+    uint64_t usecs;
+    uint64_t start;
+    char param[32];
+    char path[32];
+    int num_files;
+    int rc;
+    int i;
+    int j;
+
+    for (i = 0; i < sizeof bench_mount_files / sizeof bench_mount_files[0];
+         i++) {
+
+        num_files = bench_mount_files[i];
+
+        bench_format();
+        for (j = 0; j < num_files; j++) {
+            snprintf(path, sizeof path, "/f%03d", j);
+            bench_write_file(path, path, strlen(path), 16);
+        }
+
+        usecs = 0;
+        for (j = 0; j < BENCH_MOUNT_ITERS; j++) {
+            start = bench_now();
+            rc = nffs_detect(area_descs);
+            usecs += bench_now() - start;
+            assert(rc == 0);
+        }
+
+        snprintf(param, sizeof param, "files=%d", num_files);
+        bench_report("mount", param, (double)usecs / BENCH_MOUNT_ITERS, "us");
+    }
+}
+
+/**
+ * Garbage collection throughput, in bytes of live data copied per second.
+ */
+static void
+bench_gc(void)
+{
+    uint64_t start;
+    uint64_t usecs;
+    uint32_t copied;
+    char param[32];
+    char path[32];
+    int rc;
+    int i;
+
+    bench_format();
+    for (i = 0; i < BENCH_GC_FILES; i++) {
+        snprintf(path, sizeof path, "/gc%d", i);
+        bench_fill(bench_buf, BENCH_GC_FILE_SIZE, i);
+        bench_write_file(path, bench_buf, BENCH_GC_FILE_SIZE, 256);
+    }
+
+    copied = nffs_stats.STATS_SECT_VAR(gc_bytes_copied);
+    start = bench_now();
+    for (i = 0; i < BENCH_GC_CYCLES; i++) {
+        rc = nffs_gc(NULL);
+        assert(rc == 0);
+    }
+    usecs = bench_now() - start;
+    copied = nffs_stats.STATS_SECT_VAR(gc_bytes_copied) - copied;
+
+    snprintf(param, sizeof param, "live_kb=%d",
+             BENCH_GC_FILES * BENCH_GC_FILE_SIZE / 1024);
+    bench_report("gc", param, bench_mbps(copied, usecs), "MB/s");
+    bench_report("gc_cycle", param, (double)usecs / BENCH_GC_CYCLES, "us");
+}
+
+static void
+usage(int rc)
+{
+    printf("%s [-f flash_file] [-t flash_profile] [-b blocks] [-i indexes] "
+           "[-r readahead] [-w write_bufs] [-g gc_buf]\n", progname);
+    printf("  Benchmarks nffs on the slinky flash layout; prints CSV\n");
+    printf("   -f: flash_file is the name of the flash image file\n");
+    printf("   -t: emulate the timing of nrf51, nrf52 or stm32f4 flash\n");
+    printf("   -b: data block cache size\n");
+    printf("   -i: number of cached block indexes\n");
+    printf("   -r: number of blocks to read ahead\n");
+    printf("   -w: number of write buffers\n");
+    printf("   -g: garbage collection bulk copy buffer size, in bytes\n");
+    exit(rc);
+}
+
+int
+main(int argc, char **argv)
+{
+    const struct native_flash_profile *profile;
+    int rc;
+    int ch;
+    int cnt;
+
+    progname = argv[0];
+    profile = NULL;
+
+    memset(&nffs_config, 0, sizeof nffs_config);
+    nffs_config.nc_num_inodes = BENCH_NUM_INODES;
+    nffs_config.nc_num_blocks = BENCH_NUM_BLOCKS;
+    while ((ch = getopt(argc, argv, "b:f:g:hi:r:t:w:")) != -1) {
+        switch (ch) {
+        case 'b':
+            nffs_config.nc_num_cache_blocks = atoi(optarg);
+            break;
+        case 'f':
+            native_flash_file = optarg;
+            break;
+        case 'g':
+            nffs_config.nc_bulk_buf_size = atoi(optarg);
+            break;
+        case 'i':
+            nffs_config.nc_num_cache_indexes = atoi(optarg);
+            break;
+        case 't':
+            profile = native_flash_profile_find(optarg);
+            if (profile == NULL) {
+                usage(1);
+            }
+            break;
+        case 'r':
+            nffs_config.nc_cache_readahead = atoi(optarg);
+            break;
+        case 'w':
+            nffs_config.nc_num_write_bufs = atoi(optarg);
+            break;
+        case 'h':
+            usage(0);
+            break;
+        case '?':
+        default:
+            usage(1);
+        }
+    }
+
+    os_init();
+
+    rc = hal_flash_init();
+    assert(rc == 0);
+
+    rc = nffs_init();
+    assert(rc == 0);
+
+    cnt = NFFS_AREA_MAX;
+    rc = flash_area_to_nffs_desc(FLASH_AREA_NFFS, &cnt, area_descs);
+    assert(rc == 0);
+
+    /* Emulated time is added to the measurements rather than slept. */
+    native_flash_emu_init(profile, 0);
+
+    printf("# nffs_bench: flash=%s areas=%d cache_blocks=%u "
+           "cache_indexes=%u readahead=%u write_bufs=%u gc_buf=%u\n",
+           profile != NULL ? profile->nfp_name : "native", cnt,
+           (unsigned int)nffs_config.nc_num_cache_blocks,
+           (unsigned int)nffs_config.nc_num_cache_indexes,
+           (unsigned int)nffs_config.nc_cache_readahead,
+           (unsigned int)nffs_config.nc_num_write_bufs,
+           (unsigned int)nffs_config.nc_bulk_buf_size);
+    printf("bench,param,value,unit\n");
+
+    bench_seq();
+    bench_rand_read();
+    bench_open();
+    bench_mount();
+    bench_gc();
+
+    return 0;
+}
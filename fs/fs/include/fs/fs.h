@@ -29,11 +29,45 @@
 struct fs_file;
 struct fs_dir;
 struct fs_dirent;
+struct os_mbuf;
+
+/* Longest name copied into a struct fs_dirent_stat. */
+#define FS_DIRENT_STAT_NAME_MAX 63
+
+/*
+ * Directory entry summary filled in by fs_readdir_stat().
+ */
+struct fs_dirent_stat {
+    uint32_t fds_size;          /* File length; 0 for directories. */
+    uint8_t fds_is_dir;         /* 1 if the entry is a directory. */
+    uint8_t fds_name_len;       /* Full length of the name. */
+    char fds_name[FS_DIRENT_STAT_NAME_MAX + 1]; /* Null-terminated; truncated
+                                                   if longer than the max. */
+};
+
+/*
+ * One buffer of a vectored read or write.
+ */
+struct fs_iovec {
+    void *fi_base;
+    uint32_t fi_len;
+};
 
 int fs_open(const char *filename, uint8_t access_flags, struct fs_file **);
 int fs_close(struct fs_file *);
 int fs_read(struct fs_file *, uint32_t len, void *out_data, uint32_t *out_len);
 int fs_write(struct fs_file *, const void *data, int len);
+int fs_readv(struct fs_file *, const struct fs_iovec *iov, int iovcnt,
+  uint32_t *out_len);
+int fs_writev(struct fs_file *, const struct fs_iovec *iov, int iovcnt);
+int fs_read_mbuf(struct fs_file *, uint32_t len, struct os_mbuf *om,
+  uint32_t *out_len);
+int fs_write_mbuf(struct fs_file *, const struct os_mbuf *om, int off,
+  int len);
+int fs_flush(struct fs_file *);
+int fs_read_ptr(struct fs_file *, uint32_t len, const void **out_ptr,
+  uint32_t *out_len);
+void fs_read_ptr_release(struct fs_file *);
 int fs_seek(struct fs_file *, uint32_t offset);
 uint32_t fs_getpos(const struct fs_file *);
 int fs_filelen(const struct fs_file *, uint32_t *out_len);
@@ -44,6 +78,8 @@ int fs_mkdir(const char *path);
 
 int fs_opendir(const char *path, struct fs_dir **);
 int fs_readdir(struct fs_dir *, struct fs_dirent **);
+int fs_readdir_stat(struct fs_dir *, struct fs_dirent_stat *out_stats,
+  int max_stats, int *out_num_stats);
 int fs_closedir(struct fs_dir *);
 int fs_dirent_name(const struct fs_dirent *, size_t max_len,
   char *out_name, uint8_t *out_name_len);
@@ -56,6 +92,7 @@ int fs_dirent_is_dir(const struct fs_dirent *);
 #define FS_ACCESS_WRITE         0x02
 #define FS_ACCESS_APPEND        0x04
 #define FS_ACCESS_TRUNCATE      0x08
+#define FS_ACCESS_COMPRESS      0x10
 
 /*
  * File access return codes.
@@ -74,5 +111,7 @@ int fs_dirent_is_dir(const struct fs_dirent *);
 #define FS_EEXIST       11  /* File or directory already exists */
 #define FS_EACCESS      12  /* Operation prohibited by file open mode */
 #define FS_EUNINIT      13  /* File system not initialized */
+#define FS_ENOTSUP      14  /* Operation not supported */
+#define FS_EBUSY        15  /* Request queue full */
 
 #endif
@@ -0,0 +1,95 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef __FS_ASYNC_H__
+#define __FS_ASYNC_H__
+
+#include <inttypes.h>
+#include "os/os.h"
+#include "stats/stats.h"
+
+struct fs_file;
+
+/*
+ * Default type of the event posted to the caller's event queue when an
+ * asynchronous request completes; the event's ev_arg points to the completed
+ * fs_async_req.  Event types above OS_EVENT_T_PERUSER belong to whoever owns
+ * the queue, and packages number theirs upward from OS_EVENT_T_PERUSER, so
+ * the default is taken from the top of the range.  A caller whose queue
+ * already uses this value sets far_ev_type instead.
+ */
+#define FS_EVENT_T_ASYNC_DONE   0xff
+
+/*
+ * Asynchronous operation codes.
+ */
+#define FS_ASYNC_OP_READ        1
+#define FS_ASYNC_OP_WRITE       2
+#define FS_ASYNC_OP_SYNC        3
+
+/*
+ * An asynchronous file system request.  The caller owns this structure; it
+ * and the buffer it refers to must remain valid until the completion event
+ * has been received.  The caller zeroes a request before its first use, and
+ * may then set far_ev_type.  A request must not be reused until its
+ * completion event has been received; submitting it earlier fails with
+ * FS_EBUSY while the request is still queued or executing.
+ */
+struct fs_async_req {
+    struct os_event far_ev;         /* Completion event; ev_arg = this req. */
+    struct os_eventq *far_evq;      /* Queue the completion is posted to. */
+    uint8_t far_ev_type;            /* Completion event type; set by the
+                                       caller, 0 = FS_EVENT_T_ASYNC_DONE. */
+    struct fs_file *far_file;
+    void *far_data;                 /* Source or destination buffer. */
+    uint32_t far_len;               /* Requested byte count. */
+    uint32_t far_out_len;           /* Bytes read (read requests only). */
+    os_time_t far_submit_time;
+    os_time_t far_latency;          /* Ticks from submission to completion. */
+    int far_rc;                     /* Result of the operation. */
+    uint8_t far_op;                 /* One of FS_ASYNC_OP_[...]. */
+    uint8_t far_busy;               /* Set from submission until just
+                                       before the completion is posted. */
+};
+
+/*
+ * 'rejected' counts every submission that failed with FS_EBUSY, whether the
+ * queue was full or the request had not completed yet.
+ */
+STATS_SECT_START(fs_async_stats)
+    STATS_SECT_ENTRY(submitted)
+    STATS_SECT_ENTRY(rejected)
+    STATS_SECT_ENTRY(completed)
+    STATS_SECT_ENTRY(failed)
+    STATS_SECT_ENTRY(latency_total)
+    STATS_SECT_ENTRY(latency_max)
+    STATS_SECT_ENTRY(queue_max)
+STATS_SECT_END
+extern STATS_SECT_DECL(fs_async_stats) fs_async_stats;
+
+int fs_async_init(uint8_t prio, os_stack_t *stack, uint16_t stack_size,
+  uint16_t max_reqs);
+int fs_read_async(struct fs_file *, uint32_t len, void *out_data,
+  struct os_eventq *evq, struct fs_async_req *req);
+int fs_write_async(struct fs_file *, const void *data, uint32_t len,
+  struct os_eventq *evq, struct fs_async_req *req);
+int fs_sync_async(struct fs_file *, struct os_eventq *evq,
+  struct fs_async_req *req);
+
+#endif
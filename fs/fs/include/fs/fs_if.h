@@ -22,6 +22,12 @@
 
 /*
  * Common interface filesystem(s) provide.
+ *
+ * The file, directory and directory entry handles a file system hands out
+ * must each begin with a pointer to its struct fs_ops; handle operations are
+ * routed through that pointer, so several file systems can be in use at
+ * once.  Path operations receive the path relative to the mount point, with a
+ * leading '/'.
  */
 struct fs_ops {
     int (*f_open)(const char *filename, uint8_t access_flags,
@@ -30,6 +36,14 @@ struct fs_ops {
     int (*f_read)(struct fs_file *file, uint32_t len, void *out_data,
       uint32_t *out_len);
     int (*f_write)(struct fs_file *file, const void *data, int len);
+    int (*f_readv)(struct fs_file *file, const struct fs_iovec *iov,
+      int iovcnt, uint32_t *out_len);
+    int (*f_writev)(struct fs_file *file, const struct fs_iovec *iov,
+      int iovcnt);
+    int (*f_flush)(struct fs_file *file);
+    int (*f_read_ptr)(struct fs_file *file, uint32_t len, const void **out_ptr,
+      uint32_t *out_len);
+    void (*f_read_ptr_release)(struct fs_file *file);
 
     int (*f_seek)(struct fs_file *file, uint32_t offset);
     uint32_t (*f_getpos)(const struct fs_file *file);
@@ -41,6 +55,8 @@ struct fs_ops {
 
     int (*f_opendir)(const char *path, struct fs_dir **out_dir);
     int (*f_readdir)(struct fs_dir *dir, struct fs_dirent **out_dirent);
+    int (*f_readdir_stat)(struct fs_dir *dir, struct fs_dirent_stat *out_stats,
+      int max_stats, int *out_num_stats);
     int (*f_closedir)(struct fs_dir *dir);
 
     int (*f_dirent_name)(const struct fs_dirent *dirent, size_t max_len,
@@ -51,8 +67,15 @@ struct fs_ops {
 };
 
 /*
- * Currently allow only one type of FS, starts at root.
+ * Registers the root file system; equivalent to fs_mount(fops, "/").
  */
 int fs_register(const struct fs_ops *);
 
+/*
+ * Makes a file system available under the specified absolute path, e.g.
+ * "/ram".  The mount point string is not copied.  Paths are routed to the
+ * file system with the longest matching mount point.
+ */
+int fs_mount(const struct fs_ops *fops, const char *mount_point);
+
 #endif
@@ -0,0 +1,276 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <string.h>
+#include "os/os.h"
+#include "stats/stats.h"
+#include "fs/fs.h"
+#include "fs/fs_async.h"
+
+static struct os_task fs_async_task;
+static struct os_eventq fs_async_evq;
+
+/** Maximum number of outstanding requests; 0 if there is no worker task. */
+static uint16_t fs_async_max_reqs;
+
+/** Number of requests submitted but not yet completed. */
+static uint16_t fs_async_num_reqs;
+
+STATS_SECT_DECL(fs_async_stats) fs_async_stats;
+
+STATS_NAME_START(fs_async_stats)
+    STATS_NAME(fs_async_stats, submitted)
+    STATS_NAME(fs_async_stats, rejected)
+    STATS_NAME(fs_async_stats, completed)
+    STATS_NAME(fs_async_stats, failed)
+    STATS_NAME(fs_async_stats, latency_total)
+    STATS_NAME(fs_async_stats, latency_max)
+    STATS_NAME(fs_async_stats, queue_max)
+STATS_NAME_END(fs_async_stats)
+
+static void
+fs_async_process(struct fs_async_req *req)
+{
+    os_time_t latency;
+    os_sr_t sr;
+
+    switch (req->far_op) {
+    case FS_ASYNC_OP_READ:
+        req->far_rc = fs_read(req->far_file, req->far_len, req->far_data,
+                              &req->far_out_len);
+        break;
+
+    case FS_ASYNC_OP_WRITE:
+        req->far_rc = fs_write(req->far_file, req->far_data, req->far_len);
+        break;
+
+    case FS_ASYNC_OP_SYNC:
+        req->far_rc = fs_flush(req->far_file);
+        break;
+
+    default:
+        req->far_rc = FS_EINVAL;
+        break;
+    }
+
+    latency = os_time_get() - req->far_submit_time;
+    req->far_latency = latency;
+
+    STATS_INC(fs_async_stats, completed);
+    if (req->far_rc != 0) {
+        STATS_INC(fs_async_stats, failed);
+    }
+    STATS_INCN(fs_async_stats, latency_total, latency);
+    if (latency > fs_async_stats.STATS_SECT_VAR(latency_max)) {
+        fs_async_stats.STATS_SECT_VAR(latency_max) = latency;
+    }
+
+    OS_ENTER_CRITICAL(sr);
+    fs_async_num_reqs--;
+    req->far_busy = 0;
+    OS_EXIT_CRITICAL(sr);
+
+    if (req->far_ev_type != 0) {
+        req->far_ev.ev_type = req->far_ev_type;
+    } else {
+        req->far_ev.ev_type = FS_EVENT_T_ASYNC_DONE;
+    }
+    os_eventq_put(req->far_evq, &req->far_ev);
+}
+
+static void
+fs_async_task_func(void *arg)
+{
+    struct os_event *ev;
+
+    while (1) {
+        ev = os_eventq_get(&fs_async_evq);
+        fs_async_process(ev->ev_arg);
+    }
+}
+
+static int
+fs_async_submit(struct fs_async_req *req, uint8_t op, struct fs_file *file,
+                void *data, uint32_t len, struct os_eventq *evq)
+{
+    os_sr_t sr;
+
+    if (req == NULL || evq == NULL || file == NULL) {
+        return FS_EINVAL;
+    }
+
+    if (fs_async_max_reqs == 0) {
+        return FS_EUNINIT;
+    }
+
+    /* The request may still be in the worker's queue, being executed, or
+     * waiting in the caller's queue with its completion.
+     */
+    OS_ENTER_CRITICAL(sr);
+    if (fs_async_num_reqs >= fs_async_max_reqs ||
+        req->far_busy || OS_EVENT_QUEUED(&req->far_ev)) {
+
+        OS_EXIT_CRITICAL(sr);
+        STATS_INC(fs_async_stats, rejected);
+        return FS_EBUSY;
+    }
+    req->far_busy = 1;
+    fs_async_num_reqs++;
+    if (fs_async_num_reqs > fs_async_stats.STATS_SECT_VAR(queue_max)) {
+        fs_async_stats.STATS_SECT_VAR(queue_max) = fs_async_num_reqs;
+    }
+    OS_EXIT_CRITICAL(sr);
+
+    memset(&req->far_ev, 0, sizeof req->far_ev);
+    req->far_ev.ev_arg = req;
+    req->far_evq = evq;
+    req->far_file = file;
+    req->far_data = data;
+    req->far_len = len;
+    req->far_out_len = 0;
+    req->far_latency = 0;
+    req->far_rc = 0;
+    req->far_op = op;
+    req->far_submit_time = os_time_get();
+
+    STATS_INC(fs_async_stats, submitted);
+
+    os_eventq_put(&fs_async_evq, &req->far_ev);
+
+    return 0;
+}
+
+/**
+ * Queues a read from the current position of the specified file.  On
+ * completion, the request's far_rc and far_out_len fields are filled in and
+ * the request's event is posted to the specified queue.
+ *
+ * @param file              The file to read from.
+ * @param len               The maximum number of bytes to read.
+ * @param out_data          The destination buffer; must remain valid until
+ *                              the request completes.
+ * @param evq               The queue to post the completion event to.
+ * @param req               The request to submit.
+ *
+ * @return                  0 if the request was queued;
+ *                          FS_EBUSY if the request queue is full, or if
+ *                              req has not completed yet;
+ *                          FS_EUNINIT if fs_async_init() was not called;
+ *                          FS_EINVAL on bad arguments.
+ */
+int
+fs_read_async(struct fs_file *file, uint32_t len, void *out_data,
+              struct os_eventq *evq, struct fs_async_req *req)
+{
+    return fs_async_submit(req, FS_ASYNC_OP_READ, file, out_data, len, evq);
+}
+
+/**
+ * Queues a write at the current position of the specified file.  On
+ * completion, the request's far_rc field is filled in and the request's
+ * event is posted to the specified queue.
+ *
+ * @param file              The file to write to.
+ * @param data              The data to write; must remain valid until the
+ *                              request completes.
+ * @param len               The number of bytes to write.
+ * @param evq               The queue to post the completion event to.
+ * @param req               The request to submit.
+ *
+ * @return                  0 if the request was queued;
+ *                          FS_EBUSY if the request queue is full, or if
+ *                              req has not completed yet;
+ *                          FS_EUNINIT if fs_async_init() was not called;
+ *                          FS_EINVAL on bad arguments.
+ */
+int
+fs_write_async(struct fs_file *file, const void *data, uint32_t len,
+               struct os_eventq *evq, struct fs_async_req *req)
+{
+    return fs_async_submit(req, FS_ASYNC_OP_WRITE, file, (void *)data, len,
+                           evq);
+}
+
+/**
+ * Queues a flush of the specified file (see fs_flush()).  Since requests are
+ * processed in order, the completion of a sync request also indicates that
+ * all previously queued requests have completed.
+ *
+ * @param file              The file to flush.
+ * @param evq               The queue to post the completion event to.
+ * @param req               The request to submit.
+ *
+ * @return                  0 if the request was queued;
+ *                          FS_EBUSY if the request queue is full, or if
+ *                              req has not completed yet;
+ *                          FS_EUNINIT if fs_async_init() was not called;
+ *                          FS_EINVAL on bad arguments.
+ */
+int
+fs_sync_async(struct fs_file *file, struct os_eventq *evq,
+              struct fs_async_req *req)
+{
+    return fs_async_submit(req, FS_ASYNC_OP_SYNC, file, NULL, 0, evq);
+}
+
+/**
+ * Starts the task that executes asynchronous file system requests.  Requests
+ * are executed one at a time, in submission order, with the same semantics
+ * as the corresponding synchronous calls.  This function must be called at
+ * most once.
+ *
+ * @param prio              The priority of the worker task.
+ * @param stack             The stack to use for the worker task.
+ * @param stack_size        The size of the stack, in os_stack_t units.
+ * @param max_reqs          The maximum number of outstanding requests;
+ *                              further submissions fail with FS_EBUSY.
+ *
+ * @return                  0 on success;
+ *                          FS_EINVAL if max_reqs is 0;
+ *                          FS_EOS if the task could not be created.
+ */
+int
+fs_async_init(uint8_t prio, os_stack_t *stack, uint16_t stack_size,
+              uint16_t max_reqs)
+{
+    int rc;
+
+    if (max_reqs == 0) {
+        return FS_EINVAL;
+    }
+
+    rc = stats_init_and_reg(
+        STATS_HDR(fs_async_stats), STATS_SIZE_INIT_PARMS(fs_async_stats,
+        STATS_SIZE_32), STATS_NAME_INIT_PARMS(fs_async_stats), "fs_async");
+    if (rc != 0) {
+        return FS_EOS;
+    }
+
+    os_eventq_init(&fs_async_evq);
+
+    rc = os_task_init(&fs_async_task, "fs_async", fs_async_task_func, NULL,
+                      prio, OS_WAIT_FOREVER, stack, stack_size);
+    if (rc != 0) {
+        return FS_EOS;
+    }
+
+    fs_async_max_reqs = max_reqs;
+
+    return 0;
+}
@@ -65,6 +65,39 @@ fs_ls_dir(const char *name)
     console_printf("\t%6s %s\n", "dir", name);
 }
 
+/*
+ * Lists directory entries a few at a time, letting the file system fetch
+ * names and sizes in bulk.
+ */
+static int
+fs_ls_entries(struct fs_dir *dir, const char *prefix, int *file_cnt)
+{
+    struct fs_dirent_stat stats[4];
+    int num;
+    int rc;
+    int i;
+
+    while (1) {
+        rc = fs_readdir_stat(dir, stats, 4, &num);
+        if (rc == FS_ENOENT) {
+            return 0;
+        }
+        if (rc) {
+            return rc;
+        }
+        for (i = 0; i < num; i++) {
+            if (stats[i].fds_is_dir) {
+                console_printf("\t%6s %s%s\n", "dir", prefix,
+                  stats[i].fds_name);
+            } else {
+                console_printf("\t%6lu %s%s\n",
+                  (unsigned long)stats[i].fds_size, prefix, stats[i].fds_name);
+            }
+            (*file_cnt)++;
+        }
+    }
+}
+
 static int
 fs_ls_cmd(int argc, char **argv)
 {
@@ -106,6 +139,11 @@ fs_ls_cmd(int argc, char **argv)
 
     rc = fs_opendir(path, &dir);
     if (rc == 0) {
+        rc = fs_ls_entries(dir, name, &file_cnt);
+        if (rc != FS_ENOTSUP) {
+            fs_closedir(dir);
+            goto done;
+        }
         do {
             rc = fs_readdir(dir, &dirent);
             if (rc) {
@@ -23,30 +23,51 @@
 int
 fs_opendir(const char *path, struct fs_dir **out_dir)
 {
-    return fs_root_ops->f_opendir(path, out_dir);
+    const struct fs_ops *fops;
+
+    fops = fs_mount_find(path, &path);
+    if (fops == NULL) {
+        return FS_ENOENT;
+    }
+    return fops->f_opendir(path, out_dir);
 }
 
 int
 fs_readdir(struct fs_dir *dir, struct fs_dirent **out_dirent)
 {
-    return fs_root_ops->f_readdir(dir, out_dirent);
+    return FS_HANDLE_OPS(dir)->f_readdir(dir, out_dirent);
+}
+
+int
+fs_readdir_stat(struct fs_dir *dir, struct fs_dirent_stat *out_stats,
+  int max_stats, int *out_num_stats)
+{
+    if (FS_HANDLE_OPS(dir)->f_readdir_stat == NULL) {
+        return FS_ENOTSUP;
+    }
+    return FS_HANDLE_OPS(dir)->f_readdir_stat(dir, out_stats, max_stats,
+      out_num_stats);
 }
 
 int
 fs_closedir(struct fs_dir *dir)
 {
-    return fs_root_ops->f_closedir(dir);
+    if (dir == NULL) {
+        return 0;
+    }
+    return FS_HANDLE_OPS(dir)->f_closedir(dir);
 }
 
 int
 fs_dirent_name(const struct fs_dirent *dirent, size_t max_len,
   char *out_name, uint8_t *out_name_len)
 {
-    return fs_root_ops->f_dirent_name(dirent, max_len, out_name, out_name_len);
+    return FS_HANDLE_OPS(dirent)->f_dirent_name(dirent, max_len, out_name,
+      out_name_len);
 }
 
 int
 fs_dirent_is_dir(const struct fs_dirent *dirent)
 {
-    return fs_root_ops->f_dirent_is_dir(dirent);
+    return FS_HANDLE_OPS(dirent)->f_dirent_is_dir(dirent);
 }
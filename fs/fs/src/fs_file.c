@@ -24,47 +24,150 @@
 int
 fs_open(const char *filename, uint8_t access_flags, struct fs_file **out_file)
 {
-    return fs_root_ops->f_open(filename, access_flags, out_file);
+    const struct fs_ops *fops;
+
+    fops = fs_mount_find(filename, &filename);
+    if (fops == NULL) {
+        *out_file = NULL;
+        return FS_ENOENT;
+    }
+    return fops->f_open(filename, access_flags, out_file);
 }
 
 int
 fs_close(struct fs_file *file)
 {
-    return fs_root_ops->f_close(file);
+    if (file == NULL) {
+        return 0;
+    }
+    return FS_HANDLE_OPS(file)->f_close(file);
 }
 
 int
 fs_read(struct fs_file *file, uint32_t len, void *out_data, uint32_t *out_len)
 {
-    return fs_root_ops->f_read(file, len, out_data, out_len);
+    return FS_HANDLE_OPS(file)->f_read(file, len, out_data, out_len);
 }
 
 int
 fs_write(struct fs_file *file, const void *data, int len)
 {
-    return fs_root_ops->f_write(file, data, len);
+    return FS_HANDLE_OPS(file)->f_write(file, data, len);
+}
+
+/*
+ * Reads into each buffer in turn, stopping early at end of file.  File
+ * systems that do not implement f_readv get one f_read call per buffer.
+ */
+int
+fs_readv(struct fs_file *file, const struct fs_iovec *iov, int iovcnt,
+  uint32_t *out_len)
+{
+    const struct fs_ops *fops;
+    uint32_t bytes_read;
+    uint32_t total;
+    int rc;
+    int i;
+
+    fops = FS_HANDLE_OPS(file);
+    if (fops->f_readv != NULL) {
+        return fops->f_readv(file, iov, iovcnt, out_len);
+    }
+
+    total = 0;
+    for (i = 0; i < iovcnt; i++) {
+        rc = fops->f_read(file, iov[i].fi_len, iov[i].fi_base, &bytes_read);
+        if (rc != 0) {
+            return rc;
+        }
+        total += bytes_read;
+        if (bytes_read < iov[i].fi_len) {
+            break;
+        }
+    }
+
+    if (out_len != NULL) {
+        *out_len = total;
+    }
+    return 0;
+}
+
+int
+fs_writev(struct fs_file *file, const struct fs_iovec *iov, int iovcnt)
+{
+    const struct fs_ops *fops;
+    int rc;
+    int i;
+
+    fops = FS_HANDLE_OPS(file);
+    if (fops->f_writev != NULL) {
+        return fops->f_writev(file, iov, iovcnt);
+    }
+
+    for (i = 0; i < iovcnt; i++) {
+        rc = fops->f_write(file, iov[i].fi_base, iov[i].fi_len);
+        if (rc != 0) {
+            return rc;
+        }
+    }
+    return 0;
+}
+
+int
+fs_flush(struct fs_file *file)
+{
+    /* File systems without write buffering need not implement flush. */
+    if (FS_HANDLE_OPS(file)->f_flush == NULL) {
+        return 0;
+    }
+    return FS_HANDLE_OPS(file)->f_flush(file);
+}
+
+int
+fs_read_ptr(struct fs_file *file, uint32_t len, const void **out_ptr,
+  uint32_t *out_len)
+{
+    /* Only file systems on memory-mapped storage can provide this. */
+    if (FS_HANDLE_OPS(file)->f_read_ptr == NULL) {
+        return FS_ENOTSUP;
+    }
+    return FS_HANDLE_OPS(file)->f_read_ptr(file, len, out_ptr, out_len);
+}
+
+void
+fs_read_ptr_release(struct fs_file *file)
+{
+    if (FS_HANDLE_OPS(file)->f_read_ptr_release != NULL) {
+        FS_HANDLE_OPS(file)->f_read_ptr_release(file);
+    }
 }
 
 int
 fs_seek(struct fs_file *file, uint32_t offset)
 {
-    return fs_root_ops->f_seek(file, offset);
+    return FS_HANDLE_OPS(file)->f_seek(file, offset);
 }
 
 uint32_t
 fs_getpos(const struct fs_file *file)
 {
-    return fs_root_ops->f_getpos(file);
+    return FS_HANDLE_OPS(file)->f_getpos(file);
 }
 
 int
 fs_filelen(const struct fs_file *file, uint32_t *out_len)
 {
-    return fs_root_ops->f_filelen(file, out_len);
+    return FS_HANDLE_OPS(file)->f_filelen(file, out_len);
 }
 
 int
 fs_unlink(const char *filename)
 {
-    return fs_root_ops->f_unlink(filename);
+    const struct fs_ops *fops;
+
+    fops = fs_mount_find(filename, &filename);
+    if (fops == NULL) {
+        return FS_ENOENT;
+    }
+    return fops->f_unlink(filename);
 }
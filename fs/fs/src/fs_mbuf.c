@@ -0,0 +1,236 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/*
+ * File I/O straight to and from mbuf chains.  The data buffers of the mbufs
+ * are handed to the file system as an I/O vector, so no intermediate copy is
+ * made.
+ */
+
+#include "os/os.h"
+#include "fs/fs.h"
+
+/* Number of mbufs passed to the file system per vectored call. */
+#define FS_MBUF_IOV_BATCH       8
+
+/**
+ * Writes part of an mbuf chain to a file at the handle's current position.
+ *
+ * @param file                  The file to write to.
+ * @param om                    The mbuf chain holding the data.
+ * @param off                   The offset within the chain of the first
+ *                                  byte to write.
+ * @param len                   The number of bytes to write.
+ *
+ * @return                      0 on success;
+ *                              FS_EINVAL if the chain holds fewer than
+ *                                  off + len bytes;
+ *                              other nonzero on failure.
+ */
+int
+fs_write_mbuf(struct fs_file *file, const struct os_mbuf *om, int off,
+  int len)
+{
+    struct fs_iovec iov[FS_MBUF_IOV_BATCH];
+    const struct os_mbuf *cur;
+    int chain_len;
+    int seg_len;
+    int num_segs;
+    int rc;
+
+    if (off < 0 || len < 0) {
+        return FS_EINVAL;
+    }
+
+    chain_len = 0;
+    for (cur = om; cur != NULL; cur = SLIST_NEXT(cur, om_next)) {
+        chain_len += cur->om_len;
+    }
+    if (off + len > chain_len) {
+        return FS_EINVAL;
+    }
+
+    /* Skip to the mbuf containing the first byte. */
+    cur = om;
+    while (off >= cur->om_len && len > 0) {
+        off -= cur->om_len;
+        cur = SLIST_NEXT(cur, om_next);
+    }
+
+    while (len > 0) {
+        num_segs = 0;
+        while (num_segs < FS_MBUF_IOV_BATCH && len > 0) {
+            seg_len = cur->om_len - off;
+            if (seg_len > len) {
+                seg_len = len;
+            }
+            if (seg_len > 0) {
+                iov[num_segs].fi_base = cur->om_data + off;
+                iov[num_segs].fi_len = seg_len;
+                num_segs++;
+                len -= seg_len;
+            }
+            off = 0;
+            cur = SLIST_NEXT(cur, om_next);
+        }
+
+        rc = fs_writev(file, iov, num_segs);
+        if (rc != 0) {
+            return rc;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Reads from a file onto the end of an mbuf chain.  Data fills the trailing
+ * space of the chain's last mbuf, then new mbufs allocated from the chain's
+ * pool.  The packet header length is updated if the chain has one.  If more
+ * data is requested than remains in the file, all available data is read.
+ *
+ * @param file                  The file to read from.
+ * @param len                   The number of bytes to attempt to read.
+ * @param om                    The mbuf chain to append to.
+ * @param out_len               The number of bytes appended gets written
+ *                                  here, even on failure.  Pass null if you
+ *                                  don't care.
+ *
+ * @return                      0 on success;
+ *                              FS_ENOMEM if the mbuf pool ran out;
+ *                              other nonzero on failure.
+ */
+int
+fs_read_mbuf(struct fs_file *file, uint32_t len, struct os_mbuf *om,
+  uint32_t *out_len)
+{
+    struct fs_iovec iov[FS_MBUF_IOV_BATCH];
+    struct os_mbuf *segs[FS_MBUF_IOV_BATCH];
+    struct os_mbuf *last;
+    struct os_mbuf *seg;
+    uint32_t file_len;
+    uint32_t bytes_read;
+    uint32_t requested;
+    uint32_t total;
+    uint32_t left;
+    uint32_t pos;
+    uint32_t n;
+    int num_segs;
+    int rc;
+    int i;
+
+    total = 0;
+
+    /* Don't allocate mbufs for data past the end of the file. */
+    rc = fs_filelen(file, &file_len);
+    if (rc != 0) {
+        goto done;
+    }
+    pos = fs_getpos(file);
+    if (pos >= file_len) {
+        len = 0;
+    } else if (len > file_len - pos) {
+        len = file_len - pos;
+    }
+
+    last = om;
+    while (SLIST_NEXT(last, om_next) != NULL) {
+        last = SLIST_NEXT(last, om_next);
+    }
+
+    while (total < len) {
+        /* Gather free space at the end of the chain, extending it as
+         * needed.
+         */
+        num_segs = 0;
+        requested = 0;
+        seg = last;
+        while (num_segs < FS_MBUF_IOV_BATCH && requested < len - total) {
+            if (num_segs > 0 || OS_MBUF_TRAILINGSPACE(seg) == 0) {
+                SLIST_NEXT(seg, om_next) = os_mbuf_get(om->om_omp, 0);
+                if (SLIST_NEXT(seg, om_next) == NULL) {
+                    break;
+                }
+                seg = SLIST_NEXT(seg, om_next);
+            }
+
+            n = OS_MBUF_TRAILINGSPACE(seg);
+            if (n > len - total - requested) {
+                n = len - total - requested;
+            }
+            iov[num_segs].fi_base = seg->om_data + seg->om_len;
+            iov[num_segs].fi_len = n;
+            segs[num_segs] = seg;
+            num_segs++;
+            requested += n;
+        }
+        if (num_segs == 0) {
+            rc = FS_ENOMEM;
+            goto done;
+        }
+
+        rc = fs_readv(file, iov, num_segs, &bytes_read);
+        if (rc != 0) {
+            bytes_read = 0;
+        }
+
+        /* Account for the data in each mbuf; free the new mbufs the read
+         * did not reach.
+         */
+        left = bytes_read;
+        seg = last;
+        for (i = 0; i < num_segs; i++) {
+            n = iov[i].fi_len;
+            if (n > left) {
+                n = left;
+            }
+            segs[i]->om_len += n;
+            left -= n;
+
+            if (n > 0) {
+                seg = segs[i];
+            }
+        }
+        if (SLIST_NEXT(seg, om_next) != NULL) {
+            os_mbuf_free_chain(SLIST_NEXT(seg, om_next));
+            SLIST_NEXT(seg, om_next) = NULL;
+        }
+        last = seg;
+
+        if (OS_MBUF_IS_PKTHDR(om)) {
+            OS_MBUF_PKTHDR(om)->omp_len += bytes_read;
+        }
+        total += bytes_read;
+
+        if (rc != 0) {
+            goto done;
+        }
+        if (bytes_read < requested) {
+            break;
+        }
+    }
+
+    rc = 0;
+
+done:
+    if (out_len != NULL) {
+        *out_len = total;
+    }
+    return rc;
+}
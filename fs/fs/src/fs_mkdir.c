@@ -24,11 +24,30 @@
 int
 fs_rename(const char *from, const char *to)
 {
-    return fs_root_ops->f_rename(from, to);
+    const struct fs_ops *from_ops;
+    const struct fs_ops *to_ops;
+
+    from_ops = fs_mount_find(from, &from);
+    to_ops = fs_mount_find(to, &to);
+    if (from_ops == NULL || to_ops == NULL) {
+        return FS_ENOENT;
+    }
+
+    /* Files cannot be moved between file systems. */
+    if (from_ops != to_ops) {
+        return FS_EINVAL;
+    }
+    return from_ops->f_rename(from, to);
 }
 
 int
 fs_mkdir(const char *path)
 {
-    return fs_root_ops->f_mkdir(path);
+    const struct fs_ops *fops;
+
+    fops = fs_mount_find(path, &path);
+    if (fops == NULL) {
+        return FS_ENOENT;
+    }
+    return fops->f_mkdir(path);
 }
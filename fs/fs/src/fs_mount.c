@@ -16,23 +16,115 @@
  * specific language governing permissions and limitations
  * under the License.
  */
+#include <string.h>
 #include <fs/fs.h>
 #include <fs/fs_if.h>
 #include "fs_priv.h"
 
-const struct fs_ops *fs_root_ops = NULL;
+static struct fs_mount fs_mounts[FS_MOUNT_MAX];
+static int fs_num_mounts;
 
 int
 fs_register(const struct fs_ops *fops)
 {
-    if (fs_root_ops) {
-        return FS_EEXIST;
+    return fs_mount(fops, "/");
+}
+
+int
+fs_mount(const struct fs_ops *fops, const char *mount_point)
+{
+    struct fs_mount *mount;
+    size_t len;
+    int i;
+
+    len = strlen(mount_point);
+    if (mount_point[0] != '/' || len > UINT8_MAX ||
+        (len > 1 && mount_point[len - 1] == '/')) {
+
+        return FS_EINVAL;
     }
-    fs_root_ops = fops;
+
+    for (i = 0; i < fs_num_mounts; i++) {
+        mount = fs_mounts + i;
+        if (mount->fm_point_len == len &&
+            memcmp(mount->fm_point, mount_point, len) == 0) {
+
+            return FS_EEXIST;
+        }
+    }
+    if (fs_num_mounts >= FS_MOUNT_MAX) {
+        return FS_ENOMEM;
+    }
+
+    mount = fs_mounts + fs_num_mounts;
+    mount->fm_ops = fops;
+    mount->fm_point = mount_point;
+    mount->fm_point_len = len;
 
 #ifdef SHELL_PRESENT
-    fs_cli_init();
+    if (fs_num_mounts == 0) {
+        fs_cli_init();
+    }
 #endif
 
+    fs_num_mounts++;
+
     return FS_EOK;
 }
+
+/**
+ * Finds the file system responsible for the specified path.
+ *
+ * @param path                  The absolute path to look up.
+ * @param out_path              On success, the path relative to the file
+ *                                  system's mount point gets written here.
+ *
+ * @return                      The file system's operations;
+ *                              NULL if no mounted file system contains the
+ *                                  path.
+ */
+const struct fs_ops *
+fs_mount_find(const char *path, const char **out_path)
+{
+    const struct fs_mount *best;
+    const struct fs_mount *mount;
+    const char *rest;
+    int i;
+
+    best = NULL;
+    for (i = 0; i < fs_num_mounts; i++) {
+        mount = fs_mounts + i;
+        if (best != NULL && mount->fm_point_len <= best->fm_point_len) {
+            continue;
+        }
+
+        /* The root file system gets every path not claimed by another mount,
+         * including malformed ones, which it is left to reject.
+         */
+        if (mount->fm_point_len > 1) {
+            if (strncmp(path, mount->fm_point, mount->fm_point_len) != 0) {
+                continue;
+            }
+
+            /* "/ram" contains "/ram" and "/ram/x", but not "/ramx". */
+            rest = path + mount->fm_point_len;
+            if (*rest != '\0' && *rest != '/') {
+                continue;
+            }
+        }
+
+        best = mount;
+    }
+
+    if (best == NULL) {
+        return NULL;
+    }
+
+    if (best->fm_point_len == 1) {
+        *out_path = path;
+    } else {
+        rest = path + best->fm_point_len;
+        *out_path = *rest == '\0' ? "/" : rest;
+    }
+    return best->fm_ops;
+}
@@ -19,8 +19,24 @@
 #ifndef __FS_PRIV_H__
 #define __FS_PRIV_H__
 
+#include <inttypes.h>
+
 struct fs_ops;
-extern const struct fs_ops *fs_root_ops;
+
+#ifndef FS_MOUNT_MAX
+#define FS_MOUNT_MAX            4
+#endif
+
+struct fs_mount {
+    const struct fs_ops *fm_ops;
+    const char *fm_point;
+    uint8_t fm_point_len;
+};
+
+/* The file system that created a handle; see fs_if.h. */
+#define FS_HANDLE_OPS(handle)   (*(const struct fs_ops * const *)(handle))
+
+const struct fs_ops *fs_mount_find(const char *path, const char **out_path);
 
 #ifdef SHELL_PRESENT
 void fs_cli_init(void);
@@ -22,10 +22,14 @@
 
 #include <stddef.h>
 #include <inttypes.h>
+#include "os/os.h"
 
 #define NFFS_FILENAME_MAX_LEN   256  /* Does not require null terminator. */
 #define NFFS_MAX_AREAS          256
 
+/** Rewrite the checkpoint automatically after garbage collection. */
+#define NFFS_CHECKPOINT_F_AUTO  0x01
+
 struct nffs_config {
     /** Maximum number of inodes; default=1024. */
     uint32_t nc_num_inodes;
@@ -44,6 +48,54 @@ struct nffs_config {
 
     /** Data block cache size; default=64. */
     uint32_t nc_num_cache_blocks;
+
+    /** Path lookup cache size; default=0 (no path caching). */
+    uint32_t nc_num_cache_paths;
+
+    /** Number of write coalescing buffers; default=0 (no buffering). */
+    uint32_t nc_num_write_bufs;
+
+    /** Number of cached block offset indexes; default=0 (no indexing). */
+    uint32_t nc_num_cache_indexes;
+
+    /**
+     * Number of blocks to read ahead when a file is read sequentially
+     * (max 8); default=0 (no read-ahead).
+     */
+    uint32_t nc_cache_readahead;
+
+    /**
+     * Size of the buffer used for bulk flash copies and CRC calculations;
+     * default=0 (use the 256-byte shared buffer).
+     */
+    uint32_t nc_bulk_buf_size;
+
+    /**
+     * Maximum data length of a single block (max 32768); default=2048.  The
+     * effective limit is also capped at half the size of the smallest area.
+     */
+    uint32_t nc_block_max_data_sz;
+
+    /**
+     * If nonzero, data block entries are only kept in RAM for files that
+     * have been accessed since the last mount, and are evicted when the
+     * block pool runs out.  Checkpoints are unavailable in this mode;
+     * default=0 (all block entries resident).
+     */
+    uint32_t nc_lazy_blocks;
+
+    /**
+     * Number of hash table buckets, rounded up to a power of two (16 to
+     * 4096); default=(nc_num_inodes + nc_num_blocks) / 2.
+     */
+    uint32_t nc_num_hash_buckets;
+
+    /**
+     * If nonzero, files opened with FS_ACCESS_COMPRESS at creation have their
+     * data blocks compressed, and compressed blocks can be read.  Allocates
+     * a buffer of about 5 kB; default=0 (no compression).
+     */
+    uint32_t nc_compress;
 };
 
 extern struct nffs_config nffs_config;
@@ -57,5 +109,10 @@ struct nffs_area_desc {
 int nffs_init(void);
 int nffs_detect(const struct nffs_area_desc *area_descs);
 int nffs_format(const struct nffs_area_desc *area_descs);
+int nffs_checkpoint_init(const struct nffs_area_desc *area_desc,
+                         uint8_t flags);
+int nffs_checkpoint(void);
+int nffs_gc_task_init(uint8_t prio, os_stack_t *stack, uint16_t stack_size,
+                      uint32_t free_threshold);
 
 #endif
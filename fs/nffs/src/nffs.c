@@ -22,9 +22,13 @@
 #include <stdlib.h>
 #include <assert.h>
 #include "hal/hal_flash.h"
+#include "hal/hal_cputime.h"
 #include "os/os_mempool.h"
 #include "os/os_mutex.h"
+#include "os/os_sem.h"
 #include "os/os_malloc.h"
+#include "os/os_eventq.h"
+#include "os/os_task.h"
 #include "nffs_priv.h"
 #include "nffs/nffs.h"
 #include "fs/fs_if.h"
@@ -32,6 +36,7 @@
 struct nffs_area *nffs_areas;
 uint8_t nffs_num_areas;
 uint8_t nffs_scratch_area_idx;
+uint8_t nffs_gc_from_area_idx;
 uint16_t nffs_block_max_data_sz;
 
 struct os_mempool nffs_file_pool;
@@ -40,6 +45,9 @@ struct os_mempool nffs_inode_entry_pool;
 struct os_mempool nffs_block_entry_pool;
 struct os_mempool nffs_cache_inode_pool;
 struct os_mempool nffs_cache_block_pool;
+struct os_mempool nffs_path_cache_pool;
+struct os_mempool nffs_write_buf_pool;
+struct os_mempool nffs_cache_index_pool;
 
 void *nffs_file_mem;
 void *nffs_inode_mem;
@@ -47,21 +55,95 @@ void *nffs_block_entry_mem;
 void *nffs_cache_inode_mem;
 void *nffs_cache_block_mem;
 void *nffs_dir_mem;
+void *nffs_path_cache_mem;
+void *nffs_write_buf_mem;
+void *nffs_cache_index_mem;
 
 struct nffs_inode_entry *nffs_root_dir;
 struct nffs_inode_entry *nffs_lost_found_dir;
 
+/*
+ * Locking: nffs_mutex serializes operations that modify the file system.
+ * Read-only operations instead register as readers; any number of them can
+ * run at once.  A writer holds nffs_mutex while it waits for the active
+ * readers to drain, so new readers queue up behind it.  Readers still modify
+ * some shared RAM state (caches, reference counts); nffs_ram_mutex protects
+ * that state among concurrent readers.
+ */
 static struct os_mutex nffs_mutex;
+static struct os_mutex nffs_ram_mutex;
+static struct os_sem nffs_drain_sem;
+static uint16_t nffs_num_readers;
+static uint8_t nffs_writer_waiting;
+
+static struct os_task nffs_gc_task;
+static struct os_eventq nffs_gc_evq;
+static struct os_event nffs_gc_ev;
+
+/** Free space below which the gc task runs; 0 if there is no gc task. */
+static uint32_t nffs_gc_free_threshold;
 
 static struct log_handler nffs_log_console_handler;
 struct log nffs_log;
 
+STATS_SECT_DECL(nffs_stats) nffs_stats;
+STATS_NAME_START(nffs_stats)
+    STATS_NAME(nffs_stats, cache_inode_hit)
+    STATS_NAME(nffs_stats, cache_inode_miss)
+    STATS_NAME(nffs_stats, cache_inode_evict)
+    STATS_NAME(nffs_stats, cache_block_hit)
+    STATS_NAME(nffs_stats, cache_block_miss)
+    STATS_NAME(nffs_stats, cache_block_evict)
+    STATS_NAME(nffs_stats, cache_readahead)
+    STATS_NAME(nffs_stats, flash_read)
+    STATS_NAME(nffs_stats, flash_write)
+    STATS_NAME(nffs_stats, flash_read_bytes)
+    STATS_NAME(nffs_stats, flash_write_bytes)
+    STATS_NAME(nffs_stats, flash_erase)
+    STATS_NAME(nffs_stats, gc_run)
+    STATS_NAME(nffs_stats, gc_bytes_copied)
+    STATS_NAME(nffs_stats, gc_bytes_reclaimed)
+    STATS_NAME(nffs_stats, restore_ticks)
+    STATS_NAME(nffs_stats, open_lat_100us)
+    STATS_NAME(nffs_stats, open_lat_1ms)
+    STATS_NAME(nffs_stats, open_lat_10ms)
+    STATS_NAME(nffs_stats, open_lat_slow)
+    STATS_NAME(nffs_stats, read_lat_100us)
+    STATS_NAME(nffs_stats, read_lat_1ms)
+    STATS_NAME(nffs_stats, read_lat_10ms)
+    STATS_NAME(nffs_stats, read_lat_slow)
+    STATS_NAME(nffs_stats, write_lat_100us)
+    STATS_NAME(nffs_stats, write_lat_1ms)
+    STATS_NAME(nffs_stats, write_lat_10ms)
+    STATS_NAME(nffs_stats, write_lat_slow)
+    STATS_NAME(nffs_stats, close_lat_100us)
+    STATS_NAME(nffs_stats, close_lat_1ms)
+    STATS_NAME(nffs_stats, close_lat_10ms)
+    STATS_NAME(nffs_stats, close_lat_slow)
+    STATS_NAME(nffs_stats, unlink_lat_100us)
+    STATS_NAME(nffs_stats, unlink_lat_1ms)
+    STATS_NAME(nffs_stats, unlink_lat_10ms)
+    STATS_NAME(nffs_stats, unlink_lat_slow)
+STATS_NAME_END(nffs_stats)
+static int nffs_stats_registered;
+
+#define NFFS_STATS_LAT(op, start) \
+    nffs_stats_lat(&nffs_stats.STATS_SECT_VAR(op ## _lat_100us), (start))
+
 static int nffs_open(const char *path, uint8_t access_flags,
   struct fs_file **out_file);
 static int nffs_close(struct fs_file *fs_file);
 static int nffs_read(struct fs_file *fs_file, uint32_t len, void *out_data,
   uint32_t *out_len);
 static int nffs_write(struct fs_file *fs_file, const void *data, int len);
+static int nffs_readv(struct fs_file *fs_file, const struct fs_iovec *iov,
+  int iovcnt, uint32_t *out_len);
+static int nffs_writev(struct fs_file *fs_file, const struct fs_iovec *iov,
+  int iovcnt);
+static int nffs_flush(struct fs_file *fs_file);
+static int nffs_read_ptr(struct fs_file *fs_file, uint32_t len,
+  const void **out_ptr, uint32_t *out_len);
+static void nffs_read_ptr_release(struct fs_file *fs_file);
 static int nffs_seek(struct fs_file *fs_file, uint32_t offset);
 static uint32_t nffs_getpos(const struct fs_file *fs_file);
 static int nffs_file_len(const struct fs_file *fs_file, uint32_t *out_len);
@@ -70,6 +152,9 @@ static int nffs_rename(const char *from, const char *to);
 static int nffs_mkdir(const char *path);
 static int nffs_opendir(const char *path, struct fs_dir **out_fs_dir);
 static int nffs_readdir(struct fs_dir *dir, struct fs_dirent **out_dirent);
+static int nffs_readdir_stat(struct fs_dir *dir,
+                             struct fs_dirent_stat *out_stats, int max_stats,
+                             int *out_num_stats);
 static int nffs_closedir(struct fs_dir *dir);
 static int nffs_dirent_name(const struct fs_dirent *fs_dirent, size_t max_len,
   char *out_name, uint8_t *out_name_len);
@@ -80,6 +165,11 @@ static const struct fs_ops nffs_ops = {
     .f_close = nffs_close,
     .f_read = nffs_read,
     .f_write = nffs_write,
+    .f_readv = nffs_readv,
+    .f_writev = nffs_writev,
+    .f_flush = nffs_flush,
+    .f_read_ptr = nffs_read_ptr,
+    .f_read_ptr_release = nffs_read_ptr_release,
 
     .f_seek = nffs_seek,
     .f_getpos = nffs_getpos,
@@ -91,6 +181,7 @@ static const struct fs_ops nffs_ops = {
 
     .f_opendir = nffs_opendir,
     .f_readdir = nffs_readdir,
+    .f_readdir_stat = nffs_readdir_stat,
     .f_closedir = nffs_closedir,
 
     .f_dirent_name = nffs_dirent_name,
@@ -99,13 +190,68 @@ static const struct fs_ops nffs_ops = {
     .f_name = "nffs"
 };
 
+/**
+ * Records the duration of an operation in its latency histogram.  A
+ * histogram is four consecutive stats entries: under 100 us, under 1 ms,
+ * under 10 ms, and slower.  Nothing is recorded if the cputime timer has not
+ * been initialized.  Readers run concurrently, so the update is done with
+ * interrupts disabled.
+ *
+ * @param hist              The first entry of the histogram.
+ * @param start             The cputime at which the operation started.
+ */
+static void
+nffs_stats_lat(uint32_t *hist, uint32_t start)
+{
+    uint32_t ticks;
+    os_sr_t sr;
+    int bucket;
+
+    if (cputime_usecs_to_ticks(1) == 0) {
+        return;
+    }
+
+    ticks = cputime_get32() - start;
+    if (ticks < cputime_usecs_to_ticks(100)) {
+        bucket = 0;
+    } else if (ticks < cputime_usecs_to_ticks(1000)) {
+        bucket = 1;
+    } else if (ticks < cputime_usecs_to_ticks(10000)) {
+        bucket = 2;
+    } else {
+        bucket = 3;
+    }
+
+    OS_ENTER_CRITICAL(sr);
+    hist[bucket]++;
+    OS_EXIT_CRITICAL(sr);
+}
+
+/**
+ * Acquires exclusive access to the file system.  Waits for any active readers
+ * to finish.
+ */
 static void
 nffs_lock(void)
 {
+    os_sr_t sr;
     int rc;
 
     rc = os_mutex_pend(&nffs_mutex, 0xffffffff);
     assert(rc == 0 || rc == OS_NOT_STARTED);
+
+    while (1) {
+        OS_ENTER_CRITICAL(sr);
+        if (nffs_num_readers == 0) {
+            OS_EXIT_CRITICAL(sr);
+            break;
+        }
+        nffs_writer_waiting = 1;
+        OS_EXIT_CRITICAL(sr);
+
+        rc = os_sem_pend(&nffs_drain_sem, OS_TIMEOUT_NEVER);
+        assert(rc == 0);
+    }
 }
 
 static void
@@ -117,6 +263,113 @@ nffs_unlock(void)
     assert(rc == 0 || rc == OS_NOT_STARTED);
 }
 
+/**
+ * Acquires shared access to the file system for a read-only operation.  Only
+ * blocks while a writer holds, or is waiting for, exclusive access.
+ */
+static void
+nffs_lock_read(void)
+{
+    os_sr_t sr;
+    int rc;
+
+    rc = os_mutex_pend(&nffs_mutex, 0xffffffff);
+    assert(rc == 0 || rc == OS_NOT_STARTED);
+
+    OS_ENTER_CRITICAL(sr);
+    nffs_num_readers++;
+    OS_EXIT_CRITICAL(sr);
+
+    rc = os_mutex_release(&nffs_mutex);
+    assert(rc == 0 || rc == OS_NOT_STARTED);
+}
+
+static void
+nffs_unlock_read(void)
+{
+    os_sr_t sr;
+    int wake;
+    int rc;
+
+    OS_ENTER_CRITICAL(sr);
+    assert(nffs_num_readers > 0);
+    nffs_num_readers--;
+    wake = nffs_num_readers == 0 && nffs_writer_waiting;
+    if (wake) {
+        nffs_writer_waiting = 0;
+    }
+    OS_EXIT_CRITICAL(sr);
+
+    if (wake) {
+        rc = os_sem_release(&nffs_drain_sem);
+        assert(rc == 0);
+    }
+}
+
+/**
+ * Locks a file handle for a read-only operation.  A handle that is open for
+ * writing may have buffered data that the operation needs to flush, so it
+ * gets exclusive access instead.
+ */
+static void
+nffs_lock_file(const struct nffs_file *file)
+{
+    if (file->nf_access_flags & FS_ACCESS_WRITE) {
+        nffs_lock();
+    } else {
+        nffs_lock_read();
+    }
+}
+
+static void
+nffs_unlock_file(const struct nffs_file *file)
+{
+    if (file->nf_access_flags & FS_ACCESS_WRITE) {
+        nffs_unlock();
+    } else {
+        nffs_unlock_read();
+    }
+}
+
+/**
+ * Protects the RAM state that read-only operations modify or traverse: the
+ * hash table, the caches, the compression buffer and inode reference counts.
+ * Writers hold exclusive access already, so taking this lock is only
+ * required for code that runs on behalf of readers.  The lock is recursive.
+ */
+void
+nffs_ram_lock(void)
+{
+    int rc;
+
+    rc = os_mutex_pend(&nffs_ram_mutex, 0xffffffff);
+    assert(rc == 0 || rc == OS_NOT_STARTED);
+}
+
+void
+nffs_ram_unlock(void)
+{
+    int rc;
+
+    rc = os_mutex_release(&nffs_ram_mutex);
+    assert(rc == 0 || rc == OS_NOT_STARTED);
+}
+
+/**
+ * Wakes the background gc task if the free space has fallen below its
+ * threshold.  This must be called with the nffs lock held, after an operation
+ * that writes to flash.
+ */
+static void
+nffs_gc_task_kick(void)
+{
+    if (nffs_gc_free_threshold != 0 &&
+        nffs_gc_needed(nffs_gc_free_threshold)) {
+
+        os_eventq_put(&nffs_gc_evq, &nffs_gc_ev);
+    }
+}
+
 /**
  * Opens a file at the specified path.  The result of opening a nonexistent
  * file depends on the access flags specified.  All intermediate directories
@@ -131,6 +384,11 @@ nffs_unlock(void)
  *   "a"  -  FS_ACCESS_WRITE | FS_ACCESS_APPEND
  *   "a+" -  FS_ACCESS_READ | FS_ACCESS_WRITE | FS_ACCESS_APPEND
  *
+ * If FS_ACCESS_COMPRESS is specified along with FS_ACCESS_WRITE, a file
+ * created by the call is marked for compression: the data blocks written to
+ * it are compressed.  The flag has no effect on an existing file unless it is
+ * truncated.  It requires nc_compress to be enabled in the configuration.
+ *
  * @param path              The path of the file to open.
  * @param access_flags      Flags controlling file access; see above table.
  * @param out_file          On success, a pointer to the newly-created file
@@ -141,10 +399,22 @@ nffs_unlock(void)
 static int
 nffs_open(const char *path, uint8_t access_flags, struct fs_file **out_fs_file)
 {
+    uint32_t start;
+    int writer;
     int rc;
     struct nffs_file *out_file;
 
-    nffs_lock();
+    start = cputime_get32();
+
+    /* A read-only open does not change the file system; it only looks up
+     * the path.
+     */
+    writer = access_flags & FS_ACCESS_WRITE;
+    if (writer) {
+        nffs_lock();
+    } else {
+        nffs_lock_read();
+    }
 
     if (!nffs_misc_ready()) {
         rc = FS_EUNINIT;
@@ -155,12 +425,22 @@ nffs_open(const char *path, uint8_t access_flags, struct fs_file **out_fs_file)
     if (rc != 0) {
         goto done;
     }
+    out_file->nf_fops = &nffs_ops;
     *out_fs_file = (struct fs_file *)out_file;
+    if (writer) {
+        nffs_checkpoint_write_pending();
+        nffs_gc_task_kick();
+    }
 done:
-    nffs_unlock();
+    if (writer) {
+        nffs_unlock();
+    } else {
+        nffs_unlock_read();
+    }
     if (rc != 0) {
         *out_fs_file = NULL;
     }
+    NFFS_STATS_LAT(open, start);
     return rc;
 }
 
@@ -176,6 +456,7 @@ done:
 static int
 nffs_close(struct fs_file *fs_file)
 {
+    uint32_t start;
     int rc;
     struct nffs_file *file = (struct nffs_file *)fs_file;
 
@@ -183,10 +464,13 @@ nffs_close(struct fs_file *fs_file)
         return 0;
     }
 
+    start = cputime_get32();
+
     nffs_lock();
     rc = nffs_file_close(file);
     nffs_unlock();
 
+    NFFS_STATS_LAT(close, start);
     return rc;
 }
 
@@ -206,9 +490,9 @@ nffs_seek(struct fs_file *fs_file, uint32_t offset)
     int rc;
     struct nffs_file *file = (struct nffs_file *)fs_file;
 
-    nffs_lock();
+    nffs_lock_file(file);
     rc = nffs_file_seek(file, offset);
-    nffs_unlock();
+    nffs_unlock_file(file);
 
     return rc;
 }
@@ -226,9 +510,9 @@ nffs_getpos(const struct fs_file *fs_file)
     uint32_t offset;
     const struct nffs_file *file = (const struct nffs_file *)fs_file;
 
-    nffs_lock();
+    nffs_lock_read();
     offset = file->nf_offset;
-    nffs_unlock();
+    nffs_unlock_read();
 
     return offset;
 }
@@ -248,9 +532,9 @@ nffs_file_len(const struct fs_file *fs_file, uint32_t *out_len)
     int rc;
     const struct nffs_file *file = (const struct nffs_file *)fs_file;
 
-    nffs_lock();
-    rc = nffs_inode_data_len(file->nf_inode_entry, out_len);
-    nffs_unlock();
+    nffs_lock_read();
+    rc = nffs_file_data_len(file, out_len);
+    nffs_unlock_read();
 
     return rc;
 }
@@ -271,13 +555,17 @@ static int
 nffs_read(struct fs_file *fs_file, uint32_t len, void *out_data,
           uint32_t *out_len)
 {
+    uint32_t start;
     int rc;
     struct nffs_file *file = (struct nffs_file *)fs_file;
 
-    nffs_lock();
+    start = cputime_get32();
+
+    nffs_lock_file(file);
     rc = nffs_file_read(file, len, out_data, out_len);
-    nffs_unlock();
+    nffs_unlock_file(file);
 
+    NFFS_STATS_LAT(read, start);
     return rc;
 }
 
@@ -293,9 +581,12 @@ nffs_read(struct fs_file *fs_file, uint32_t len, void *out_data,
 static int
 nffs_write(struct fs_file *fs_file, const void *data, int len)
 {
+    uint32_t start;
     int rc;
     struct nffs_file *file = (struct nffs_file *)fs_file;
 
+    start = cputime_get32();
+
     nffs_lock();
 
     if (!nffs_misc_ready()) {
@@ -308,13 +599,198 @@ nffs_write(struct fs_file *fs_file, const void *data, int len)
         goto done;
     }
 
+    nffs_checkpoint_write_pending();
+    nffs_gc_task_kick();
     rc = 0;
 
+done:
+    nffs_unlock();
+    NFFS_STATS_LAT(write, start);
+    return rc;
+}
+
+/**
+ * Reads data from the specified file into several buffers in turn.  This is
+ * equivalent to one nffs_read() per buffer, but the file system is locked
+ * only once.  Reading stops early at end of file.
+ *
+ * @param file              The file to read from.
+ * @param iov               The buffers to read into.
+ * @param iovcnt            The number of buffers.
+ * @param out_len           On success, the total number of bytes read gets
+ *                              written here.  Pass null if you don't care.
+ *
+ * @return                  0 on success; nonzero on failure.
+ */
+static int
+nffs_readv(struct fs_file *fs_file, const struct fs_iovec *iov, int iovcnt,
+           uint32_t *out_len)
+{
+    struct nffs_file *file = (struct nffs_file *)fs_file;
+    uint32_t bytes_read;
+    uint32_t start;
+    uint32_t total;
+    int rc;
+    int i;
+
+    start = cputime_get32();
+
+    total = 0;
+    rc = 0;
+
+    nffs_lock_file(file);
+    for (i = 0; i < iovcnt; i++) {
+        rc = nffs_file_read(file, iov[i].fi_len, iov[i].fi_base, &bytes_read);
+        if (rc != 0) {
+            break;
+        }
+        total += bytes_read;
+        if (bytes_read < iov[i].fi_len) {
+            break;
+        }
+    }
+    nffs_unlock_file(file);
+
+    if (rc == 0 && out_len != NULL) {
+        *out_len = total;
+    }
+    NFFS_STATS_LAT(read, start);
+    return rc;
+}
+
+/**
+ * Writes the contents of several buffers to the current offset of the
+ * specified file handle.  The file system is locked only once, and the
+ * checkpoint and garbage collection checks run once for the whole vector.
+ * Without a write buffer, each buffer is stored as a separate data block.
+ *
+ * @param file              The file to write to.
+ * @param iov               The buffers to write.
+ * @param iovcnt            The number of buffers.
+ *
+ * @return                  0 on success; nonzero on failure.
+ */
+static int
+nffs_writev(struct fs_file *fs_file, const struct fs_iovec *iov, int iovcnt)
+{
+    struct nffs_file *file = (struct nffs_file *)fs_file;
+    uint32_t start;
+    int rc;
+    int i;
+
+    start = cputime_get32();
+
+    nffs_lock();
+
+    if (!nffs_misc_ready()) {
+        rc = FS_EUNINIT;
+        goto done;
+    }
+
+    for (i = 0; i < iovcnt; i++) {
+        rc = nffs_write_to_file(file, iov[i].fi_base, iov[i].fi_len);
+        if (rc != 0) {
+            goto done;
+        }
+    }
+
+    nffs_checkpoint_write_pending();
+    nffs_gc_task_kick();
+    rc = 0;
+
+done:
+    nffs_unlock();
+    NFFS_STATS_LAT(write, start);
+    return rc;
+}
+
+/**
+ * Writes any data buffered in the specified file handle to flash.
+ *
+ * @param file              The file to flush.
+ *
+ * @return                  0 on success; nonzero on failure.
+ */
+static int
+nffs_flush(struct fs_file *fs_file)
+{
+    int rc;
+    struct nffs_file *file = (struct nffs_file *)fs_file;
+
+    nffs_lock();
+
+    if (!nffs_misc_ready()) {
+        rc = FS_EUNINIT;
+        goto done;
+    }
+
+    rc = nffs_write_flush(file);
+    if (rc != 0) {
+        goto done;
+    }
+
+    nffs_checkpoint_write_pending();
+    nffs_gc_task_kick();
+
 done:
     nffs_unlock();
     return rc;
 }
 
+/**
+ * Retrieves a pointer to the file data at the current offset without copying
+ * it.  This is only supported when the file system resides in memory-mapped
+ * flash.  The returned extent does not span data blocks, so it may be shorter
+ * than requested; the file offset advances by its length.  The pointer
+ * remains valid until it is released, the next call to this function with the
+ * same handle, or the handle is closed.
+ *
+ * @param file              The file to read from.
+ * @param len               The maximum number of bytes to retrieve.
+ * @param out_ptr           On success, a pointer to the data gets written
+ *                              here; null at the end of the file.
+ * @param out_len           On success, the number of bytes available at
+ *                              out_ptr gets written here.
+ *
+ * @return                  0 on success;
+ *                          FS_ENOTSUP if the flash is not memory-mapped;
+ *                          other nonzero on failure.
+ */
+static int
+nffs_read_ptr(struct fs_file *fs_file, uint32_t len, const void **out_ptr,
+              uint32_t *out_len)
+{
+    int rc;
+    struct nffs_file *file = (struct nffs_file *)fs_file;
+
+    nffs_lock();
+    rc = nffs_file_read_ptr(file, len, out_ptr, out_len);
+    if (rc == 0) {
+        nffs_checkpoint_write_pending();
+    }
+    nffs_unlock();
+
+    return rc;
+}
+
+/**
+ * Releases the pointer most recently retrieved with nffs_read_ptr().
+ *
+ * @param file              The file whose pointer should be released.
+ */
+static void
+nffs_read_ptr_release(struct fs_file *fs_file)
+{
+    struct nffs_file *file = (struct nffs_file *)fs_file;
+
+    nffs_lock();
+    nffs_file_read_ptr_release(file);
+
+    /* The released area may now be eligible for garbage collection. */
+    nffs_gc_task_kick();
+    nffs_unlock();
+}
+
 /**
  * Unlinks the file or directory at the specified path.  If the path refers to
  * a directory, all the directory's descendants are recursively unlinked.  Any
@@ -328,8 +804,11 @@ done:
 static int
 nffs_unlink(const char *path)
 {
+    uint32_t start;
     int rc;
 
+    start = cputime_get32();
+
     nffs_lock();
 
     if (!nffs_misc_ready()) {
@@ -342,10 +821,13 @@ nffs_unlink(const char *path)
         goto done;
     }
 
+    nffs_checkpoint_write_pending();
+    nffs_gc_task_kick();
     rc = 0;
 
 done:
     nffs_unlock();
+    NFFS_STATS_LAT(unlink, start);
     return rc;
 }
 
@@ -382,6 +864,8 @@ nffs_rename(const char *from, const char *to)
         goto done;
     }
 
+    nffs_checkpoint_write_pending();
+    nffs_gc_task_kick();
     rc = 0;
 
 done:
@@ -416,6 +900,9 @@ nffs_mkdir(const char *path)
         goto done;
     }
 
+    nffs_checkpoint_write_pending();
+    nffs_gc_task_kick();
+
 done:
     nffs_unlock();
     return rc;
@@ -443,7 +930,7 @@ nffs_opendir(const char *path, struct fs_dir **out_fs_dir)
     int rc;
     struct nffs_dir **out_dir = (struct nffs_dir **)out_fs_dir;
 
-    nffs_lock();
+    nffs_lock_read();
 
     if (!nffs_misc_ready()) {
         rc = FS_EUNINIT;
@@ -451,9 +938,13 @@ nffs_opendir(const char *path, struct fs_dir **out_fs_dir)
     }
 
     rc = nffs_dir_open(path, out_dir);
+    if (rc == 0) {
+        (*out_dir)->nd_fops = &nffs_ops;
+        (*out_dir)->nd_dirent.nde_fops = &nffs_ops;
+    }
 
 done:
-    nffs_unlock();
+    nffs_unlock_read();
     return rc;
 }
 
@@ -476,9 +967,39 @@ nffs_readdir(struct fs_dir *fs_dir, struct fs_dirent **out_fs_dirent)
     struct nffs_dir *dir = (struct nffs_dir *)fs_dir;
     struct nffs_dirent **out_dirent = (struct nffs_dirent **)out_fs_dirent;
 
-    nffs_lock();
+    nffs_lock_read();
     rc = nffs_dir_read(dir, out_dirent);
-    nffs_unlock();
+    nffs_unlock_read();
+
+    return rc;
+}
+
+/**
+ * Reads the name, type and size of several directory entries at once.  This
+ * is equivalent to calling nffs_readdir() followed by nffs_dirent_name() and
+ * a length query for each entry, but the entries' inodes are read from flash
+ * in address order, one access each.
+ *
+ * @param dir                   The directory handle to read from.
+ * @param out_stats             The entry summaries get written here.
+ * @param max_stats             The capacity of the out_stats array.
+ * @param out_num_stats         On success, the number of entries written.
+ *
+ * @return                      0 on success;
+ *                              FS_ENOENT if there are no more entries in the
+ *                                  parent directory;
+ *                              other nonzero on error.
+ */
+static int
+nffs_readdir_stat(struct fs_dir *fs_dir, struct fs_dirent_stat *out_stats,
+                  int max_stats, int *out_num_stats)
+{
+    int rc;
+    struct nffs_dir *dir = (struct nffs_dir *)fs_dir;
+
+    nffs_lock_read();
+    rc = nffs_dir_read_stat(dir, out_stats, max_stats, out_num_stats);
+    nffs_unlock_read();
 
     return rc;
 }
@@ -496,9 +1017,9 @@ nffs_closedir(struct fs_dir *fs_dir)
     int rc;
     struct nffs_dir *dir = (struct nffs_dir *)fs_dir;
 
-    nffs_lock();
+    nffs_lock_read();
     rc = nffs_dir_close(dir);
-    nffs_unlock();
+    nffs_unlock_read();
 
     return rc;
 }
@@ -526,13 +1047,13 @@ nffs_dirent_name(const struct fs_dirent *fs_dirent, size_t max_len,
     int rc;
     struct nffs_dirent *dirent = (struct nffs_dirent *)fs_dirent;
 
-    nffs_lock();
+    nffs_lock_read();
 
     assert(dirent != NULL && dirent->nde_inode_entry != NULL);
     rc = nffs_inode_read_filename(dirent->nde_inode_entry, max_len, out_name,
                                   out_name_len);
 
-    nffs_unlock();
+    nffs_unlock_read();
 
     return rc;
 }
@@ -552,12 +1073,12 @@ nffs_dirent_is_dir(const struct fs_dirent *fs_dirent)
     uint32_t id;
     const struct nffs_dirent *dirent = (const struct nffs_dirent *)fs_dirent;
 
-    nffs_lock();
+    nffs_lock_read();
 
     assert(dirent != NULL && dirent->nde_inode_entry != NULL);
     id = dirent->nde_inode_entry->nie_hash_entry.nhe_id;
 
-    nffs_unlock();
+    nffs_unlock_read();
 
     return nffs_hash_id_is_dir(id);
 }
@@ -589,6 +1110,10 @@ nffs_format(const struct nffs_area_desc *area_descs)
  * supplied areas.  If the area set does not contain a valid file system,
  * a new one can be created via a separate call to nffs_format().
  *
+ * If a checkpoint region has been configured and contains a checkpoint that
+ * matches the area set, the file system is restored from the checkpoint
+ * rather than with a full scan of every area.
+ *
  * @param area_descs        The area set to search.  This array must be
  *                              terminated with a 0-length area.
  *
@@ -598,16 +1123,173 @@ nffs_format(const struct nffs_area_desc *area_descs)
  */
 int
 nffs_detect(const struct nffs_area_desc *area_descs)
+{
+    uint32_t start;
+    uint32_t ticks;
+    int full;
+    int rc;
+
+    start = cputime_get32();
+
+    nffs_lock();
+
+    full = 0;
+    rc = nffs_restore_checkpoint(area_descs);
+    if (rc != 0) {
+        full = 1;
+        rc = nffs_restore_full(area_descs);
+        if (rc == 0) {
+            /* Make sure the next mount is a fast one. */
+            nffs_checkpoint_mark_stale();
+            nffs_checkpoint_write_pending();
+        }
+    }
+
+    ticks = cputime_get32() - start;
+    nffs_stats.STATS_SECT_VAR(restore_ticks) = ticks;
+    NFFS_LOG(INFO, "%s restore; rc=%d ticks=%u\n",
+             full ? "full" : "checkpoint", rc, (unsigned int)ticks);
+
+    nffs_unlock();
+
+    return rc;
+}
+
+/**
+ * Configures the flash region used to store checkpoints.  A checkpoint is a
+ * snapshot of the nffs RAM representation; it allows nffs_detect() to avoid
+ * scanning every area.  The region must not overlap any nffs area.  A
+ * checkpoint is only written when nffs_checkpoint() is called, or, if the
+ * NFFS_CHECKPOINT_F_AUTO flag is specified, after a full restore and after
+ * each garbage collection cycle.
+ *
+ * @param area_desc         The checkpoint region; null to disable
+ *                              checkpoints.
+ * @param flags             NFFS_CHECKPOINT_F_[...]
+ *
+ * @return                  0 on success;
+ *                          FS_ENOTSUP if lazy block loading is enabled;
+ *                          other nonzero on failure.
+ */
+int
+nffs_checkpoint_init(const struct nffs_area_desc *area_desc, uint8_t flags)
 {
     int rc;
 
     nffs_lock();
-    rc = nffs_restore_full(area_descs);
+    rc = nffs_checkpoint_set_area(area_desc, flags);
     nffs_unlock();
 
     return rc;
 }
 
+/**
+ * Writes a checkpoint of the current file system state to the checkpoint
+ * region.  Objects written after the checkpoint are replayed from flash
+ * during the next nffs_detect().
+ *
+ * @return                  0 on success;
+ *                          FS_ENOENT if no checkpoint region is configured;
+ *                          FS_EFULL if the checkpoint region is too small;
+ *                          other nonzero on failure.
+ */
+int
+nffs_checkpoint(void)
+{
+    int rc;
+
+    nffs_lock();
+
+    if (!nffs_misc_ready()) {
+        rc = FS_EUNINIT;
+        goto done;
+    }
+
+    rc = nffs_checkpoint_write();
+
+done:
+    nffs_unlock();
+    return rc;
+}
+
+static void
+nffs_gc_task_func(void *arg)
+{
+    int done;
+    int more;
+    int rc;
+
+    while (1) {
+        os_eventq_get(&nffs_gc_evq);
+
+        /* Collect one bounded step at a time, releasing the lock in between
+         * so that foreground operations are never held up for long.
+         */
+        do {
+            nffs_lock();
+
+            more = nffs_misc_ready() &&
+                   nffs_gc_needed(nffs_gc_free_threshold);
+            if (more) {
+                rc = nffs_gc_step(&done);
+                if (rc != 0) {
+                    more = 0;
+                } else if (done) {
+                    nffs_checkpoint_write_pending();
+                }
+            }
+
+            nffs_unlock();
+        } while (more);
+    }
+}
+
+/**
+ * Starts a task that garbage collects in the background.  When the free
+ * space outside the scratch area falls below the specified threshold, the
+ * task collects areas holding dead space in small steps, releasing the nffs
+ * lock between steps.  This makes it less likely that a write has to perform
+ * a full garbage collection cycle itself.  This function must be called at
+ * most once, after nffs_init().
+ *
+ * @param prio              The priority of the gc task.  This should be
+ *                              lower than that of any task that uses the
+ *                              file system.
+ * @param stack             The stack to use for the gc task.
+ * @param stack_size        The size of the stack, in os_stack_t units.
+ * @param free_threshold    The number of free bytes below which background
+ *                              collection starts.
+ *
+ * @return                  0 on success;
+ *                          FS_EINVAL if the threshold is 0;
+ *                          FS_EOS if the task could not be created.
+ */
+int
+nffs_gc_task_init(uint8_t prio, os_stack_t *stack, uint16_t stack_size,
+                  uint32_t free_threshold)
+{
+    int rc;
+
+    if (free_threshold == 0) {
+        return FS_EINVAL;
+    }
+
+    os_eventq_init(&nffs_gc_evq);
+    nffs_gc_ev.ev_type = OS_EVENT_T_PERUSER;
+
+    rc = os_task_init(&nffs_gc_task, "nffs_gc", nffs_gc_task_func, NULL,
+                      prio, OS_WAIT_FOREVER, stack, stack_size);
+    if (rc != 0) {
+        return FS_EOS;
+    }
+
+    nffs_lock();
+    nffs_gc_free_threshold = free_threshold;
+    nffs_unlock();
+
+    return 0;
+}
+
 /**
  * Initializes internal nffs memory and data structures.  This must be called
  * before any nffs operations are attempted.
@@ -622,12 +1304,25 @@ nffs_init(void)
     nffs_config_init();
 
     nffs_cache_clear();
+    nffs_path_cache_clear();
 
     rc = os_mutex_init(&nffs_mutex);
     if (rc != 0) {
         return FS_EOS;
     }
 
+    rc = os_mutex_init(&nffs_ram_mutex);
+    if (rc != 0) {
+        return FS_EOS;
+    }
+
+    rc = os_sem_init(&nffs_drain_sem, 0);
+    if (rc != 0) {
+        return FS_EOS;
+    }
+    nffs_num_readers = 0;
+    nffs_writer_waiting = 0;
+
     free(nffs_file_mem);
     nffs_file_mem = malloc(
         OS_MEMPOOL_BYTES(nffs_config.nc_num_files, sizeof (struct nffs_file)));
@@ -675,10 +1370,74 @@ nffs_init(void)
         return FS_ENOMEM;
     }
 
+    free(nffs_path_cache_mem);
+    nffs_path_cache_mem = NULL;
+    if (nffs_config.nc_num_cache_paths > 0) {
+        nffs_path_cache_mem = malloc(
+            OS_MEMPOOL_BYTES(nffs_config.nc_num_cache_paths,
+                             sizeof (struct nffs_path_cache_entry)));
+        if (nffs_path_cache_mem == NULL) {
+            return FS_ENOMEM;
+        }
+    }
+
+    free(nffs_write_buf_mem);
+    nffs_write_buf_mem = NULL;
+    if (nffs_config.nc_num_write_bufs > 0) {
+        nffs_write_buf_mem = malloc(
+            OS_MEMPOOL_BYTES(nffs_config.nc_num_write_bufs,
+                             sizeof (struct nffs_write_buf)));
+        if (nffs_write_buf_mem == NULL) {
+            return FS_ENOMEM;
+        }
+    }
+
+    free(nffs_bulk_buf_mem);
+    nffs_bulk_buf_mem = NULL;
+    nffs_bulk_buf_sz = 0;
+    if (nffs_config.nc_bulk_buf_size > NFFS_FLASH_BUF_SZ) {
+        nffs_bulk_buf_mem = malloc(nffs_config.nc_bulk_buf_size);
+        if (nffs_bulk_buf_mem == NULL) {
+            return FS_ENOMEM;
+        }
+        nffs_bulk_buf_sz = nffs_config.nc_bulk_buf_size;
+    }
+
+    free(nffs_lz_buf);
+    nffs_lz_buf = NULL;
+    if (nffs_config.nc_compress) {
+        nffs_lz_buf = malloc(sizeof *nffs_lz_buf);
+        if (nffs_lz_buf == NULL) {
+            return FS_ENOMEM;
+        }
+    }
+
+    free(nffs_cache_index_mem);
+    nffs_cache_index_mem = NULL;
+    if (nffs_config.nc_num_cache_indexes > 0) {
+        nffs_cache_index_mem = malloc(
+            OS_MEMPOOL_BYTES(nffs_config.nc_num_cache_indexes,
+                             sizeof (struct nffs_cache_index)));
+        if (nffs_cache_index_mem == NULL) {
+            return FS_ENOMEM;
+        }
+    }
+
     log_init();
     log_console_handler_init(&nffs_log_console_handler);
     log_register("nffs", &nffs_log, &nffs_log_console_handler);
 
+    /* The stats group persists across re-initialization. */
+    if (!nffs_stats_registered) {
+        rc = stats_init_and_reg(
+            STATS_HDR(nffs_stats), STATS_SIZE_INIT_PARMS(nffs_stats,
+            STATS_SIZE_32), STATS_NAME_INIT_PARMS(nffs_stats), "nffs");
+        if (rc != 0) {
+            return FS_EOS;
+        }
+        nffs_stats_registered = 1;
+    }
+
     rc = nffs_misc_reset();
     if (rc != 0) {
         return rc;
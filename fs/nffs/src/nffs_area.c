@@ -65,6 +65,59 @@ nffs_area_free_space(const struct nffs_area *area)
     return area->na_length - area->na_cur;
 }
 
+/**
+ * Calculates the number of bytes in an area that are still referenced by the
+ * RAM representation.  This is the amount of data a garbage collection cycle
+ * would need to copy out of the area.
+ */
+uint32_t
+nffs_area_live_space(const struct nffs_area *area)
+{
+    uint32_t written;
+
+    if (area->na_cur < sizeof (struct nffs_disk_area)) {
+        return 0;
+    }
+
+    written = area->na_cur - sizeof (struct nffs_disk_area);
+    if (area->na_dead >= written) {
+        return 0;
+    }
+
+    return written - area->na_dead;
+}
+
+/**
+ * Records that an object on disk is no longer referenced (it was superseded or
+ * deleted).  The space it occupies is reclaimed when its area is garbage
+ * collected.
+ *
+ * @param flash_loc             The location of the dead object.
+ * @param len                   The size of the object, including its header.
+ */
+void
+nffs_area_add_dead(uint32_t flash_loc, uint32_t len)
+{
+    struct nffs_area *area;
+    uint32_t area_offset;
+    uint8_t area_idx;
+
+    if (flash_loc == NFFS_FLASH_LOC_NONE) {
+        return;
+    }
+
+    nffs_flash_loc_expand(flash_loc, &area_idx, &area_offset);
+    if (area_idx >= nffs_num_areas) {
+        return;
+    }
+
+    area = nffs_areas + area_idx;
+    area->na_dead += len;
+    if (area->na_dead > area->na_cur) {
+        area->na_dead = area->na_cur;
+    }
+}
+
 /**
  * Finds a corrupt scratch area.  An area is indentified as a corrupt scratch
  * area if it and another area share the same ID.  Among two areas with the
@@ -23,7 +23,86 @@
 #include "testutil/testutil.h"
 #include "nffs/nffs.h"
 #include "nffs_priv.h"
-#include "crc16.h"
+#include "util/crc16.h"
+
+/** Decompression cache and compression scratch; null if not configured. */
+struct nffs_lz_buf *nffs_lz_buf;
+
+/** Where the next search for a file to evict starts (lazy loading only). */
+static uint16_t nffs_block_evict_bucket;
+
+/**
+ * Removes a file's block entries from RAM without marking the blocks dead on
+ * disk.  The entries get rebuilt by nffs_block_chain_load() the next time the
+ * file is accessed.
+ *
+ * @param inode_entry           The file inode to unload.
+ */
+static void
+nffs_block_chain_unload(struct nffs_inode_entry *inode_entry)
+{
+    struct nffs_hash_entry *entry;
+    struct nffs_hash_entry *prev;
+    struct nffs_block block;
+    int rc;
+
+    nffs_cache_inode_delete(inode_entry);
+
+    entry = inode_entry->nie_last_block_entry;
+    while (entry != NULL) {
+        rc = nffs_block_from_hash_entry(&block, entry);
+        if (rc == 0 || rc == FS_ECORRUPT) {
+            prev = block.nb_prev;
+        } else {
+            prev = NULL;
+        }
+
+        nffs_hash_remove(entry);
+        nffs_block_entry_free(entry);
+        entry = prev;
+    }
+
+    inode_entry->nie_last_block_entry = NULL;
+    inode_entry->nie_flags |= NFFS_INODE_F_UNLOADED;
+}
+
+/**
+ * Unloads the block entries of one file that is not currently in use.  Files
+ * are selected round-robin across the hash table.
+ *
+ * @return                      0 if block entries were freed;
+ *                              FS_ENOMEM if no file could be unloaded.
+ */
+static int
+nffs_block_evict(void)
+{
+    struct nffs_inode_entry *inode_entry;
+    struct nffs_hash_entry *entry;
+    int bucket;
+    int i;
+
+    for (i = 0; i < nffs_hash_size; i++) {
+        bucket = (nffs_block_evict_bucket + i) % nffs_hash_size;
+        SLIST_FOREACH(entry, nffs_hash + bucket, nhe_next) {
+            if (!nffs_hash_id_is_file(entry->nhe_id)) {
+                continue;
+            }
+
+            /* Files with open handles or a load in progress are skipped. */
+            inode_entry = (struct nffs_inode_entry *)entry;
+            if (inode_entry->nie_refcnt == 1 &&
+                !(inode_entry->nie_flags & NFFS_INODE_F_UNLOADED) &&
+                inode_entry->nie_last_block_entry != NULL) {
+
+                nffs_block_chain_unload(inode_entry);
+                nffs_block_evict_bucket = (bucket + 1) % nffs_hash_size;
+                return 0;
+            }
+        }
+    }
+
+    return FS_ENOMEM;
+}
 
 struct nffs_hash_entry *
 nffs_block_entry_alloc(void)
@@ -31,6 +110,12 @@ nffs_block_entry_alloc(void)
     struct nffs_hash_entry *entry;
 
     entry = os_memblock_get(&nffs_block_entry_pool);
+    if (entry == NULL && nffs_config.nc_lazy_blocks) {
+        /* Make room by unloading the blocks of files that are not in use. */
+        while (entry == NULL && nffs_block_evict() == 0) {
+            entry = os_memblock_get(&nffs_block_entry_pool);
+        }
+    }
     if (entry != NULL) {
         memset(entry, 0, sizeof *entry);
     }
@@ -70,7 +155,9 @@ nffs_block_read_disk(uint8_t area_idx, uint32_t area_offset,
     if (rc != 0) {
         return rc;
     }
-    if (out_disk_block->ndb_magic != NFFS_BLOCK_MAGIC) {
+    if (out_disk_block->ndb_magic != NFFS_BLOCK_MAGIC &&
+        out_disk_block->ndb_magic != NFFS_BLOCK_MAGIC_LZ) {
+
         return FS_EUNEXP;
     }
 
@@ -135,6 +222,12 @@ nffs_block_from_disk_no_ptrs(struct nffs_block *out_block,
     out_block->nb_inode_entry = NULL;
     out_block->nb_prev = NULL;
     out_block->nb_data_len = disk_block->ndb_data_len;
+    out_block->nb_disk_len = disk_block->ndb_data_len;
+    if (disk_block->ndb_magic == NFFS_BLOCK_MAGIC_LZ) {
+        out_block->nb_flags = NFFS_BLOCK_F_LZ;
+    } else {
+        out_block->nb_flags = 0;
+    }
 }
 
 /**
@@ -145,6 +238,9 @@ nffs_block_from_disk_no_ptrs(struct nffs_block *out_block,
  * indicates file system corruption.  In this case, the resulting block is
  * populated with all valid references, and an FS_ECORRUPT code is returned.
  *
+ * The data length of a compressed block is not part of its header; until
+ * nffs_block_read_data_len() is called, nb_data_len holds the on-disk length.
+ *
  * @param out_block             The resulting block is written here (regardless
  *                                  of this function's return code).
  * @param disk_block            The source disk record to convert.
@@ -153,7 +249,7 @@ nffs_block_from_disk_no_ptrs(struct nffs_block *out_block,
  *                              FS_ECORRUPT if one or more pointers could not
  *                                  be filled in due to file system corruption.
  */
-static int
+int
 nffs_block_from_disk(struct nffs_block *out_block,
                      const struct nffs_disk_block *disk_block)
 {
@@ -229,6 +325,9 @@ nffs_block_delete_from_ram(struct nffs_hash_entry *block_entry)
             inode_entry->nie_last_block_entry = block.nb_prev;
         }
 
+        nffs_area_add_dead(block_entry->nhe_flash_loc,
+                           sizeof (struct nffs_disk_block) +
+                           block.nb_disk_len);
         nffs_hash_remove(block_entry);
         nffs_block_entry_free(block_entry);
     }
@@ -312,7 +411,7 @@ nffs_block_from_hash_entry_no_ptrs(struct nffs_block *out_block,
     out_block->nb_hash_entry = block_entry;
     nffs_block_from_disk_no_ptrs(out_block, &disk_block);
 
-    return 0;
+    return nffs_block_read_data_len(out_block);
 }
 
 /**
@@ -360,17 +459,217 @@ nffs_block_from_hash_entry(struct nffs_block *out_block,
         return rc;
     }
 
+    rc = nffs_block_read_data_len(out_block);
+    if (rc != 0) {
+        return rc;
+    }
+
     return 0;
 }
 
+/**
+ * Fills in the data length of a compressed block by reading the uncompressed
+ * length that precedes its compressed data.  This is a no-op for uncompressed
+ * blocks.
+ *
+ * @param block                 The block to update; its hash entry pointer
+ *                                  and flags must be set.
+ *
+ * @return                      0 on success; nonzero on failure.
+ */
+int
+nffs_block_read_data_len(struct nffs_block *block)
+{
+    uint32_t area_offset;
+    uint16_t data_len;
+    uint8_t area_idx;
+    int rc;
+
+    if (!(block->nb_flags & NFFS_BLOCK_F_LZ)) {
+        return 0;
+    }
+
+    if (block->nb_disk_len < NFFS_BLOCK_LZ_HDR_SZ) {
+        return FS_ECORRUPT;
+    }
+
+    nffs_flash_loc_expand(block->nb_hash_entry->nhe_flash_loc,
+                          &area_idx, &area_offset);
+    area_offset += sizeof (struct nffs_disk_block);
+    rc = nffs_flash_read(area_idx, area_offset, &data_len, sizeof data_len);
+    if (rc != 0) {
+        return rc;
+    }
+
+    block->nb_data_len = data_len;
+
+    return 0;
+}
+
+/**
+ * Forgets the contents of the decompression buffer.  This must be called
+ * before the buffer is modified.
+ */
+void
+nffs_block_lz_invalidate(void)
+{
+    if (nffs_lz_buf != NULL) {
+        nffs_lz_buf->nlb_block_id = NFFS_ID_NONE;
+    }
+}
+
+/**
+ * Retrieves the uncompressed contents of a compressed block.  The most
+ * recently decompressed block is retained, so successive reads from the same
+ * block only decompress it once.
+ *
+ * @param block                 The compressed block to read.
+ * @param out_data              On success, points to the block's data.  The
+ *                                  pointer remains valid until the next call
+ *                                  to this function or to
+ *                                  nffs_block_lz_pack().
+ *
+ * @return                      0 on success;
+ *                              FS_ENOTSUP if compression is not configured;
+ *                              FS_ECORRUPT if the block cannot be
+ *                                  decompressed;
+ *                              other nonzero on failure.
+ */
+int
+nffs_block_lz_data(const struct nffs_block *block, uint8_t **out_data)
+{
+    uint32_t area_offset;
+    uint16_t disk_len;
+    uint8_t area_idx;
+    int rc;
+
+    assert(block->nb_flags & NFFS_BLOCK_F_LZ);
+
+    if (nffs_lz_buf == NULL) {
+        return FS_ENOTSUP;
+    }
+
+    if (nffs_lz_buf->nlb_block_id == block->nb_hash_entry->nhe_id &&
+        nffs_lz_buf->nlb_block_seq == block->nb_seq) {
+
+        *out_data = nffs_lz_buf->nlb_data;
+        return 0;
+    }
+
+    nffs_block_lz_invalidate();
+
+    disk_len = block->nb_disk_len - NFFS_BLOCK_LZ_HDR_SZ;
+    if (block->nb_data_len > sizeof nffs_lz_buf->nlb_data ||
+        disk_len > sizeof nffs_lz_buf->nlb_disk) {
+
+        return FS_ECORRUPT;
+    }
+
+    nffs_flash_loc_expand(block->nb_hash_entry->nhe_flash_loc,
+                          &area_idx, &area_offset);
+    area_offset += sizeof (struct nffs_disk_block) + NFFS_BLOCK_LZ_HDR_SZ;
+    rc = nffs_flash_read(area_idx, area_offset, nffs_lz_buf->nlb_disk,
+                         disk_len);
+    if (rc != 0) {
+        return rc;
+    }
+
+    rc = nffs_lz_decompress(nffs_lz_buf->nlb_disk, disk_len,
+                            nffs_lz_buf->nlb_data, block->nb_data_len);
+    if (rc != 0) {
+        return rc;
+    }
+
+    nffs_lz_buf->nlb_block_id = block->nb_hash_entry->nhe_id;
+    nffs_lz_buf->nlb_block_seq = block->nb_seq;
+    *out_data = nffs_lz_buf->nlb_data;
+
+    return 0;
+}
+
+/**
+ * Attempts to compress the data of a block that is about to be written.  On
+ * success, the disk block is converted to a compressed block and the data
+ * pointer is redirected to the compressed representation.  If compression is
+ * not configured, the data is too long, or compression would not save any
+ * space, the block is left as is.
+ *
+ * @param disk_block            The header of the block to write; its data
+ *                                  length must be set.
+ * @param inout_data            On input, the block's uncompressed data.  On
+ *                                  success, the data to write instead.
+ *
+ * @return                      1 if the block was compressed; 0 otherwise.
+ */
+int
+nffs_block_lz_pack(struct nffs_disk_block *disk_block,
+                   const void **inout_data)
+{
+    uint16_t data_len;
+    uint16_t lz_len;
+    int rc;
+
+    data_len = disk_block->ndb_data_len;
+    if (nffs_lz_buf == NULL ||
+        data_len > NFFS_BLOCK_LZ_MAX_DATA_SZ ||
+        data_len > nffs_block_max_data_sz ||
+        data_len <= NFFS_BLOCK_LZ_HDR_SZ) {
+
+        return 0;
+    }
+
+    /* The output must be smaller than the input, header included. */
+    rc = nffs_lz_compress(*inout_data, data_len,
+                          nffs_lz_buf->nlb_disk + NFFS_BLOCK_LZ_HDR_SZ,
+                          data_len - NFFS_BLOCK_LZ_HDR_SZ - 1, &lz_len);
+    if (rc != 0) {
+        return 0;
+    }
+
+    memcpy(nffs_lz_buf->nlb_disk, &data_len, NFFS_BLOCK_LZ_HDR_SZ);
+
+    disk_block->ndb_magic = NFFS_BLOCK_MAGIC_LZ;
+    disk_block->ndb_data_len = NFFS_BLOCK_LZ_HDR_SZ + lz_len;
+    *inout_data = nffs_lz_buf->nlb_disk;
+
+    return 1;
+}
+
+/**
+ * Reads data from a block.  Compressed blocks are decompressed into the
+ * decompression buffer first.
+ *
+ * @param block                 The block to read from.
+ * @param offset                The offset within the block's data to start
+ *                                  reading at.
+ * @param length                The number of bytes to read.
+ * @param dst                   The data gets written here.
+ *
+ * @return                      0 on success; nonzero on failure.
+ */
 int
 nffs_block_read_data(const struct nffs_block *block, uint16_t offset,
                      uint16_t length, void *dst)
 {
     uint32_t area_offset;
+    uint8_t *data;
     uint8_t area_idx;
     int rc;
 
+    if (block->nb_flags & NFFS_BLOCK_F_LZ) {
+        assert(offset + length <= block->nb_data_len);
+
+        /* The decompression buffer is shared among readers. */
+        nffs_ram_lock();
+        rc = nffs_block_lz_data(block, &data);
+        if (rc == 0) {
+            memcpy(dst, data + offset, length);
+        }
+        nffs_ram_unlock();
+
+        return rc;
+    }
+
     nffs_flash_loc_expand(block->nb_hash_entry->nhe_flash_loc,
                          &area_idx, &area_offset);
     area_offset += sizeof (struct nffs_disk_block);
@@ -383,3 +682,264 @@ nffs_block_read_data(const struct nffs_block *block, uint16_t offset,
 
     return 0;
 }
+
+/**
+ * Indicates whether a file's blocks in the specified area should be ignored
+ * when the file's block chain is loaded.  While a garbage collection cycle is
+ * in progress, a file's blocks exist in both the source and destination areas
+ * once they have been copied; only the copies are valid at that point.
+ */
+static int
+nffs_block_load_skip_area(const struct nffs_inode_entry *inode_entry,
+                          uint8_t area_idx)
+{
+    if (nffs_gc_from_area_idx == NFFS_AREA_ID_NONE) {
+        return area_idx == nffs_scratch_area_idx;
+    }
+
+    return area_idx == nffs_gc_from_area_idx &&
+           !(inode_entry->nie_flags & NFFS_INODE_F_GC_PENDING);
+}
+
+/**
+ * Inserts a single block read from flash into the RAM representation as part
+ * of loading a file's block chain.  If the block supersedes a version that
+ * was already loaded, the existing entry is pointed at the new version.
+ *
+ * The sum of the IDs of all loaded blocks and the sum of their predecessor
+ * IDs are accumulated so that the last block of the chain can be identified
+ * once all blocks are loaded.
+ */
+static int
+nffs_block_load_one(const struct nffs_disk_object *disk_object,
+                    uint32_t *id_sum, uint32_t *prev_sum,
+                    uint32_t *num_blocks)
+{
+    const struct nffs_disk_block *disk_block;
+    struct nffs_disk_block old_disk_block;
+    struct nffs_hash_entry *entry;
+    uint32_t area_offset;
+    uint8_t area_idx;
+    int rc;
+
+    disk_block = &disk_object->ndo_disk_block;
+
+    rc = nffs_crc_disk_block_validate(disk_block, disk_object->ndo_area_idx,
+                                      disk_object->ndo_offset);
+    if (rc == FS_ECORRUPT) {
+        /* Corrupt block; any older version remains current. */
+        return 0;
+    } else if (rc != 0) {
+        return rc;
+    }
+
+    entry = nffs_hash_find_block(disk_block->ndb_id);
+    if (entry != NULL) {
+        nffs_flash_loc_expand(entry->nhe_flash_loc, &area_idx, &area_offset);
+        rc = nffs_block_read_disk(area_idx, area_offset, &old_disk_block);
+        if (rc != 0) {
+            return rc;
+        }
+
+        if (old_disk_block.ndb_seq >= disk_block->ndb_seq) {
+            /* The new block is superseded by the old; nothing to do. */
+            return 0;
+        }
+
+        if (old_disk_block.ndb_prev_id != NFFS_ID_NONE) {
+            *prev_sum -= old_disk_block.ndb_prev_id;
+        }
+    } else {
+        entry = nffs_block_entry_alloc();
+        if (entry == NULL) {
+            return FS_ENOMEM;
+        }
+
+        entry->nhe_id = disk_block->ndb_id;
+        nffs_hash_insert(entry);
+
+        *id_sum += disk_block->ndb_id;
+        (*num_blocks)++;
+    }
+
+    entry->nhe_flash_loc = nffs_flash_loc(disk_object->ndo_area_idx,
+                                          disk_object->ndo_offset);
+    if (disk_block->ndb_prev_id != NFFS_ID_NONE) {
+        *prev_sum += disk_block->ndb_prev_id;
+    }
+
+    return 0;
+}
+
+/**
+ * Removes any block entries belonging to the specified file from RAM.  Used to
+ * back out of a failed load.
+ */
+static void
+nffs_block_chain_discard(const struct nffs_inode_entry *inode_entry)
+{
+    struct nffs_disk_object disk_object;
+    struct nffs_hash_entry *entry;
+    uint32_t area_offset;
+    int i;
+
+    for (i = 0; i < nffs_num_areas; i++) {
+        area_offset = sizeof (struct nffs_disk_area);
+        while (nffs_restore_next_object(i, &area_offset, &disk_object) == 0) {
+            if (disk_object.ndo_type == NFFS_OBJECT_TYPE_BLOCK &&
+                disk_object.ndo_disk_block.ndb_inode_id ==
+                    inode_entry->nie_hash_entry.nhe_id) {
+
+                entry = nffs_hash_find_block(disk_object.ndo_disk_block.ndb_id);
+                if (entry != NULL) {
+                    nffs_hash_remove(entry);
+                    nffs_block_entry_free(entry);
+                }
+            }
+            area_offset += nffs_restore_disk_object_size(&disk_object);
+        }
+    }
+}
+
+/**
+ * Verifies that the specified block is the end of an unbroken chain of the
+ * expected length, consisting only of blocks belonging to the specified file.
+ */
+static int
+nffs_block_chain_verify(const struct nffs_inode_entry *inode_entry,
+                        struct nffs_hash_entry *last_entry,
+                        uint32_t num_blocks)
+{
+    struct nffs_hash_entry *entry;
+    struct nffs_block block;
+    uint32_t count;
+    int rc;
+
+    count = 0;
+    entry = last_entry;
+    while (entry != NULL) {
+        count++;
+        if (count > num_blocks) {
+            return FS_ECORRUPT;
+        }
+
+        rc = nffs_block_from_hash_entry(&block, entry);
+        if (rc != 0) {
+            return rc;
+        }
+        if (block.nb_inode_entry != inode_entry) {
+            return FS_ECORRUPT;
+        }
+
+        entry = block.nb_prev;
+    }
+
+    if (count != num_blocks) {
+        return FS_ECORRUPT;
+    }
+
+    return 0;
+}
+
+/**
+ * Ensures a file's block entries are present in RAM.  With lazy block loading
+ * enabled, a file's block chain is only discovered when the file is first
+ * accessed: every area is scanned for the file's data blocks, which are then
+ * inserted into the hash table.  Block entries of other files that are not in
+ * use may be evicted to make room.  This function does nothing if the file is
+ * already loaded.
+ *
+ * @param inode_entry           The file inode to load.
+ *
+ * @return                      0 on success;
+ *                              FS_ENOMEM if the block entry pool is too small
+ *                                  to hold the file's blocks;
+ *                              FS_ECORRUPT if the file's block chain is
+ *                                  incomplete;
+ *                              other nonzero on error.
+ */
+int
+nffs_block_chain_load(struct nffs_inode_entry *inode_entry)
+{
+    struct nffs_disk_object disk_object;
+    struct nffs_hash_entry *last_entry;
+    uint32_t area_offset;
+    uint32_t num_blocks;
+    uint32_t prev_sum;
+    uint32_t id_sum;
+    uint32_t last_id;
+    int rc;
+    int i;
+
+    if (!(inode_entry->nie_flags & NFFS_INODE_F_UNLOADED)) {
+        return 0;
+    }
+
+    id_sum = 0;
+    prev_sum = 0;
+    num_blocks = 0;
+
+    for (i = 0; i < nffs_num_areas; i++) {
+        if (nffs_block_load_skip_area(inode_entry, i)) {
+            continue;
+        }
+
+        area_offset = sizeof (struct nffs_disk_area);
+        while (1) {
+            rc = nffs_restore_next_object(i, &area_offset, &disk_object);
+            if (rc == FS_EEMPTY) {
+                break;
+            }
+            if (rc != 0) {
+                goto err;
+            }
+
+            if (disk_object.ndo_type == NFFS_OBJECT_TYPE_BLOCK &&
+                disk_object.ndo_disk_block.ndb_inode_id ==
+                    inode_entry->nie_hash_entry.nhe_id) {
+
+                rc = nffs_block_load_one(&disk_object, &id_sum, &prev_sum,
+                                         &num_blocks);
+                if (rc != 0) {
+                    goto err;
+                }
+            }
+
+            area_offset += nffs_restore_disk_object_size(&disk_object);
+        }
+    }
+
+    if (num_blocks == 0) {
+        last_entry = NULL;
+    } else {
+        /* Every block except the last is the predecessor of exactly one other
+         * block, so the last block's ID is what remains after the predecessor
+         * IDs are subtracted from the block IDs.
+         */
+        last_id = id_sum - prev_sum;
+        if (!nffs_hash_id_is_block(last_id)) {
+            rc = FS_ECORRUPT;
+            goto err;
+        }
+
+        last_entry = nffs_hash_find_block(last_id);
+        if (last_entry == NULL) {
+            rc = FS_ECORRUPT;
+            goto err;
+        }
+
+        rc = nffs_block_chain_verify(inode_entry, last_entry, num_blocks);
+        if (rc != 0) {
+            goto err;
+        }
+    }
+
+    inode_entry->nie_last_block_entry = last_entry;
+    inode_entry->nie_flags &= ~NFFS_INODE_F_UNLOADED;
+
+    return 0;
+
+err:
+    nffs_block_chain_discard(inode_entry);
+    return rc;
+}
@@ -109,11 +109,21 @@ nffs_cache_inode_free_blocks(struct nffs_cache_inode *cache_inode)
     }
 }
 
+static void
+nffs_cache_inode_free_index(struct nffs_cache_inode *cache_inode)
+{
+    if (cache_inode->nci_index != NULL) {
+        os_memblock_put(&nffs_cache_index_pool, cache_inode->nci_index);
+        cache_inode->nci_index = NULL;
+    }
+}
+
 static void
 nffs_cache_inode_free(struct nffs_cache_inode *entry)
 {
     if (entry != NULL) {
         nffs_cache_inode_free_blocks(entry);
+        nffs_cache_inode_free_index(entry);
         os_memblock_put(&nffs_cache_inode_pool, entry);
     }
 }
@@ -130,6 +140,7 @@ nffs_cache_inode_acquire(void)
 
         TAILQ_REMOVE(&nffs_cache_inode_list, entry, nci_link);
         nffs_cache_inode_free(entry);
+        STATS_INC(nffs_stats, cache_inode_evict);
 
         entry = nffs_cache_inode_alloc();
     }
@@ -219,10 +230,15 @@ static void
 nffs_cache_collect_blocks(void)
 {
     struct nffs_cache_inode *cache_inode;
+    struct nffs_cache_block *cache_block;
 
     TAILQ_FOREACH_REVERSE(cache_inode, &nffs_cache_inode_list,
                           nffs_cache_inode_list, nci_link) {
         if (!TAILQ_EMPTY(&cache_inode->nci_block_list)) {
+            TAILQ_FOREACH(cache_block, &cache_inode->nci_block_list,
+                          ncb_link) {
+                STATS_INC(nffs_stats, cache_block_evict);
+            }
             nffs_cache_inode_free_blocks(cache_inode);
             return;
         }
@@ -231,6 +247,208 @@ nffs_cache_collect_blocks(void)
     assert(0);
 }
 
+/**
+ * Allocates a block index.  If none are free, the index belonging to the least
+ * recently used cached inode is stolen.
+ *
+ * @return                      The allocated index on success; null if block
+ *                                  indexing is disabled.
+ */
+static struct nffs_cache_index *
+nffs_cache_index_acquire(void)
+{
+    struct nffs_cache_inode *cache_inode;
+    struct nffs_cache_index *index;
+
+    if (nffs_config.nc_num_cache_indexes == 0) {
+        return NULL;
+    }
+
+    index = os_memblock_get(&nffs_cache_index_pool);
+    if (index == NULL) {
+        TAILQ_FOREACH_REVERSE(cache_inode, &nffs_cache_inode_list,
+                              nffs_cache_inode_list, nci_link) {
+            if (cache_inode->nci_index != NULL) {
+                index = cache_inode->nci_index;
+                cache_inode->nci_index = NULL;
+                break;
+            }
+        }
+    }
+
+    return index;
+}
+
+/**
+ * Builds a sparse block index for the specified cached inode.  A single pass
+ * is made backwards through the block chain; every ncx_stride'th block is
+ * recorded.  If the index fills up, every other entry is discarded and the
+ * stride is doubled, so that the index always spans the whole file.
+ */
+static int
+nffs_cache_index_build(struct nffs_cache_inode *cache_inode)
+{
+    struct nffs_cache_index_entry *entry;
+    struct nffs_cache_index_entry tmp;
+    struct nffs_cache_index *index;
+    struct nffs_hash_entry *block_entry;
+    struct nffs_block block;
+    uint32_t block_end;
+    uint32_t ordinal;
+    int num_entries;
+    int i;
+    int j;
+    int rc;
+
+    index = cache_inode->nci_index;
+    if (index == NULL) {
+        index = nffs_cache_index_acquire();
+        if (index == NULL) {
+            return FS_ENOMEM;
+        }
+    }
+    cache_inode->nci_index = NULL;
+
+    index->ncx_stride = 1;
+    num_entries = 0;
+
+    block_entry = cache_inode->nci_inode.ni_inode_entry->nie_last_block_entry;
+    block_end = cache_inode->nci_file_size;
+    ordinal = 0;
+    while (block_entry != NULL) {
+        rc = nffs_block_from_hash_entry(&block, block_entry);
+        if (rc != 0) {
+            os_memblock_put(&nffs_cache_index_pool, index);
+            return rc;
+        }
+
+        if (ordinal % index->ncx_stride == 0) {
+            if (num_entries >= NFFS_CACHE_INDEX_MAX_ENTRIES) {
+                /* Index full; keep every other entry and double the
+                 * stride.
+                 */
+                for (i = 0, j = 0; i < num_entries; i += 2, j++) {
+                    index->ncx_entries[j] = index->ncx_entries[i];
+                }
+                num_entries = j;
+                index->ncx_stride *= 2;
+            }
+
+            if (ordinal % index->ncx_stride == 0) {
+                entry = index->ncx_entries + num_entries;
+                entry->ncie_block_entry = block_entry;
+                entry->ncie_end_offset = block_end;
+                num_entries++;
+            }
+        }
+
+        block_end -= block.nb_data_len;
+        block_entry = block.nb_prev;
+        ordinal++;
+    }
+
+    /* Entries were recorded from the end of the file; sort them by offset. */
+    for (i = 0, j = num_entries - 1; i < j; i++, j--) {
+        tmp = index->ncx_entries[i];
+        index->ncx_entries[i] = index->ncx_entries[j];
+        index->ncx_entries[j] = tmp;
+    }
+
+    index->ncx_num_entries = num_entries;
+    index->ncx_file_size = cache_inode->nci_file_size;
+    cache_inode->nci_index = index;
+
+    return 0;
+}
+
+/**
+ * Uses the specified inode's block index to find the indexed block nearest
+ * to, but not preceding, the block containing the given offset.  The index is
+ * built if it does not exist yet.
+ *
+ * @return                      The index entry on success; null if the inode
+ *                                  could not be indexed or if the offset is
+ *                                  beyond the last indexed block.
+ */
+static const struct nffs_cache_index_entry *
+nffs_cache_index_find(struct nffs_cache_inode *cache_inode,
+                      uint32_t seek_offset)
+{
+    const struct nffs_cache_index_entry *entry;
+    struct nffs_cache_index *index;
+    uint32_t max_walk;
+    int rc;
+    int lo;
+    int hi;
+    int mid;
+
+    max_walk = NFFS_CACHE_INDEX_MIN_WALK * nffs_block_max_data_sz;
+
+    index = cache_inode->nci_index;
+    if (index == NULL ||
+        cache_inode->nci_file_size - index->ncx_file_size > max_walk) {
+
+        rc = nffs_cache_index_build(cache_inode);
+        if (rc != 0) {
+            return NULL;
+        }
+        index = cache_inode->nci_index;
+    }
+
+    /* Binary search for the first indexed block ending after the offset. */
+    lo = 0;
+    hi = index->ncx_num_entries;
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (index->ncx_entries[mid].ncie_end_offset <= seek_offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (lo >= index->ncx_num_entries) {
+        return NULL;
+    }
+
+    entry = index->ncx_entries + lo;
+    return entry;
+}
+
+/**
+ * Discards the block index of the specified inode, if it has one.  This must
+ * be called whenever the offsets of the inode's blocks change or when any of
+ * its block entries get removed.
+ */
+void
+nffs_cache_index_delete(const struct nffs_inode_entry *inode_entry)
+{
+    struct nffs_cache_inode *cache_inode;
+
+    cache_inode = nffs_cache_inode_find(inode_entry);
+    if (cache_inode != NULL) {
+        nffs_cache_inode_free_index(cache_inode);
+    }
+}
+
+/**
+ * Discards the cached blocks and block index of the specified inode, if it is
+ * cached.  The cached inode itself remains valid.  This must be called when
+ * the inode's block entries are replaced, e.g., when garbage collection
+ * merges several blocks into one.
+ */
+void
+nffs_cache_inode_clear_blocks(const struct nffs_inode_entry *inode_entry)
+{
+    struct nffs_cache_inode *cache_inode;
+
+    cache_inode = nffs_cache_inode_find(inode_entry);
+    if (cache_inode != NULL) {
+        nffs_cache_inode_free_blocks(cache_inode);
+        nffs_cache_inode_free_index(cache_inode);
+    }
+}
+
 void
 nffs_cache_inode_delete(const struct nffs_inode_entry *inode_entry)
 {
@@ -254,10 +472,24 @@ nffs_cache_inode_ensure(struct nffs_cache_inode **out_cache_inode,
 
     cache_inode = nffs_cache_inode_find(inode_entry);
     if (cache_inode != NULL) {
+        /* Move the inode to the front of the list to maintain LRU order. */
+        if (cache_inode != TAILQ_FIRST(&nffs_cache_inode_list)) {
+            TAILQ_REMOVE(&nffs_cache_inode_list, cache_inode, nci_link);
+            TAILQ_INSERT_HEAD(&nffs_cache_inode_list, cache_inode, nci_link);
+        }
+        STATS_INC(nffs_stats, cache_inode_hit);
         rc = 0;
         goto done;
     }
 
+    STATS_INC(nffs_stats, cache_inode_miss);
+
+    rc = nffs_block_chain_load(inode_entry);
+    if (rc != 0) {
+        *out_cache_inode = NULL;
+        return rc;
+    }
+
     cache_inode = nffs_cache_inode_acquire();
     rc = nffs_cache_inode_populate(cache_inode, inode_entry);
     if (rc != 0) {
@@ -297,6 +529,11 @@ done:
  *      b. Else, clear the cache, and populate it with the single entry
  *         corresponding to the requested block.
  *
+ * In case 3, if the requested block directly follows the cache or is the
+ * first block in the file, the file is assumed to be read sequentially.  Up to
+ * nc_cache_readahead of the blocks that follow it, which were already read
+ * during the backwards scan, are cached as well.
+ *
  * @param cache_inode           The cached file inode to seek within.
  * @param seek_offset           The file offset to seek to.
  * @param out_cache_block       On success, the requested cached block gets
@@ -309,7 +546,10 @@ int
 nffs_cache_seek(struct nffs_cache_inode *cache_inode, uint32_t seek_offset,
                 struct nffs_cache_block **out_cache_block)
 {
+    const struct nffs_cache_index_entry *index_entry;
+    struct nffs_block ra_blocks[NFFS_CACHE_READAHEAD_MAX];
     struct nffs_cache_block *cache_block;
+    struct nffs_cache_block *ra_cache_block;
     struct nffs_hash_entry *last_cached_entry;
     struct nffs_hash_entry *block_entry;
     struct nffs_hash_entry *pred_entry;
@@ -318,13 +558,26 @@ nffs_cache_seek(struct nffs_cache_inode *cache_inode, uint32_t seek_offset,
     uint32_t cache_end;
     uint32_t block_start;
     uint32_t block_end;
+    uint32_t index_offset;
+    int sequential;
+    int ra_count;
+    int ra_max;
+    int miss;
     int rc;
+    int i;
 
     /* Empty files have no blocks that can be cached. */
     if (cache_inode->nci_file_size == 0) {
         return FS_ENOENT;
     }
 
+    ra_max = nffs_config.nc_cache_readahead;
+    if (ra_max > NFFS_CACHE_READAHEAD_MAX) {
+        ra_max = NFFS_CACHE_READAHEAD_MAX;
+    }
+    ra_count = 0;
+    miss = 0;
+
     nffs_cache_inode_range(cache_inode, &cache_start, &cache_end);
     if (cache_end != 0 && seek_offset < cache_start) {
         /* Seeking prior to cache.  Iterate backwards from cache start. */
@@ -350,6 +603,38 @@ nffs_cache_seek(struct nffs_cache_inode *cache_inode, uint32_t seek_offset,
         block_end = cache_inode->nci_file_size;
     }
 
+    /* If the walk would be long, skip ahead using the inode's block index. */
+    if (cache_block == NULL && nffs_config.nc_num_cache_indexes > 0 &&
+        block_end - seek_offset >
+            NFFS_CACHE_INDEX_MIN_WALK * nffs_block_max_data_sz) {
+
+        /* If this looks like a sequential read, start the scan far enough
+         * past the requested block that there is something to read ahead.
+         */
+        index_offset = seek_offset;
+        if (ra_max > 0 &&
+            (seek_offset < nffs_block_max_data_sz ||
+             (cache_end != 0 && seek_offset >= cache_end &&
+              seek_offset - cache_end < nffs_block_max_data_sz))) {
+
+            index_offset += ra_max * nffs_block_max_data_sz;
+        }
+
+        index_entry = nffs_cache_index_find(cache_inode, index_offset);
+        if (index_entry != NULL && index_entry->ncie_end_offset < block_end) {
+            if (index_entry->ncie_end_offset <= cache_start) {
+                /* The walk now starts before the cache; the blocks between
+                 * here and the cache would not get cached.  Discard the cache
+                 * to keep it contiguous.
+                 */
+                nffs_cache_inode_free_blocks(cache_inode);
+                cache_start = 0;
+            }
+            block_entry = index_entry->ncie_block_entry;
+            block_end = index_entry->ncie_end_offset;
+        }
+    }
+
     /* Scan backwards until we find the block containing the seek offest. */
     while (1) {
         if (block_end <= cache_start) {
@@ -366,6 +651,7 @@ nffs_cache_seek(struct nffs_cache_inode *cache_inode, uint32_t seek_offset,
 
             TAILQ_INSERT_HEAD(&cache_inode->nci_block_list, cache_block,
                               ncb_link);
+            miss = 1;
         }
 
         /* Calculate the file offset of the start of this block.  This is used
@@ -403,16 +689,42 @@ nffs_cache_seek(struct nffs_cache_inode *cache_inode, uint32_t seek_offset,
                 cache_block->ncb_file_offset = block_start;
 
                 last_cached_entry = nffs_cache_inode_last_entry(cache_inode);
+                sequential = pred_entry == NULL;
                 if (last_cached_entry != NULL &&
                     last_cached_entry == pred_entry) {
 
                     TAILQ_INSERT_TAIL(&cache_inode->nci_block_list,
                                       cache_block, ncb_link);
+                    sequential = 1;
                 } else {
                     nffs_cache_inode_free_blocks(cache_inode);
                     TAILQ_INSERT_HEAD(&cache_inode->nci_block_list,
                                       cache_block, ncb_link);
                 }
+                miss = 1;
+
+                /* Cache the blocks that follow the requested one.  The most
+                 * recently scanned block is the nearest successor.  Don't
+                 * evict anything to make room for read-ahead.
+                 */
+                if (sequential) {
+                    block_end = cache_block->ncb_file_offset +
+                                cache_block->ncb_block.nb_data_len;
+                    for (i = 1; i <= ra_max && i <= ra_count; i++) {
+                        ra_cache_block = nffs_cache_block_alloc();
+                        if (ra_cache_block == NULL) {
+                            break;
+                        }
+
+                        ra_cache_block->ncb_block =
+                            ra_blocks[(ra_count - i) % ra_max];
+                        ra_cache_block->ncb_file_offset = block_end;
+                        block_end += ra_cache_block->ncb_block.nb_data_len;
+                        TAILQ_INSERT_TAIL(&cache_inode->nci_block_list,
+                                          ra_cache_block, ncb_link);
+                        STATS_INC(nffs_stats, cache_readahead);
+                    }
+                }
             }
 
             if (out_cache_block != NULL) {
@@ -425,11 +737,23 @@ nffs_cache_seek(struct nffs_cache_inode *cache_inode, uint32_t seek_offset,
         if (cache_block != NULL) {
             cache_block = TAILQ_PREV(cache_block, nffs_cache_block_list,
                                      ncb_link);
+        } else if (ra_max > 0) {
+            /* Remember the blocks most recently read from flash in case
+             * they are needed for read-ahead.
+             */
+            ra_blocks[ra_count % ra_max] = block;
+            ra_count++;
         }
         block_entry = pred_entry;
         block_end = block_start;
     }
 
+    if (miss) {
+        STATS_INC(nffs_stats, cache_block_miss);
+    } else {
+        STATS_INC(nffs_stats, cache_block_hit);
+    }
+
     return 0;
 }
 
@@ -0,0 +1,765 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <assert.h>
+#include <string.h>
+#include "hal/hal_flash.h"
+#include "nffs_priv.h"
+#include "nffs/nffs.h"
+#include "util/crc16.h"
+
+/**
+ * A checkpoint is a snapshot of the RAM representation (hash entries, the
+ * directory tree, and each area's write offset) stored in a dedicated flash
+ * region outside of the file system areas.  The header is written last, so an
+ * interrupted checkpoint write leaves the region without a valid header.
+ *
+ * Checkpoint region layout:
+ *     struct nffs_disk_ckpt                       (header)
+ *     struct nffs_disk_ckpt_area[ndc_num_areas]
+ *     object records:
+ *         o The root directory.
+ *         o For each directory, its children in list order.  Each file is
+ *           preceded by all of its data blocks.
+ */
+
+/** Location of the checkpoint region; length of 0 means none configured. */
+static struct nffs_area_desc nffs_checkpoint_area_desc;
+
+/** NFFS_CHECKPOINT_F_[...] */
+static uint8_t nffs_checkpoint_flags;
+
+/** Set when a garbage collection cycle has invalidated the checkpoint. */
+static uint8_t nffs_checkpoint_pending;
+
+/**
+ * Region offset of the data in nffs_flash_buf.  While writing, the buffer
+ * holds records waiting to be flushed; while reading, it caches the region
+ * contents starting at this offset.
+ */
+static uint32_t nffs_checkpoint_buf_off;
+static uint16_t nffs_checkpoint_buf_len;
+
+/** Running CRC of all records flushed so far. */
+static uint16_t nffs_checkpoint_crc;
+
+/** Tracks the state of the directory tree as it is loaded. */
+struct nffs_checkpoint_loader {
+    struct nffs_inode_entry *ncl_parent;    /* Parent of last loaded inode. */
+    struct nffs_inode_entry *ncl_child;     /* Last loaded inode. */
+    int ncl_num_dummies;                    /* # of unresolved parents. */
+};
+
+static int
+nffs_checkpoint_is_configured(void)
+{
+    return nffs_checkpoint_area_desc.nad_length != 0;
+}
+
+/**
+ * Specifies the flash region to use for checkpoints.  The region must not
+ * overlap any of the file system's areas.
+ *
+ * @param area_desc             The checkpoint region; null to disable
+ *                                  checkpoints.
+ * @param flags                 NFFS_CHECKPOINT_F_[...]
+ *
+ * @return                      0 on success;
+ *                              FS_ENOTSUP if lazy block loading is enabled;
+ *                              other nonzero on failure.
+ */
+int
+nffs_checkpoint_set_area(const struct nffs_area_desc *area_desc,
+                         uint8_t flags)
+{
+    if (area_desc == NULL) {
+        memset(&nffs_checkpoint_area_desc, 0,
+               sizeof nffs_checkpoint_area_desc);
+        nffs_checkpoint_flags = 0;
+        nffs_checkpoint_pending = 0;
+        return 0;
+    }
+
+    if (area_desc->nad_length < sizeof (struct nffs_disk_ckpt)) {
+        return FS_EINVAL;
+    }
+
+    /* A checkpoint records every block entry, which is incompatible with
+     * loading block entries on demand.
+     */
+    if (nffs_config.nc_lazy_blocks) {
+        return FS_ENOTSUP;
+    }
+
+    nffs_checkpoint_area_desc = *area_desc;
+    nffs_checkpoint_flags = flags;
+    nffs_checkpoint_pending = 0;
+
+    return 0;
+}
+
+/**
+ * Erases the checkpoint region, if one is configured.  This causes the next
+ * mount to perform a full restore.
+ *
+ * @return                      0 on success; nonzero on failure.
+ */
+int
+nffs_checkpoint_erase(void)
+{
+    int rc;
+
+    if (!nffs_checkpoint_is_configured()) {
+        return 0;
+    }
+
+    STATS_INC(nffs_stats, flash_erase);
+    rc = hal_flash_erase(nffs_checkpoint_area_desc.nad_flash_id,
+                         nffs_checkpoint_area_desc.nad_offset,
+                         nffs_checkpoint_area_desc.nad_length);
+    if (rc != 0) {
+        return FS_EHW;
+    }
+
+    return 0;
+}
+
+/**
+ * Indicates that the checkpoint no longer matches the contents of flash.  If
+ * automatic checkpoints are enabled, a new one gets written at the end of the
+ * current file system operation.
+ */
+void
+nffs_checkpoint_mark_stale(void)
+{
+    if (nffs_checkpoint_flags & NFFS_CHECKPOINT_F_AUTO) {
+        nffs_checkpoint_pending = 1;
+    }
+}
+
+/**
+ * Writes a checkpoint if the previous one was invalidated by a garbage
+ * collection cycle.  This must only be called when the RAM representation is
+ * consistent with flash (i.e., between file system operations).  Nothing is
+ * written while an incremental garbage collection cycle is in progress; the
+ * checkpoint is written once the cycle completes.  Failure is not reported;
+ * the next mount falls back to a full restore.
+ */
+void
+nffs_checkpoint_write_pending(void)
+{
+    if (nffs_checkpoint_pending &&
+        nffs_gc_from_area_idx == NFFS_AREA_ID_NONE) {
+
+        nffs_checkpoint_write();
+    }
+}
+
+static int
+nffs_checkpoint_flush(void)
+{
+    int rc;
+
+    if (nffs_checkpoint_buf_len == 0) {
+        return 0;
+    }
+
+    if (nffs_checkpoint_buf_off + nffs_checkpoint_buf_len >
+        nffs_checkpoint_area_desc.nad_length) {
+
+        return FS_EFULL;
+    }
+
+    rc = hal_flash_write(nffs_checkpoint_area_desc.nad_flash_id,
+                         nffs_checkpoint_area_desc.nad_offset +
+                            nffs_checkpoint_buf_off,
+                         nffs_flash_buf, nffs_checkpoint_buf_len);
+    if (rc != 0) {
+        return FS_EHW;
+    }
+
+    nffs_checkpoint_crc = crc16_ccitt(nffs_checkpoint_crc, nffs_flash_buf,
+                                      nffs_checkpoint_buf_len);
+    nffs_checkpoint_buf_off += nffs_checkpoint_buf_len;
+    nffs_checkpoint_buf_len = 0;
+
+    return 0;
+}
+
+static int
+nffs_checkpoint_append(const void *data, uint16_t len)
+{
+    int rc;
+
+    assert(len <= sizeof nffs_flash_buf);
+
+    if (nffs_checkpoint_buf_len + len > sizeof nffs_flash_buf) {
+        rc = nffs_checkpoint_flush();
+        if (rc != 0) {
+            return rc;
+        }
+    }
+
+    memcpy(nffs_flash_buf + nffs_checkpoint_buf_len, data, len);
+    nffs_checkpoint_buf_len += len;
+
+    return 0;
+}
+
+/**
+ * Appends the record for a single inode.  If the inode is a file, records for
+ * each of its data blocks are appended first.
+ */
+static int
+nffs_checkpoint_append_inode(struct nffs_inode_entry *inode_entry,
+                             uint32_t parent_id)
+{
+    struct nffs_disk_ckpt_object ckpt_object;
+    struct nffs_hash_entry *block_entry;
+    struct nffs_block block;
+    int rc;
+
+    ckpt_object.ndco_last_block_id = NFFS_ID_NONE;
+
+    if (nffs_hash_id_is_file(inode_entry->nie_hash_entry.nhe_id)) {
+        block_entry = inode_entry->nie_last_block_entry;
+        if (block_entry != NULL) {
+            ckpt_object.ndco_last_block_id = block_entry->nhe_id;
+        }
+
+        while (block_entry != NULL) {
+            rc = nffs_block_from_hash_entry(&block, block_entry);
+            if (rc != 0) {
+                return rc;
+            }
+
+            ckpt_object.ndco_id = block_entry->nhe_id;
+            ckpt_object.ndco_flash_loc = block_entry->nhe_flash_loc;
+            rc = nffs_checkpoint_append(&ckpt_object,
+                                        NFFS_DISK_CKPT_BLOCK_SZ);
+            if (rc != 0) {
+                return rc;
+            }
+
+            block_entry = block.nb_prev;
+        }
+    }
+
+    ckpt_object.ndco_id = inode_entry->nie_hash_entry.nhe_id;
+    ckpt_object.ndco_flash_loc = inode_entry->nie_hash_entry.nhe_flash_loc;
+    ckpt_object.ndco_parent_id = parent_id;
+
+    return nffs_checkpoint_append(&ckpt_object, sizeof ckpt_object);
+}
+
+/**
+ * Writes a checkpoint of the current RAM representation to the checkpoint
+ * region, replacing the previous one.  If an incremental garbage collection
+ * cycle is in progress, it is completed first so that the checkpoint
+ * describes a single scratch area.
+ *
+ * @return                      0 on success;
+ *                              FS_ENOENT if no checkpoint region is
+ *                                  configured;
+ *                              FS_EFULL if the checkpoint region is too small;
+ *                              other nonzero on failure.
+ */
+int
+nffs_checkpoint_write(void)
+{
+    struct nffs_disk_ckpt_area ckpt_area;
+    struct nffs_inode_entry *inode_entry;
+    struct nffs_inode_entry *child;
+    struct nffs_hash_entry *entry;
+    struct nffs_disk_ckpt ckpt;
+    int rc;
+    int i;
+
+    if (!nffs_checkpoint_is_configured()) {
+        return FS_ENOENT;
+    }
+
+    if (nffs_gc_from_area_idx != NFFS_AREA_ID_NONE) {
+        rc = nffs_gc(NULL);
+        if (rc != 0) {
+            return rc;
+        }
+    }
+
+    nffs_checkpoint_pending = 0;
+
+    rc = nffs_checkpoint_erase();
+    if (rc != 0) {
+        return rc;
+    }
+
+    nffs_checkpoint_buf_off = sizeof ckpt;
+    nffs_checkpoint_buf_len = 0;
+    nffs_checkpoint_crc = 0;
+
+    for (i = 0; i < nffs_num_areas; i++) {
+        memset(&ckpt_area, 0, sizeof ckpt_area);
+        ckpt_area.ndca_offset = nffs_areas[i].na_offset;
+        ckpt_area.ndca_length = nffs_areas[i].na_length;
+        ckpt_area.ndca_cur = nffs_areas[i].na_cur;
+        ckpt_area.ndca_dead = nffs_areas[i].na_dead;
+        ckpt_area.ndca_flash_id = nffs_areas[i].na_flash_id;
+        ckpt_area.ndca_gc_seq = nffs_areas[i].na_gc_seq;
+        ckpt_area.ndca_id = nffs_areas[i].na_id;
+
+        rc = nffs_checkpoint_append(&ckpt_area, sizeof ckpt_area);
+        if (rc != 0) {
+            return rc;
+        }
+    }
+
+    rc = nffs_checkpoint_append_inode(nffs_root_dir, NFFS_ID_NONE);
+    if (rc != 0) {
+        return rc;
+    }
+
+    /* Every inode other than the root is written as a child of its parent.
+     * Inodes that have been unlinked but are still open are omitted; they
+     * would not survive a full restore either.
+     */
+    NFFS_HASH_FOREACH(entry, i) {
+        if (nffs_hash_id_is_dir(entry->nhe_id)) {
+            inode_entry = (struct nffs_inode_entry *)entry;
+            SLIST_FOREACH(child, &inode_entry->nie_child_list,
+                          nie_sibling_next) {
+
+                rc = nffs_checkpoint_append_inode(child, entry->nhe_id);
+                if (rc != 0) {
+                    return rc;
+                }
+            }
+        }
+    }
+
+    rc = nffs_checkpoint_flush();
+    if (rc != 0) {
+        return rc;
+    }
+
+    memset(&ckpt, 0, sizeof ckpt);
+    ckpt.ndc_magic = NFFS_CKPT_MAGIC;
+    ckpt.ndc_len = nffs_checkpoint_buf_off - sizeof ckpt;
+    ckpt.ndc_next_dir_id = nffs_hash_next_dir_id;
+    ckpt.ndc_next_file_id = nffs_hash_next_file_id;
+    ckpt.ndc_next_block_id = nffs_hash_next_block_id;
+    ckpt.ndc_block_max_data_sz = nffs_block_max_data_sz;
+    ckpt.ndc_ver = NFFS_CKPT_VER;
+    ckpt.ndc_num_areas = nffs_num_areas;
+    ckpt.ndc_crc16 = crc16_ccitt(nffs_checkpoint_crc, &ckpt,
+                                 NFFS_DISK_CKPT_OFFSET_CRC);
+
+    rc = hal_flash_write(nffs_checkpoint_area_desc.nad_flash_id,
+                         nffs_checkpoint_area_desc.nad_offset,
+                         &ckpt, sizeof ckpt);
+    if (rc != 0) {
+        return FS_EHW;
+    }
+
+    return 0;
+}
+
+/**
+ * Reads from the checkpoint region via the shared flash buffer.
+ */
+static int
+nffs_checkpoint_read(uint32_t offset, void *data, uint16_t len)
+{
+    uint32_t chunk_len;
+    int rc;
+
+    assert(len <= sizeof nffs_flash_buf);
+
+    if (offset + len > nffs_checkpoint_area_desc.nad_length) {
+        return FS_ECORRUPT;
+    }
+
+    if (offset < nffs_checkpoint_buf_off ||
+        offset + len > nffs_checkpoint_buf_off + nffs_checkpoint_buf_len) {
+
+        chunk_len = nffs_checkpoint_area_desc.nad_length - offset;
+        if (chunk_len > sizeof nffs_flash_buf) {
+            chunk_len = sizeof nffs_flash_buf;
+        }
+
+        rc = hal_flash_read(nffs_checkpoint_area_desc.nad_flash_id,
+                            nffs_checkpoint_area_desc.nad_offset + offset,
+                            nffs_flash_buf, chunk_len);
+        if (rc != 0) {
+            nffs_checkpoint_buf_len = 0;
+            return FS_EHW;
+        }
+
+        nffs_checkpoint_buf_off = offset;
+        nffs_checkpoint_buf_len = chunk_len;
+    }
+
+    memcpy(data, nffs_flash_buf + offset - nffs_checkpoint_buf_off, len);
+
+    return 0;
+}
+
+/**
+ * Reads and validates the checkpoint header and the CRC of its contents.
+ */
+static int
+nffs_checkpoint_read_hdr(struct nffs_disk_ckpt *out_ckpt)
+{
+    uint32_t chunk_len;
+    uint32_t offset;
+    uint32_t end;
+    uint16_t crc;
+    int rc;
+
+    nffs_checkpoint_buf_len = 0;
+
+    rc = nffs_checkpoint_read(0, out_ckpt, sizeof *out_ckpt);
+    if (rc != 0) {
+        return rc;
+    }
+
+    if (out_ckpt->ndc_magic != NFFS_CKPT_MAGIC ||
+        out_ckpt->ndc_ver != NFFS_CKPT_VER ||
+        out_ckpt->ndc_len > nffs_checkpoint_area_desc.nad_length -
+                            sizeof *out_ckpt) {
+
+        return FS_ECORRUPT;
+    }
+
+    crc = 0;
+    offset = sizeof *out_ckpt;
+    end = offset + out_ckpt->ndc_len;
+    while (offset < end) {
+        chunk_len = end - offset;
+        if (chunk_len > sizeof nffs_flash_buf) {
+            chunk_len = sizeof nffs_flash_buf;
+        }
+
+        rc = hal_flash_read(nffs_checkpoint_area_desc.nad_flash_id,
+                            nffs_checkpoint_area_desc.nad_offset + offset,
+                            nffs_flash_buf, chunk_len);
+        if (rc != 0) {
+            return FS_EHW;
+        }
+        crc = crc16_ccitt(crc, nffs_flash_buf, chunk_len);
+        offset += chunk_len;
+    }
+
+    /* The flash buffer no longer holds the start of the region. */
+    nffs_checkpoint_buf_len = 0;
+
+    crc = crc16_ccitt(crc, out_ckpt, NFFS_DISK_CKPT_OFFSET_CRC);
+    if (crc != out_ckpt->ndc_crc16) {
+        return FS_ECORRUPT;
+    }
+
+    return 0;
+}
+
+/**
+ * Restores the RAM representation of each area from the checkpoint.  The
+ * checkpoint is only usable if the area set is unchanged and no area has been
+ * formatted or garbage collected since it was written.
+ */
+static int
+nffs_checkpoint_load_areas(const struct nffs_disk_ckpt *ckpt,
+                           const struct nffs_area_desc *area_descs,
+                           uint32_t *offset)
+{
+    struct nffs_disk_ckpt_area ckpt_area;
+    struct nffs_disk_area disk_area;
+    struct nffs_area *area;
+    int rc;
+    int i;
+
+    for (i = 0; area_descs[i].nad_length != 0; i++) {
+        if (i >= ckpt->ndc_num_areas) {
+            return FS_ECORRUPT;
+        }
+    }
+    if (i != ckpt->ndc_num_areas) {
+        return FS_ECORRUPT;
+    }
+
+    rc = nffs_misc_set_num_areas(ckpt->ndc_num_areas);
+    if (rc != 0) {
+        return rc;
+    }
+
+    for (i = 0; i < nffs_num_areas; i++) {
+        rc = nffs_checkpoint_read(*offset, &ckpt_area, sizeof ckpt_area);
+        if (rc != 0) {
+            return rc;
+        }
+        *offset += sizeof ckpt_area;
+
+        rc = hal_flash_read(area_descs[i].nad_flash_id,
+                            area_descs[i].nad_offset,
+                            &disk_area, sizeof disk_area);
+        if (rc != 0) {
+            return FS_EHW;
+        }
+
+        if (!nffs_area_magic_is_set(&disk_area)                 ||
+            ckpt_area.ndca_offset != area_descs[i].nad_offset    ||
+            ckpt_area.ndca_length != area_descs[i].nad_length    ||
+            ckpt_area.ndca_flash_id != area_descs[i].nad_flash_id ||
+            ckpt_area.ndca_gc_seq != disk_area.nda_gc_seq        ||
+            ckpt_area.ndca_id != disk_area.nda_id                ||
+            ckpt_area.ndca_cur > ckpt_area.ndca_length           ||
+            ckpt_area.ndca_dead > ckpt_area.ndca_cur) {
+
+            return FS_ECORRUPT;
+        }
+
+        area = nffs_areas + i;
+        area->na_offset = ckpt_area.ndca_offset;
+        area->na_length = ckpt_area.ndca_length;
+        area->na_cur = ckpt_area.ndca_cur;
+        area->na_dead = ckpt_area.ndca_dead;
+        area->na_flash_id = ckpt_area.ndca_flash_id;
+        area->na_gc_seq = ckpt_area.ndca_gc_seq;
+        area->na_id = ckpt_area.ndca_id;
+        area->na_pins = 0;
+
+        if (area->na_id == NFFS_AREA_ID_NONE) {
+            if (nffs_scratch_area_idx != NFFS_AREA_ID_NONE) {
+                return FS_ECORRUPT;
+            }
+            nffs_scratch_area_idx = i;
+        }
+    }
+
+    return 0;
+}
+
+static int
+nffs_checkpoint_flash_loc_is_valid(uint32_t flash_loc)
+{
+    uint32_t area_offset;
+    uint8_t area_idx;
+
+    nffs_flash_loc_expand(flash_loc, &area_idx, &area_offset);
+    return area_idx < nffs_num_areas &&
+           area_idx != nffs_scratch_area_idx &&
+           area_offset < nffs_areas[area_idx].na_cur;
+}
+
+static int
+nffs_checkpoint_load_block(const struct nffs_disk_ckpt_object *ckpt_object)
+{
+    struct nffs_hash_entry *entry;
+
+    if (nffs_hash_find(ckpt_object->ndco_id) != NULL) {
+        return FS_ECORRUPT;
+    }
+
+    entry = nffs_block_entry_alloc();
+    if (entry == NULL) {
+        return FS_ENOMEM;
+    }
+
+    entry->nhe_id = ckpt_object->ndco_id;
+    entry->nhe_flash_loc = ckpt_object->ndco_flash_loc;
+    nffs_hash_insert(entry);
+
+    return 0;
+}
+
+/**
+ * Loads a single inode and links it into its parent's child list.  Children
+ * of a directory are stored contiguously and in order, so each is appended to
+ * the list without reading any filenames from flash.
+ */
+static int
+nffs_checkpoint_load_inode(const struct nffs_disk_ckpt_object *ckpt_object,
+                           struct nffs_checkpoint_loader *loader)
+{
+    struct nffs_inode_entry *inode_entry;
+    struct nffs_inode_entry *parent;
+
+    inode_entry = nffs_hash_find_inode(ckpt_object->ndco_id);
+    if (inode_entry == NULL) {
+        inode_entry = nffs_inode_entry_alloc();
+        if (inode_entry == NULL) {
+            return FS_ENOMEM;
+        }
+        inode_entry->nie_hash_entry.nhe_id = ckpt_object->ndco_id;
+        nffs_hash_insert(&inode_entry->nie_hash_entry);
+    } else if (inode_entry->nie_refcnt != 0) {
+        /* Duplicate record. */
+        return FS_ECORRUPT;
+    } else {
+        /* Placeholder created when one of this directory's children was
+         * loaded.
+         */
+        loader->ncl_num_dummies--;
+    }
+
+    inode_entry->nie_hash_entry.nhe_flash_loc = ckpt_object->ndco_flash_loc;
+    inode_entry->nie_refcnt = 1;
+
+    if (nffs_hash_id_is_file(ckpt_object->ndco_id) &&
+        ckpt_object->ndco_last_block_id != NFFS_ID_NONE) {
+
+        inode_entry->nie_last_block_entry =
+            nffs_hash_find_block(ckpt_object->ndco_last_block_id);
+        if (inode_entry->nie_last_block_entry == NULL) {
+            return FS_ECORRUPT;
+        }
+    }
+
+    if (ckpt_object->ndco_parent_id == NFFS_ID_NONE) {
+        if (ckpt_object->ndco_id != NFFS_ID_ROOT_DIR) {
+            return FS_ECORRUPT;
+        }
+        nffs_root_dir = inode_entry;
+        return 0;
+    }
+
+    if (!nffs_hash_id_is_dir(ckpt_object->ndco_parent_id)) {
+        return FS_ECORRUPT;
+    }
+
+    parent = nffs_hash_find_inode(ckpt_object->ndco_parent_id);
+    if (parent == NULL) {
+        parent = nffs_inode_entry_alloc();
+        if (parent == NULL) {
+            return FS_ENOMEM;
+        }
+        parent->nie_hash_entry.nhe_id = ckpt_object->ndco_parent_id;
+        parent->nie_hash_entry.nhe_flash_loc = NFFS_FLASH_LOC_NONE;
+        parent->nie_refcnt = 0;
+        nffs_hash_insert(&parent->nie_hash_entry);
+        loader->ncl_num_dummies++;
+    }
+
+    if (parent == loader->ncl_parent) {
+        SLIST_INSERT_AFTER(loader->ncl_child, inode_entry, nie_sibling_next);
+    } else {
+        if (!SLIST_EMPTY(&parent->nie_child_list)) {
+            return FS_ECORRUPT;
+        }
+        SLIST_INSERT_HEAD(&parent->nie_child_list, inode_entry,
+                          nie_sibling_next);
+    }
+
+    loader->ncl_parent = parent;
+    loader->ncl_child = inode_entry;
+
+    return 0;
+}
+
+/**
+ * Populates the RAM representation from the checkpoint region.  The caller is
+ * responsible for resetting the RAM representation beforehand, and for
+ * replaying objects written after the checkpoint.  On success, each area's
+ * write offset indicates where the checkpointed objects end.
+ *
+ * @param area_descs            The area set being mounted.
+ * @param out_block_max_data_sz On success, the maximum data block size in
+ *                                  effect when the checkpoint was written
+ *                                  gets written here.
+ *
+ * @return                      0 on success;
+ *                              FS_ENOENT if no checkpoint region is
+ *                                  configured;
+ *                              FS_ECORRUPT if the checkpoint is absent,
+ *                                  corrupt, or stale;
+ *                              other nonzero on failure.
+ */
+int
+nffs_checkpoint_load(const struct nffs_area_desc *area_descs,
+                     uint16_t *out_block_max_data_sz)
+{
+    struct nffs_checkpoint_loader loader;
+    struct nffs_disk_ckpt_object ckpt_object;
+    struct nffs_disk_ckpt ckpt;
+    uint32_t offset;
+    uint32_t end;
+    int rc;
+
+    if (!nffs_checkpoint_is_configured()) {
+        return FS_ENOENT;
+    }
+
+    rc = nffs_checkpoint_read_hdr(&ckpt);
+    if (rc != 0) {
+        return rc;
+    }
+
+    offset = sizeof ckpt;
+    end = offset + ckpt.ndc_len;
+
+    rc = nffs_checkpoint_load_areas(&ckpt, area_descs, &offset);
+    if (rc != 0) {
+        return rc;
+    }
+
+    memset(&loader, 0, sizeof loader);
+    while (offset < end) {
+        rc = nffs_checkpoint_read(offset, &ckpt_object,
+                                  NFFS_DISK_CKPT_BLOCK_SZ);
+        if (rc != 0) {
+            return rc;
+        }
+        offset += NFFS_DISK_CKPT_BLOCK_SZ;
+
+        if (!nffs_checkpoint_flash_loc_is_valid(ckpt_object.ndco_flash_loc)) {
+            return FS_ECORRUPT;
+        }
+
+        if (nffs_hash_id_is_block(ckpt_object.ndco_id)) {
+            rc = nffs_checkpoint_load_block(&ckpt_object);
+        } else if (nffs_hash_id_is_inode(ckpt_object.ndco_id)) {
+            rc = nffs_checkpoint_read(offset, &ckpt_object.ndco_parent_id,
+                                      sizeof ckpt_object -
+                                      NFFS_DISK_CKPT_BLOCK_SZ);
+            if (rc != 0) {
+                return rc;
+            }
+            offset += sizeof ckpt_object - NFFS_DISK_CKPT_BLOCK_SZ;
+
+            rc = nffs_checkpoint_load_inode(&ckpt_object, &loader);
+        } else {
+            rc = FS_ECORRUPT;
+        }
+        if (rc != 0) {
+            return rc;
+        }
+    }
+
+    if (offset != end || loader.ncl_num_dummies != 0 ||
+        nffs_root_dir == NULL) {
+
+        return FS_ECORRUPT;
+    }
+
+    nffs_hash_next_dir_id = ckpt.ndc_next_dir_id;
+    nffs_hash_next_file_id = ckpt.ndc_next_file_id;
+    nffs_hash_next_block_id = ckpt.ndc_next_block_id;
+
+    *out_block_max_data_sz = ckpt.ndc_block_max_data_sz;
+
+    return 0;
+}
@@ -28,6 +28,7 @@ const struct nffs_config nffs_config_dflt = {
     .nc_num_cache_inodes = 4,
     .nc_num_cache_blocks = 64,
     .nc_num_dirs = 4,
+    .nc_block_max_data_sz = 2048,
 };
 
 void
@@ -51,4 +52,19 @@ nffs_config_init(void)
     if (nffs_config.nc_num_dirs == 0) {
         nffs_config.nc_num_dirs = nffs_config_dflt.nc_num_dirs;
     }
+    if (nffs_config.nc_block_max_data_sz == 0) {
+        nffs_config.nc_block_max_data_sz =
+            nffs_config_dflt.nc_block_max_data_sz;
+    }
+    if (nffs_config.nc_num_hash_buckets == 0) {
+        /* Aim for an average of two objects per bucket when full. */
+        nffs_config.nc_num_hash_buckets =
+            (nffs_config.nc_num_inodes + nffs_config.nc_num_blocks) / 2;
+    }
+    /* nc_num_cache_paths, nc_num_write_bufs, nc_num_cache_indexes,
+     * nc_cache_readahead, nc_bulk_buf_size, nc_lazy_blocks and nc_compress
+     * default to 0; path caching, write buffering, block indexing,
+     * read-ahead, the bulk buffer, lazy block loading and compression are
+     * opt-in.
+     */
 }
@@ -19,32 +19,35 @@
 
 
 #include "nffs_priv.h"
-#include "crc16.h"
+#include "util/crc16.h"
 
 int
 nffs_crc_flash(uint16_t initial_crc, uint8_t area_idx, uint32_t area_offset,
                uint32_t len, uint16_t *out_crc)
 {
     uint32_t chunk_len;
+    uint32_t buf_len;
     uint16_t crc;
+    uint8_t *buf;
     int rc;
 
     crc = initial_crc;
+    buf = nffs_flash_bulk_buf(&buf_len);
 
-    /* Copy data in chunks small enough to fit in the flash buffer. */
+    /* Read data in chunks small enough to fit in the buffer. */
     while (len > 0) {
-        if (len > sizeof nffs_flash_buf) {
-            chunk_len = sizeof nffs_flash_buf;
+        if (len > buf_len) {
+            chunk_len = buf_len;
         } else {
             chunk_len = len;
         }
 
-        rc = nffs_flash_read(area_idx, area_offset, nffs_flash_buf, chunk_len);
+        rc = nffs_flash_read(area_idx, area_offset, buf, chunk_len);
         if (rc != 0) {
             return rc;
         }
 
-        crc = crc16_ccitt(crc, nffs_flash_buf, chunk_len);
+        crc = crc16_ccitt(crc, buf, chunk_len);
 
         area_offset += chunk_len;
         len -= chunk_len;
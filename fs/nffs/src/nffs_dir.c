@@ -72,7 +72,9 @@ nffs_dir_open(const char *path, struct nffs_dir **out_dir)
     }
 
     dir->nd_parent_inode_entry = parent_inode_entry;
+    nffs_ram_lock();
     dir->nd_parent_inode_entry->nie_refcnt++;
+    nffs_ram_unlock();
     memset(&dir->nd_dirent, 0, sizeof dir->nd_dirent);
 
     *out_dir = dir;
@@ -86,6 +88,8 @@ nffs_dir_read(struct nffs_dir *dir, struct nffs_dirent **out_dirent)
     struct nffs_inode_entry *child;
     int rc;
 
+    nffs_ram_lock();
+
     if (dir->nd_dirent.nde_inode_entry == NULL) {
         child = SLIST_FIRST(&dir->nd_parent_inode_entry->nie_child_list);
     } else {
@@ -93,18 +97,202 @@ nffs_dir_read(struct nffs_dir *dir, struct nffs_dirent **out_dirent)
         rc = nffs_inode_dec_refcnt(dir->nd_dirent.nde_inode_entry);
         if (rc != 0) {
             /* XXX: Need to clean up anything? */
-            return rc;
+            goto done;
         }
     }
     dir->nd_dirent.nde_inode_entry = child;
 
     if (child == NULL) {
         *out_dirent = NULL;
-        return FS_ENOENT;
+        rc = FS_ENOENT;
+        goto done;
     }
 
     child->nie_refcnt++;
     *out_dirent = &dir->nd_dirent;
+    rc = 0;
+
+done:
+    nffs_ram_unlock();
+    return rc;
+}
+
+/**
+ * Fills in the summary of a single directory entry.  The inode header and
+ * the filename are read from flash in a single access.
+ */
+static int
+nffs_dir_stat_entry(struct nffs_inode_entry *inode_entry,
+                    struct fs_dirent_stat *out_stat)
+{
+    uint8_t buf[sizeof (struct nffs_disk_inode) + FS_DIRENT_STAT_NAME_MAX];
+    struct nffs_disk_inode disk_inode;
+    const struct nffs_area *area;
+    uint32_t area_offset;
+    uint32_t read_len;
+    uint8_t area_idx;
+    int copy_len;
+    int rc;
+
+    nffs_flash_loc_expand(inode_entry->nie_hash_entry.nhe_flash_loc,
+                          &area_idx, &area_offset);
+    area = nffs_areas + area_idx;
+
+    read_len = sizeof buf;
+    if (area_offset + read_len > area->na_length) {
+        read_len = area->na_length - area_offset;
+    }
+    if (read_len < sizeof disk_inode) {
+        return FS_ECORRUPT;
+    }
+
+    rc = nffs_flash_read(area_idx, area_offset, buf, read_len);
+    if (rc != 0) {
+        return rc;
+    }
+
+    memcpy(&disk_inode, buf, sizeof disk_inode);
+    if (disk_inode.ndi_magic != NFFS_INODE_MAGIC &&
+        disk_inode.ndi_magic != NFFS_INODE_MAGIC_FLAGS) {
+
+        return FS_EUNEXP;
+    }
+
+    copy_len = disk_inode.ndi_filename_len;
+    if (copy_len > FS_DIRENT_STAT_NAME_MAX) {
+        copy_len = FS_DIRENT_STAT_NAME_MAX;
+    }
+    if (sizeof disk_inode + copy_len > read_len) {
+        return FS_ECORRUPT;
+    }
+
+    memcpy(out_stat->fds_name, buf + sizeof disk_inode, copy_len);
+    out_stat->fds_name[copy_len] = '\0';
+    out_stat->fds_name_len = disk_inode.ndi_filename_len;
+
+    if (nffs_hash_id_is_dir(inode_entry->nie_hash_entry.nhe_id)) {
+        out_stat->fds_is_dir = 1;
+        out_stat->fds_size = 0;
+    } else {
+        out_stat->fds_is_dir = 0;
+        rc = nffs_inode_data_len(inode_entry, &out_stat->fds_size);
+        if (rc != 0) {
+            return rc;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Reads a batch of directory entries, continuing from the handle's current
+ * position.  Entries are reported in directory (alphabetical) order, but each
+ * batch of up to NFFS_DIR_STAT_BATCH inodes is read from flash in address
+ * order.  On success, the handle is left positioned at the last entry
+ * reported, as if it had been returned by nffs_dir_read().
+ *
+ * @param dir                   The directory handle to read from.
+ * @param out_stats             The entry summaries get written here.
+ * @param max_stats             The capacity of the out_stats array.
+ * @param out_num_stats         On success, the number of entries written.
+ *
+ * @return                      0 on success;
+ *                              FS_ENOENT if there are no more entries in the
+ *                                  directory;
+ *                              other nonzero on error.
+ */
+int
+nffs_dir_read_stat(struct nffs_dir *dir, struct fs_dirent_stat *out_stats,
+                   int max_stats, int *out_num_stats)
+{
+    struct nffs_inode_entry *batch[NFFS_DIR_STAT_BATCH];
+    struct nffs_inode_entry *cur;
+    struct nffs_inode_entry *child;
+    uint32_t addrs[NFFS_DIR_STAT_BATCH];
+    uint32_t area_offset;
+    uint32_t addr;
+    uint8_t order[NFFS_DIR_STAT_BATCH];
+    uint8_t area_idx;
+    uint8_t tmp;
+    int batch_len;
+    int num_stats;
+    int rc;
+    int i;
+    int j;
+
+    if (max_stats <= 0) {
+        return FS_EINVAL;
+    }
+
+    cur = dir->nd_dirent.nde_inode_entry;
+    num_stats = 0;
+    while (num_stats < max_stats) {
+        /* Gather the next batch of children in directory order. */
+        if (cur == NULL) {
+            child = SLIST_FIRST(&dir->nd_parent_inode_entry->nie_child_list);
+        } else {
+            child = SLIST_NEXT(cur, nie_sibling_next);
+        }
+
+        batch_len = 0;
+        while (child != NULL && batch_len < NFFS_DIR_STAT_BATCH &&
+               num_stats + batch_len < max_stats) {
+
+            nffs_flash_loc_expand(child->nie_hash_entry.nhe_flash_loc,
+                                  &area_idx, &area_offset);
+            addrs[batch_len] = nffs_areas[area_idx].na_offset + area_offset;
+            batch[batch_len] = child;
+            order[batch_len] = batch_len;
+            batch_len++;
+
+            child = SLIST_NEXT(child, nie_sibling_next);
+        }
+
+        if (batch_len == 0) {
+            break;
+        }
+
+        /* Sort the batch by flash address. */
+        for (i = 1; i < batch_len; i++) {
+            tmp = order[i];
+            addr = addrs[tmp];
+            for (j = i; j > 0 && addrs[order[j - 1]] > addr; j--) {
+                order[j] = order[j - 1];
+            }
+            order[j] = tmp;
+        }
+
+        for (i = 0; i < batch_len; i++) {
+            rc = nffs_dir_stat_entry(batch[order[i]],
+                                     out_stats + num_stats + order[i]);
+            if (rc != 0) {
+                return rc;
+            }
+        }
+
+        num_stats += batch_len;
+        cur = batch[batch_len - 1];
+    }
+
+    /* Move the handle's position to the last entry reported. */
+    if (cur != dir->nd_dirent.nde_inode_entry) {
+        nffs_ram_lock();
+        cur->nie_refcnt++;
+        if (dir->nd_dirent.nde_inode_entry != NULL) {
+            rc = nffs_inode_dec_refcnt(dir->nd_dirent.nde_inode_entry);
+            if (rc != 0) {
+                nffs_ram_unlock();
+                return rc;
+            }
+        }
+        dir->nd_dirent.nde_inode_entry = cur;
+        nffs_ram_unlock();
+    }
+
+    *out_num_stats = num_stats;
+    if (num_stats == 0) {
+        return FS_ENOENT;
+    }
 
     return 0;
 }
@@ -41,6 +41,13 @@ nffs_file_free(struct nffs_file *file)
     int rc;
 
     if (file != NULL) {
+        if (file->nf_write_buf != NULL) {
+            rc = os_memblock_put(&nffs_write_buf_pool, file->nf_write_buf);
+            if (rc != 0) {
+                return FS_EOS;
+            }
+        }
+
         rc = os_memblock_put(&nffs_file_pool, file);
         if (rc != 0) {
             return FS_EOS;
@@ -59,6 +66,7 @@ nffs_file_free(struct nffs_file *file)
  * @param filename_len          The length of the filename, in characters.
  * @param is_dir                1 if this is a directory; 0 if it is a normal
  *                                  file.
+ * @param flags                 The new file's NFFS_INODE_FLAG_[...] flags.
  * @param out_inode_entry       On success, this points to the inode
  *                                  corresponding to the new file.
  *
@@ -66,7 +74,7 @@ nffs_file_free(struct nffs_file *file)
  */
 int
 nffs_file_new(struct nffs_inode_entry *parent, const char *filename,
-              uint8_t filename_len, int is_dir,
+              uint8_t filename_len, int is_dir, uint8_t flags,
               struct nffs_inode_entry **out_inode_entry)
 {
     struct nffs_disk_inode disk_inode;
@@ -88,7 +96,7 @@ nffs_file_new(struct nffs_inode_entry *parent, const char *filename,
     }
 
     memset(&disk_inode, 0xff, sizeof disk_inode);
-    disk_inode.ndi_magic = NFFS_INODE_MAGIC;
+    nffs_inode_disk_set_flags(&disk_inode, flags);
     if (is_dir) {
         disk_inode.ndi_id = nffs_hash_next_dir_id++;
     } else {
@@ -116,6 +124,8 @@ nffs_file_new(struct nffs_inode_entry *parent, const char *filename,
     if (parent != NULL) {
         rc = nffs_inode_add_child(parent, inode_entry);
         if (rc != 0) {
+            nffs_area_add_dead(inode_entry->nie_hash_entry.nhe_flash_loc,
+                               sizeof disk_inode + filename_len);
             goto err;
         }
     } else {
@@ -151,6 +161,7 @@ nffs_file_open(struct nffs_file **out_file, const char *path,
     struct nffs_inode_entry *parent;
     struct nffs_inode_entry *inode;
     struct nffs_file *file;
+    uint8_t inode_flags;
     int rc;
 
     file = NULL;
@@ -172,6 +183,19 @@ nffs_file_open(struct nffs_file **out_file, const char *path,
         rc = FS_EINVAL;
         goto err;
     }
+    if (access_flags & FS_ACCESS_COMPRESS) {
+        if (!(access_flags & FS_ACCESS_WRITE)) {
+            rc = FS_EINVAL;
+            goto err;
+        }
+        if (nffs_lz_buf == NULL) {
+            rc = FS_ENOTSUP;
+            goto err;
+        }
+        inode_flags = NFFS_INODE_FLAG_COMPRESS;
+    } else {
+        inode_flags = 0;
+    }
 
     file = nffs_file_alloc();
     if (file == NULL) {
@@ -196,7 +220,7 @@ nffs_file_open(struct nffs_file **out_file, const char *path,
 
         /* Create a new file at the specified path. */
         rc = nffs_file_new(parent, parser.npp_token, parser.npp_token_len, 0,
-                           &file->nf_inode_entry);
+                           inode_flags, &file->nf_inode_entry);
         if (rc != 0) {
             goto err;
         }
@@ -215,7 +239,7 @@ nffs_file_open(struct nffs_file **out_file, const char *path,
              */
             nffs_path_unlink(path);
             rc = nffs_file_new(parent, parser.npp_token, parser.npp_token_len,
-                               0, &file->nf_inode_entry);
+                               0, inode_flags, &file->nf_inode_entry);
             if (rc != 0) {
                 goto err;
             }
@@ -224,6 +248,16 @@ nffs_file_open(struct nffs_file **out_file, const char *path,
              * the existing inode.
              */
             file->nf_inode_entry = inode;
+
+            /* With lazy block loading, the file's block chain is brought into
+             * RAM on first open.
+             */
+            nffs_ram_lock();
+            rc = nffs_block_chain_load(inode);
+            nffs_ram_unlock();
+            if (rc != 0) {
+                goto err;
+            }
         }
     } else {
         /* Invalid path. */
@@ -238,8 +272,22 @@ nffs_file_open(struct nffs_file **out_file, const char *path,
     } else {
         file->nf_offset = 0;
     }
+    nffs_ram_lock();
     file->nf_inode_entry->nie_refcnt++;
+    nffs_ram_unlock();
+
     file->nf_access_flags = access_flags;
+    file->nf_pin_area_idx = NFFS_AREA_ID_NONE;
+
+    /* Writers get a write buffer if one is available; otherwise, each write
+     * goes straight to flash.
+     */
+    if (access_flags & FS_ACCESS_WRITE && nffs_config.nc_num_write_bufs > 0) {
+        file->nf_write_buf = os_memblock_get(&nffs_write_buf_pool);
+        if (file->nf_write_buf != NULL) {
+            file->nf_write_buf->nwb_len = 0;
+        }
+    }
 
     *out_file = file;
 
@@ -266,6 +314,11 @@ nffs_file_seek(struct nffs_file *file, uint32_t offset)
     uint32_t len;
     int rc;
 
+    rc = nffs_write_flush(file);
+    if (rc != 0) {
+        return rc;
+    }
+
     rc = nffs_inode_data_len(file->nf_inode_entry, &len);
     if (rc != 0) {
         return rc;
@@ -307,6 +360,11 @@ nffs_file_read(struct nffs_file *file, uint32_t len, void *out_data,
         return FS_EACCESS;
     }
 
+    rc = nffs_write_flush(file);
+    if (rc != 0) {
+        return rc;
+    }
+
     rc = nffs_inode_read(file->nf_inode_entry, file->nf_offset, len, out_data,
                         &bytes_read);
     if (rc != 0) {
@@ -321,10 +379,106 @@ nffs_file_read(struct nffs_file *file, uint32_t len, void *out_data,
     return 0;
 }
 
+/**
+ * Retrieves a pointer to the file data at the handle's current offset,
+ * avoiding a copy when the file system resides in memory-mapped flash.  The
+ * returned extent is contiguous on flash, so it may be shorter than requested
+ * even if the file contains more data; the file offset advances by the
+ * extent's length.
+ *
+ * The area holding the extent is pinned: garbage collection does not erase it
+ * until the pointer is released with nffs_file_read_ptr_release(), a
+ * subsequent call to this function, or closing the handle.  The data itself
+ * remains readable even if the file is overwritten or unlinked in the
+ * meantime.
+ *
+ * @param file              The file to read from.
+ * @param len               The maximum number of bytes to retrieve.
+ * @param out_ptr           On success, a pointer to the data gets written
+ *                              here; null at the end of the file.
+ * @param out_len           On success, the number of bytes available at
+ *                              out_ptr gets written here.
+ *
+ * @return                  0 on success;
+ *                          FS_ENOTSUP if the flash is not memory-mapped;
+ *                          other nonzero on failure.
+ */
+int
+nffs_file_read_ptr(struct nffs_file *file, uint32_t len, const void **out_ptr,
+                   uint32_t *out_len)
+{
+    uint8_t area_idx;
+    int rc;
+
+    if (!nffs_misc_ready()) {
+        return FS_EUNINIT;
+    }
+
+    if (!(file->nf_access_flags & FS_ACCESS_READ)) {
+        return FS_EACCESS;
+    }
+
+    nffs_file_read_ptr_release(file);
+
+    rc = nffs_write_flush(file);
+    if (rc != 0) {
+        return rc;
+    }
+
+    rc = nffs_inode_read_ptr(file->nf_inode_entry, file->nf_offset, len,
+                             out_ptr, out_len, &area_idx);
+    if (rc != 0) {
+        return rc;
+    }
+
+    if (*out_len > 0 && area_idx == nffs_gc_from_area_idx) {
+        /* The extent is in the area that the garbage collection cycle in
+         * progress is about to erase.  Finish the cycle so that the data gets
+         * relocated before it is pinned.
+         */
+        rc = nffs_gc(NULL);
+        if (rc != 0) {
+            return rc;
+        }
+
+        rc = nffs_inode_read_ptr(file->nf_inode_entry, file->nf_offset, len,
+                                 out_ptr, out_len, &area_idx);
+        if (rc != 0) {
+            return rc;
+        }
+    }
+
+    if (*out_len > 0) {
+        nffs_areas[area_idx].na_pins++;
+        file->nf_pin_area_idx = area_idx;
+        file->nf_offset += *out_len;
+    }
+
+    return 0;
+}
+
+/**
+ * Releases the pointer most recently retrieved via nffs_file_read_ptr(), if
+ * any.  The pointer must not be dereferenced afterwards.
+ *
+ * @param file              The file whose pointer should be released.
+ */
+void
+nffs_file_read_ptr_release(struct nffs_file *file)
+{
+    if (file->nf_pin_area_idx != NFFS_AREA_ID_NONE) {
+        assert(nffs_areas[file->nf_pin_area_idx].na_pins > 0);
+        nffs_areas[file->nf_pin_area_idx].na_pins--;
+        file->nf_pin_area_idx = NFFS_AREA_ID_NONE;
+    }
+}
+
 /**
  * Closes the specified file and invalidates the file handle.  If the file has
  * already been unlinked, and this is the last open handle to the file, this
- * operation causes the file to be deleted.
+ * operation causes the file to be deleted.  Any buffered data is written to
+ * flash first; if this fails, the handle is still closed, but the error is
+ * reported.
  *
  * @param file              The file handle to close.
  *
@@ -333,8 +487,14 @@ nffs_file_read(struct nffs_file *file, uint32_t len, void *out_data,
 int
 nffs_file_close(struct nffs_file *file)
 {
+    int flush_rc;
     int rc;
 
+    nffs_file_read_ptr_release(file);
+
+    /* The handle gets closed even if the buffered data can't be written. */
+    flush_rc = nffs_write_flush(file);
+
     rc = nffs_inode_dec_refcnt(file->nf_inode_entry);
     if (rc != 0) {
         return rc;
@@ -345,5 +505,38 @@ nffs_file_close(struct nffs_file *file)
         return rc;
     }
 
+    return flush_rc;
+}
+
+/**
+ * Retrieves the length of the specified open file, including any data that
+ * is still in the file handle's write buffer.
+ *
+ * @param file              The file to query.
+ * @param out_len           On success, the number of bytes in the file gets
+ *                              written here.
+ *
+ * @return                  0 on success; nonzero on failure.
+ */
+int
+nffs_file_data_len(const struct nffs_file *file, uint32_t *out_len)
+{
+    const struct nffs_write_buf *write_buf;
+    uint32_t buf_end;
+    int rc;
+
+    rc = nffs_inode_data_len(file->nf_inode_entry, out_len);
+    if (rc != 0) {
+        return rc;
+    }
+
+    write_buf = file->nf_write_buf;
+    if (write_buf != NULL && write_buf->nwb_len > 0) {
+        buf_end = write_buf->nwb_file_offset + write_buf->nwb_len;
+        if (buf_end > *out_len) {
+            *out_len = buf_end;
+        }
+    }
+
     return 0;
 }
@@ -21,10 +21,40 @@
 #include "hal/hal_flash.h"
 #include "nffs/nffs.h"
 #include "nffs_priv.h"
+#include "util/crc16.h"
 
 /** A buffer used for flash reads; shared across all of nffs. */
 uint8_t nffs_flash_buf[NFFS_FLASH_BUF_SZ];
 
+/**
+ * Optional larger buffer used for bulk copies and CRC calculations; null if
+ * nc_bulk_buf_size is not configured.
+ */
+void *nffs_bulk_buf_mem;
+uint32_t nffs_bulk_buf_sz;
+
+/**
+ * Retrieves the buffer to use for bulk flash transfers.  This is the
+ * configured bulk buffer if there is one, or the shared flash buffer
+ * otherwise.
+ *
+ * @param out_len               On success, the size of the buffer gets
+ *                                  written here.
+ *
+ * @return                      The buffer.
+ */
+uint8_t *
+nffs_flash_bulk_buf(uint32_t *out_len)
+{
+    if (nffs_bulk_buf_mem != NULL) {
+        *out_len = nffs_bulk_buf_sz;
+        return nffs_bulk_buf_mem;
+    }
+
+    *out_len = sizeof nffs_flash_buf;
+    return nffs_flash_buf;
+}
+
 /**
  * Reads a chunk of data from flash.
  *
@@ -54,6 +84,8 @@ nffs_flash_read(uint8_t area_idx, uint32_t area_offset, void *data,
         return FS_EOFFSET;
     }
 
+    STATS_INC(nffs_stats, flash_read);
+    STATS_INCN(nffs_stats, flash_read_bytes, len);
     rc = hal_flash_read(area->na_flash_id, area->na_offset + area_offset, data,
                         len);
     if (rc != 0) {
@@ -63,6 +95,44 @@ nffs_flash_read(uint8_t area_idx, uint32_t area_offset, void *data,
     return 0;
 }
 
+/**
+ * Retrieves a pointer through which a region of an area can be read in place.
+ * This is only possible if the area resides in memory-mapped flash.
+ *
+ * @param area_idx              The index of the area to read from.
+ * @param area_offset           The offset within the area to read from.
+ * @param len                   The number of bytes that will be read.
+ * @param out_ptr               On success, the pointer gets written here.
+ *
+ * @return                      0 on success;
+ *                              FS_EOFFSET on an attempt to access an invalid
+ *                                  address range;
+ *                              FS_ENOTSUP if the flash is not memory-mapped.
+ */
+int
+nffs_flash_ptr(uint8_t area_idx, uint32_t area_offset, uint32_t len,
+               const void **out_ptr)
+{
+    const struct nffs_area *area;
+    int rc;
+
+    assert(area_idx < nffs_num_areas);
+
+    area = nffs_areas + area_idx;
+
+    if (area_offset + len > area->na_length) {
+        return FS_EOFFSET;
+    }
+
+    rc = hal_flash_ptr(area->na_flash_id, area->na_offset + area_offset, len,
+                       out_ptr);
+    if (rc != 0) {
+        return FS_ENOTSUP;
+    }
+
+    return 0;
+}
+
 /**
  * Writes a chunk of data to flash.
  *
@@ -95,6 +165,8 @@ nffs_flash_write(uint8_t area_idx, uint32_t area_offset, const void *data,
         return FS_EOFFSET;
     }
 
+    STATS_INC(nffs_stats, flash_write);
+    STATS_INCN(nffs_stats, flash_write_bytes, len);
     rc = hal_flash_write(area->na_flash_id, area->na_offset + area_offset,
                          data, len);
     if (rc != 0) {
@@ -121,30 +193,71 @@ int
 nffs_flash_copy(uint8_t area_idx_from, uint32_t area_offset_from,
                 uint8_t area_idx_to, uint32_t area_offset_to,
                 uint32_t len)
+{
+    return nffs_flash_copy_crc16(area_idx_from, area_offset_from,
+                                 area_idx_to, area_offset_to, len, 0, NULL);
+}
+
+/**
+ * Copies a chunk of data from one region of flash to another, and calculates
+ * the CRC16 of the copied data as it passes through RAM.  This allows an
+ * object to be verified while it is copied without reading it twice.
+ *
+ * @param area_idx_from         The index of the area to copy from.
+ * @param area_offset_from      The offset within the area to copy from.
+ * @param area_idx_to           The index of the area to copy to.
+ * @param area_offset_to        The offset within the area to copy to.
+ * @param len                   The number of bytes to copy.
+ * @param crc_skip              The number of leading bytes to exclude from
+ *                                  the CRC calculation (e.g., an object
+ *                                  header whose CRC is calculated
+ *                                  separately).
+ * @param inout_crc             The initial CRC value; on success, the updated
+ *                                  CRC gets written here.  Pass null if no CRC
+ *                                  is needed.
+ *
+ * @return                      0 on success; nonzero on failure.
+ */
+int
+nffs_flash_copy_crc16(uint8_t area_idx_from, uint32_t area_offset_from,
+                      uint8_t area_idx_to, uint32_t area_offset_to,
+                      uint32_t len, uint32_t crc_skip, uint16_t *inout_crc)
 {
     uint32_t chunk_len;
+    uint32_t buf_len;
+    uint8_t *buf;
     int rc;
 
-    /* Copy data in chunks small enough to fit in the flash buffer. */
+    buf = nffs_flash_bulk_buf(&buf_len);
+
+    /* Copy data in chunks small enough to fit in the buffer. */
     while (len > 0) {
-        if (len > sizeof nffs_flash_buf) {
-            chunk_len = sizeof nffs_flash_buf;
+        if (len > buf_len) {
+            chunk_len = buf_len;
         } else {
             chunk_len = len;
         }
 
-        rc = nffs_flash_read(area_idx_from, area_offset_from, nffs_flash_buf,
-                             chunk_len);
+        rc = nffs_flash_read(area_idx_from, area_offset_from, buf, chunk_len);
         if (rc != 0) {
             return rc;
         }
 
-        rc = nffs_flash_write(area_idx_to, area_offset_to, nffs_flash_buf,
-                              chunk_len);
+        rc = nffs_flash_write(area_idx_to, area_offset_to, buf, chunk_len);
         if (rc != 0) {
             return rc;
         }
 
+        if (inout_crc != NULL) {
+            if (crc_skip < chunk_len) {
+                *inout_crc = crc16_ccitt(*inout_crc, buf + crc_skip,
+                                         chunk_len - crc_skip);
+                crc_skip = 0;
+            } else {
+                crc_skip -= chunk_len;
+            }
+        }
+
         area_offset_from += chunk_len;
         area_offset_to += chunk_len;
         len -= chunk_len;
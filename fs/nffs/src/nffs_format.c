@@ -71,11 +71,13 @@ nffs_format_area(uint8_t area_idx, int is_scratch)
 
     area = nffs_areas + area_idx;
 
+    STATS_INC(nffs_stats, flash_erase);
     rc = hal_flash_erase(area->na_flash_id, area->na_offset, area->na_length);
     if (rc != 0) {
         return FS_EHW;
     }
     area->na_cur = 0;
+    area->na_dead = 0;
 
     nffs_area_to_disk(area, &disk_area);
 
@@ -112,6 +114,14 @@ nffs_format_full(const struct nffs_area_desc *area_descs)
     /* Start from a clean state. */
     nffs_misc_reset();
 
+    /* A checkpoint of the previous file system must not be applied to the
+     * new one.
+     */
+    rc = nffs_checkpoint_erase();
+    if (rc != 0) {
+        goto err;
+    }
+
     /* Select largest area to be the initial scratch area. */
     nffs_scratch_area_idx = 0;
     for (i = 1; area_descs[i].nad_length != 0; i++) {
@@ -137,7 +147,9 @@ nffs_format_full(const struct nffs_area_desc *area_descs)
         nffs_areas[i].na_length = area_descs[i].nad_length;
         nffs_areas[i].na_flash_id = area_descs[i].nad_flash_id;
         nffs_areas[i].na_cur = 0;
+        nffs_areas[i].na_dead = 0;
         nffs_areas[i].na_gc_seq = 0;
+        nffs_areas[i].na_pins = 0;
 
         if (i == nffs_scratch_area_idx) {
             nffs_areas[i].na_id = NFFS_AREA_ID_NONE;
@@ -157,7 +169,7 @@ nffs_format_full(const struct nffs_area_desc *area_descs)
     }
 
     /* Create root directory. */
-    rc = nffs_file_new(NULL, "", 0, 1, &nffs_root_dir);
+    rc = nffs_file_new(NULL, "", 0, 1, 0, &nffs_root_dir);
     if (rc != 0) {
         goto err;
     }
@@ -19,13 +19,30 @@
 
 #include <assert.h>
 #include <string.h>
-#include "os/os_malloc.h"
 #include "testutil/testutil.h"
 #include "nffs_priv.h"
 #include "nffs/nffs.h"
 
+/** Next hash bucket to be processed by the cycle in progress. */
+static uint16_t nffs_gc_next_bucket;
+
+/**
+ * Copies an object to the end of the specified area.
+ *
+ * @param entry                 The object to copy.
+ * @param object_size           The size of the object, including its header.
+ * @param crc_skip              The number of leading bytes to exclude from
+ *                                  the CRC calculation.
+ * @param inout_crc             The initial CRC value; on success, the CRC
+ *                                  of the copied data gets written here.
+ *                                  Pass null if no CRC is needed.
+ * @param to_area_idx           The index of the area to copy to.
+ *
+ * @return                      0 on success; nonzero on failure.
+ */
 static int
 nffs_gc_copy_object(struct nffs_hash_entry *entry, uint16_t object_size,
+                    uint16_t crc_skip, uint16_t *inout_crc,
                     uint8_t to_area_idx)
 {
     uint32_t from_area_offset;
@@ -37,8 +54,9 @@ nffs_gc_copy_object(struct nffs_hash_entry *entry, uint16_t object_size,
                           &from_area_idx, &from_area_offset);
     to_area_offset = nffs_areas[to_area_idx].na_cur;
 
-    rc = nffs_flash_copy(from_area_idx, from_area_offset, to_area_idx,
-                         to_area_offset, object_size);
+    rc = nffs_flash_copy_crc16(from_area_idx, from_area_offset, to_area_idx,
+                               to_area_offset, object_size, crc_skip,
+                               inout_crc);
     if (rc != 0) {
         return rc;
     }
@@ -51,17 +69,21 @@ nffs_gc_copy_object(struct nffs_hash_entry *entry, uint16_t object_size,
 static int
 nffs_gc_copy_inode(struct nffs_inode_entry *inode_entry, uint8_t to_area_idx)
 {
-    struct nffs_inode inode;
+    struct nffs_disk_inode disk_inode;
+    uint32_t area_offset;
     uint16_t copy_len;
+    uint8_t area_idx;
     int rc;
 
-    rc = nffs_inode_from_entry(&inode, inode_entry);
+    nffs_flash_loc_expand(inode_entry->nie_hash_entry.nhe_flash_loc,
+                          &area_idx, &area_offset);
+    rc = nffs_inode_read_disk(area_idx, area_offset, &disk_inode);
     if (rc != 0) {
         return rc;
     }
-    copy_len = sizeof (struct nffs_disk_inode) + inode.ni_filename_len;
+    copy_len = sizeof disk_inode + disk_inode.ndi_filename_len;
 
-    rc = nffs_gc_copy_object(&inode_entry->nie_hash_entry, copy_len,
+    rc = nffs_gc_copy_object(&inode_entry->nie_hash_entry, copy_len, 0, NULL,
                              to_area_idx);
     if (rc != 0) {
         return rc;
@@ -71,32 +93,92 @@ nffs_gc_copy_inode(struct nffs_inode_entry *inode_entry, uint8_t to_area_idx)
 }
 
 /**
- * Selects the most appropriate area for garbage collection.
+ * Calculates the benefit-to-cost ratio of garbage collecting the specified
+ * area.  The benefit is the amount of dead space reclaimed, weighted by the
+ * number of cycles since the area was last collected; the cost is reading the
+ * whole area and rewriting its live data:
+ *
+ *     dead * (lag + 1) / (length + live)
  *
- * @return                  The ID of the area to garbage collect.
+ * An area that has fallen NFFS_GC_SEQ_LAG_MAX or more cycles behind the most
+ * recently collected area gets the maximum score.  This keeps areas full of
+ * static data in the rotation so that wear remains even.
+ *
+ * @param area              The area to score.
+ * @param newest_seq        The garbage collection sequence number of the most
+ *                              recently collected area.
+ *
+ * @return                  The area's score; higher is better.
+ */
+static uint32_t
+nffs_gc_area_score(const struct nffs_area *area, uint8_t newest_seq)
+{
+    uint64_t score;
+    int8_t lag;
+
+    lag = newest_seq - area->na_gc_seq;
+    if (lag < 0) {
+        lag = 0;
+    }
+    if (lag >= NFFS_GC_SEQ_LAG_MAX) {
+        return UINT32_MAX;
+    }
+
+    score = (uint64_t)area->na_dead * (lag + 1) * NFFS_GC_SCORE_SCALE;
+    score /= area->na_length + nffs_area_live_space(area);
+
+    return score;
+}
+
+/**
+ * Selects the most appropriate area for garbage collection.  Only areas as
+ * large as the scratch area are candidates, since the selected area becomes
+ * the next scratch area.  Among these, the area with the highest cost-benefit
+ * score is selected (see nffs_gc_area_score()).  Ties, including the case
+ * where no area contains any dead space, go to the area with the lowest
+ * garbage collection sequence number.  Areas holding data that is referenced
+ * by an outstanding nffs_file_read_ptr() pointer are skipped.
+ *
+ * @return                  The ID of the area to garbage collect;
+ *                          NFFS_AREA_ID_NONE if every candidate is pinned.
  */
 static uint16_t
 nffs_gc_select_area(void)
 {
     const struct nffs_area *area;
+    uint32_t best_score;
+    uint32_t score;
     uint8_t best_area_idx;
+    uint8_t newest_seq;
     int8_t diff;
     int i;
 
-    best_area_idx = 0;
+    /* Find the sequence number of the most recently collected area. */
+    newest_seq = nffs_areas[0].na_gc_seq;
     for (i = 1; i < nffs_num_areas; i++) {
-        if (i == nffs_scratch_area_idx) {
-            continue;
+        diff = nffs_areas[i].na_gc_seq - newest_seq;
+        if (diff > 0) {
+            newest_seq = nffs_areas[i].na_gc_seq;
         }
+    }
 
+    best_area_idx = NFFS_AREA_ID_NONE;
+    best_score = 0;
+    for (i = 0; i < nffs_num_areas; i++) {
         area = nffs_areas + i;
-        if (area->na_length > nffs_areas[best_area_idx].na_length) {
-            best_area_idx = i;
-        } else if (best_area_idx == nffs_scratch_area_idx) {
+        if (i == nffs_scratch_area_idx ||
+            area->na_length < nffs_areas[nffs_scratch_area_idx].na_length ||
+            area->na_pins > 0) {
+
+            continue;
+        }
+
+        score = nffs_gc_area_score(area, newest_seq);
+        if (best_area_idx == NFFS_AREA_ID_NONE || score > best_score) {
             best_area_idx = i;
-        } else {
-            diff = nffs_areas[i].na_gc_seq -
-                   nffs_areas[best_area_idx].na_gc_seq;
+            best_score = score;
+        } else if (score == best_score) {
+            diff = area->na_gc_seq - nffs_areas[best_area_idx].na_gc_seq;
             if (diff < 0) {
                 best_area_idx = i;
             }
@@ -108,14 +190,24 @@ nffs_gc_select_area(void)
     return best_area_idx;
 }
 
+/**
+ * Copies each block in a chain to the specified area.  Each block's CRC is
+ * verified as its data passes through RAM, so no separate read is required.
+ * A CRC mismatch is logged, but the block is still copied; it gets discarded
+ * the next time the file system is restored.
+ */
 static int
 nffs_gc_block_chain_copy(struct nffs_hash_entry *last_entry, uint32_t data_len,
                          uint8_t to_area_idx)
 {
+    struct nffs_disk_block disk_block;
     struct nffs_hash_entry *entry;
     struct nffs_block block;
     uint32_t data_bytes_copied;
+    uint32_t area_offset;
     uint16_t copy_len;
+    uint16_t crc;
+    uint8_t area_idx;
     int rc;
 
     data_bytes_copied = 0;
@@ -124,16 +216,34 @@ nffs_gc_block_chain_copy(struct nffs_hash_entry *last_entry, uint32_t data_len,
     while (data_bytes_copied < data_len) {
         assert(entry != NULL);
 
-        rc = nffs_block_from_hash_entry(&block, entry);
+        nffs_flash_loc_expand(entry->nhe_flash_loc, &area_idx, &area_offset);
+        rc = nffs_block_read_disk(area_idx, area_offset, &disk_block);
+        if (rc != 0) {
+            return rc;
+        }
+
+        block.nb_hash_entry = entry;
+        rc = nffs_block_from_disk(&block, &disk_block);
+        if (rc != 0) {
+            return rc;
+        }
+
+        rc = nffs_block_read_data_len(&block);
         if (rc != 0) {
             return rc;
         }
 
-        copy_len = sizeof (struct nffs_disk_block) + block.nb_data_len;
-        rc = nffs_gc_copy_object(entry, copy_len, to_area_idx);
+        copy_len = sizeof disk_block + block.nb_disk_len;
+        crc = nffs_crc_disk_block_hdr(&disk_block);
+        rc = nffs_gc_copy_object(entry, copy_len, sizeof disk_block, &crc,
+                                 to_area_idx);
         if (rc != 0) {
             return rc;
         }
+        if (crc != disk_block.ndb_crc16) {
+            NFFS_LOG(ERROR, "gc: block crc mismatch; id=%u\n",
+                     (unsigned int)entry->nhe_id);
+        }
         data_bytes_copied += block.nb_data_len;
 
         entry = block.nb_prev;
@@ -143,8 +253,11 @@ nffs_gc_block_chain_copy(struct nffs_hash_entry *last_entry, uint32_t data_len,
 }
 
 /**
- * Moves a chain of blocks from one area to another.  This function attempts to
- * collate the blocks into a single new block in the destination area.
+ * Moves a chain of blocks from one area to another, merging them into a single
+ * new block in the destination area.  The data is streamed through the bulk
+ * buffer twice: once to calculate the new block's CRC, which is needed for
+ * its header, and once to copy it after the header.  No heap memory is
+ * required.
  *
  * @param last_entry            The last block entry in the chain.
  * @param data_len              The total length of data to collate.
@@ -158,15 +271,15 @@ nffs_gc_block_chain_copy(struct nffs_hash_entry *last_entry, uint32_t data_len,
  *                              On output, this points to the next hash entry
  *                                  that should be processed.
  *
- * @return                      0 on success;
- *                              FS_ENOMEM if there is insufficient heap;
- *                              other nonzero on failure.
+ * @return                      0 on success; nonzero on failure.
  */
 static int
 nffs_gc_block_chain_collate(struct nffs_hash_entry *last_entry,
                             uint32_t data_len, uint8_t to_area_idx,
                             struct nffs_hash_entry **inout_next)
 {
+    struct nffs_hash_entry *entries[NFFS_GC_COLLATE_MAX_BLOCKS];
+    uint16_t lens[NFFS_GC_COLLATE_MAX_BLOCKS];
     struct nffs_disk_block disk_block;
     struct nffs_hash_entry *entry;
     struct nffs_area *to_area;
@@ -175,51 +288,39 @@ nffs_gc_block_chain_collate(struct nffs_hash_entry *last_entry,
     uint32_t to_area_offset;
     uint32_t from_area_offset;
     uint32_t data_offset;
-    uint8_t *data;
+    uint16_t crc;
     uint8_t from_area_idx;
+    int num_blocks;
     int rc;
+    int i;
 
     memset(&last_block, 0, sizeof last_block);
 
-    data = malloc(data_len);
-    if (data == NULL) {
-        rc = FS_ENOMEM;
-        goto done;
-    }
-
-    memset(&last_block, 0, sizeof(last_block));
-    
     to_area = nffs_areas + to_area_idx;
 
+    /* Gather the constituent blocks, last to first. */
+    num_blocks = 0;
     entry = last_entry;
     data_offset = data_len;
     while (data_offset > 0) {
+        assert(num_blocks < NFFS_GC_COLLATE_MAX_BLOCKS);
+
         rc = nffs_block_from_hash_entry(&block, entry);
         if (rc != 0) {
-            goto done;
+            return rc;
         }
         data_offset -= block.nb_data_len;
 
-        nffs_flash_loc_expand(block.nb_hash_entry->nhe_flash_loc,
-                              &from_area_idx, &from_area_offset);
-        from_area_offset += sizeof disk_block;
-        rc = nffs_flash_read(from_area_idx, from_area_offset,
-                             data + data_offset, block.nb_data_len);
-        if (rc != 0) {
-            goto done;
-        }
-
-        if (entry != last_entry) {
-            if (inout_next != NULL && *inout_next == entry) {
-                *inout_next = SLIST_NEXT(entry, nhe_next);
-            }
-            nffs_block_delete_from_ram(entry);
-        } else {
+        if (entry == last_entry) {
             last_block = block;
         }
+        entries[num_blocks] = entry;
+        lens[num_blocks] = block.nb_data_len;
+        num_blocks++;
+
         entry = block.nb_prev;
     }
-    
+
     /* we had better have found the last block */
     assert(last_block.nb_hash_entry);
 
@@ -239,38 +340,65 @@ nffs_gc_block_chain_collate(struct nffs_hash_entry *last_entry,
         disk_block.ndb_prev_id = entry->nhe_id;
     }
     disk_block.ndb_data_len = data_len;
-    nffs_crc_disk_block_fill(&disk_block, data);
+
+    crc = nffs_crc_disk_block_hdr(&disk_block);
+    for (i = num_blocks - 1; i >= 0; i--) {
+        nffs_flash_loc_expand(entries[i]->nhe_flash_loc,
+                              &from_area_idx, &from_area_offset);
+        rc = nffs_crc_flash(crc, from_area_idx,
+                            from_area_offset + sizeof disk_block, lens[i],
+                            &crc);
+        if (rc != 0) {
+            return rc;
+        }
+    }
+    disk_block.ndb_crc16 = crc;
 
     to_area_offset = to_area->na_cur;
     rc = nffs_flash_write(to_area_idx, to_area_offset,
                           &disk_block, sizeof disk_block);
     if (rc != 0) {
-        goto done;
+        return rc;
     }
 
-    rc = nffs_flash_write(to_area_idx, to_area_offset + sizeof disk_block,
-                          data, data_len);
-    if (rc != 0) {
-        goto done;
+    data_offset = to_area_offset + sizeof disk_block;
+    for (i = num_blocks - 1; i >= 0; i--) {
+        nffs_flash_loc_expand(entries[i]->nhe_flash_loc,
+                              &from_area_idx, &from_area_offset);
+        rc = nffs_flash_copy(from_area_idx,
+                             from_area_offset + sizeof disk_block,
+                             to_area_idx, data_offset, lens[i]);
+        if (rc != 0) {
+            return rc;
+        }
+        data_offset += lens[i];
     }
 
-    last_entry->nhe_flash_loc = nffs_flash_loc(to_area_idx, to_area_offset);
+    /* The merged block replaces its constituents. */
+    for (i = 1; i < num_blocks; i++) {
+        if (inout_next != NULL && *inout_next == entries[i]) {
+            *inout_next = SLIST_NEXT(entries[i], nhe_next);
+        }
+        nffs_block_delete_from_ram(entries[i]);
+    }
 
-    rc = 0;
+    /* The file's cached blocks and block index refer to the deleted block
+     * entries.
+     */
+    nffs_cache_inode_clear_blocks(last_block.nb_inode_entry);
+
+    last_entry->nhe_flash_loc = nffs_flash_loc(to_area_idx, to_area_offset);
 
     ASSERT_IF_TEST(nffs_crc_disk_block_validate(&disk_block, to_area_idx,
                                                 to_area_offset) == 0);
 
-done:
-    free(data);
-    return rc;
+    return 0;
 }
 
 /**
- * Moves a chain of blocks from one area to another.  This function attempts to
- * collate the blocks into a single new block in the destination area.  If
- * there is insufficient heap memory do to this, the function falls back to
- * copying each block separately.
+ * Moves a chain of blocks from one area to another.  If the chain consists of
+ * more than one block, the blocks are merged into a single new block in the
+ * destination area.
  *
  * @param last_entry            The last block entry in the chain.
  * @param multiple_blocks       0=single block; 1=more than one block.
@@ -302,12 +430,6 @@ nffs_gc_block_chain(struct nffs_hash_entry *last_entry, int multiple_blocks,
     } else {
         rc = nffs_gc_block_chain_collate(last_entry, data_len, to_area_idx,
                                          inout_next);
-        if (rc == FS_ENOMEM) {
-            /* Insufficient heap for collation; just copy each block one by
-             * one.
-             */
-            rc = nffs_gc_block_chain_copy(last_entry, data_len, to_area_idx);
-        }
     }
 
     return rc;
@@ -326,6 +448,8 @@ nffs_gc_inode_blocks(struct nffs_inode_entry *inode_entry,
     uint32_t data_len;
     uint8_t area_idx;
     int multiple_blocks;
+    int num_blocks;
+    int chain_lz;
     int rc;
 
     assert(nffs_hash_id_is_file(inode_entry->nie_hash_entry.nhe_id));
@@ -333,6 +457,8 @@ nffs_gc_inode_blocks(struct nffs_inode_entry *inode_entry,
     data_len = 0;
     last_entry = NULL;
     multiple_blocks = 0;
+    num_blocks = 0;
+    chain_lz = 0;
     entry = inode_entry->nie_last_block_entry;
     while (entry != NULL) {
         rc = nffs_block_from_hash_entry(&block, entry);
@@ -344,11 +470,18 @@ nffs_gc_inode_blocks(struct nffs_inode_entry *inode_entry,
         if (area_idx == from_area_idx) {
             if (last_entry == NULL) {
                 last_entry = entry;
+                chain_lz = block.nb_flags & NFFS_BLOCK_F_LZ;
             }
 
+            /* Compressed blocks are copied as is, never collated. */
             prospective_data_len = data_len + block.nb_data_len;
-            if (prospective_data_len <= nffs_block_max_data_sz) {
+            if (prospective_data_len <= nffs_block_max_data_sz &&
+                num_blocks < NFFS_GC_COLLATE_MAX_BLOCKS &&
+                (last_entry == entry ||
+                 (!chain_lz && !(block.nb_flags & NFFS_BLOCK_F_LZ)))) {
+
                 data_len = prospective_data_len;
+                num_blocks++;
                 if (last_entry != entry) {
                     multiple_blocks = 1;
                 }
@@ -359,8 +492,10 @@ nffs_gc_inode_blocks(struct nffs_inode_entry *inode_entry,
                     return rc;
                 }
                 last_entry = entry;
+                chain_lz = block.nb_flags & NFFS_BLOCK_F_LZ;
                 data_len = block.nb_data_len;
                 multiple_blocks = 0;
+                num_blocks = 1;
             }
         } else {
             if (last_entry != NULL) {
@@ -373,6 +508,7 @@ nffs_gc_inode_blocks(struct nffs_inode_entry *inode_entry,
                 last_entry = NULL;
                 data_len = 0;
                 multiple_blocks = 0;
+                num_blocks = 0;
             }
         }
 
@@ -390,12 +526,209 @@ nffs_gc_inode_blocks(struct nffs_inode_entry *inode_entry,
     return 0;
 }
 
+/**
+ * With lazy block loading, a file whose blocks are not in RAM has no block
+ * entries for the garbage collector to walk.  This flags every file that has
+ * data blocks in the source area so that its block chain can be loaded when
+ * its hash bucket is collected.
+ */
+static int
+nffs_gc_mark_pending(uint8_t from_area_idx)
+{
+    struct nffs_disk_object disk_object;
+    struct nffs_inode_entry *inode_entry;
+    struct nffs_hash_entry *entry;
+    uint32_t area_offset;
+    int rc;
+    int i;
+
+    NFFS_HASH_FOREACH(entry, i) {
+        if (nffs_hash_id_is_file(entry->nhe_id)) {
+            inode_entry = (struct nffs_inode_entry *)entry;
+            inode_entry->nie_flags &= ~NFFS_INODE_F_GC_PENDING;
+        }
+    }
+
+    area_offset = sizeof (struct nffs_disk_area);
+    while (1) {
+        rc = nffs_restore_next_object(from_area_idx, &area_offset,
+                                      &disk_object);
+        if (rc == FS_EEMPTY) {
+            return 0;
+        }
+        if (rc != 0) {
+            return rc;
+        }
+
+        if (disk_object.ndo_type == NFFS_OBJECT_TYPE_BLOCK) {
+            inode_entry = nffs_hash_find_inode(
+                disk_object.ndo_disk_block.ndb_inode_id);
+            if (inode_entry != NULL) {
+                inode_entry->nie_flags |= NFFS_INODE_F_GC_PENDING;
+            }
+        }
+
+        area_offset += nffs_restore_disk_object_size(&disk_object);
+    }
+}
+
+/**
+ * Starts a garbage collection cycle: selects the source area and turns the
+ * scratch area into the destination area.
+ */
+static int
+nffs_gc_begin(void)
+{
+    uint8_t from_area_idx;
+    int rc;
+
+    from_area_idx = nffs_gc_select_area();
+    if (from_area_idx == NFFS_AREA_ID_NONE) {
+        /* Every area that could be collected is pinned. */
+        return FS_EFULL;
+    }
+
+    if (nffs_config.nc_lazy_blocks) {
+        rc = nffs_gc_mark_pending(from_area_idx);
+        if (rc != 0) {
+            return rc;
+        }
+    }
+
+    rc = nffs_format_from_scratch_area(nffs_scratch_area_idx,
+                                       nffs_areas[from_area_idx].na_id);
+    if (rc != 0) {
+        return rc;
+    }
+
+    nffs_gc_from_area_idx = from_area_idx;
+    nffs_gc_next_bucket = 0;
+
+    return 0;
+}
+
+/**
+ * Copies the objects resident in the source area that belong to the inodes in
+ * the specified hash bucket to the destination area.
+ */
+static int
+nffs_gc_bucket(int bucket)
+{
+    struct nffs_inode_entry *inode_entry;
+    struct nffs_hash_entry *entry;
+    struct nffs_hash_entry *next;
+    uint32_t area_offset;
+    uint8_t area_idx;
+    int rc;
+
+    entry = SLIST_FIRST(nffs_hash + bucket);
+    while (entry != NULL) {
+        next = SLIST_NEXT(entry, nhe_next);
+
+        if (nffs_hash_id_is_inode(entry->nhe_id)) {
+            /* The inode gets copied if it is in the source area. */
+            nffs_flash_loc_expand(entry->nhe_flash_loc,
+                                  &area_idx, &area_offset);
+            inode_entry = (struct nffs_inode_entry *)entry;
+            if (area_idx == nffs_gc_from_area_idx) {
+                rc = nffs_gc_copy_inode(inode_entry, nffs_scratch_area_idx);
+                if (rc != 0) {
+                    return rc;
+                }
+            }
+
+            /* If the inode is a file, all constituent data blocks that are
+             * resident in the source area get copied.
+             */
+            if (nffs_hash_id_is_file(entry->nhe_id)) {
+                if (inode_entry->nie_flags & NFFS_INODE_F_UNLOADED &&
+                    inode_entry->nie_flags & NFFS_INODE_F_GC_PENDING) {
+
+                    rc = nffs_block_chain_load(inode_entry);
+                    if (rc != 0) {
+                        return rc;
+                    }
+
+                    /* Loading may have evicted block entries from this
+                     * bucket.  Revisit the bucket from the start once this
+                     * file is done; files already collected have nothing left
+                     * in the source area.
+                     */
+                    next = SLIST_FIRST(nffs_hash + bucket);
+                }
+
+                rc = nffs_gc_inode_blocks(inode_entry, nffs_gc_from_area_idx,
+                                          nffs_scratch_area_idx, &next);
+                if (rc != 0) {
+                    return rc;
+                }
+                inode_entry->nie_flags &= ~NFFS_INODE_F_GC_PENDING;
+            }
+        }
+
+        entry = next;
+    }
+
+    return 0;
+}
+
+/**
+ * Completes the garbage collection cycle in progress: the source area is
+ * erased and becomes the new scratch area.
+ */
+static int
+nffs_gc_end(uint8_t *out_area_idx)
+{
+    struct nffs_area *from_area;
+    struct nffs_area *to_area;
+    uint32_t reclaimed;
+    uint32_t copied;
+    uint8_t from_area_idx;
+    int rc;
+
+    from_area_idx = nffs_gc_from_area_idx;
+    from_area = nffs_areas + from_area_idx;
+    to_area = nffs_areas + nffs_scratch_area_idx;
+
+    /* The amount of written data should never increase as a result of a gc
+     * cycle.
+     */
+    assert(to_area->na_cur <= from_area->na_cur);
+
+    copied = to_area->na_cur - sizeof (struct nffs_disk_area);
+    reclaimed = from_area->na_cur - to_area->na_cur;
+    STATS_INC(nffs_stats, gc_run);
+    STATS_INCN(nffs_stats, gc_bytes_copied, copied);
+    STATS_INCN(nffs_stats, gc_bytes_reclaimed, reclaimed);
+    NFFS_LOG(INFO, "gc: area %d -> %d; copied=%u reclaimed=%u\n",
+             from_area_idx, nffs_scratch_area_idx, (unsigned int)copied,
+             (unsigned int)reclaimed);
+
+    /* Turn the source area into the new scratch area. */
+    from_area->na_gc_seq++;
+    rc = nffs_format_area(from_area_idx, 1);
+    if (rc != 0) {
+        return rc;
+    }
+
+    if (out_area_idx != NULL) {
+        *out_area_idx = nffs_scratch_area_idx;
+    }
+
+    nffs_scratch_area_idx = from_area_idx;
+    nffs_gc_from_area_idx = NFFS_AREA_ID_NONE;
+
+    /* The source area's new sequence number invalidates the checkpoint. */
+    nffs_checkpoint_mark_stale();
+
+    return 0;
+}
+
 /**
  * Triggers a garbage collection cycle.  This is implemented as follows:
  *
- *  (1) The non-scratch area with the lowest garbage collection sequence
- *      number is selected as the "source area."  If there are other areas
- *      with the same sequence number, the first one encountered is selected.
+ *  (1) The non-scratch area with the best cost-benefit score is selected as
+ *      the "source area" (see nffs_gc_select_area()).
  *
  *  (2) The source area's ID is written to the scratch area's header,
  *      transforming it into a non-scratch ID.  The former scratch area is now
@@ -420,6 +753,9 @@ nffs_gc_inode_blocks(struct nffs_inode_entry *inode_entry,
  *      number is incremented prior to rewriting the header.  This area is now
  *      the new scratch sector.
  *
+ * If an incremental cycle is already in progress (see nffs_gc_step()), this
+ * function completes that cycle rather than starting a new one.
+ *
  * @param out_area_idx      On success, the ID of the cleaned up area gets
  *                              written here.  Pass null if you do not need
  *                              this information.
@@ -429,82 +765,125 @@ nffs_gc_inode_blocks(struct nffs_inode_entry *inode_entry,
 int
 nffs_gc(uint8_t *out_area_idx)
 {
-    struct nffs_hash_entry *entry;
-    struct nffs_hash_entry *next;
-    struct nffs_area *from_area;
-    struct nffs_area *to_area;
-    struct nffs_inode_entry *inode_entry;
-    uint32_t area_offset;
-    uint8_t from_area_idx;
-    uint8_t area_idx;
     int rc;
-    int i;
 
-    from_area_idx = nffs_gc_select_area();
-    from_area = nffs_areas + from_area_idx;
-    to_area = nffs_areas + nffs_scratch_area_idx;
-
-    rc = nffs_format_from_scratch_area(nffs_scratch_area_idx,
-                                       from_area->na_id);
-    if (rc != 0) {
-        return rc;
+    if (nffs_gc_from_area_idx == NFFS_AREA_ID_NONE) {
+        rc = nffs_gc_begin();
+        if (rc != 0) {
+            return rc;
+        }
     }
 
-    for (i = 0; i < NFFS_HASH_SIZE; i++) {
-        entry = SLIST_FIRST(nffs_hash + i);
-        while (entry != NULL) {
-            next = SLIST_NEXT(entry, nhe_next);
+    while (nffs_gc_next_bucket < nffs_hash_size) {
+        rc = nffs_gc_bucket(nffs_gc_next_bucket);
+        if (rc != 0) {
+            return rc;
+        }
+        nffs_gc_next_bucket++;
+    }
 
-            if (nffs_hash_id_is_inode(entry->nhe_id)) {
-                /* The inode gets copied if it is in the source area. */
-                nffs_flash_loc_expand(entry->nhe_flash_loc,
-                                      &area_idx, &area_offset);
-                inode_entry = (struct nffs_inode_entry *)entry;
-                if (area_idx == from_area_idx) {
-                    rc = nffs_gc_copy_inode(inode_entry,
-                                            nffs_scratch_area_idx);
-                    if (rc != 0) {
-                        return rc;
-                    }
-                }
+    return nffs_gc_end(out_area_idx);
+}
 
-                /* If the inode is a file, all constituent data blocks that are
-                 * resident in the source area get copied.
-                 */
-                if (nffs_hash_id_is_file(entry->nhe_id)) {
-                    rc = nffs_gc_inode_blocks(inode_entry, from_area_idx,
-                                              nffs_scratch_area_idx, &next);
-                    if (rc != 0) {
-                        return rc;
-                    }
-                }
-            }
+/**
+ * Performs a bounded portion of a garbage collection cycle, starting a new
+ * cycle if none is in progress.  Each call copies the objects belonging to
+ * NFFS_GC_STEP_BUCKETS hash buckets; the call after the last bucket has been
+ * processed completes the cycle by erasing the source area.
+ *
+ * Other file system operations may be performed between steps.  While a
+ * cycle is in progress, no new objects are written to the source area, so
+ * buckets that have already been processed never need to be revisited.
+ *
+ * @param out_done          On success, this gets set to 1 if the cycle was
+ *                              completed, or 0 if more steps remain.
+ *
+ * @return                  0 on success; nonzero on error.
+ */
+int
+nffs_gc_step(int *out_done)
+{
+    int end;
+    int rc;
 
-            entry = next;
+    if (nffs_gc_from_area_idx == NFFS_AREA_ID_NONE) {
+        rc = nffs_gc_begin();
+        if (rc != 0) {
+            return rc;
         }
     }
 
-    /* The amount of written data should never increase as a result of a gc
-     * cycle.
-     */
-    assert(to_area->na_cur <= from_area->na_cur);
+    if (nffs_gc_next_bucket >= nffs_hash_size) {
+        rc = nffs_gc_end(NULL);
+        if (rc != 0) {
+            return rc;
+        }
 
-    /* Turn the source area into the new scratch area. */
-    from_area->na_gc_seq++;
-    rc = nffs_format_area(from_area_idx, 1);
-    if (rc != 0) {
-        return rc;
+        *out_done = 1;
+        return 0;
     }
 
-    if (out_area_idx != NULL) {
-        *out_area_idx = nffs_scratch_area_idx;
+    end = nffs_gc_next_bucket + NFFS_GC_STEP_BUCKETS;
+    if (end > nffs_hash_size) {
+        end = nffs_hash_size;
     }
 
-    nffs_scratch_area_idx = from_area_idx;
+    while (nffs_gc_next_bucket < end) {
+        rc = nffs_gc_bucket(nffs_gc_next_bucket);
+        if (rc != 0) {
+            return rc;
+        }
+        nffs_gc_next_bucket++;
+    }
 
+    *out_done = 0;
     return 0;
 }
 
+/**
+ * Determines whether garbage collection should be performed in the
+ * background.  This is the case if a cycle is already in progress, or if the
+ * free space outside the scratch area has fallen below the specified
+ * threshold and the area that would be selected holds enough dead space to
+ * be worth collecting.
+ *
+ * @param free_threshold    The number of free bytes below which collection
+ *                              should start.
+ *
+ * @return                  1 if a garbage collection step should be
+ *                              performed; 0 otherwise.
+ */
+int
+nffs_gc_needed(uint32_t free_threshold)
+{
+    const struct nffs_area *area;
+    uint32_t free_space;
+    uint16_t area_idx;
+    int i;
+
+    if (nffs_gc_from_area_idx != NFFS_AREA_ID_NONE) {
+        return 1;
+    }
+
+    free_space = 0;
+    for (i = 0; i < nffs_num_areas; i++) {
+        if (i != nffs_scratch_area_idx) {
+            free_space += nffs_area_free_space(nffs_areas + i);
+        }
+    }
+    if (free_space >= free_threshold) {
+        return 0;
+    }
+
+    area_idx = nffs_gc_select_area();
+    if (area_idx == NFFS_AREA_ID_NONE) {
+        return 0;
+    }
+
+    area = nffs_areas + area_idx;
+    return area->na_dead >= area->na_length / NFFS_GC_BG_MIN_DEAD_DIV;
+}
+
 /**
  * Repeatedly performs garbage collection cycles until there is enough free
  * space to accommodate an object of the specified size.  If there still isn't
@@ -25,6 +25,9 @@
 
 struct nffs_hash_list *nffs_hash;
 
+/** Number of buckets in the hash table; always a power of two. */
+uint16_t nffs_hash_size;
+
 uint32_t nffs_hash_next_dir_id;
 uint32_t nffs_hash_next_file_id;
 uint32_t nffs_hash_next_block_id;
@@ -56,7 +59,7 @@ nffs_hash_id_is_block(uint32_t id)
 static int
 nffs_hash_fn(uint32_t id)
 {
-    return id % NFFS_HASH_SIZE;
+    return id & (nffs_hash_size - 1);
 }
 
 struct nffs_hash_entry *
@@ -133,6 +136,13 @@ nffs_hash_remove(struct nffs_hash_entry *entry)
     SLIST_REMOVE(list, entry, nffs_hash_entry, nhe_next);
 }
 
+/**
+ * Allocates an empty hash table.  The number of buckets is the configured
+ * count rounded up to a power of two, within the range
+ * [NFFS_HASH_SIZE_MIN, NFFS_HASH_SIZE_MAX].
+ *
+ * @return                      0 on success; FS_ENOMEM on failure.
+ */
 int
 nffs_hash_init(void)
 {
@@ -140,12 +150,19 @@ nffs_hash_init(void)
 
     free(nffs_hash);
 
-    nffs_hash = malloc(NFFS_HASH_SIZE * sizeof *nffs_hash);
+    nffs_hash_size = NFFS_HASH_SIZE_MIN;
+    while (nffs_hash_size < nffs_config.nc_num_hash_buckets &&
+           nffs_hash_size < NFFS_HASH_SIZE_MAX) {
+
+        nffs_hash_size *= 2;
+    }
+
+    nffs_hash = malloc(nffs_hash_size * sizeof *nffs_hash);
     if (nffs_hash == NULL) {
         return FS_ENOMEM;
     }
 
-    for (i = 0; i < NFFS_HASH_SIZE; i++) {
+    for (i = 0; i < nffs_hash_size; i++) {
         SLIST_INIT(nffs_hash + i);
     }
 
@@ -24,7 +24,7 @@
 #include "os/os_mempool.h"
 #include "nffs/nffs.h"
 #include "nffs_priv.h"
-#include "crc16.h"
+#include "util/crc16.h"
 
 /* Partition the flash buffer into two equal halves; used for filename
  * comparisons.
@@ -55,6 +55,7 @@ nffs_inode_entry_free(struct nffs_inode_entry *inode_entry)
 {
     if (inode_entry != NULL) {
         assert(nffs_hash_id_is_inode(inode_entry->nie_hash_entry.nhe_id));
+        nffs_path_cache_clear();
         os_memblock_put(&nffs_inode_entry_pool, inode_entry);
     }
 }
@@ -76,13 +77,54 @@ nffs_inode_read_disk(uint8_t area_idx, uint32_t offset,
     if (rc != 0) {
         return rc;
     }
-    if (out_disk_inode->ndi_magic != NFFS_INODE_MAGIC) {
+    if (out_disk_inode->ndi_magic != NFFS_INODE_MAGIC &&
+        out_disk_inode->ndi_magic != NFFS_INODE_MAGIC_FLAGS) {
+
         return FS_EUNEXP;
     }
 
     return 0;
 }
 
+/**
+ * Fills in the magic number and flags of an inode header.  An inode without
+ * flags keeps the original magic number so that older versions of nffs can
+ * still read it.
+ *
+ * @param disk_inode            The inode header to fill in.
+ * @param flags                 The NFFS_INODE_FLAG_[...] flags to record.
+ */
+void
+nffs_inode_disk_set_flags(struct nffs_disk_inode *disk_inode, uint8_t flags)
+{
+    if (flags == 0) {
+        disk_inode->ndi_magic = NFFS_INODE_MAGIC;
+        disk_inode->ndi_flags = 0xff;
+    } else {
+        disk_inode->ndi_magic = NFFS_INODE_MAGIC_FLAGS;
+        disk_inode->ndi_flags = flags;
+    }
+}
+
+/**
+ * Retrieves the flags recorded in an inode header.  The flags byte of an
+ * inode with the original magic number is not trusted; older versions of
+ * nffs wrote uninitialized data there.
+ *
+ * @param disk_inode            The inode header to read.
+ *
+ * @return                      The inode's NFFS_INODE_FLAG_[...] flags.
+ */
+uint8_t
+nffs_inode_disk_flags(const struct nffs_disk_inode *disk_inode)
+{
+    if (disk_inode->ndi_magic != NFFS_INODE_MAGIC_FLAGS) {
+        return 0;
+    }
+
+    return disk_inode->ndi_flags & NFFS_INODE_FLAG_MASK;
+}
+
 int
 nffs_inode_write_disk(const struct nffs_disk_inode *disk_inode,
                       const char *filename, uint8_t area_idx,
@@ -143,14 +185,14 @@ nffs_inode_data_len(struct nffs_inode_entry *inode_entry, uint32_t *out_len)
     struct nffs_cache_inode *cache_inode;
     int rc;
 
+    nffs_ram_lock();
     rc = nffs_cache_inode_ensure(&cache_inode, inode_entry);
-    if (rc != 0) {
-        return rc;
+    if (rc == 0) {
+        *out_len = cache_inode->nci_file_size;
     }
+    nffs_ram_unlock();
 
-    *out_len = cache_inode->nci_file_size;
-
-    return 0;
+    return rc;
 }
 
 int
@@ -176,10 +218,14 @@ nffs_inode_from_entry(struct nffs_inode *out_inode,
     if (disk_inode.ndi_parent_id == NFFS_ID_NONE) {
         out_inode->ni_parent = NULL;
     } else {
+        nffs_ram_lock();
         out_inode->ni_parent = nffs_hash_find_inode(disk_inode.ndi_parent_id);
+        nffs_ram_unlock();
     }
     out_inode->ni_filename_len = disk_inode.ndi_filename_len;
 
+    out_inode->ni_flags = nffs_inode_disk_flags(&disk_inode);
+
     if (out_inode->ni_filename_len > NFFS_SHORT_FILENAME_LEN) {
         cached_name_len = NFFS_SHORT_FILENAME_LEN;
     } else {
@@ -206,6 +252,33 @@ nffs_inode_parent_id(const struct nffs_inode *inode)
     }
 }
 
+/**
+ * Records the specified inode's current disk record as garbage.  This is
+ * called when the inode is removed from RAM, since nothing references the
+ * record after that point.
+ */
+static void
+nffs_inode_add_dead(const struct nffs_inode_entry *inode_entry)
+{
+    struct nffs_disk_inode disk_inode;
+    uint32_t area_offset;
+    uint32_t flash_loc;
+    uint8_t area_idx;
+    int rc;
+
+    flash_loc = inode_entry->nie_hash_entry.nhe_flash_loc;
+    if (flash_loc == NFFS_FLASH_LOC_NONE) {
+        return;
+    }
+
+    nffs_flash_loc_expand(flash_loc, &area_idx, &area_offset);
+    rc = nffs_inode_read_disk(area_idx, area_offset, &disk_inode);
+    if (rc == 0) {
+        nffs_area_add_dead(flash_loc,
+                           sizeof disk_inode + disk_inode.ndi_filename_len);
+    }
+}
+
 static int
 nffs_inode_delete_blocks_from_ram(struct nffs_inode_entry *inode_entry)
 {
@@ -260,6 +333,7 @@ nffs_inode_delete_from_ram(struct nffs_inode_entry *inode_entry,
         }
     }
 
+    nffs_inode_add_dead(inode_entry);
     nffs_cache_inode_delete(inode_entry);
     nffs_hash_remove(&inode_entry->nie_hash_entry);
     nffs_inode_entry_free(inode_entry);
@@ -316,7 +390,10 @@ nffs_inode_dec_refcnt(struct nffs_inode_entry *inode_entry)
 {
     int rc;
 
+    nffs_ram_lock();
     rc = nffs_inode_dec_refcnt_priv(inode_entry, 0);
+    nffs_ram_unlock();
+
     return rc;
 }
 
@@ -373,6 +450,7 @@ nffs_inode_process_unlink_list(struct nffs_hash_entry **inout_next,
         /* The directory is already removed from the hash table; just free its
          * memory.
          */
+        nffs_inode_add_dead(inode_entry);
         nffs_inode_entry_free(inode_entry);
     }
 
@@ -397,7 +475,7 @@ nffs_inode_delete_from_disk(struct nffs_inode *inode)
 
     inode->ni_seq++;
 
-    disk_inode.ndi_magic = NFFS_INODE_MAGIC;
+    nffs_inode_disk_set_flags(&disk_inode, inode->ni_flags);
     disk_inode.ndi_id = inode->ni_inode_entry->nie_hash_entry.nhe_id;
     disk_inode.ndi_seq = inode->ni_seq;
     disk_inode.ndi_parent_id = NFFS_ID_NONE;
@@ -409,6 +487,11 @@ nffs_inode_delete_from_disk(struct nffs_inode *inode)
         return rc;
     }
 
+    /* Nothing in RAM references a deletion record; it is garbage as soon as
+     * it is written.
+     */
+    nffs_area_add_dead(nffs_flash_loc(area_idx, offset), sizeof disk_inode);
+
     return 0;
 }
 
@@ -429,6 +512,9 @@ nffs_inode_rename(struct nffs_inode_entry *inode_entry,
         return rc;
     }
 
+    /* Cached lookups of the old and new paths are about to become stale. */
+    nffs_path_cache_clear();
+
     if (inode.ni_parent != new_parent) {
         if (inode.ni_parent != NULL) {
             nffs_inode_remove_child(&inode);
@@ -464,7 +550,7 @@ nffs_inode_rename(struct nffs_inode_entry *inode_entry,
         return rc;
     }
 
-    disk_inode.ndi_magic = NFFS_INODE_MAGIC;
+    nffs_inode_disk_set_flags(&disk_inode, inode.ni_flags);
     disk_inode.ndi_id = inode_entry->nie_hash_entry.nhe_id;
     disk_inode.ndi_seq = inode.ni_seq + 1;
     disk_inode.ndi_parent_id = nffs_inode_parent_id(&inode);
@@ -477,6 +563,8 @@ nffs_inode_rename(struct nffs_inode_entry *inode_entry,
         return rc;
     }
 
+    nffs_area_add_dead(inode_entry->nie_hash_entry.nhe_flash_loc,
+                       sizeof disk_inode + inode.ni_filename_len);
     inode_entry->nie_hash_entry.nhe_flash_loc =
         nffs_flash_loc(area_idx, area_offset);
 
@@ -563,6 +651,8 @@ nffs_inode_add_child(struct nffs_inode_entry *parent,
 
     assert(nffs_hash_id_is_dir(parent->nie_hash_entry.nhe_id));
 
+    nffs_path_cache_clear();
+
     rc = nffs_inode_from_entry(&child_inode, child);
     if (rc != 0) {
         return rc;
@@ -605,6 +695,9 @@ nffs_inode_remove_child(struct nffs_inode *child)
     parent = child->ni_parent;
     assert(parent != NULL);
     assert(nffs_hash_id_is_dir(parent->nie_hash_entry.nhe_id));
+
+    nffs_path_cache_clear();
+
     SLIST_REMOVE(&parent->nie_child_list, child->ni_inode_entry,
                  nffs_inode_entry, nie_sibling_next);
     SLIST_NEXT(child->ni_inode_entry, nie_sibling_next) = NULL;
@@ -634,7 +727,11 @@ nffs_inode_filename_cmp_ram(const struct nffs_inode *inode,
     }
     *result = strncmp((char *)inode->ni_filename, name, chunk_len);
 
+    /* The filename buffer is shared with concurrent readers. */
+    nffs_ram_lock();
+
     off = chunk_len;
+    rc = 0;
     while (*result == 0 && off < short_len) {
         rem_len = short_len - off;
         if (rem_len > NFFS_INODE_FILENAME_BUF_SZ) {
@@ -647,7 +744,7 @@ nffs_inode_filename_cmp_ram(const struct nffs_inode *inode,
                                             nffs_inode_filename_buf0,
                                             chunk_len);
         if (rc != 0) {
-            return rc;
+            break;
         }
 
         *result = strncmp((char *)nffs_inode_filename_buf0, name + off,
@@ -655,6 +752,12 @@ nffs_inode_filename_cmp_ram(const struct nffs_inode *inode,
         off += chunk_len;
     }
 
+    nffs_ram_unlock();
+
+    if (rc != 0) {
+        return rc;
+    }
+
     if (*result == 0) {
         *result = inode->ni_filename_len - name_len;
     }
@@ -793,9 +896,24 @@ nffs_inode_seek(struct nffs_inode_entry *inode_entry, uint32_t offset,
     }
 }
 
+/** Maximum number of blocks whose data gets read per cache lookup. */
+#define NFFS_INODE_READ_BATCH   4
+
+/** One block's contribution to an nffs_inode_read() call. */
+struct nffs_inode_read_extent {
+    struct nffs_block nire_block;
+    uint32_t nire_dst_off;
+    uint16_t nire_block_off;
+    uint16_t nire_len;
+};
+
 /**
  * Reads data from the specified file inode.
  *
+ * The cache is only consulted with the RAM lock held.  Block data is read
+ * from flash after the lock is released, a batch of blocks at a time, so
+ * concurrent readers only contend for the cache lookups.
+ *
  * @param inode_entry           The inode to read from.
  * @param offset                The offset within the file to start the read
  *                                  at.
@@ -810,6 +928,8 @@ int
 nffs_inode_read(struct nffs_inode_entry *inode_entry, uint32_t offset,
                 uint32_t len, void *out_data, uint32_t *out_len)
 {
+    struct nffs_inode_read_extent extents[NFFS_INODE_READ_BATCH];
+    struct nffs_inode_read_extent *extent;
     struct nffs_cache_inode *cache_inode;
     struct nffs_cache_block *cache_block;
     uint32_t block_end;
@@ -819,7 +939,9 @@ nffs_inode_read(struct nffs_inode_entry *inode_entry, uint32_t offset,
     uint16_t block_off;
     uint16_t chunk_sz;
     uint8_t *dptr;
+    int num_extents;
     int rc;
+    int i;
 
     if (len == 0) {
         if (out_len != NULL) {
@@ -828,8 +950,11 @@ nffs_inode_read(struct nffs_inode_entry *inode_entry, uint32_t offset,
         return 0;
     }
 
+    nffs_ram_lock();
+
     rc = nffs_cache_inode_ensure(&cache_inode, inode_entry);
     if (rc != 0) {
+        nffs_ram_unlock();
         return rc;
     }
 
@@ -842,42 +967,75 @@ nffs_inode_read(struct nffs_inode_entry *inode_entry, uint32_t offset,
     dst_off = src_end - offset;
     src_off = src_end;
     dptr = out_data;
-    cache_block = NULL;
 
     /* Read each relevant block into the destination buffer, iterating in
      * reverse.
      */
     while (dst_off > 0) {
-        if (cache_block == NULL) {
-            rc = nffs_cache_seek(cache_inode, src_off - 1, &cache_block);
+        if (cache_inode == NULL) {
+            /* The cache may have changed while the lock was released. */
+            nffs_ram_lock();
+            rc = nffs_cache_inode_ensure(&cache_inode, inode_entry);
             if (rc != 0) {
+                nffs_ram_unlock();
                 return rc;
             }
         }
 
-        if (cache_block->ncb_file_offset < offset) {
-            block_off = offset - cache_block->ncb_file_offset;
-        } else {
-            block_off = 0;
-        }
+        rc = nffs_cache_seek(cache_inode, src_off - 1, &cache_block);
+
+        num_extents = 0;
+        while (rc == 0 && dst_off > 0 && cache_block != NULL &&
+               num_extents < NFFS_INODE_READ_BATCH) {
+
+            if (cache_block->ncb_file_offset < offset) {
+                block_off = offset - cache_block->ncb_file_offset;
+            } else {
+                block_off = 0;
+            }
+
+            block_end = cache_block->ncb_file_offset +
+                        cache_block->ncb_block.nb_data_len;
+            chunk_sz = cache_block->ncb_block.nb_data_len - block_off;
+            if (block_end > src_end) {
+                chunk_sz -= block_end - src_end;
+            }
 
-        block_end = cache_block->ncb_file_offset +
-                    cache_block->ncb_block.nb_data_len;
-        chunk_sz = cache_block->ncb_block.nb_data_len - block_off;
-        if (block_end > src_end) {
-            chunk_sz -= block_end - src_end;
+            dst_off -= chunk_sz;
+            src_off -= chunk_sz;
+
+            extent = extents + num_extents;
+            extent->nire_block = cache_block->ncb_block;
+            extent->nire_dst_off = dst_off;
+            extent->nire_block_off = block_off;
+            extent->nire_len = chunk_sz;
+            num_extents++;
+
+            cache_block = TAILQ_PREV(cache_block, nffs_cache_block_list,
+                                     ncb_link);
         }
 
-        dst_off -= chunk_sz;
-        src_off -= chunk_sz;
+        nffs_ram_unlock();
+        cache_inode = NULL;
 
-        rc = nffs_block_read_data(&cache_block->ncb_block, block_off, chunk_sz,
-                                  dptr + dst_off);
         if (rc != 0) {
             return rc;
         }
 
-        cache_block = TAILQ_PREV(cache_block, nffs_cache_block_list, ncb_link);
+        for (i = 0; i < num_extents; i++) {
+            extent = extents + i;
+            rc = nffs_block_read_data(&extent->nire_block,
+                                      extent->nire_block_off,
+                                      extent->nire_len,
+                                      dptr + extent->nire_dst_off);
+            if (rc != 0) {
+                return rc;
+            }
+        }
+    }
+
+    if (cache_inode != NULL) {
+        nffs_ram_unlock();
     }
 
     if (out_len != NULL) {
@@ -887,6 +1045,84 @@ nffs_inode_read(struct nffs_inode_entry *inode_entry, uint32_t offset,
     return 0;
 }
 
+/**
+ * Retrieves a pointer to file data residing in memory-mapped flash.  The
+ * returned extent never spans more than one data block, so fewer bytes than
+ * requested may be returned even if the file contains more data.
+ *
+ * @param inode_entry           The inode to read from.
+ * @param offset                The file offset to start reading at.
+ * @param len                   The maximum number of bytes to retrieve.
+ * @param out_ptr               On success, a pointer to the data gets written
+ *                                  here; null if the offset is at the end of
+ *                                  the file.
+ * @param out_len               On success, the length of the extent gets
+ *                                  written here.
+ * @param out_area_idx          On success, the index of the area containing
+ *                                  the extent gets written here.
+ *
+ * @return                      0 on success;
+ *                              FS_ENOTSUP if the flash is not memory-mapped
+ *                                  or the data is compressed;
+ *                              other nonzero on failure.
+ */
+int
+nffs_inode_read_ptr(struct nffs_inode_entry *inode_entry, uint32_t offset,
+                    uint32_t len, const void **out_ptr, uint32_t *out_len,
+                    uint8_t *out_area_idx)
+{
+    struct nffs_cache_inode *cache_inode;
+    struct nffs_cache_block *cache_block;
+    uint32_t area_offset;
+    uint32_t block_end;
+    uint16_t block_off;
+    uint8_t area_idx;
+    int rc;
+
+    *out_ptr = NULL;
+    *out_len = 0;
+
+    rc = nffs_cache_inode_ensure(&cache_inode, inode_entry);
+    if (rc != 0) {
+        return rc;
+    }
+
+    if (len == 0 || offset >= cache_inode->nci_file_size) {
+        return 0;
+    }
+
+    rc = nffs_cache_seek(cache_inode, offset, &cache_block);
+    if (rc != 0) {
+        return rc;
+    }
+
+    /* Compressed data cannot be read in place. */
+    if (cache_block->ncb_block.nb_flags & NFFS_BLOCK_F_LZ) {
+        return FS_ENOTSUP;
+    }
+
+    block_off = offset - cache_block->ncb_file_offset;
+    block_end = cache_block->ncb_file_offset +
+                cache_block->ncb_block.nb_data_len;
+    if (len > block_end - offset) {
+        len = block_end - offset;
+    }
+
+    nffs_flash_loc_expand(cache_block->ncb_block.nb_hash_entry->nhe_flash_loc,
+                          &area_idx, &area_offset);
+    area_offset += sizeof (struct nffs_disk_block) + block_off;
+
+    rc = nffs_flash_ptr(area_idx, area_offset, len, out_ptr);
+    if (rc != 0) {
+        return rc;
+    }
+
+    *out_len = len;
+    *out_area_idx = area_idx;
+
+    return 0;
+}
+
 static int
 nffs_inode_unlink_from_ram_priv(struct nffs_inode *inode,
                                 int ignore_corruption,
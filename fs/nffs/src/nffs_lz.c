@@ -0,0 +1,254 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/**
+ * Block data codec.  The stream format is that of LZF: a sequence of
+ * literal runs and back-references, each introduced by a control byte.
+ *
+ *     000lllll                    Run of (l + 1) literal bytes follows.
+ *     LLLooooo [llllllll] oooooooo
+ *                                 Back-reference to the (o + 1)'th previous
+ *                                 byte; length is (L + 2) if L < 7,
+ *                                 otherwise (l + 9).
+ *
+ * Decompression needs no memory beyond its input and output buffers; the
+ * compressor keeps a small table of recent match candidates in the shared
+ * nffs_lz_buf.
+ */
+
+#include <assert.h>
+#include <string.h>
+#include "nffs/nffs.h"
+#include "nffs_priv.h"
+
+#define NFFS_LZ_LIT_MAX         32
+#define NFFS_LZ_MATCH_MIN       3
+#define NFFS_LZ_MATCH_MAX       (7 + 255 + 2)
+#define NFFS_LZ_OFF_MAX         (1 << 13)
+#define NFFS_LZ_HASH_NONE       0xffff
+
+static uint16_t
+nffs_lz_hash(const uint8_t *p)
+{
+    uint32_t v;
+
+    v = (p[0] << 16) | (p[1] << 8) | p[2];
+    return ((v * 2654435761u) >> 16) & (NFFS_LZ_HASH_SIZE - 1);
+}
+
+/**
+ * Emits a sequence of literal bytes as one or more literal runs.
+ *
+ * @return                      0 on success;
+ *                              FS_ENOMEM if the output buffer is too small.
+ */
+static int
+nffs_lz_put_literals(const uint8_t *lit, uint16_t lit_len,
+                     uint8_t *dst, uint16_t dst_len, uint16_t *inout_off)
+{
+    uint16_t run;
+    uint16_t off;
+
+    off = *inout_off;
+    while (lit_len > 0) {
+        run = lit_len;
+        if (run > NFFS_LZ_LIT_MAX) {
+            run = NFFS_LZ_LIT_MAX;
+        }
+        if (off + 1 + run > dst_len) {
+            return FS_ENOMEM;
+        }
+
+        dst[off++] = run - 1;
+        memcpy(dst + off, lit, run);
+        off += run;
+
+        lit += run;
+        lit_len -= run;
+    }
+
+    *inout_off = off;
+    return 0;
+}
+
+/**
+ * Compresses a buffer.  Fails if the compressed stream would not fit in the
+ * destination, so passing a destination smaller than the source rejects
+ * incompressible data without extra work.  nffs_lz_buf must be allocated.
+ *
+ * @param src                   The data to compress.
+ * @param src_len               The number of bytes to compress.
+ * @param dst                   The compressed stream gets written here.
+ * @param dst_len               The size of the destination buffer.
+ * @param out_len               On success, the length of the compressed
+ *                                  stream gets written here.
+ *
+ * @return                      0 on success;
+ *                              FS_ENOMEM if the compressed stream does not
+ *                                  fit in the destination buffer.
+ */
+int
+nffs_lz_compress(const uint8_t *src, uint16_t src_len, uint8_t *dst,
+                 uint16_t dst_len, uint16_t *out_len)
+{
+    uint16_t *table;
+    uint16_t lit_start;
+    uint16_t match_max;
+    uint16_t match_len;
+    uint16_t dist;
+    uint16_t ref;
+    uint16_t src_off;
+    uint16_t dst_off;
+    uint16_t h;
+    int rc;
+
+    assert(nffs_lz_buf != NULL);
+
+    table = nffs_lz_buf->nlb_hash;
+    memset(table, 0xff, sizeof nffs_lz_buf->nlb_hash);
+
+    src_off = 0;
+    dst_off = 0;
+    lit_start = 0;
+
+    while (src_off + NFFS_LZ_MATCH_MIN <= src_len) {
+        h = nffs_lz_hash(src + src_off);
+        ref = table[h];
+        table[h] = src_off;
+
+        if (ref == NFFS_LZ_HASH_NONE ||
+            src_off - ref > NFFS_LZ_OFF_MAX ||
+            memcmp(src + ref, src + src_off, NFFS_LZ_MATCH_MIN) != 0) {
+
+            src_off++;
+            continue;
+        }
+
+        match_max = src_len - src_off;
+        if (match_max > NFFS_LZ_MATCH_MAX) {
+            match_max = NFFS_LZ_MATCH_MAX;
+        }
+        match_len = NFFS_LZ_MATCH_MIN;
+        while (match_len < match_max &&
+               src[ref + match_len] == src[src_off + match_len]) {
+
+            match_len++;
+        }
+
+        rc = nffs_lz_put_literals(src + lit_start, src_off - lit_start,
+                                  dst, dst_len, &dst_off);
+        if (rc != 0) {
+            return rc;
+        }
+
+        if (dst_off + 3 > dst_len) {
+            return FS_ENOMEM;
+        }
+        dist = src_off - ref - 1;
+        if (match_len - 2 < 7) {
+            dst[dst_off++] = ((match_len - 2) << 5) | (dist >> 8);
+        } else {
+            dst[dst_off++] = (7 << 5) | (dist >> 8);
+            dst[dst_off++] = match_len - 2 - 7;
+        }
+        dst[dst_off++] = dist & 0xff;
+
+        src_off += match_len;
+        lit_start = src_off;
+    }
+
+    rc = nffs_lz_put_literals(src + lit_start, src_len - lit_start,
+                              dst, dst_len, &dst_off);
+    if (rc != 0) {
+        return rc;
+    }
+
+    *out_len = dst_off;
+    return 0;
+}
+
+/**
+ * Decompresses a buffer.  The stream must expand to exactly the specified
+ * length.
+ *
+ * @param src                   The compressed stream.
+ * @param src_len               The length of the compressed stream.
+ * @param dst                   The decompressed data gets written here.
+ * @param dst_len               The expected decompressed length.
+ *
+ * @return                      0 on success;
+ *                              FS_ECORRUPT if the stream is malformed.
+ */
+int
+nffs_lz_decompress(const uint8_t *src, uint16_t src_len, uint8_t *dst,
+                   uint16_t dst_len)
+{
+    uint16_t src_off;
+    uint16_t dst_off;
+    uint16_t dist;
+    uint16_t len;
+    uint8_t ctrl;
+
+    src_off = 0;
+    dst_off = 0;
+
+    while (src_off < src_len) {
+        ctrl = src[src_off++];
+
+        if (ctrl < NFFS_LZ_LIT_MAX) {
+            len = ctrl + 1;
+            if (src_off + len > src_len || dst_off + len > dst_len) {
+                return FS_ECORRUPT;
+            }
+            memcpy(dst + dst_off, src + src_off, len);
+            src_off += len;
+            dst_off += len;
+        } else {
+            len = ctrl >> 5;
+            if (len == 7) {
+                if (src_off >= src_len) {
+                    return FS_ECORRUPT;
+                }
+                len += src[src_off++];
+            }
+            len += 2;
+
+            if (src_off >= src_len) {
+                return FS_ECORRUPT;
+            }
+            dist = (((ctrl & 0x1f) << 8) | src[src_off++]) + 1;
+
+            if (dist > dst_off || dst_off + len > dst_len) {
+                return FS_ECORRUPT;
+            }
+
+            /* Source and destination may overlap; copy one byte at a time. */
+            for (; len > 0; len--) {
+                dst[dst_off] = dst[dst_off - dist];
+                dst_off++;
+            }
+        }
+    }
+
+    if (dst_off != dst_len) {
+        return FS_ECORRUPT;
+    }
+
+    return 0;
+}
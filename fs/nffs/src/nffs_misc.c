@@ -21,7 +21,7 @@
 #include "os/os_malloc.h"
 #include "nffs/nffs.h"
 #include "nffs_priv.h"
-#include "crc16.h"
+#include "util/crc16.h"
 
 /**
  * Determines if the file system contains a valid root directory.  For the root
@@ -138,9 +138,12 @@ nffs_misc_reserve_space(uint16_t space,
     int rc;
     int i;
 
-    /* Find the first area with sufficient free space. */
+    /* Find the first area with sufficient free space.  The area being
+     * garbage collected is skipped; anything written to it would be lost when
+     * the collection completes.
+     */
     for (i = 0; i < nffs_num_areas; i++) {
-        if (i != nffs_scratch_area_idx) {
+        if (i != nffs_scratch_area_idx && i != nffs_gc_from_area_idx) {
             rc = nffs_misc_reserve_space_area(i, space, out_area_offset);
             if (rc == 0) {
                 *out_area_idx = i;
@@ -215,7 +218,8 @@ nffs_misc_area_capacity_two(uint32_t area_length)
  * The result of the calculation is the greatest number which satisfies all of
  * the following restrictions:
  *     o No more than half the size of the smallest area.
- *     o No more than 2048.
+ *     o No more than the configured maximum (nc_block_max_data_sz, itself
+ *       capped at NFFS_BLOCK_MAX_DATA_SZ_MAX).
  *     o No smaller than the data length of any existing data block.
  *
  * @param min_size              The minimum allowed data length.  This is the
@@ -229,6 +233,7 @@ nffs_misc_set_max_block_data_len(uint16_t min_data_len)
 {
     uint32_t smallest_area;
     uint32_t half_smallest;
+    uint32_t max_sz;
     int i;
 
     smallest_area = -1;
@@ -243,11 +248,16 @@ nffs_misc_set_max_block_data_len(uint16_t min_data_len)
         return FS_ECORRUPT;
     }
 
+    max_sz = nffs_config.nc_block_max_data_sz;
+    if (max_sz > NFFS_BLOCK_MAX_DATA_SZ_MAX) {
+        max_sz = NFFS_BLOCK_MAX_DATA_SZ_MAX;
+    }
+
     half_smallest = nffs_misc_area_capacity_two(smallest_area);
-    if (half_smallest < NFFS_BLOCK_MAX_DATA_SZ_MAX) {
+    if (half_smallest < max_sz) {
         nffs_block_max_data_sz = half_smallest;
     } else {
-        nffs_block_max_data_sz = NFFS_BLOCK_MAX_DATA_SZ_MAX;
+        nffs_block_max_data_sz = max_sz;
     }
 
     if (nffs_block_max_data_sz < min_data_len) {
@@ -288,6 +298,7 @@ nffs_misc_reset(void)
     int rc;
 
     nffs_cache_clear();
+    nffs_path_cache_clear();
 
     rc = os_mempool_init(&nffs_file_pool, nffs_config.nc_num_files,
                          sizeof (struct nffs_file), nffs_file_mem,
@@ -334,6 +345,36 @@ nffs_misc_reset(void)
         return FS_EOS;
     }
 
+    if (nffs_config.nc_num_cache_paths > 0) {
+        rc = os_mempool_init(&nffs_path_cache_pool,
+                             nffs_config.nc_num_cache_paths,
+                             sizeof (struct nffs_path_cache_entry),
+                             nffs_path_cache_mem, "nffs_path_cache_pool");
+        if (rc != 0) {
+            return FS_EOS;
+        }
+    }
+
+    if (nffs_config.nc_num_write_bufs > 0) {
+        rc = os_mempool_init(&nffs_write_buf_pool,
+                             nffs_config.nc_num_write_bufs,
+                             sizeof (struct nffs_write_buf),
+                             nffs_write_buf_mem, "nffs_write_buf_pool");
+        if (rc != 0) {
+            return FS_EOS;
+        }
+    }
+
+    if (nffs_config.nc_num_cache_indexes > 0) {
+        rc = os_mempool_init(&nffs_cache_index_pool,
+                             nffs_config.nc_num_cache_indexes,
+                             sizeof (struct nffs_cache_index),
+                             nffs_cache_index_mem, "nffs_cache_index_pool");
+        if (rc != 0) {
+            return FS_EOS;
+        }
+    }
+
     rc = nffs_hash_init();
     if (rc != 0) {
         return rc;
@@ -346,11 +387,15 @@ nffs_misc_reset(void)
     nffs_root_dir = NULL;
     nffs_lost_found_dir = NULL;
     nffs_scratch_area_idx = NFFS_AREA_ID_NONE;
+    nffs_gc_from_area_idx = NFFS_AREA_ID_NONE;
 
     nffs_hash_next_file_id = NFFS_ID_FILE_MIN;
     nffs_hash_next_dir_id = NFFS_ID_DIR_MIN;
     nffs_hash_next_block_id = NFFS_ID_BLOCK_MIN;
 
+    /* Block IDs get reused after a reset; cached block data is stale. */
+    nffs_block_lz_invalidate();
+
     return 0;
 }
 
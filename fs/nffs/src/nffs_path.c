@@ -21,6 +21,11 @@
 #include <string.h>
 #include "nffs/nffs.h"
 #include "nffs_priv.h"
+#include "util/crc16.h"
+
+TAILQ_HEAD(nffs_path_cache_list, nffs_path_cache_entry);
+static struct nffs_path_cache_list nffs_path_cache_list =
+    TAILQ_HEAD_INITIALIZER(nffs_path_cache_list);
 
 int
 nffs_path_parse_next(struct nffs_path_parser *parser)
@@ -98,10 +103,10 @@ nffs_path_find_child(struct nffs_inode_entry *parent,
     return FS_ENOENT;
 }
 
-int
-nffs_path_find(struct nffs_path_parser *parser,
-               struct nffs_inode_entry **out_inode_entry,
-               struct nffs_inode_entry **out_parent)
+static int
+nffs_path_find_uncached(struct nffs_path_parser *parser,
+                        struct nffs_inode_entry **out_inode_entry,
+                        struct nffs_inode_entry **out_parent)
 {
     struct nffs_inode_entry *parent;
     struct nffs_inode_entry *inode_entry;
@@ -170,6 +175,202 @@ done:
     return rc;
 }
 
+static void
+nffs_path_cache_entry_free(struct nffs_path_cache_entry *entry)
+{
+    if (entry != NULL) {
+        os_memblock_put(&nffs_path_cache_pool, entry);
+    }
+}
+
+static struct nffs_path_cache_entry *
+nffs_path_cache_entry_acquire(void)
+{
+    struct nffs_path_cache_entry *entry;
+
+    entry = os_memblock_get(&nffs_path_cache_pool);
+    if (entry == NULL) {
+        /* Cache is full; evict the least recently used entry. */
+        entry = TAILQ_LAST(&nffs_path_cache_list, nffs_path_cache_list);
+        assert(entry != NULL);
+
+        TAILQ_REMOVE(&nffs_path_cache_list, entry, npce_link);
+    }
+
+    memset(entry, 0, sizeof *entry);
+
+    return entry;
+}
+
+static struct nffs_path_cache_entry *
+nffs_path_cache_find(const char *path, int path_len, uint16_t hash)
+{
+    struct nffs_path_cache_entry *entry;
+
+    TAILQ_FOREACH(entry, &nffs_path_cache_list, npce_link) {
+        if (entry->npce_hash == hash &&
+            entry->npce_path_len == path_len &&
+            memcmp(entry->npce_path, path, path_len) == 0) {
+
+            /* Move entry to the front of the list. */
+            if (entry != TAILQ_FIRST(&nffs_path_cache_list)) {
+                TAILQ_REMOVE(&nffs_path_cache_list, entry, npce_link);
+                TAILQ_INSERT_HEAD(&nffs_path_cache_list, entry, npce_link);
+            }
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+static void
+nffs_path_cache_insert(const char *path, int path_len, uint16_t hash,
+                       struct nffs_inode_entry *inode_entry,
+                       struct nffs_inode_entry *parent)
+{
+    struct nffs_path_cache_entry *entry;
+
+    entry = nffs_path_cache_entry_acquire();
+    entry->npce_inode_entry = inode_entry;
+    entry->npce_parent = parent;
+    entry->npce_hash = hash;
+    entry->npce_path_len = path_len;
+    memcpy(entry->npce_path, path, path_len);
+
+    TAILQ_INSERT_HEAD(&nffs_path_cache_list, entry, npce_link);
+}
+
+/**
+ * Puts a fresh path parser into the state it would be in after a lookup
+ * successfully walked the full path down to its leaf.  This allows a cache
+ * hit to satisfy callers that inspect the parser after a lookup (e.g., to
+ * determine the name of a file to create).
+ */
+static void
+nffs_path_parser_skip_to_leaf(struct nffs_path_parser *parser)
+{
+    const char *leaf;
+
+    leaf = strrchr(parser->npp_path, '/');
+    assert(leaf != NULL);
+    leaf++;
+
+    parser->npp_token_type = NFFS_PATH_TOKEN_LEAF;
+    parser->npp_token = leaf;
+    parser->npp_token_len = strlen(leaf);
+    parser->npp_off = leaf - parser->npp_path + parser->npp_token_len + 1;
+}
+
+/**
+ * Resolves a path to an inode entry.  Recently resolved paths are remembered
+ * in the path cache, including paths which do not exist (but whose parent
+ * directory does).  Only lookups performed with a fresh parser are cached.
+ *
+ * @param parser                A parser initialized with the path to look up.
+ * @param out_inode_entry       On success, the inode entry corresponding to
+ *                                  the path gets written here.
+ * @param out_parent            On success or FS_ENOENT, the parent directory
+ *                                  of the leaf gets written here.  Pass null
+ *                                  if you don't care.
+ *
+ * @return                      0 on success;
+ *                              FS_ENOENT if the path does not exist;
+ *                              other nonzero on failure.
+ */
+int
+nffs_path_find(struct nffs_path_parser *parser,
+               struct nffs_inode_entry **out_inode_entry,
+               struct nffs_inode_entry **out_parent)
+{
+    struct nffs_path_cache_entry *entry;
+    struct nffs_inode_entry *parent;
+    uint16_t hash;
+    int path_len;
+    int rc;
+
+    if (nffs_config.nc_num_cache_paths == 0 ||
+        parser->npp_token_type != NFFS_PATH_TOKEN_NONE ||
+        parser->npp_off != 0) {
+
+        return nffs_path_find_uncached(parser, out_inode_entry, out_parent);
+    }
+
+    path_len = strlen(parser->npp_path);
+    if (path_len > NFFS_PATH_CACHE_MAX_LEN) {
+        return nffs_path_find_uncached(parser, out_inode_entry, out_parent);
+    }
+
+    hash = crc16_ccitt(0, parser->npp_path, path_len);
+
+    nffs_ram_lock();
+    entry = nffs_path_cache_find(parser->npp_path, path_len, hash);
+    if (entry != NULL) {
+        nffs_path_parser_skip_to_leaf(parser);
+
+        *out_inode_entry = entry->npce_inode_entry;
+        if (out_parent != NULL) {
+            *out_parent = entry->npce_parent;
+        }
+        nffs_ram_unlock();
+
+        if (*out_inode_entry == NULL) {
+            return FS_ENOENT;
+        }
+        return 0;
+    }
+    nffs_ram_unlock();
+
+    rc = nffs_path_find_uncached(parser, out_inode_entry, &parent);
+    if (out_parent != NULL) {
+        *out_parent = parent;
+    }
+
+    /* Only remember complete lookups; a missing intermediate directory is not
+     * cached.
+     */
+    if (parser->npp_token_type == NFFS_PATH_TOKEN_LEAF && parent != NULL) {
+        nffs_ram_lock();
+        switch (rc) {
+        case 0:
+            nffs_path_cache_insert(parser->npp_path, path_len, hash,
+                                   *out_inode_entry, parent);
+            break;
+
+        case FS_ENOENT:
+            nffs_path_cache_insert(parser->npp_path, path_len, hash,
+                                   NULL, parent);
+            break;
+
+        default:
+            break;
+        }
+        nffs_ram_unlock();
+    }
+
+    return rc;
+}
+
+/**
+ * Discards all cached path lookups.  This must be called whenever the
+ * directory tree changes shape (an inode is created, unlinked, renamed, or
+ * freed).
+ */
+void
+nffs_path_cache_clear(void)
+{
+    struct nffs_path_cache_entry *entry;
+
+    /* The list is always empty while the cache is disabled.  It is not
+     * skipped based on nc_num_cache_paths, since nffs_init() may be
+     * disabling a cache which still holds entries.
+     */
+    while ((entry = TAILQ_FIRST(&nffs_path_cache_list)) != NULL) {
+        TAILQ_REMOVE(&nffs_path_cache_list, entry, npce_link);
+        nffs_path_cache_entry_free(entry);
+    }
+}
+
 int
 nffs_path_find_inode_entry(const char *filename,
                            struct nffs_inode_entry **out_inode_entry)
@@ -326,7 +527,7 @@ nffs_path_new_dir(const char *path, struct nffs_inode_entry **out_inode_entry)
         return FS_ENOENT;
     }
 
-    rc = nffs_file_new(parent, parser.npp_token, parser.npp_token_len, 1, 
+    rc = nffs_file_new(parent, parser.npp_token, parser.npp_token_len, 1, 0,
                        &inode_entry);
     if (rc != 0) {
         return rc;
@@ -23,11 +23,13 @@
 #include <inttypes.h>
 #include "log/log.h"
 #include "os/queue.h"
+#include "stats/stats.h"
 #include "os/os_mempool.h"
 #include "nffs/nffs.h"
 #include "fs/fs.h"
 
-#define NFFS_HASH_SIZE               256
+#define NFFS_HASH_SIZE_MIN           16
+#define NFFS_HASH_SIZE_MAX           4096
 
 #define NFFS_ID_DIR_MIN              0
 #define NFFS_ID_DIR_MAX              0x10000000
@@ -44,15 +46,54 @@
 #define NFFS_AREA_MAGIC2             0xace08253
 #define NFFS_AREA_MAGIC3             0xb185fc8e
 #define NFFS_BLOCK_MAGIC             0x53ba23b9
+#define NFFS_BLOCK_MAGIC_LZ          0x53ba23ba
 #define NFFS_INODE_MAGIC             0x925f8bc0
+#define NFFS_INODE_MAGIC_FLAGS       0x925f8bc1
+#define NFFS_CKPT_MAGIC              0x3c9ed1a7
 
 #define NFFS_AREA_ID_NONE            0xff
 #define NFFS_AREA_VER                0
 #define NFFS_AREA_OFFSET_ID          23
 
+#define NFFS_CKPT_VER                1
+
 #define NFFS_SHORT_FILENAME_LEN      3
 
-#define NFFS_BLOCK_MAX_DATA_SZ_MAX   2048
+/** Default maximum block data length; also the size of a write buffer. */
+#define NFFS_BLOCK_MAX_DATA_SZ_DFLT  2048
+
+/** Upper limit on nc_block_max_data_sz. */
+#define NFFS_BLOCK_MAX_DATA_SZ_MAX   32768
+
+#define NFFS_PATH_CACHE_MAX_LEN      64
+
+#define NFFS_CACHE_INDEX_MAX_ENTRIES 32
+
+/**
+ * A file's block index is only consulted when a seek would otherwise walk
+ * back over more than this many full-size blocks' worth of data.
+ */
+#define NFFS_CACHE_INDEX_MIN_WALK    4
+
+/** Upper limit on nc_cache_readahead. */
+#define NFFS_CACHE_READAHEAD_MAX     8
+
+/** An area this many gc cycles behind is collected regardless of its score. */
+#define NFFS_GC_SEQ_LAG_MAX          16
+#define NFFS_GC_SCORE_SCALE          256
+
+/** Number of hash buckets processed by each incremental gc step. */
+#define NFFS_GC_STEP_BUCKETS         16
+#define NFFS_DIR_STAT_BATCH          8
+
+/**
+ * Background gc only collects an area if at least 1/n of it is dead.  This
+ * keeps a nearly full file system from being recopied on every write.
+ */
+#define NFFS_GC_BG_MIN_DEAD_DIV      8
+
+/** Maximum number of blocks gc merges into a single block. */
+#define NFFS_GC_COLLATE_MAX_BLOCKS   16
 
 /** On-disk representation of an area header. */
 struct nffs_disk_area {
@@ -66,12 +107,13 @@ struct nffs_disk_area {
 
 /** On-disk representation of an inode (file or directory). */
 struct nffs_disk_inode {
-    uint32_t ndi_magic;         /* NFFS_INODE_MAGIC */
+    uint32_t ndi_magic;         /* NFFS_INODE_MAGIC{,_FLAGS} */
     uint32_t ndi_id;            /* Unique object ID. */
     uint32_t ndi_seq;           /* Sequence number; greater supersedes
                                    lesser. */
     uint32_t ndi_parent_id;     /* Object ID of parent directory inode. */
-    uint8_t reserved8;
+    uint8_t ndi_flags;          /* NFFS_INODE_FLAG_[...]; only valid if
+                                   magic is NFFS_INODE_MAGIC_FLAGS. */
     uint8_t ndi_filename_len;   /* Length of filename, in bytes. */
     uint16_t ndi_crc16;         /* Covers rest of header and filename. */
     /* Followed by filename. */
@@ -79,6 +121,12 @@ struct nffs_disk_inode {
 
 #define NFFS_DISK_INODE_OFFSET_CRC  18
 
+/** Data written to the file is compressed. */
+#define NFFS_INODE_FLAG_COMPRESS    0x01
+
+/** All flags that this version of nffs understands. */
+#define NFFS_INODE_FLAG_MASK        NFFS_INODE_FLAG_COMPRESS
+
 /** On-disk representation of a data block. */
 struct nffs_disk_block {
     uint32_t ndb_magic;     /* NFFS_BLOCK_MAGIC */
@@ -94,6 +142,60 @@ struct nffs_disk_block {
 
 #define NFFS_DISK_BLOCK_OFFSET_CRC  20
 
+/**
+ * The data of a compressed block (NFFS_BLOCK_MAGIC_LZ) starts with its
+ * uncompressed length (uint16_t), followed by the compressed stream.
+ */
+#define NFFS_BLOCK_LZ_HDR_SZ        2
+
+/** Maximum uncompressed length of a compressed block. */
+#define NFFS_BLOCK_LZ_MAX_DATA_SZ   NFFS_BLOCK_MAX_DATA_SZ_DFLT
+
+/** Number of entries in the compressor's match table (power of two). */
+#define NFFS_LZ_HASH_SIZE           512
+
+/** On-disk representation of a checkpoint header. */
+struct nffs_disk_ckpt {
+    uint32_t ndc_magic;         /* NFFS_CKPT_MAGIC */
+    uint32_t ndc_len;           /* Length of records following header. */
+    uint32_t ndc_next_dir_id;   /* Next unused directory ID. */
+    uint32_t ndc_next_file_id;  /* Next unused file ID. */
+    uint32_t ndc_next_block_id; /* Next unused block ID. */
+    uint16_t ndc_block_max_data_sz;
+    uint8_t ndc_ver;            /* Current checkpoint version: 1 */
+    uint8_t ndc_num_areas;      /* # of area records following header. */
+    uint16_t reserved16;
+    uint16_t ndc_crc16;         /* Covers records and rest of header. */
+    /* Followed by area records, then object records. */
+};
+
+#define NFFS_DISK_CKPT_OFFSET_CRC   26
+
+/** On-disk representation of an area's state at checkpoint time. */
+struct nffs_disk_ckpt_area {
+    uint32_t ndca_offset;       /* Flash offset of start of area. */
+    uint32_t ndca_length;       /* Total size of area, in bytes. */
+    uint32_t ndca_cur;          /* Write offset at checkpoint time. */
+    uint32_t ndca_dead;         /* Unreferenced bytes at checkpoint time. */
+    uint8_t ndca_flash_id;      /* Logical flash id. */
+    uint8_t ndca_gc_seq;        /* Garbage collection count. */
+    uint8_t ndca_id;            /* 0xff if scratch area. */
+    uint8_t reserved8;
+};
+
+/**
+ * On-disk representation of a checkpointed inode or data block.  Block
+ * records only consist of the first two fields.
+ */
+struct nffs_disk_ckpt_object {
+    uint32_t ndco_id;           /* Object ID. */
+    uint32_t ndco_flash_loc;    /* Location of object in its area. */
+    uint32_t ndco_parent_id;    /* Inodes only; NFFS_ID_NONE if root. */
+    uint32_t ndco_last_block_id;/* Files only; NFFS_ID_NONE otherwise. */
+};
+
+#define NFFS_DISK_CKPT_BLOCK_SZ     8
+
 /**
  * What gets stored in the hash table.  Each entry represents a data block or
  * an inode.
@@ -117,8 +219,15 @@ struct nffs_inode_entry {
         struct nffs_hash_entry *nie_last_block_entry;    /* If file */
     };
     uint8_t nie_refcnt;
+    uint8_t nie_flags;                          /* NFFS_INODE_F_[...] */
 };
 
+/** File's block entries are not in RAM (lazy block loading only). */
+#define NFFS_INODE_F_UNLOADED       0x01
+
+/** File has blocks in the area being garbage collected (lazy loading only). */
+#define NFFS_INODE_F_GC_PENDING     0x02
+
 /** Full inode representation; not stored permanently RAM. */
 struct nffs_inode {
     struct nffs_inode_entry *ni_inode_entry; /* Points to real inode entry. */
@@ -127,6 +236,7 @@ struct nffs_inode {
     struct nffs_inode_entry *ni_parent;      /* Points to parent directory. */
     uint8_t ni_filename_len;                 /* # chars in filename. */
     uint8_t ni_filename[NFFS_SHORT_FILENAME_LEN]; /* First 3 bytes. */
+    uint8_t ni_flags;                        /* NFFS_INODE_FLAG_[...] */
 };
 
 /** Full data block representation; not stored permanently RAM. */
@@ -137,22 +247,51 @@ struct nffs_block {
     struct nffs_inode_entry *nb_inode_entry; /* Owning inode. */
     struct nffs_hash_entry *nb_prev;         /* Previous block in file. */
     uint16_t nb_data_len;                    /* # of data bytes in block. */
-    uint16_t reserved16;
+    uint16_t nb_disk_len;                    /* # of data bytes on disk;
+                                                less if compressed. */
+    uint8_t nb_flags;                        /* NFFS_BLOCK_F_[...] */
+};
+
+/** Block data is compressed on disk. */
+#define NFFS_BLOCK_F_LZ             0x01
+
+/**
+ * Holds the most recently decompressed block, and scratch space for
+ * compressing new blocks.
+ */
+struct nffs_lz_buf {
+    uint32_t nlb_block_id;      /* NFFS_ID_NONE if nlb_data is invalid. */
+    uint32_t nlb_block_seq;
+    uint16_t nlb_hash[NFFS_LZ_HASH_SIZE];
+    uint8_t nlb_data[NFFS_BLOCK_LZ_MAX_DATA_SZ];
+    uint8_t nlb_disk[NFFS_BLOCK_LZ_MAX_DATA_SZ];
+};
+
+/** Coalesces small appends into full-size data blocks. */
+struct nffs_write_buf {
+    uint32_t nwb_file_offset;   /* File offset of first buffered byte. */
+    uint16_t nwb_len;           /* # of bytes buffered. */
+    uint8_t nwb_data[NFFS_BLOCK_MAX_DATA_SZ_DFLT];
 };
 
 struct nffs_file {
+    const struct fs_ops *nf_fops;           /* Must be first; see fs_if.h. */
     struct nffs_inode_entry *nf_inode_entry;
+    struct nffs_write_buf *nf_write_buf;    /* Null if unbuffered. */
     uint32_t nf_offset;
     uint8_t nf_access_flags;
+    uint8_t nf_pin_area_idx;    /* NFFS_AREA_ID_NONE if no pointer held. */
 };
 
 struct nffs_area {
     uint32_t na_offset;
     uint32_t na_length;
     uint32_t na_cur;
+    uint32_t na_dead;       /* Bytes written but no longer referenced. */
     uint16_t na_id;
     uint8_t na_gc_seq;
     uint8_t na_flash_id;
+    uint16_t na_pins;       /* Outstanding fs_read_ptr() pointers. */
 };
 
 struct nffs_disk_object {
@@ -195,19 +334,49 @@ struct nffs_cache_block {
 
 TAILQ_HEAD(nffs_cache_block_list, nffs_cache_block);
 
+/** A single entry in a file's block offset index. */
+struct nffs_cache_index_entry {
+    struct nffs_hash_entry *ncie_block_entry;   /* Indexed data block. */
+    uint32_t ncie_end_offset;                   /* File offset of block end. */
+};
+
+/**
+ * Sparse index of a file's data blocks; records every ncx_stride'th block,
+ * counting back from the last block.  Entries are sorted by file offset.
+ */
+struct nffs_cache_index {
+    uint32_t ncx_file_size;     /* File size when the index was built. */
+    uint16_t ncx_stride;        /* # of blocks between indexed blocks. */
+    uint16_t ncx_num_entries;
+    struct nffs_cache_index_entry ncx_entries[NFFS_CACHE_INDEX_MAX_ENTRIES];
+};
+
 /** Represents a single cached file inode. */
 struct nffs_cache_inode {
     TAILQ_ENTRY(nffs_cache_inode) nci_link;        /* Sorted; LRU at tail. */
     struct nffs_inode nci_inode;                   /* Full inode. */
     struct nffs_cache_block_list nci_block_list;   /* List of cached blocks. */
+    struct nffs_cache_index *nci_index;            /* Null if not indexed. */
     uint32_t nci_file_size;                        /* Total file size. */
 };
 
+/** Represents a single cached path lookup result. */
+struct nffs_path_cache_entry {
+    TAILQ_ENTRY(nffs_path_cache_entry) npce_link; /* Sorted; LRU at tail. */
+    struct nffs_inode_entry *npce_inode_entry;    /* Null if path absent. */
+    struct nffs_inode_entry *npce_parent;         /* Parent of leaf. */
+    uint16_t npce_hash;                           /* CRC16 of path. */
+    uint8_t npce_path_len;                        /* # chars in path. */
+    char npce_path[NFFS_PATH_CACHE_MAX_LEN];      /* Not null-terminated. */
+};
+
 struct nffs_dirent {
+    const struct fs_ops *nde_fops;          /* Must be first; see fs_if.h. */
     struct nffs_inode_entry *nde_inode_entry;
 };
 
 struct nffs_dir {
+    const struct fs_ops *nd_fops;           /* Must be first; see fs_if.h. */
     struct nffs_inode_entry *nd_parent_inode_entry;
     struct nffs_dirent nd_dirent;
 };
@@ -218,35 +387,90 @@ extern void *nffs_inode_mem;
 extern void *nffs_cache_inode_mem;
 extern void *nffs_cache_block_mem;
 extern void *nffs_dir_mem;
+extern void *nffs_path_cache_mem;
+extern void *nffs_write_buf_mem;
+extern void *nffs_cache_index_mem;
 extern struct os_mempool nffs_file_pool;
 extern struct os_mempool nffs_dir_pool;
 extern struct os_mempool nffs_inode_entry_pool;
 extern struct os_mempool nffs_block_entry_pool;
 extern struct os_mempool nffs_cache_inode_pool;
 extern struct os_mempool nffs_cache_block_pool;
+extern struct os_mempool nffs_path_cache_pool;
+extern struct os_mempool nffs_write_buf_pool;
+extern struct os_mempool nffs_cache_index_pool;
 extern uint32_t nffs_hash_next_file_id;
 extern uint32_t nffs_hash_next_dir_id;
 extern uint32_t nffs_hash_next_block_id;
 extern struct nffs_area *nffs_areas;
 extern uint8_t nffs_num_areas;
 extern uint8_t nffs_scratch_area_idx;
+extern uint8_t nffs_gc_from_area_idx;
 extern uint16_t nffs_block_max_data_sz;
 
 #define NFFS_FLASH_BUF_SZ        256
 extern uint8_t nffs_flash_buf[NFFS_FLASH_BUF_SZ];
+extern void *nffs_bulk_buf_mem;
+extern uint32_t nffs_bulk_buf_sz;
+extern struct nffs_lz_buf *nffs_lz_buf;
 
 extern struct nffs_hash_list *nffs_hash;
+extern uint16_t nffs_hash_size;
 extern struct nffs_inode_entry *nffs_root_dir;
 extern struct nffs_inode_entry *nffs_lost_found_dir;
 
 extern struct log nffs_log;
 
+STATS_SECT_START(nffs_stats)
+    STATS_SECT_ENTRY(cache_inode_hit)
+    STATS_SECT_ENTRY(cache_inode_miss)
+    STATS_SECT_ENTRY(cache_inode_evict)
+    STATS_SECT_ENTRY(cache_block_hit)
+    STATS_SECT_ENTRY(cache_block_miss)
+    STATS_SECT_ENTRY(cache_block_evict)
+    STATS_SECT_ENTRY(cache_readahead)
+    STATS_SECT_ENTRY(flash_read)
+    STATS_SECT_ENTRY(flash_write)
+    STATS_SECT_ENTRY(flash_read_bytes)
+    STATS_SECT_ENTRY(flash_write_bytes)
+    STATS_SECT_ENTRY(flash_erase)
+    STATS_SECT_ENTRY(gc_run)
+    STATS_SECT_ENTRY(gc_bytes_copied)
+    STATS_SECT_ENTRY(gc_bytes_reclaimed)
+    STATS_SECT_ENTRY(restore_ticks)     /* Duration of last nffs_detect(). */
+
+    /* Operation latency histograms; see nffs_stats_lat() in nffs.c. */
+    STATS_SECT_ENTRY(open_lat_100us)
+    STATS_SECT_ENTRY(open_lat_1ms)
+    STATS_SECT_ENTRY(open_lat_10ms)
+    STATS_SECT_ENTRY(open_lat_slow)
+    STATS_SECT_ENTRY(read_lat_100us)
+    STATS_SECT_ENTRY(read_lat_1ms)
+    STATS_SECT_ENTRY(read_lat_10ms)
+    STATS_SECT_ENTRY(read_lat_slow)
+    STATS_SECT_ENTRY(write_lat_100us)
+    STATS_SECT_ENTRY(write_lat_1ms)
+    STATS_SECT_ENTRY(write_lat_10ms)
+    STATS_SECT_ENTRY(write_lat_slow)
+    STATS_SECT_ENTRY(close_lat_100us)
+    STATS_SECT_ENTRY(close_lat_1ms)
+    STATS_SECT_ENTRY(close_lat_10ms)
+    STATS_SECT_ENTRY(close_lat_slow)
+    STATS_SECT_ENTRY(unlink_lat_100us)
+    STATS_SECT_ENTRY(unlink_lat_1ms)
+    STATS_SECT_ENTRY(unlink_lat_10ms)
+    STATS_SECT_ENTRY(unlink_lat_slow)
+STATS_SECT_END
+extern STATS_SECT_DECL(nffs_stats) nffs_stats;
+
 /* @area */
 int nffs_area_magic_is_set(const struct nffs_disk_area *disk_area);
 int nffs_area_is_scratch(const struct nffs_disk_area *disk_area);
 void nffs_area_to_disk(const struct nffs_area *area,
                        struct nffs_disk_area *out_disk_area);
 uint32_t nffs_area_free_space(const struct nffs_area *area);
+uint32_t nffs_area_live_space(const struct nffs_area *area);
+void nffs_area_add_dead(uint32_t flash_loc, uint32_t len);
 int nffs_area_find_corrupt_scratch(uint16_t *out_good_idx,
                                    uint16_t *out_bad_idx);
 
@@ -267,15 +491,26 @@ void nffs_block_to_disk(const struct nffs_block *block,
                         struct nffs_disk_block *out_disk_block);
 int nffs_block_find_predecessor(struct nffs_hash_entry *start,
                                 uint32_t sought_id);
+int nffs_block_from_disk(struct nffs_block *out_block,
+                         const struct nffs_disk_block *disk_block);
 int nffs_block_from_hash_entry_no_ptrs(struct nffs_block *out_block,
                                        struct nffs_hash_entry *entry);
 int nffs_block_from_hash_entry(struct nffs_block *out_block,
                                struct nffs_hash_entry *entry);
+int nffs_block_read_data_len(struct nffs_block *block);
 int nffs_block_read_data(const struct nffs_block *block, uint16_t offset,
                          uint16_t length, void *dst);
+int nffs_block_lz_data(const struct nffs_block *block, uint8_t **out_data);
+void nffs_block_lz_invalidate(void);
+int nffs_block_lz_pack(struct nffs_disk_block *disk_block,
+                       const void **inout_data);
+int nffs_block_chain_load(struct nffs_inode_entry *inode_entry);
 
 /* @cache */
 void nffs_cache_inode_delete(const struct nffs_inode_entry *inode_entry);
+void nffs_cache_index_delete(const struct nffs_inode_entry *inode_entry);
+void nffs_cache_inode_clear_blocks(
+    const struct nffs_inode_entry *inode_entry);
 int nffs_cache_inode_ensure(struct nffs_cache_inode **out_entry,
                             struct nffs_inode_entry *inode_entry);
 void nffs_cache_inode_range(const struct nffs_cache_inode *cache_inode,
@@ -297,23 +532,39 @@ int nffs_crc_disk_inode_validate(const struct nffs_disk_inode *disk_inode,
 void nffs_crc_disk_inode_fill(struct nffs_disk_inode *disk_inode,
                               const char *filename);
 
+/* @checkpoint */
+int nffs_checkpoint_set_area(const struct nffs_area_desc *area_desc,
+                             uint8_t flags);
+int nffs_checkpoint_write(void);
+int nffs_checkpoint_erase(void);
+int nffs_checkpoint_load(const struct nffs_area_desc *area_descs,
+                         uint16_t *out_block_max_data_sz);
+void nffs_checkpoint_mark_stale(void);
+void nffs_checkpoint_write_pending(void);
+
 /* @config */
 void nffs_config_init(void);
 
 /* @dir */
 int nffs_dir_open(const char *path, struct nffs_dir **out_dir);
 int nffs_dir_read(struct nffs_dir *dir, struct nffs_dirent **out_dirent);
+int nffs_dir_read_stat(struct nffs_dir *dir, struct fs_dirent_stat *out_stats,
+                       int max_stats, int *out_num_stats);
 int nffs_dir_close(struct nffs_dir *dir);
 
 /* @file */
 int nffs_file_open(struct nffs_file **out_file, const char *filename,
                    uint8_t access_flags);
 int nffs_file_seek(struct nffs_file *file, uint32_t offset);
+int nffs_file_read_ptr(struct nffs_file *file, uint32_t len,
+                       const void **out_ptr, uint32_t *out_len);
+void nffs_file_read_ptr_release(struct nffs_file *file);
 int nffs_file_read(struct nffs_file *file, uint32_t len, void *out_data,
                    uint32_t *out_len);
 int nffs_file_close(struct nffs_file *file);
+int nffs_file_data_len(const struct nffs_file *file, uint32_t *out_len);
 int nffs_file_new(struct nffs_inode_entry *parent, const char *filename,
-                  uint8_t filename_len, int is_dir,
+                  uint8_t filename_len, int is_dir, uint8_t flags,
                   struct nffs_inode_entry **out_inode_entry);
 
 /* @format */
@@ -323,10 +574,14 @@ int nffs_format_full(const struct nffs_area_desc *area_descs);
 
 /* @gc */
 int nffs_gc(uint8_t *out_area_idx);
+int nffs_gc_step(int *out_done);
+int nffs_gc_needed(uint32_t free_threshold);
 int nffs_gc_until(uint32_t space, uint8_t *out_area_idx);
 
 /* @flash */
 struct nffs_area *nffs_flash_find_area(uint16_t logical_id);
+int nffs_flash_ptr(uint8_t area_idx, uint32_t area_offset, uint32_t len,
+                   const void **out_ptr);
 int nffs_flash_read(uint8_t area_idx, uint32_t offset,
                     void *data, uint32_t len);
 int nffs_flash_write(uint8_t area_idx, uint32_t offset,
@@ -334,6 +589,11 @@ int nffs_flash_write(uint8_t area_idx, uint32_t offset,
 int nffs_flash_copy(uint8_t area_id_from, uint32_t offset_from,
                     uint8_t area_id_to, uint32_t offset_to,
                     uint32_t len);
+int nffs_flash_copy_crc16(uint8_t area_idx_from, uint32_t area_offset_from,
+                          uint8_t area_idx_to, uint32_t area_offset_to,
+                          uint32_t len, uint32_t crc_skip,
+                          uint16_t *inout_crc);
+uint8_t *nffs_flash_bulk_buf(uint32_t *out_len);
 uint32_t nffs_flash_loc(uint8_t area_idx, uint32_t offset);
 void nffs_flash_loc_expand(uint32_t flash_loc, uint8_t *out_area_idx,
                            uint32_t *out_area_offset);
@@ -369,6 +629,9 @@ void nffs_inode_insert_block(struct nffs_inode *inode,
                              struct nffs_block *block);
 int nffs_inode_read_disk(uint8_t area_idx, uint32_t offset,
                          struct nffs_disk_inode *out_disk_inode);
+void nffs_inode_disk_set_flags(struct nffs_disk_inode *disk_inode,
+                               uint8_t flags);
+uint8_t nffs_inode_disk_flags(const struct nffs_disk_inode *disk_inode);
 int nffs_inode_write_disk(const struct nffs_disk_inode *disk_inode,
                           const char *filename, uint8_t area_idx,
                           uint32_t offset);
@@ -388,6 +651,9 @@ int nffs_inode_filename_cmp_flash(const struct nffs_inode *inode1,
                                   int *result);
 int nffs_inode_read(struct nffs_inode_entry *inode_entry, uint32_t offset,
                     uint32_t len, void *data, uint32_t *out_len);
+int nffs_inode_read_ptr(struct nffs_inode_entry *inode_entry, uint32_t offset,
+                        uint32_t len, const void **out_ptr, uint32_t *out_len,
+                        uint8_t *out_area_idx);
 int nffs_inode_seek(struct nffs_inode_entry *inode_entry, uint32_t offset,
                     uint32_t length, struct nffs_seek_info *out_seek_info);
 int nffs_inode_from_entry(struct nffs_inode *out_inode,
@@ -398,6 +664,12 @@ int nffs_inode_unlink_from_ram_corrupt_ok(struct nffs_inode *inode,
                                           struct nffs_hash_entry **out_next);
 int nffs_inode_unlink(struct nffs_inode *inode);
 
+/* @lz */
+int nffs_lz_compress(const uint8_t *src, uint16_t src_len, uint8_t *dst,
+                     uint16_t dst_len, uint16_t *out_len);
+int nffs_lz_decompress(const uint8_t *src, uint16_t src_len, uint8_t *dst,
+                       uint16_t dst_len);
+
 /* @misc */
 int nffs_misc_reserve_space(uint16_t space,
                             uint8_t *out_area_idx, uint32_t *out_area_offset);
@@ -409,6 +681,10 @@ int nffs_misc_set_max_block_data_len(uint16_t min_data_len);
 int nffs_misc_reset(void);
 int nffs_misc_ready(void);
 
+/* @nffs */
+void nffs_ram_lock(void);
+void nffs_ram_unlock(void);
+
 /* @path */
 int nffs_path_parse_next(struct nffs_path_parser *parser);
 void nffs_path_parser_new(struct nffs_path_parser *parser, const char *path);
@@ -421,16 +697,22 @@ int nffs_path_unlink(const char *filename);
 int nffs_path_rename(const char *from, const char *to);
 int nffs_path_new_dir(const char *path,
                       struct nffs_inode_entry **out_inode_entry);
+void nffs_path_cache_clear(void);
 
 /* @restore */
 int nffs_restore_full(const struct nffs_area_desc *area_descs);
+int nffs_restore_checkpoint(const struct nffs_area_desc *area_descs);
+int nffs_restore_next_object(uint8_t area_idx, uint32_t *inout_offset,
+                             struct nffs_disk_object *out_disk_object);
+int nffs_restore_disk_object_size(const struct nffs_disk_object *disk_object);
 
 /* @write */
 int nffs_write_to_file(struct nffs_file *file, const void *data, int len);
+int nffs_write_flush(struct nffs_file *file);
 
 
 #define NFFS_HASH_FOREACH(entry, i)                                      \
-    for ((i) = 0; (i) < NFFS_HASH_SIZE; (i)++)                 \
+    for ((i) = 0; (i) < nffs_hash_size; (i)++)                 \
         SLIST_FOREACH((entry), &nffs_hash[i], nhe_next)
 
 #define NFFS_FLASH_LOC_NONE  nffs_flash_loc(NFFS_AREA_ID_NONE, 0)
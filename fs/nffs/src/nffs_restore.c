@@ -246,7 +246,7 @@ nffs_restore_sweep(void)
     /* Iterate through every object in the hash table, deleting all inodes that
      * should be removed.
      */
-    for (i = 0; i < NFFS_HASH_SIZE; i++) {
+    for (i = 0; i < nffs_hash_size; i++) {
         list = nffs_hash + i;
 
         entry = SLIST_FIRST(list);
@@ -414,6 +414,8 @@ nffs_restore_inode(const struct nffs_disk_inode *disk_inode, uint8_t area_idx,
     /* Check the inode's CRC.  If the inode is corrupt, discard it. */
     rc = nffs_crc_disk_inode_validate(disk_inode, area_idx, area_offset);
     if (rc != 0) {
+        nffs_area_add_dead(nffs_flash_loc(area_idx, area_offset),
+                           sizeof *disk_inode + disk_inode->ndi_filename_len);
         goto err;
     }
 
@@ -436,10 +438,20 @@ nffs_restore_inode(const struct nffs_disk_inode *disk_inode, uint8_t area_idx,
                 if (inode.ni_parent != NULL) {
                     nffs_inode_remove_child(&inode);
                 }
+
+                /* The superseded record is garbage. */
+                nffs_area_add_dead(inode_entry->nie_hash_entry.nhe_flash_loc,
+                                   sizeof (struct nffs_disk_inode) +
+                                   inode.ni_filename_len);
             }
  
             inode_entry->nie_hash_entry.nhe_flash_loc =
                 nffs_flash_loc(area_idx, area_offset);
+        } else {
+            /* A newer version was already restored. */
+            nffs_area_add_dead(nffs_flash_loc(area_idx, area_offset),
+                               sizeof *disk_inode +
+                               disk_inode->ndi_filename_len);
         }
     } else {
         inode_entry = nffs_inode_entry_alloc();
@@ -572,9 +584,24 @@ nffs_restore_block(const struct nffs_disk_block *disk_block, uint8_t area_idx,
      */
     rc = nffs_crc_disk_block_validate(disk_block, area_idx, area_offset);
     if (rc != 0) {
+        nffs_area_add_dead(nffs_flash_loc(area_idx, area_offset),
+                           sizeof *disk_block + disk_block->ndb_data_len);
         goto err;
     }
 
+    if (nffs_config.nc_lazy_blocks) {
+        /* Block entries get created when their file is first accessed; only
+         * the global block bookkeeping is restored here.
+         */
+        if (disk_block->ndb_id >= nffs_hash_next_block_id) {
+            nffs_hash_next_block_id = disk_block->ndb_id + 1;
+        }
+        if (disk_block->ndb_data_len > nffs_restore_largest_block_data_len) {
+            nffs_restore_largest_block_data_len = disk_block->ndb_data_len;
+        }
+        return 0;
+    }
+
     entry = nffs_hash_find_block(disk_block->ndb_id);
     if (entry != NULL) {
         rc = nffs_block_from_hash_entry_no_ptrs(&block, entry);
@@ -588,7 +615,9 @@ nffs_restore_block(const struct nffs_disk_block *disk_block, uint8_t area_idx,
         }
 
         if (!do_replace) {
-            /* The new block is superseded by the old; nothing to do. */
+            /* The new block is superseded by the old; it is garbage. */
+            nffs_area_add_dead(nffs_flash_loc(area_idx, area_offset),
+                               sizeof *disk_block + disk_block->ndb_data_len);
             return 0;
         }
 
@@ -754,12 +783,14 @@ nffs_restore_disk_object(int area_idx, uint32_t area_offset,
 
     switch (magic) {
     case NFFS_INODE_MAGIC:
+    case NFFS_INODE_MAGIC_FLAGS:
         out_disk_object->ndo_type = NFFS_OBJECT_TYPE_INODE;
         rc = nffs_inode_read_disk(area_idx, area_offset,
                                  &out_disk_object->ndo_disk_inode);
         break;
 
     case NFFS_BLOCK_MAGIC:
+    case NFFS_BLOCK_MAGIC_LZ:
         out_disk_object->ndo_type = NFFS_OBJECT_TYPE_BLOCK;
         rc = nffs_block_read_disk(area_idx, area_offset,
                                  &out_disk_object->ndo_disk_block);
@@ -789,7 +820,7 @@ nffs_restore_disk_object(int area_idx, uint32_t area_offset,
  *
  * @param disk_object
  */
-static int
+int
 nffs_restore_disk_object_size(const struct nffs_disk_object *disk_object)
 {
     switch (disk_object->ndo_type) {
@@ -807,9 +838,59 @@ nffs_restore_disk_object_size(const struct nffs_disk_object *disk_object)
     }
 }
 
+/**
+ * Reads the next disk object from an area that has already been restored,
+ * skipping over corrupt bytes.  To walk an area, start at the end of the area
+ * header and advance the offset by the size of each object returned.
+ *
+ * @param area_idx              The area to read from.
+ * @param inout_offset          On input, the offset to start searching from.
+ *                                  On success, the offset of the object found
+ *                                  gets written here.
+ * @param out_disk_object       On success, the object gets written here.
+ *
+ * @return                      0 on success;
+ *                              FS_EEMPTY if the end of the area's written
+ *                                  data was reached;
+ *                              other nonzero on error.
+ */
+int
+nffs_restore_next_object(uint8_t area_idx, uint32_t *inout_offset,
+                         struct nffs_disk_object *out_disk_object)
+{
+    const struct nffs_area *area;
+    int rc;
+
+    area = nffs_areas + area_idx;
+    while (*inout_offset < area->na_cur) {
+        rc = nffs_restore_disk_object(area_idx, *inout_offset,
+                                      out_disk_object);
+        switch (rc) {
+        case 0:
+            return 0;
+
+        case FS_ECORRUPT:
+            (*inout_offset)++;
+            break;
+
+        case FS_EEMPTY:
+        case FS_EOFFSET:
+            return FS_EEMPTY;
+
+        default:
+            return rc;
+        }
+    }
+
+    return FS_EEMPTY;
+}
+
 /**
  * Reads the specified area from disk and loads its contents into the RAM
- * representation.
+ * representation.  Reading starts at the area's current write offset and
+ * continues until the end of written data is reached.  Objects that are
+ * discarded or superseded along the way, and corrupt bytes, are added to the
+ * areas' dead byte counts.
  *
  * @param area_idx              The index of the area to read.
  *
@@ -824,19 +905,22 @@ nffs_restore_area_contents(int area_idx)
 
     area = nffs_areas + area_idx;
 
-    area->na_cur = sizeof (struct nffs_disk_area);
     while (1) {
         rc = nffs_restore_disk_object(area_idx, area->na_cur,  &disk_object);
         switch (rc) {
         case 0:
-            /* Valid object; restore it into the RAM representation. */
-            nffs_restore_object(&disk_object);
+            /* Valid object; restore it into the RAM representation.  The
+             * write offset is advanced first so that the object can be
+             * counted as dead if it gets discarded.
+             */
             area->na_cur += nffs_restore_disk_object_size(&disk_object);
+            nffs_restore_object(&disk_object);
             break;
 
         case FS_ECORRUPT:
             /* Invalid object; keep scanning for a valid magic number. */
             area->na_cur++;
+            area->na_dead++;
             break;
 
         case FS_EEMPTY:
@@ -917,7 +1001,7 @@ nffs_restore_corrupt_scratch(void)
     }
 
     /* Invalidate all objects resident in the bad area. */
-    for (i = 0; i < NFFS_HASH_SIZE; i++) {
+    for (i = 0; i < nffs_hash_size; i++) {
         entry = SLIST_FIRST(&nffs_hash[i]);
         while (entry != NULL) {
             next = SLIST_NEXT(entry, nhe_next);
@@ -943,6 +1027,7 @@ nffs_restore_corrupt_scratch(void)
     /* Now that the objects in the scratch area have been invalidated, reload
      * everything from the good area.
      */
+    nffs_areas[good_idx].na_cur = sizeof (struct nffs_disk_area);
     rc = nffs_restore_area_contents(good_idx);
     if (rc != 0) {
         return rc;
@@ -958,9 +1043,121 @@ nffs_restore_corrupt_scratch(void)
     return 0;
 }
 
+/**
+ * Calculates the amount of garbage in each area.  Every byte written to an
+ * area that does not belong to an object in the RAM representation is dead;
+ * this includes superseded and deleted objects as well as the remnants of
+ * incomplete writes.  This reads the header of every live object, so it is
+ * only used after a full restore.
+ */
+static void
+nffs_restore_count_dead(void)
+{
+    struct nffs_disk_object disk_object;
+    struct nffs_disk_inode disk_inode;
+    struct nffs_disk_block disk_block;
+    struct nffs_hash_entry *entry;
+    struct nffs_area *area;
+    uint32_t area_offset;
+    uint32_t len;
+    uint8_t area_idx;
+    int rc;
+    int i;
+
+    /* Start by considering every written byte dead, then subtract the size of
+     * each object that is still referenced.
+     */
+    for (i = 0; i < nffs_num_areas; i++) {
+        area = nffs_areas + i;
+        if (i == nffs_scratch_area_idx ||
+            area->na_cur < sizeof (struct nffs_disk_area)) {
+
+            area->na_dead = 0;
+        } else {
+            area->na_dead = area->na_cur - sizeof (struct nffs_disk_area);
+        }
+    }
+
+    NFFS_HASH_FOREACH(entry, i) {
+        if (entry->nhe_flash_loc == NFFS_FLASH_LOC_NONE) {
+            continue;
+        }
+
+        nffs_flash_loc_expand(entry->nhe_flash_loc, &area_idx, &area_offset);
+        if (nffs_hash_id_is_inode(entry->nhe_id)) {
+            rc = nffs_inode_read_disk(area_idx, area_offset, &disk_inode);
+            len = sizeof disk_inode + disk_inode.ndi_filename_len;
+        } else {
+            rc = nffs_block_read_disk(area_idx, area_offset, &disk_block);
+            len = sizeof disk_block + disk_block.ndb_data_len;
+        }
+
+        if (rc == 0) {
+            area = nffs_areas + area_idx;
+            if (area->na_dead > len) {
+                area->na_dead -= len;
+            } else {
+                area->na_dead = 0;
+            }
+        }
+    }
+
+    if (!nffs_config.nc_lazy_blocks) {
+        return;
+    }
+
+    /* Block entries are not resident, so treat every block belonging to an
+     * existing file as live.  Superseded block versions are counted too; this
+     * underestimates the dead space, which only makes garbage collection less
+     * eager.
+     */
+    for (i = 0; i < nffs_num_areas; i++) {
+        if (i == nffs_scratch_area_idx) {
+            continue;
+        }
+
+        area = nffs_areas + i;
+        area_offset = sizeof (struct nffs_disk_area);
+        while (nffs_restore_next_object(i, &area_offset, &disk_object) == 0) {
+            len = nffs_restore_disk_object_size(&disk_object);
+            if (disk_object.ndo_type == NFFS_OBJECT_TYPE_BLOCK &&
+                nffs_hash_find_inode(
+                    disk_object.ndo_disk_block.ndb_inode_id) != NULL) {
+
+                if (area->na_dead > len) {
+                    area->na_dead -= len;
+                } else {
+                    area->na_dead = 0;
+                }
+            }
+            area_offset += len;
+        }
+    }
+}
+
+/**
+ * Marks every file inode as having its block entries unloaded.  Used with lazy
+ * block loading after a full restore.
+ */
+static void
+nffs_restore_mark_unloaded(void)
+{
+    struct nffs_inode_entry *inode_entry;
+    struct nffs_hash_entry *entry;
+    int i;
+
+    NFFS_HASH_FOREACH(entry, i) {
+        if (nffs_hash_id_is_file(entry->nhe_id)) {
+            inode_entry = (struct nffs_inode_entry *)entry;
+            inode_entry->nie_flags |= NFFS_INODE_F_UNLOADED;
+        }
+    }
+}
+
 static void
 nffs_log_contents(void)
 {
+    const struct nffs_area *area;
     struct nffs_inode_entry *inode_entry;
     struct nffs_hash_entry *entry;
     struct nffs_block block;
@@ -968,6 +1165,14 @@ nffs_log_contents(void)
     int rc;
     int i;
 
+    for (i = 0; i < nffs_num_areas; i++) {
+        area = nffs_areas + i;
+        NFFS_LOG(DEBUG, "area; idx=%d id=%u gc_seq=%u length=%u cur=%u "
+                        "live=%u dead=%u\n",
+                 i, area->na_id, area->na_gc_seq, area->na_length,
+                 area->na_cur, nffs_area_live_space(area), area->na_dead);
+    }
+
     NFFS_HASH_FOREACH(entry, i) {
         if (nffs_hash_id_is_block(entry->nhe_id)) {
             rc = nffs_block_from_hash_entry(&block, entry);
@@ -1088,6 +1293,8 @@ nffs_restore_full(const struct nffs_area_desc *area_descs)
             nffs_areas[cur_area_idx].na_flash_id = area_descs[i].nad_flash_id;
             nffs_areas[cur_area_idx].na_gc_seq = disk_area.nda_gc_seq;
             nffs_areas[cur_area_idx].na_id = disk_area.nda_id;
+            nffs_areas[cur_area_idx].na_dead = 0;
+            nffs_areas[cur_area_idx].na_pins = 0;
 
             if (disk_area.nda_id == NFFS_AREA_ID_NONE) {
                 nffs_areas[cur_area_idx].na_cur = NFFS_AREA_OFFSET_ID;
@@ -1138,6 +1345,13 @@ nffs_restore_full(const struct nffs_area_desc *area_descs)
      */
     nffs_restore_sweep();
 
+    if (nffs_config.nc_lazy_blocks) {
+        nffs_restore_mark_unloaded();
+    }
+
+    /* Determine how much reclaimable space each area contains. */
+    nffs_restore_count_dead();
+
     /* Set the maximum data block size according to the size of the smallest
      * area.
      */
@@ -1155,3 +1369,90 @@ err:
     nffs_misc_reset();
     return rc;
 }
+
+/**
+ * Restores the file system from the checkpoint region.  Only objects written
+ * after the checkpoint are read from the areas themselves; the rest of the
+ * RAM representation is loaded directly from the checkpoint.
+ *
+ * @param area_descs        The area set to restore.  This array must be
+ *                              terminated with a 0-length area.
+ *
+ * @return                  0 on success;
+ *                          FS_ENOENT if no checkpoint region is configured;
+ *                          FS_ECORRUPT if the checkpoint is absent, corrupt,
+ *                              or does not match the area set;
+ *                          other nonzero on error.
+ */
+int
+nffs_restore_checkpoint(const struct nffs_area_desc *area_descs)
+{
+    uint16_t block_max_data_sz;
+    uint32_t ckpt_cur;
+    int replayed;
+    int rc;
+    int i;
+
+    /* Start from a clean state. */
+    rc = nffs_misc_reset();
+    if (rc) {
+        return rc;
+    }
+
+    rc = nffs_checkpoint_load(area_descs, &block_max_data_sz);
+    if (rc != 0) {
+        goto err;
+    }
+    nffs_restore_largest_block_data_len = block_max_data_sz;
+
+    /* Replay objects written since the checkpoint. */
+    replayed = 0;
+    for (i = 0; i < nffs_num_areas; i++) {
+        if (i != nffs_scratch_area_idx) {
+            ckpt_cur = nffs_areas[i].na_cur;
+            rc = nffs_restore_area_contents(i);
+            if (rc != 0) {
+                goto err;
+            }
+
+            if (nffs_areas[i].na_cur != ckpt_cur) {
+                replayed = 1;
+            }
+        }
+    }
+
+    rc = nffs_misc_validate_scratch();
+    if (rc != 0) {
+        goto err;
+    }
+
+    rc = nffs_misc_validate_root_dir();
+    if (rc != 0) {
+        goto err;
+    }
+
+    rc = nffs_misc_create_lost_found_dir();
+    if (rc != 0) {
+        goto err;
+    }
+
+    /* The checkpointed objects were already swept when the checkpoint was
+     * written.  Only replayed objects can require removal.  The checkpointed
+     * dead byte counts have been brought up to date as the replayed objects
+     * superseded or deleted others, so they are not recounted.
+     */
+    if (replayed) {
+        nffs_restore_sweep();
+    }
+
+    rc = nffs_misc_set_max_block_data_len(nffs_restore_largest_block_data_len);
+    if (rc != 0) {
+        goto err;
+    }
+
+    return 0;
+
+err:
+    nffs_misc_reset();
+    return rc;
+}
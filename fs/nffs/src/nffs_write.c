@@ -18,10 +18,11 @@
  */
 
 #include <assert.h>
+#include <string.h>
 #include "testutil/testutil.h"
 #include "nffs/nffs.h"
 #include "nffs_priv.h"
-#include "crc16.h"
+#include "util/crc16.h"
 
 static int
 nffs_write_fill_crc16_overwrite(struct nffs_disk_block *disk_block,
@@ -75,6 +76,110 @@ nffs_write_fill_crc16_overwrite(struct nffs_disk_block *disk_block,
     return 0;
 }
 
+/**
+ * Overwrites an existing compressed data block.  The old contents are
+ * decompressed, the new data is spliced in, and the result is recompressed.
+ * If the resulting block is too long to compress, it is written uncompressed.
+ *
+ * @param block                 The compressed block to overwrite.
+ * @param left_copy_len         The number of bytes of existing data to retain
+ *                                  before the new data begins.
+ * @param new_data              The new data to write to the block.
+ * @param new_data_len          The number of new bytes to write to the block.
+ *
+ * @return                      0 on success; nonzero on failure.
+ */
+static int
+nffs_write_over_block_lz(struct nffs_block *block, uint16_t left_copy_len,
+                         const void *new_data, uint16_t new_data_len)
+{
+    struct nffs_disk_block disk_block;
+    struct nffs_hash_entry *entry;
+    const void *data;
+    uint32_t area_offset;
+    uint16_t old_data_len;
+    uint16_t old_disk_len;
+    uint16_t crc16;
+    uint8_t *buf;
+    uint8_t area_idx;
+    int rc;
+
+    entry = block->nb_hash_entry;
+    old_data_len = block->nb_data_len;
+    old_disk_len = block->nb_disk_len;
+
+    rc = nffs_block_lz_data(block, &buf);
+    if (rc != 0) {
+        return rc;
+    }
+
+    block->nb_seq++;
+    if (left_copy_len + new_data_len > old_data_len) {
+        block->nb_data_len = left_copy_len + new_data_len;
+    }
+    nffs_block_to_disk(block, &disk_block);
+
+    if (block->nb_data_len <= sizeof nffs_lz_buf->nlb_data) {
+        /* Splice the new data into the decompressed copy. */
+        nffs_block_lz_invalidate();
+        memcpy(buf + left_copy_len, new_data, new_data_len);
+
+        data = buf;
+        nffs_block_lz_pack(&disk_block, &data);
+        nffs_crc_disk_block_fill(&disk_block, data);
+
+        rc = nffs_block_write_disk(&disk_block, data, &area_idx, &area_offset);
+        if (rc != 0) {
+            return rc;
+        }
+    } else {
+        /* The block grew past what can be compressed; write it out
+         * uncompressed from the old data and the new.  Nothing of the old
+         * block follows the new data.
+         */
+        crc16 = nffs_crc_disk_block_hdr(&disk_block);
+        crc16 = crc16_ccitt(crc16, buf, left_copy_len);
+        crc16 = crc16_ccitt(crc16, new_data, new_data_len);
+        disk_block.ndb_crc16 = crc16;
+
+        rc = nffs_misc_reserve_space(sizeof disk_block +
+                                     disk_block.ndb_data_len,
+                                     &area_idx, &area_offset);
+        if (rc != 0) {
+            return rc;
+        }
+
+        rc = nffs_flash_write(area_idx, area_offset,
+                              &disk_block, sizeof disk_block);
+        if (rc == 0) {
+            rc = nffs_flash_write(area_idx, area_offset + sizeof disk_block,
+                                  buf, left_copy_len);
+        }
+        if (rc == 0) {
+            rc = nffs_flash_write(area_idx, area_offset + sizeof disk_block +
+                                  left_copy_len, new_data, new_data_len);
+        }
+        if (rc != 0) {
+            return rc;
+        }
+
+        ASSERT_IF_TEST(nffs_crc_disk_block_validate(&disk_block, area_idx,
+                                                    area_offset) == 0);
+    }
+
+    /* The old version of the block is now garbage. */
+    nffs_area_add_dead(entry->nhe_flash_loc,
+                       sizeof disk_block + old_disk_len);
+    entry->nhe_flash_loc = nffs_flash_loc(area_idx, area_offset);
+
+    /* Cached copies of the block record its old sequence number and on-disk
+     * length, which are needed to decompress it.
+     */
+    nffs_cache_inode_clear_blocks(block->nb_inode_entry);
+
+    return 0;
+}
+
 /**
  * Overwrites an existing data block.  The resulting block has the same ID as
  * the old one, but it supersedes it with a greater sequence number.
@@ -99,12 +204,30 @@ nffs_write_over_block(struct nffs_hash_entry *entry, uint16_t left_copy_len,
     struct nffs_block block;
     uint32_t src_area_offset;
     uint32_t dst_area_offset;
+    uint16_t old_data_len;
     uint16_t right_copy_len;
     uint16_t block_off;
     uint8_t src_area_idx;
     uint8_t dst_area_idx;
     int rc;
 
+    /* A block in the destination area of an incremental gc cycle may have
+     * been collated from blocks that are still in the source area.  If the
+     * system reset after this block was superseded, restore would discard
+     * the destination area and reload those blocks, which nothing would
+     * reference any more.  Finish the cycle first so that they get erased.
+     */
+    if (nffs_gc_from_area_idx != NFFS_AREA_ID_NONE) {
+        nffs_flash_loc_expand(entry->nhe_flash_loc,
+                              &src_area_idx, &src_area_offset);
+        if (src_area_idx == nffs_scratch_area_idx) {
+            rc = nffs_gc(NULL);
+            if (rc != 0) {
+                return rc;
+            }
+        }
+    }
+
     rc = nffs_block_from_hash_entry(&block, entry);
     if (rc != 0) {
         return rc;
@@ -112,6 +235,13 @@ nffs_write_over_block(struct nffs_hash_entry *entry, uint16_t left_copy_len,
 
     assert(left_copy_len <= block.nb_data_len);
 
+    if (block.nb_flags & NFFS_BLOCK_F_LZ) {
+        return nffs_write_over_block_lz(&block, left_copy_len,
+                                        new_data, new_data_len);
+    }
+
+    old_data_len = block.nb_data_len;
+
     /* Determine how much old data at the end of the block needs to be
      * retained.  If the new data doesn't extend to the end of the block, the
      * the rest of the block retains its old contents.
@@ -191,8 +321,15 @@ nffs_write_over_block(struct nffs_hash_entry *entry, uint16_t left_copy_len,
 
     assert(block_off == sizeof disk_block + block.nb_data_len);
 
+    /* The old version of the block is now garbage. */
+    nffs_area_add_dead(entry->nhe_flash_loc, sizeof disk_block + old_data_len);
     entry->nhe_flash_loc = nffs_flash_loc(dst_area_idx, dst_area_offset);
 
+    /* A change in block length shifts the file offsets the index records. */
+    if (block.nb_data_len != old_data_len) {
+        nffs_cache_index_delete(block.nb_inode_entry);
+    }
+
     ASSERT_IF_TEST(nffs_crc_disk_block_validate(&disk_block, dst_area_idx,
                                                 dst_area_offset) == 0);
 
@@ -236,6 +373,9 @@ nffs_write_append(struct nffs_cache_inode *cache_inode, const void *data,
         disk_block.ndb_prev_id = inode_entry->nie_last_block_entry->nhe_id;
     }
     disk_block.ndb_data_len = len;
+    if (cache_inode->nci_inode.ni_flags & NFFS_INODE_FLAG_COMPRESS) {
+        nffs_block_lz_pack(&disk_block, &data);
+    }
     nffs_crc_disk_block_fill(&disk_block, data);
 
     rc = nffs_block_write_disk(&disk_block, data, &area_idx, &area_offset);
@@ -332,7 +472,11 @@ nffs_write_chunk(struct nffs_cache_inode *cache_inode, uint32_t file_offset,
         }
 
         dst_off -= chunk_sz;
-        cache_block = TAILQ_PREV(cache_block, nffs_cache_block_list, ncb_link);
+
+        /* The overwrite may have triggered garbage collection, which can
+         * discard the file's cached blocks; look up the previous block again.
+         */
+        cache_block = NULL;
     } while (data_offset > 0);
 
     cache_inode->nci_file_size += append_len;
@@ -340,7 +484,152 @@ nffs_write_chunk(struct nffs_cache_inode *cache_inode, uint32_t file_offset,
 }
 
 /**
- * Writes a chunk of contiguous data to a file.
+ * Writes the contents of a file handle's write buffer to flash.
+ *
+ * @param file                  The file whose buffer should be flushed.
+ * @param cache_inode           The cached inode of the file.
+ *
+ * @return                      0 on success; nonzero on failure.
+ */
+static int
+nffs_write_flush_buf(struct nffs_file *file,
+                     struct nffs_cache_inode *cache_inode)
+{
+    struct nffs_write_buf *write_buf;
+    uint32_t file_offset;
+    int rc;
+
+    write_buf = file->nf_write_buf;
+    if (write_buf == NULL || write_buf->nwb_len == 0) {
+        return 0;
+    }
+
+    /* Another handle may have appended to the file since the data was
+     * buffered.  The append flag requires the data to go at the very end.
+     */
+    if (file->nf_access_flags & FS_ACCESS_APPEND) {
+        file_offset = cache_inode->nci_file_size;
+    } else {
+        file_offset = write_buf->nwb_file_offset;
+    }
+    assert(file_offset <= cache_inode->nci_file_size);
+
+    rc = nffs_write_chunk(cache_inode, file_offset, write_buf->nwb_data,
+                          write_buf->nwb_len);
+    if (rc != 0) {
+        return rc;
+    }
+
+    write_buf->nwb_len = 0;
+
+    return 0;
+}
+
+/**
+ * Writes any data in a file handle's write buffer to flash.  This is a no-op
+ * for unbuffered handles.
+ *
+ * @param file                  The file to flush.
+ *
+ * @return                      0 on success; nonzero on failure.
+ */
+int
+nffs_write_flush(struct nffs_file *file)
+{
+    struct nffs_cache_inode *cache_inode;
+    int rc;
+
+    if (file->nf_write_buf == NULL || file->nf_write_buf->nwb_len == 0) {
+        return 0;
+    }
+
+    rc = nffs_cache_inode_ensure(&cache_inode, file->nf_inode_entry);
+    if (rc != 0) {
+        return rc;
+    }
+
+    return nffs_write_flush_buf(file, cache_inode);
+}
+
+/**
+ * Appends data to a file via its write buffer.  The buffer is written to
+ * flash as a single data block whenever it fills up.  Writes that span a full
+ * block bypass the buffer when it is empty.  If the maximum block size exceeds
+ * the buffer size, buffered data is written in buffer-sized blocks; garbage
+ * collection later merges these into full-size blocks.
+ *
+ * @param file                  The file to write to.
+ * @param cache_inode           The cached inode of the file.
+ * @param data                  The data to write.
+ * @param len                   The length of data to write.
+ *
+ * @return                      0 on success; nonzero on failure.
+ */
+static int
+nffs_write_buffered(struct nffs_file *file,
+                    struct nffs_cache_inode *cache_inode,
+                    const void *data, int len)
+{
+    struct nffs_write_buf *write_buf;
+    const uint8_t *data_ptr;
+    uint16_t chunk_size;
+    uint16_t buf_cap;
+    int rc;
+
+    write_buf = file->nf_write_buf;
+    data_ptr = data;
+
+    buf_cap = sizeof write_buf->nwb_data;
+    if (buf_cap > nffs_block_max_data_sz) {
+        buf_cap = nffs_block_max_data_sz;
+    }
+
+    while (len > 0) {
+        if (write_buf->nwb_len == 0) {
+            if (len >= nffs_block_max_data_sz) {
+                rc = nffs_write_chunk(cache_inode, file->nf_offset, data_ptr,
+                                      nffs_block_max_data_sz);
+                if (rc != 0) {
+                    return rc;
+                }
+
+                len -= nffs_block_max_data_sz;
+                data_ptr += nffs_block_max_data_sz;
+                file->nf_offset += nffs_block_max_data_sz;
+                continue;
+            }
+
+            write_buf->nwb_file_offset = file->nf_offset;
+        }
+
+        chunk_size = buf_cap - write_buf->nwb_len;
+        if (chunk_size > len) {
+            chunk_size = len;
+        }
+
+        memcpy(write_buf->nwb_data + write_buf->nwb_len, data_ptr,
+               chunk_size);
+        write_buf->nwb_len += chunk_size;
+
+        len -= chunk_size;
+        data_ptr += chunk_size;
+        file->nf_offset += chunk_size;
+
+        if (write_buf->nwb_len >= buf_cap) {
+            rc = nffs_write_flush_buf(file, cache_inode);
+            if (rc != 0) {
+                return rc;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Writes a chunk of contiguous data to a file.  If the file handle has a
+ * write buffer, appends are accumulated in the buffer; any other write causes
+ * the buffer to be flushed first.
  *
  * @param file                  The file to write to.
  * @param data                  The data to write.
@@ -352,7 +641,9 @@ int
 nffs_write_to_file(struct nffs_file *file, const void *data, int len)
 {
     struct nffs_cache_inode *cache_inode;
+    struct nffs_write_buf *write_buf;
     const uint8_t *data_ptr;
+    uint32_t file_size;
     uint16_t chunk_size;
     int rc;
 
@@ -369,11 +660,34 @@ nffs_write_to_file(struct nffs_file *file, const void *data, int len)
         return rc;
     }
 
+    /* Determine where the file ends from this handle's point of view. */
+    file_size = cache_inode->nci_file_size;
+    write_buf = file->nf_write_buf;
+    if (write_buf != NULL && write_buf->nwb_len > 0 &&
+        write_buf->nwb_file_offset + write_buf->nwb_len > file_size) {
+
+        file_size = write_buf->nwb_file_offset + write_buf->nwb_len;
+    }
+
     /* The append flag forces all writes to the end of the file, regardless of
      * seek position.
      */
     if (file->nf_access_flags & FS_ACCESS_APPEND) {
-        file->nf_offset = cache_inode->nci_file_size;
+        file->nf_offset = file_size;
+    }
+
+    if (write_buf != NULL) {
+        if (file->nf_offset == file_size) {
+            return nffs_write_buffered(file, cache_inode, data, len);
+        }
+
+        /* Old data is getting overwritten; the buffered data must reach
+         * flash first.
+         */
+        rc = nffs_write_flush_buf(file, cache_inode);
+        if (rc != 0) {
+            return rc;
+        }
     }
 
     /* Write data as a sequence of blocks. */
@@ -22,9 +22,14 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <time.h>
+#include "os/os.h"
+#include "hal/hal_cputime.h"
 #include "hal/hal_flash.h"
+#include "mcu/mcu_sim.h"
 #include "testutil/testutil.h"
 #include "fs/fs.h"
+#include "fs/fs_async.h"
 #include "nffs/nffs.h"
 #include "nffs/nffs_test.h"
 #include "nffs_test_priv.h"
@@ -1017,6 +1022,98 @@ TEST_CASE(nffs_test_read)
     TEST_ASSERT(rc == 0);
 }
 
+TEST_CASE(nffs_test_read_ptr)
+{
+    struct nffs_test_block_desc *blocks = (struct nffs_test_block_desc[]) { {
+        .data = "abcd",
+        .data_len = 4,
+    }, {
+        .data = "efghij",
+        .data_len = 6,
+    } };
+    struct nffs_file *nfile;
+    struct fs_file *file;
+    const void *ptr;
+    uint32_t len;
+    uint8_t area_idx;
+    int rc;
+
+    static const struct nffs_area_desc area_descs_two[] = {
+        { 0x00020000, 128 * 1024 },
+        { 0x00040000, 128 * 1024 },
+        { 0, 0 },
+    };
+
+    rc = nffs_format(area_descs_two);
+    TEST_ASSERT(rc == 0);
+
+    nffs_test_util_create_file_blocks("/myfile.txt", blocks, 2);
+
+    /*** Write-only handles can't retrieve pointers. */
+    rc = fs_open("/myfile.txt", FS_ACCESS_WRITE, &file);
+    TEST_ASSERT(rc == 0);
+    rc = fs_read_ptr(file, 10, &ptr, &len);
+    TEST_ASSERT(rc == FS_EACCESS);
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+
+    /*** Each extent is limited to a single block. */
+    rc = fs_open("/myfile.txt", FS_ACCESS_READ, &file);
+    TEST_ASSERT(rc == 0);
+    nfile = (struct nffs_file *)file;
+
+    rc = fs_read_ptr(file, 100, &ptr, &len);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(len == 4);
+    TEST_ASSERT(memcmp(ptr, "abcd", 4) == 0);
+    TEST_ASSERT(fs_getpos(file) == 4);
+    area_idx = nfile->nf_pin_area_idx;
+    TEST_ASSERT_FATAL(area_idx != NFFS_AREA_ID_NONE);
+    TEST_ASSERT(nffs_areas[area_idx].na_pins == 1);
+
+    /* The next call releases the previous pointer. */
+    rc = fs_read_ptr(file, 3, &ptr, &len);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(len == 3);
+    TEST_ASSERT(memcmp(ptr, "efg", 3) == 0);
+    TEST_ASSERT(nffs_areas[area_idx].na_pins == 1);
+
+    rc = fs_read_ptr(file, 100, &ptr, &len);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(len == 3);
+    TEST_ASSERT(memcmp(ptr, "hij", 3) == 0);
+    TEST_ASSERT(fs_getpos(file) == 10);
+
+    /* End of file. */
+    rc = fs_read_ptr(file, 100, &ptr, &len);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(len == 0);
+    TEST_ASSERT(ptr == NULL);
+    TEST_ASSERT(nffs_areas[area_idx].na_pins == 0);
+
+    /*** A pinned area is not garbage collected, even after unlink. */
+    rc = fs_seek(file, 0);
+    TEST_ASSERT(rc == 0);
+    rc = fs_read_ptr(file, 100, &ptr, &len);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(len == 4);
+
+    rc = fs_unlink("/myfile.txt");
+    TEST_ASSERT(rc == 0);
+
+    rc = nffs_gc(NULL);
+    TEST_ASSERT(rc == FS_EFULL);
+    TEST_ASSERT(memcmp(ptr, "abcd", 4) == 0);
+
+    fs_read_ptr_release(file);
+    TEST_ASSERT(nffs_areas[area_idx].na_pins == 0);
+    rc = nffs_gc(NULL);
+    TEST_ASSERT(rc == 0);
+
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+}
+
 TEST_CASE(nffs_test_open)
 {
     struct fs_file *file;
@@ -1038,6 +1135,10 @@ TEST_CASE(nffs_test_open)
     rc = fs_open("/1234", FS_ACCESS_READ, &file);
     TEST_ASSERT(rc == FS_ENOENT);
 
+    /*** Fail to create a compressed file; compression is not configured. */
+    rc = fs_open("/1234", FS_ACCESS_WRITE | FS_ACCESS_COMPRESS, &file);
+    TEST_ASSERT(rc == FS_ENOTSUP);
+
     /*** Fail to open a child of a nonexistent directory. */
     rc = fs_open("/dir/myfile.txt", FS_ACCESS_WRITE, &file);
     TEST_ASSERT(rc == FS_ENOENT);
@@ -1606,7 +1707,7 @@ TEST_CASE(nffs_test_long_filename)
 
 TEST_CASE(nffs_test_large_write)
 {
-    static char data[NFFS_BLOCK_MAX_DATA_SZ_MAX * 5];
+    static char data[NFFS_BLOCK_MAX_DATA_SZ_DFLT * 5];
     int rc;
     int i;
 
@@ -1632,14 +1733,14 @@ TEST_CASE(nffs_test_large_write)
      * blocks.
      */
     TEST_ASSERT(nffs_test_util_block_count("/myfile.txt") ==
-           sizeof data / NFFS_BLOCK_MAX_DATA_SZ_MAX);
+           sizeof data / NFFS_BLOCK_MAX_DATA_SZ_DFLT);
 
     /* Garbage collect and then ensure the large file is still properly divided
      * according to max data block size.
      */
     nffs_gc(NULL);
     TEST_ASSERT(nffs_test_util_block_count("/myfile.txt") ==
-           sizeof data / NFFS_BLOCK_MAX_DATA_SZ_MAX);
+           sizeof data / NFFS_BLOCK_MAX_DATA_SZ_DFLT);
 
     struct nffs_test_file_desc *expected_system =
         (struct nffs_test_file_desc[]) { {
@@ -1797,6 +1898,181 @@ TEST_CASE(nffs_test_wear_level)
     }
 }
 
+TEST_CASE(nffs_test_gc_cost_benefit)
+{
+    uint32_t dead[4];
+    int rc;
+    int i;
+
+    static const struct nffs_area_desc area_descs_four[] = {
+        { 0x00000000, 16 * 1024 },
+        { 0x00004000, 16 * 1024 },
+        { 0x00008000, 16 * 1024 },
+        { 0x0000c000, 16 * 1024 },
+        { 0, 0 },
+    };
+
+    static uint8_t cold[15 * 1024];
+    static uint8_t hot[1024];
+
+    /*** Setup. */
+    rc = nffs_format(area_descs_four);
+    TEST_ASSERT_FATAL(rc == 0);
+    TEST_ASSERT_FATAL(nffs_scratch_area_idx == 0);
+
+    for (i = 0; i < sizeof cold; i++) {
+        cold[i] = i;
+    }
+
+    /* Nearly fill area 1 with data that never changes. */
+    nffs_test_util_create_file("/cold.txt", (char *)cold, sizeof cold);
+    TEST_ASSERT(nffs_areas[1].na_dead == 0);
+
+    /* Repeatedly rewrite a file; its blocks end up in area 2. */
+    for (i = 0; i < 4; i++) {
+        memset(hot, 'a' + i, sizeof hot);
+        nffs_test_util_create_file("/hot.txt", (char *)hot, sizeof hot);
+    }
+    TEST_ASSERT(nffs_areas[2].na_dead >= 3 * sizeof hot);
+    TEST_ASSERT(nffs_area_live_space(nffs_areas + 2) < 2 * sizeof hot);
+
+    /* The running counts must match those calculated during restore. */
+    for (i = 0; i < 4; i++) {
+        dead[i] = nffs_areas[i].na_dead;
+    }
+    rc = nffs_misc_reset();
+    TEST_ASSERT(rc == 0);
+    rc = nffs_detect(area_descs_four);
+    TEST_ASSERT_FATAL(rc == 0);
+    for (i = 0; i < 4; i++) {
+        TEST_ASSERT(nffs_areas[i].na_dead == dead[i]);
+    }
+
+    /* Every area has the same sequence number, but area 2 holds the most
+     * garbage.
+     */
+    rc = nffs_gc(NULL);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(nffs_scratch_area_idx == 2);
+    TEST_ASSERT(nffs_areas[0].na_dead == 0);
+    TEST_ASSERT(nffs_area_live_space(nffs_areas + 0) < 2 * sizeof hot);
+
+    nffs_test_util_assert_contents("/cold.txt", (char *)cold, sizeof cold);
+    nffs_test_util_assert_contents("/hot.txt", (char *)hot, sizeof hot);
+
+    /* Area 1 still holds the superseded hot.txt inodes. */
+    TEST_ASSERT(nffs_areas[1].na_dead > 0);
+    rc = nffs_gc(NULL);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(nffs_scratch_area_idx == 1);
+
+    /* With no garbage left, collection falls back to sequence order. */
+    for (i = 0; i < 4; i++) {
+        TEST_ASSERT(nffs_areas[i].na_dead == 0);
+    }
+    rc = nffs_gc(NULL);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(nffs_scratch_area_idx == 0);
+
+    nffs_test_util_assert_contents("/cold.txt", (char *)cold, sizeof cold);
+    nffs_test_util_assert_contents("/hot.txt", (char *)hot, sizeof hot);
+}
+
+TEST_CASE(nffs_test_gc_incremental)
+{
+    int steps;
+    int done;
+    int rc;
+    int i;
+
+    static const struct nffs_area_desc area_descs_four[] = {
+        { 0x00000000, 16 * 1024 },
+        { 0x00004000, 16 * 1024 },
+        { 0x00008000, 16 * 1024 },
+        { 0x0000c000, 16 * 1024 },
+        { 0, 0 },
+    };
+
+    static uint8_t cold[15 * 1024];
+    static uint8_t hot[1024];
+
+    /*** Setup; fill area 1 and leave garbage in area 2. */
+    rc = nffs_format(area_descs_four);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    for (i = 0; i < sizeof cold; i++) {
+        cold[i] = i * 7;
+    }
+    nffs_test_util_create_file("/cold.txt", (char *)cold, sizeof cold);
+    for (i = 0; i < 4; i++) {
+        memset(hot, 'a' + i, sizeof hot);
+        nffs_test_util_create_file("/hot.txt", (char *)hot, sizeof hot);
+    }
+
+    TEST_ASSERT(nffs_gc_needed(0) == 0);
+    TEST_ASSERT(nffs_gc_needed(64 * 1024) == 1);
+
+    /*** Start a cycle and modify the file system between steps. */
+    rc = nffs_gc_step(&done);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(!done);
+    TEST_ASSERT(nffs_gc_from_area_idx == 2);
+    TEST_ASSERT(nffs_gc_needed(0) == 1);
+
+    memset(hot, 'x', sizeof hot);
+    nffs_test_util_create_file("/hot.txt", (char *)hot, sizeof hot);
+    nffs_test_util_create_file("/new.txt", "new", 3);
+    TEST_ASSERT(nffs_areas[2].na_cur < area_descs_four[2].nad_length);
+
+    steps = 1;
+    do {
+        rc = nffs_gc_step(&done);
+        TEST_ASSERT_FATAL(rc == 0);
+        steps++;
+
+        if (steps == 4) {
+            rc = fs_unlink("/new.txt");
+            TEST_ASSERT(rc == 0);
+        }
+    } while (!done);
+
+    TEST_ASSERT(steps == nffs_hash_size / NFFS_GC_STEP_BUCKETS + 1);
+    TEST_ASSERT(nffs_gc_from_area_idx == NFFS_AREA_ID_NONE);
+    TEST_ASSERT(nffs_scratch_area_idx == 2);
+
+    struct nffs_test_file_desc *expected_system =
+        (struct nffs_test_file_desc[]) { {
+            .filename = "",
+            .is_dir = 1,
+            .children = (struct nffs_test_file_desc[]) { {
+                .filename = "cold.txt",
+                .contents = (char *)cold,
+                .contents_len = sizeof cold,
+            }, {
+                .filename = "hot.txt",
+                .contents = (char *)hot,
+                .contents_len = sizeof hot,
+            }, {
+                .filename = NULL,
+            } },
+    } };
+
+    nffs_test_assert_system(expected_system, area_descs_four);
+
+    /*** A synchronous cycle completes the one in progress. */
+    rc = nffs_gc_step(&done);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(nffs_gc_from_area_idx != NFFS_AREA_ID_NONE);
+    i = nffs_gc_from_area_idx;
+
+    rc = nffs_gc(NULL);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(nffs_gc_from_area_idx == NFFS_AREA_ID_NONE);
+    TEST_ASSERT(nffs_scratch_area_idx == i);
+
+    nffs_test_assert_system(expected_system, area_descs_four);
+}
+
 TEST_CASE(nffs_test_corrupt_scratch)
 {
     int non_scratch_id;
@@ -2193,7 +2469,7 @@ TEST_CASE(nffs_test_lost_found)
 
 TEST_CASE(nffs_test_cache_large_file)
 {
-    static char data[NFFS_BLOCK_MAX_DATA_SZ_MAX * 5];
+    static char data[NFFS_BLOCK_MAX_DATA_SZ_DFLT * 5];
     struct fs_file *file;
     uint8_t b;
     int rc;
@@ -2260,6 +2536,261 @@ TEST_CASE(nffs_test_cache_large_file)
     TEST_ASSERT(rc == 0);
 }
 
+static uint8_t
+nffs_test_cache_index_byte(uint32_t offset)
+{
+    return offset % 251;
+}
+
+static void
+nffs_test_cache_index_fill(uint8_t *buf, uint32_t offset, int len)
+{
+    int i;
+
+    for (i = 0; i < len; i++) {
+        buf[i] = nffs_test_cache_index_byte(offset + i);
+    }
+}
+
+static void
+nffs_test_cache_index_check(struct fs_file *file, uint32_t offset)
+{
+    uint32_t bytes_read;
+    uint8_t buf[8];
+    int rc;
+    int i;
+
+    rc = fs_seek(file, offset);
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = fs_read(file, sizeof buf, buf, &bytes_read);
+    TEST_ASSERT_FATAL(rc == 0);
+    TEST_ASSERT(bytes_read > 0);
+    for (i = 0; i < bytes_read; i++) {
+        TEST_ASSERT(buf[i] == nffs_test_cache_index_byte(offset + i));
+    }
+}
+
+TEST_CASE(nffs_test_cache_index)
+{
+    static uint8_t buf[NFFS_BLOCK_MAX_DATA_SZ_DFLT];
+    struct nffs_cache_inode *cache_inode;
+    struct nffs_cache_index *index;
+    struct nffs_file *nffs_file;
+    struct fs_file *file;
+    uint32_t offset;
+    uint32_t max_sz;
+    int rc;
+    int i;
+
+    static const struct nffs_area_desc area_descs[] = {
+        { 0x00000000, 128 * 1024 },
+        { 0x00020000, 128 * 1024 },
+        { 0x00040000, 128 * 1024 },
+        { 0x00060000, 128 * 1024 },
+        { 0, 0 },
+    };
+
+    /*** Setup; create a file consisting of 80 full-size blocks. */
+    rc = nffs_format(area_descs);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    max_sz = nffs_block_max_data_sz;
+
+    rc = fs_open("/big", FS_ACCESS_WRITE, &file);
+    TEST_ASSERT_FATAL(rc == 0);
+    for (i = 0; i < 80; i++) {
+        nffs_test_cache_index_fill(buf, i * max_sz, max_sz);
+        rc = fs_write(file, buf, max_sz);
+        TEST_ASSERT_FATAL(rc == 0);
+    }
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+    nffs_test_util_assert_block_count("/big", 80);
+
+    nffs_cache_clear();
+
+    rc = fs_open("/big", FS_ACCESS_READ | FS_ACCESS_WRITE, &file);
+    TEST_ASSERT_FATAL(rc == 0);
+    nffs_file = (struct nffs_file *)file;
+    rc = nffs_cache_inode_ensure(&cache_inode, nffs_file->nf_inode_entry);
+    TEST_ASSERT_FATAL(rc == 0);
+    TEST_ASSERT(cache_inode->nci_index == NULL);
+
+    /*** A distant seek builds the index and caches only the target block. */
+    nffs_test_cache_index_check(file, 10 * max_sz + 5);
+    index = cache_inode->nci_index;
+    TEST_ASSERT_FATAL(index != NULL);
+    TEST_ASSERT(index->ncx_stride == 4);
+    TEST_ASSERT(index->ncx_num_entries == 20);
+    TEST_ASSERT(index->ncx_file_size == 80 * max_sz);
+    nffs_test_util_assert_cache_range("/big", 10 * max_sz, 11 * max_sz);
+
+    /*** Random access throughout the file. */
+    nffs_test_cache_index_check(file, 0);
+    nffs_test_cache_index_check(file, 77 * max_sz + 1);
+    nffs_test_cache_index_check(file, 50 * max_sz - 3);
+    nffs_test_cache_index_check(file, 3 * max_sz);
+    nffs_test_cache_index_check(file, 80 * max_sz - 1);
+    nffs_test_cache_index_check(file, 61 * max_sz + 17);
+    nffs_test_util_assert_cache_is_sane("/big");
+
+    /*** Same-length overwrites keep the index. */
+    offset = 20 * max_sz + 100;
+    nffs_test_cache_index_fill(buf, offset, 300);
+    rc = fs_seek(file, offset);
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = fs_write(file, buf, 300);
+    TEST_ASSERT_FATAL(rc == 0);
+    TEST_ASSERT(cache_inode->nci_index == index);
+    nffs_test_cache_index_check(file, offset + 150);
+    nffs_test_cache_index_check(file, 70 * max_sz);
+
+    /*** Appends keep the index. */
+    offset = 80 * max_sz;
+    nffs_test_cache_index_fill(buf, offset, 10);
+    rc = fs_seek(file, offset);
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = fs_write(file, buf, 10);
+    TEST_ASSERT_FATAL(rc == 0);
+    TEST_ASSERT(cache_inode->nci_index == index);
+    nffs_test_cache_index_check(file, 5 * max_sz);
+    nffs_test_cache_index_check(file, offset + 2);
+
+    /*** Extending the last block discards the index. */
+    nffs_test_cache_index_fill(buf, offset, 20);
+    rc = fs_seek(file, offset);
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = fs_write(file, buf, 20);
+    TEST_ASSERT_FATAL(rc == 0);
+    TEST_ASSERT(cache_inode->nci_index == NULL);
+    nffs_test_cache_index_check(file, 33 * max_sz + 33);
+    TEST_ASSERT(cache_inode->nci_index != NULL);
+    nffs_test_cache_index_check(file, offset + 12);
+
+    /*** Garbage collection. */
+    rc = nffs_gc(NULL);
+    TEST_ASSERT(rc == 0);
+    nffs_test_cache_index_check(file, 7 * max_sz + 7);
+    nffs_test_cache_index_check(file, 75 * max_sz);
+    nffs_test_cache_index_check(file, offset + 19);
+
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+    nffs_test_util_assert_cache_is_sane("/big");
+}
+
+TEST_CASE(nffs_test_cache_readahead)
+{
+    static uint8_t buf[NFFS_BLOCK_MAX_DATA_SZ_DFLT * 10];
+    struct fs_file *file;
+    uint32_t readahead;
+    uint32_t inode_miss;
+    uint32_t block_hit;
+    uint32_t bytes_read;
+    uint32_t max_sz;
+    uint8_t b;
+    char path[16];
+    int rc;
+    int i;
+
+    /*** Setup. */
+    rc = nffs_format(nffs_area_descs);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    max_sz = nffs_block_max_data_sz;
+    nffs_test_cache_index_fill(buf, 0, max_sz * 10);
+    nffs_test_util_create_file("/myfile.txt", (char *)buf, max_sz * 10);
+    nffs_test_util_assert_block_count("/myfile.txt", 10);
+
+    nffs_cache_clear();
+    nffs_config.nc_cache_readahead = 3;
+
+    rc = fs_open("/myfile.txt", FS_ACCESS_READ, &file);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    /*** Reading the first block reads ahead. */
+    readahead = nffs_stats.scache_readahead;
+    rc = fs_read(file, 1, &b, NULL);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(nffs_stats.scache_readahead == readahead + 3);
+    nffs_test_util_assert_cache_range("/myfile.txt", 0, max_sz * 4);
+
+    /*** Reads within the read-ahead window are hits. */
+    block_hit = nffs_stats.scache_block_hit;
+    rc = fs_seek(file, max_sz * 3 + 7);
+    TEST_ASSERT(rc == 0);
+    rc = fs_read(file, 1, &b, NULL);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(b == nffs_test_cache_index_byte(max_sz * 3 + 7));
+    TEST_ASSERT(nffs_stats.scache_block_hit > block_hit);
+    nffs_test_util_assert_cache_range("/myfile.txt", 0, max_sz * 4);
+
+    /*** Reading the block after the cache extends the window. */
+    rc = fs_seek(file, max_sz * 4);
+    TEST_ASSERT(rc == 0);
+    rc = fs_read(file, 1, &b, NULL);
+    TEST_ASSERT(rc == 0);
+    nffs_test_util_assert_cache_range("/myfile.txt", 0, max_sz * 8);
+
+    /*** Read-ahead stops at the end of the file. */
+    rc = fs_seek(file, max_sz * 8);
+    TEST_ASSERT(rc == 0);
+    rc = fs_read(file, 1, &b, NULL);
+    TEST_ASSERT(rc == 0);
+    nffs_test_util_assert_cache_range("/myfile.txt", 0, max_sz * 10);
+
+    /*** Random access does not read ahead. */
+    nffs_cache_clear();
+    readahead = nffs_stats.scache_readahead;
+    rc = fs_seek(file, max_sz * 5);
+    TEST_ASSERT(rc == 0);
+    rc = fs_read(file, 1, &b, NULL);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(nffs_stats.scache_readahead == readahead);
+    nffs_test_util_assert_cache_range("/myfile.txt", max_sz * 5, max_sz * 6);
+
+    /*** Streaming the whole file yields the correct contents. */
+    nffs_cache_clear();
+    rc = fs_seek(file, 0);
+    TEST_ASSERT(rc == 0);
+    for (i = 0; i < 10 * 4; i++) {
+        rc = fs_read(file, max_sz / 4, buf, &bytes_read);
+        TEST_ASSERT_FATAL(rc == 0);
+        TEST_ASSERT_FATAL(bytes_read == max_sz / 4);
+        TEST_ASSERT(buf[0] == nffs_test_cache_index_byte(i * max_sz / 4));
+        TEST_ASSERT(buf[bytes_read - 1] ==
+                    nffs_test_cache_index_byte((i + 1) * max_sz / 4 - 1));
+    }
+
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+    nffs_test_util_assert_cache_is_sane("/myfile.txt");
+    nffs_config.nc_cache_readahead = 0;
+
+    /*** Cached inodes are evicted in least-recently-used order. */
+    for (i = 0; i <= nffs_config.nc_num_cache_inodes; i++) {
+        snprintf(path, sizeof path, "/f%d", i);
+        nffs_test_util_create_file(path, "abc", 3);
+    }
+    nffs_cache_clear();
+
+    for (i = 0; i < nffs_config.nc_num_cache_inodes; i++) {
+        snprintf(path, sizeof path, "/f%d", i);
+        nffs_test_util_assert_contents(path, "abc", 3);
+    }
+
+    /* Touch the oldest inode, then cache one more; /f1 gets evicted. */
+    nffs_test_util_assert_contents("/f0", "abc", 3);
+    snprintf(path, sizeof path, "/f%d", i);
+    nffs_test_util_assert_contents(path, "abc", 3);
+
+    inode_miss = nffs_stats.scache_inode_miss;
+    nffs_test_util_assert_contents("/f0", "abc", 3);
+    TEST_ASSERT(nffs_stats.scache_inode_miss == inode_miss);
+    nffs_test_util_assert_contents("/f1", "abc", 3);
+    TEST_ASSERT(nffs_stats.scache_inode_miss > inode_miss);
+}
+
 TEST_CASE(nffs_test_readdir)
 {
     struct fs_dirent *dirent;
@@ -2364,15 +2895,273 @@ TEST_CASE(nffs_test_readdir)
     TEST_ASSERT(rc == FS_ENOENT);
 }
 
-TEST_CASE(nffs_test_split_file)
+TEST_CASE(nffs_test_readdir_stat)
 {
-    static char data[24 * 1024];
+    struct fs_dirent_stat stats[5];
+    struct fs_dirent *dirent;
+    struct fs_dir *dir;
+    uint32_t num_reads;
+    char long_name[80];
+    char data[120];
+    char path[96];
+    int num_stats;
+    int total;
     int rc;
     int i;
 
     /*** Setup. */
-    static const struct nffs_area_desc area_descs_two[] = {
-            { 0x00000000, 16 * 1024 },
+    rc = nffs_format(nffs_area_descs);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    rc = fs_mkdir("/mydir");
+    TEST_ASSERT_FATAL(rc == 0);
+
+    /* Write in reverse so that flash order differs from directory order. */
+    memset(data, 'x', sizeof data);
+    for (i = 11; i >= 0; i--) {
+        sprintf(path, "/mydir/f%02d", i);
+        nffs_test_util_create_file(path, data, i * 10);
+    }
+    rc = fs_mkdir("/mydir/sub");
+    TEST_ASSERT_FATAL(rc == 0);
+
+    memset(long_name, 'l', 70);
+    long_name[70] = '\0';
+    sprintf(path, "/mydir/%s", long_name);
+    nffs_test_util_create_file(path, "abc", 3);
+
+    /*** Read the directory in batches. */
+    rc = fs_opendir("/mydir", &dir);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    total = 0;
+    while (1) {
+        rc = fs_readdir_stat(dir, stats, 5, &num_stats);
+        if (rc == FS_ENOENT) {
+            TEST_ASSERT(num_stats == 0);
+            break;
+        }
+        TEST_ASSERT_FATAL(rc == 0);
+        TEST_ASSERT(num_stats >= 1 && num_stats <= 5);
+
+        for (i = 0; i < num_stats; i++) {
+            if (total + i < 12) {
+                sprintf(path, "f%02d", total + i);
+                TEST_ASSERT(strcmp(stats[i].fds_name, path) == 0);
+                TEST_ASSERT(stats[i].fds_name_len == 3);
+                TEST_ASSERT(!stats[i].fds_is_dir);
+                TEST_ASSERT(stats[i].fds_size == (total + i) * 10);
+            } else if (total + i == 12) {
+                /* Long names are truncated. */
+                TEST_ASSERT(stats[i].fds_name_len == 70);
+                TEST_ASSERT(strlen(stats[i].fds_name) ==
+                            FS_DIRENT_STAT_NAME_MAX);
+                TEST_ASSERT(strncmp(stats[i].fds_name, long_name,
+                                    FS_DIRENT_STAT_NAME_MAX) == 0);
+                TEST_ASSERT(stats[i].fds_size == 3);
+            } else {
+                TEST_ASSERT(strcmp(stats[i].fds_name, "sub") == 0);
+                TEST_ASSERT(stats[i].fds_is_dir);
+                TEST_ASSERT(stats[i].fds_size == 0);
+            }
+        }
+        total += num_stats;
+    }
+    TEST_ASSERT(total == 14);
+
+    rc = fs_closedir(dir);
+    TEST_ASSERT(rc == 0);
+
+    /*** Batched and single reads can be mixed. */
+    rc = fs_opendir("/mydir", &dir);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    rc = fs_readdir(dir, &dirent);
+    TEST_ASSERT(rc == 0);
+    nffs_test_util_assert_ent_name(dirent, "f00");
+
+    rc = fs_readdir_stat(dir, stats, 2, &num_stats);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(num_stats == 2);
+    TEST_ASSERT(strcmp(stats[0].fds_name, "f01") == 0);
+    TEST_ASSERT(strcmp(stats[1].fds_name, "f02") == 0);
+
+    rc = fs_readdir(dir, &dirent);
+    TEST_ASSERT(rc == 0);
+    nffs_test_util_assert_ent_name(dirent, "f03");
+
+    rc = fs_closedir(dir);
+    TEST_ASSERT(rc == 0);
+
+    /*** Each directory entry costs one flash read. */
+    for (i = 0; i < 5; i++) {
+        sprintf(path, "/mydir/sub/d%d", i);
+        rc = fs_mkdir(path);
+        TEST_ASSERT_FATAL(rc == 0);
+    }
+
+    rc = fs_opendir("/mydir/sub", &dir);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    num_reads = nffs_stats.sflash_read;
+    rc = fs_readdir_stat(dir, stats, 5, &num_stats);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(num_stats == 5);
+    TEST_ASSERT(nffs_stats.sflash_read - num_reads == 5);
+
+    rc = fs_readdir_stat(dir, stats, 5, &num_stats);
+    TEST_ASSERT(rc == FS_ENOENT);
+
+    rc = fs_closedir(dir);
+    TEST_ASSERT(rc == 0);
+
+    /* Directory handles no longer hold a reference. */
+    rc = fs_unlink("/mydir");
+    TEST_ASSERT(rc == 0);
+    rc = fs_opendir("/mydir", &dir);
+    TEST_ASSERT(rc == FS_ENOENT);
+}
+
+#define NFFS_TEST_MBUF_BUF_SIZE     (sizeof (struct os_mbuf) + 40)
+#define NFFS_TEST_MBUF_BUF_COUNT    8
+
+static os_membuf_t nffs_test_mbuf_mem[
+    OS_MEMPOOL_SIZE(NFFS_TEST_MBUF_BUF_COUNT, NFFS_TEST_MBUF_BUF_SIZE)];
+static struct os_mempool nffs_test_mbuf_mempool;
+static struct os_mbuf_pool nffs_test_mbuf_pool;
+
+TEST_CASE(nffs_test_vectored_io)
+{
+    struct os_mbuf *hog[NFFS_TEST_MBUF_BUF_COUNT];
+    struct fs_iovec iov[3];
+    struct os_mbuf *om;
+    struct fs_file *file;
+    uint32_t bytes_read;
+    char data[200];
+    char buf[200];
+    int num_hog;
+    int i;
+    int rc;
+
+    /*** Setup. */
+    rc = nffs_format(nffs_area_descs);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    rc = os_mempool_init(&nffs_test_mbuf_mempool, NFFS_TEST_MBUF_BUF_COUNT,
+                         NFFS_TEST_MBUF_BUF_SIZE, nffs_test_mbuf_mem,
+                         "nffs_test_mbuf_pool");
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = os_mbuf_pool_init(&nffs_test_mbuf_pool, &nffs_test_mbuf_mempool,
+                           NFFS_TEST_MBUF_BUF_SIZE, NFFS_TEST_MBUF_BUF_COUNT);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    for (i = 0; i < sizeof data; i++) {
+        data[i] = i;
+    }
+
+    /*** Vectored write and read. */
+    rc = fs_open("/myfile.txt", FS_ACCESS_WRITE, &file);
+    TEST_ASSERT_FATAL(rc == 0);
+    iov[0].fi_base = data;
+    iov[0].fi_len = 10;
+    iov[1].fi_base = data + 10;
+    iov[1].fi_len = 0;
+    iov[2].fi_base = data + 10;
+    iov[2].fi_len = 90;
+    rc = fs_writev(file, iov, 3);
+    TEST_ASSERT(rc == 0);
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+    nffs_test_util_assert_contents("/myfile.txt", data, 100);
+
+    rc = fs_open("/myfile.txt", FS_ACCESS_READ, &file);
+    TEST_ASSERT_FATAL(rc == 0);
+    memset(buf, 0, sizeof buf);
+    iov[0].fi_base = buf;
+    iov[0].fi_len = 30;
+    iov[1].fi_base = buf + 30;
+    iov[1].fi_len = 50;
+    iov[2].fi_base = buf + 80;
+    iov[2].fi_len = 50;
+    rc = fs_readv(file, iov, 3, &bytes_read);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(bytes_read == 100);
+    TEST_ASSERT(memcmp(buf, data, 100) == 0);
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+
+    /*** Write part of an mbuf chain. */
+    om = os_mbuf_get_pkthdr(&nffs_test_mbuf_pool, 0);
+    TEST_ASSERT_FATAL(om != NULL);
+    rc = os_mbuf_append(om, data, 150);
+    TEST_ASSERT_FATAL(rc == 0);
+    TEST_ASSERT(SLIST_NEXT(om, om_next) != NULL);
+
+    rc = fs_open("/mbuf.txt", FS_ACCESS_WRITE, &file);
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = fs_write_mbuf(file, om, 5, 120);
+    TEST_ASSERT(rc == 0);
+    rc = fs_write_mbuf(file, om, 100, 51);
+    TEST_ASSERT(rc == FS_EINVAL);
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+    nffs_test_util_assert_contents("/mbuf.txt", data + 5, 120);
+
+    /*** Read onto the end of an mbuf chain. */
+    rc = fs_open("/mbuf.txt", FS_ACCESS_READ, &file);
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = fs_read_mbuf(file, 1000, om, &bytes_read);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(bytes_read == 120);
+    TEST_ASSERT(OS_MBUF_PKTLEN(om) == 270);
+    TEST_ASSERT(os_mbuf_memcmp(om, 0, data, 150) == 0);
+    TEST_ASSERT(os_mbuf_memcmp(om, 150, data + 5, 120) == 0);
+
+    /* Nothing left to read; no mbufs get allocated. */
+    rc = fs_read_mbuf(file, 10, om, &bytes_read);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(bytes_read == 0);
+    TEST_ASSERT(OS_MBUF_PKTLEN(om) == 270);
+
+    os_mbuf_free_chain(om);
+
+    /* Running out of mbufs; leave only one free besides the head. */
+    om = os_mbuf_get_pkthdr(&nffs_test_mbuf_pool, 0);
+    TEST_ASSERT_FATAL(om != NULL);
+    for (i = 0; nffs_test_mbuf_mempool.mp_num_free > 1; i++) {
+        hog[i] = os_mbuf_get(&nffs_test_mbuf_pool, 0);
+        TEST_ASSERT_FATAL(hog[i] != NULL);
+    }
+    num_hog = i;
+
+    rc = fs_seek(file, 0);
+    TEST_ASSERT(rc == 0);
+    rc = fs_read_mbuf(file, 120, om, &bytes_read);
+    TEST_ASSERT(rc == FS_ENOMEM);
+    TEST_ASSERT(bytes_read == OS_MBUF_PKTLEN(om));
+    TEST_ASSERT(bytes_read > 0 && bytes_read < 120);
+    TEST_ASSERT(os_mbuf_memcmp(om, 0, data + 5, bytes_read) == 0);
+    TEST_ASSERT(fs_getpos(file) == bytes_read);
+
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+    os_mbuf_free_chain(om);
+    for (i = 0; i < num_hog; i++) {
+        os_mbuf_free(hog[i]);
+    }
+    TEST_ASSERT(nffs_test_mbuf_mempool.mp_num_free ==
+                NFFS_TEST_MBUF_BUF_COUNT);
+}
+
+TEST_CASE(nffs_test_split_file)
+{
+    static char data[24 * 1024];
+    int rc;
+    int i;
+
+    /*** Setup. */
+    static const struct nffs_area_desc area_descs_two[] = {
+            { 0x00000000, 16 * 1024 },
             { 0x00004000, 16 * 1024 },
             { 0x00008000, 16 * 1024 },
             { 0, 0 },
@@ -2381,32 +3170,1972 @@ TEST_CASE(nffs_test_split_file)
     rc = nffs_format(area_descs_two);
     TEST_ASSERT(rc == 0);
 
-    for (i = 0; i < sizeof data; i++) {
-        data[i] = i;
+    for (i = 0; i < sizeof data; i++) {
+        data[i] = i;
+    }
+
+    for (i = 0; i < 256; i++) {
+        nffs_test_util_create_file("/myfile.txt", data, sizeof data);
+        rc = fs_unlink("/myfile.txt");
+        TEST_ASSERT(rc == 0);
+    }
+
+    nffs_test_util_create_file("/myfile.txt", data, sizeof data);
+
+    struct nffs_test_file_desc *expected_system =
+        (struct nffs_test_file_desc[]) { {
+            .filename = "",
+            .is_dir = 1,
+            .children = (struct nffs_test_file_desc[]) { {
+                .filename = "myfile.txt",
+                .contents = data,
+                .contents_len = sizeof data,
+            }, {
+                .filename = NULL,
+            } },
+    } };
+
+    nffs_test_assert_system(expected_system, area_descs_two);
+}
+
+TEST_CASE(nffs_test_path_cache)
+{
+    struct fs_file *file;
+    struct fs_dir *dir;
+    char path[32];
+    int num_free;
+    int rc;
+    int i;
+
+    rc = nffs_format(nffs_area_descs);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    /*** Negative lookup gets cached; repeated lookup reuses the entry. */
+    rc = fs_open("/cfg.txt", FS_ACCESS_READ, &file);
+    TEST_ASSERT(rc == FS_ENOENT);
+    num_free = nffs_path_cache_pool.mp_num_free;
+
+    rc = fs_open("/cfg.txt", FS_ACCESS_READ, &file);
+    TEST_ASSERT(rc == FS_ENOENT);
+    TEST_ASSERT(nffs_path_cache_pool.mp_num_free == num_free);
+
+    /*** Creating the file invalidates the negative entry. */
+    nffs_test_util_create_file("/cfg.txt", "abc", 3);
+    nffs_test_util_assert_contents("/cfg.txt", "abc", 3);
+    nffs_test_util_assert_contents("/cfg.txt", "abc", 3);
+
+    /*** Rename. */
+    rc = fs_rename("/cfg.txt", "/cfg2.txt");
+    TEST_ASSERT(rc == 0);
+    rc = fs_open("/cfg.txt", FS_ACCESS_READ, &file);
+    TEST_ASSERT(rc == FS_ENOENT);
+    nffs_test_util_assert_contents("/cfg2.txt", "abc", 3);
+
+    /*** Mkdir. */
+    rc = fs_opendir("/mydir", &dir);
+    TEST_ASSERT(rc == FS_ENOENT);
+    rc = fs_mkdir("/mydir");
+    TEST_ASSERT(rc == 0);
+    rc = fs_opendir("/mydir", &dir);
+    TEST_ASSERT(rc == 0);
+    rc = fs_closedir(dir);
+    TEST_ASSERT(rc == 0);
+
+    /*** Unlink. */
+    rc = fs_unlink("/cfg2.txt");
+    TEST_ASSERT(rc == 0);
+    rc = fs_open("/cfg2.txt", FS_ACCESS_READ, &file);
+    TEST_ASSERT(rc == FS_ENOENT);
+
+    /*** Unlinking a directory invalidates its descendants. */
+    nffs_test_util_create_file("/mydir/a.txt", "a", 1);
+    nffs_test_util_assert_contents("/mydir/a.txt", "a", 1);
+    rc = fs_unlink("/mydir");
+    TEST_ASSERT(rc == 0);
+    rc = fs_open("/mydir/a.txt", FS_ACCESS_READ, &file);
+    TEST_ASSERT(rc == FS_ENOENT);
+
+    /*** Overflow the cache; lookups must remain correct. */
+    for (i = 0; i < nffs_config.nc_num_cache_paths * 2; i++) {
+        snprintf(path, sizeof path, "/file%d", i);
+        nffs_test_util_create_file(path, path, strlen(path));
+    }
+    for (i = 0; i < nffs_config.nc_num_cache_paths * 2; i++) {
+        snprintf(path, sizeof path, "/file%d", i);
+        nffs_test_util_assert_contents(path, path, strlen(path));
+    }
+    TEST_ASSERT(nffs_path_cache_pool.mp_num_free == 0);
+}
+
+TEST_CASE(nffs_test_path_cache_off)
+{
+    struct fs_file *file;
+    int rc;
+
+    rc = nffs_format(nffs_area_descs);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    /*** No memory is set aside for the cache. */
+    TEST_ASSERT(nffs_path_cache_mem == NULL);
+
+    /*** Lookups stay correct as the tree changes. */
+    rc = fs_open("/cfg.txt", FS_ACCESS_READ, &file);
+    TEST_ASSERT(rc == FS_ENOENT);
+    nffs_test_util_create_file("/cfg.txt", "abc", 3);
+    nffs_test_util_assert_contents("/cfg.txt", "abc", 3);
+
+    rc = fs_rename("/cfg.txt", "/cfg2.txt");
+    TEST_ASSERT(rc == 0);
+    rc = fs_open("/cfg.txt", FS_ACCESS_READ, &file);
+    TEST_ASSERT(rc == FS_ENOENT);
+    nffs_test_util_assert_contents("/cfg2.txt", "abc", 3);
+
+    rc = fs_unlink("/cfg2.txt");
+    TEST_ASSERT(rc == 0);
+    rc = fs_open("/cfg2.txt", FS_ACCESS_READ, &file);
+    TEST_ASSERT(rc == FS_ENOENT);
+}
+
+TEST_CASE(nffs_test_checkpoint)
+{
+    uint32_t dead[3];
+    int rc;
+    int i;
+
+    static const struct nffs_area_desc area_descs_ckpt[] = {
+        { 0x00020000, 128 * 1024 },
+        { 0x00040000, 128 * 1024 },
+        { 0x00060000, 128 * 1024 },
+        { 0, 0 },
+    };
+    static const struct nffs_area_desc ckpt_desc = { 0x00010000, 64 * 1024 };
+
+    struct nffs_test_file_desc *expected_system =
+        (struct nffs_test_file_desc[]) { {
+            .filename = "",
+            .is_dir = 1,
+            .children = (struct nffs_test_file_desc[]) { {
+                .filename = "b.txt",
+                .contents = "bbbbbbbbccc",
+                .contents_len = 11,
+            }, {
+                .filename = "lost+found",
+                .is_dir = 1,
+            }, {
+                .filename = "mydir",
+                .is_dir = 1,
+                .children = (struct nffs_test_file_desc[]) { {
+                    .filename = "c.txt",
+                    .contents = "c",
+                    .contents_len = 1,
+                }, {
+                    .filename = "d.txt",
+                    .contents = "dddd",
+                    .contents_len = 4,
+                }, {
+                    .filename = NULL,
+                } },
+            }, {
+                .filename = "newdir",
+                .is_dir = 1,
+            }, {
+                .filename = NULL,
+            } },
+    } };
+
+    rc = nffs_checkpoint_init(&ckpt_desc, 0);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    rc = nffs_format(area_descs_ckpt);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    /*** A freshly formatted file system has no checkpoint. */
+    rc = nffs_restore_checkpoint(area_descs_ckpt);
+    TEST_ASSERT(rc == FS_ECORRUPT);
+    rc = nffs_detect(area_descs_ckpt);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    /*** Objects written before the checkpoint get loaded from it. */
+    rc = fs_mkdir("/mydir");
+    TEST_ASSERT(rc == 0);
+    nffs_test_util_create_file("/mydir/a.txt", "aaaa", 4);
+    nffs_test_util_create_file("/mydir/d.txt", "dddd", 4);
+    nffs_test_util_create_file("/b.txt", "bbbb", 4);
+    nffs_test_util_append_file("/b.txt", "bbbb", 4);
+
+    rc = nffs_checkpoint();
+    TEST_ASSERT_FATAL(rc == 0);
+
+    /*** Objects written after the checkpoint get replayed. */
+    nffs_test_util_append_file("/b.txt", "ccc", 3);
+    nffs_test_util_create_file("/mydir/c.txt", "c", 1);
+    rc = fs_unlink("/mydir/a.txt");
+    TEST_ASSERT(rc == 0);
+    rc = fs_mkdir("/newdir");
+    TEST_ASSERT(rc == 0);
+
+    rc = nffs_restore_checkpoint(area_descs_ckpt);
+    TEST_ASSERT_FATAL(rc == 0);
+    nffs_test_assert_system_once(expected_system);
+
+    /*** Replay keeps the dead byte counts that a full restore computes. */
+    for (i = 0; i < nffs_num_areas; i++) {
+        dead[i] = nffs_areas[i].na_dead;
+    }
+    rc = nffs_restore_full(area_descs_ckpt);
+    TEST_ASSERT_FATAL(rc == 0);
+    for (i = 0; i < nffs_num_areas; i++) {
+        TEST_ASSERT(nffs_areas[i].na_dead == dead[i]);
+    }
+
+    rc = nffs_restore_checkpoint(area_descs_ckpt);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    /*** A checkpoint with nothing to replay. */
+    rc = nffs_checkpoint();
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = nffs_restore_checkpoint(area_descs_ckpt);
+    TEST_ASSERT_FATAL(rc == 0);
+    nffs_test_assert_system_once(expected_system);
+
+    /*** A corrupt checkpoint causes a fallback to a full restore. */
+    flash_native_memset(ckpt_desc.nad_offset + 40, 0x5a, 1);
+    rc = nffs_restore_checkpoint(area_descs_ckpt);
+    TEST_ASSERT(rc == FS_ECORRUPT);
+    rc = nffs_detect(area_descs_ckpt);
+    TEST_ASSERT_FATAL(rc == 0);
+    nffs_test_assert_system_once(expected_system);
+
+    /*** Garbage collection invalidates the checkpoint. */
+    rc = nffs_checkpoint();
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = nffs_gc(NULL);
+    TEST_ASSERT(rc == 0);
+    rc = nffs_restore_checkpoint(area_descs_ckpt);
+    TEST_ASSERT(rc == FS_ECORRUPT);
+
+    /*** Automatic checkpoints are written after a full restore and after
+     *   garbage collection.
+     */
+    rc = nffs_checkpoint_init(&ckpt_desc, NFFS_CHECKPOINT_F_AUTO);
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = nffs_detect(area_descs_ckpt);
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = nffs_restore_checkpoint(area_descs_ckpt);
+    TEST_ASSERT_FATAL(rc == 0);
+    nffs_test_assert_system(expected_system, area_descs_ckpt);
+
+    /*** A directory recorded after its own children. */
+    rc = fs_rename("/mydir", "/newdir/mydir");
+    TEST_ASSERT(rc == 0);
+    rc = nffs_checkpoint();
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = nffs_restore_checkpoint(area_descs_ckpt);
+    TEST_ASSERT_FATAL(rc == 0);
+    nffs_test_util_assert_contents("/newdir/mydir/c.txt", "c", 1);
+    nffs_test_util_assert_contents("/newdir/mydir/d.txt", "dddd", 4);
+
+    /*** Formatting erases the checkpoint. */
+    rc = nffs_format(area_descs_ckpt);
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = nffs_restore_checkpoint(area_descs_ckpt);
+    TEST_ASSERT(rc == FS_ECORRUPT);
+
+    rc = nffs_checkpoint_init(NULL, 0);
+    TEST_ASSERT(rc == 0);
+    rc = nffs_restore_checkpoint(area_descs_ckpt);
+    TEST_ASSERT(rc == FS_ENOENT);
+}
+
+static uint32_t
+nffs_test_util_lat_count(const uint32_t *hist)
+{
+    return hist[0] + hist[1] + hist[2] + hist[3];
+}
+
+TEST_CASE(nffs_test_stats)
+{
+    struct fs_file *file;
+    uint32_t write_bytes;
+    uint32_t read_bytes;
+    uint32_t reclaimed;
+    uint32_t copied;
+    uint32_t erases;
+    uint32_t opens;
+    uint32_t gcs;
+    uint8_t buf[16];
+    int rc;
+
+    static const struct nffs_area_desc area_descs_two[] = {
+        { 0x00020000, 128 * 1024 },
+        { 0x00040000, 128 * 1024 },
+        { 0, 0 },
+    };
+
+    /*** Formatting erases every area. */
+    erases = nffs_stats.sflash_erase;
+    rc = nffs_format(area_descs_two);
+    TEST_ASSERT_FATAL(rc == 0);
+    TEST_ASSERT(nffs_stats.sflash_erase - erases == 2);
+
+    /*** Byte counters track the data handed to the flash driver. */
+    write_bytes = nffs_stats.sflash_write_bytes;
+    nffs_test_util_create_file("/myfile.txt", "abcdefgh", 8);
+    TEST_ASSERT(nffs_stats.sflash_write_bytes - write_bytes >= 8);
+
+    rc = fs_open("/myfile.txt", FS_ACCESS_READ, &file);
+    TEST_ASSERT_FATAL(rc == 0);
+    read_bytes = nffs_stats.sflash_read_bytes;
+    rc = fs_read(file, 8, buf, NULL);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(nffs_stats.sflash_read_bytes - read_bytes >= 8);
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+
+    /*** Each open is recorded in at most one latency bucket; nothing is
+     * recorded if cputime is not running.
+     */
+    opens = nffs_test_util_lat_count(&nffs_stats.sopen_lat_100us);
+    rc = fs_open("/myfile.txt", FS_ACCESS_READ, &file);
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(nffs_test_util_lat_count(&nffs_stats.sopen_lat_100us) -
+                opens <= 1);
+
+    /*** Garbage collection reports what it copied and reclaimed. */
+    nffs_test_util_create_file("/myfile.txt", "12345678", 8);
+    nffs_test_util_create_file("/myfile.txt", "ABCDEFGH", 8);
+
+    gcs = nffs_stats.sgc_run;
+    erases = nffs_stats.sflash_erase;
+    copied = nffs_stats.sgc_bytes_copied;
+    reclaimed = nffs_stats.sgc_bytes_reclaimed;
+    rc = nffs_gc(NULL);
+    TEST_ASSERT_FATAL(rc == 0);
+    TEST_ASSERT(nffs_stats.sgc_run - gcs == 1);
+    TEST_ASSERT(nffs_stats.sflash_erase - erases == 1);
+    TEST_ASSERT(nffs_stats.sgc_bytes_copied - copied > 0);
+    TEST_ASSERT(nffs_stats.sgc_bytes_reclaimed - reclaimed > 0);
+
+    nffs_test_util_assert_contents("/myfile.txt", "ABCDEFGH", 8);
+}
+
+static int
+nffs_test_util_num_blocks(const char *path)
+{
+    struct nffs_inode_entry *inode_entry;
+    struct nffs_hash_entry *entry;
+    struct nffs_block block;
+    int num_blocks;
+    int rc;
+
+    rc = nffs_path_find_inode_entry(path, &inode_entry);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    num_blocks = 0;
+    entry = inode_entry->nie_last_block_entry;
+    while (entry != NULL) {
+        rc = nffs_block_from_hash_entry(&block, entry);
+        TEST_ASSERT_FATAL(rc == 0);
+
+        num_blocks++;
+        entry = block.nb_prev;
+    }
+
+    return num_blocks;
+}
+
+static int
+nffs_test_util_num_block_entries(void)
+{
+    struct nffs_hash_entry *entry;
+    int num_entries;
+    int i;
+
+    num_entries = 0;
+    NFFS_HASH_FOREACH(entry, i) {
+        if (nffs_hash_id_is_block(entry->nhe_id)) {
+            num_entries++;
+        }
+    }
+
+    return num_entries;
+}
+
+TEST_CASE(nffs_test_gc_incremental_reset)
+{
+    struct nffs_test_block_desc blocks[4];
+    struct nffs_inode_entry *inode_entry;
+    struct fs_file *file;
+    uint32_t area_offset;
+    uint8_t log_area_idx;
+    uint8_t area_idx;
+    char log[4 * 256];
+    char hot[1024];
+    int done;
+    int rc;
+    int i;
+
+    static const struct nffs_area_desc area_descs_four[] = {
+        { 0x00000000, 16 * 1024 },
+        { 0x00004000, 16 * 1024 },
+        { 0x00008000, 16 * 1024 },
+        { 0x0000c000, 16 * 1024 },
+        { 0, 0 },
+    };
+
+    /*** Setup; a file of several blocks shares an area with garbage. */
+    rc = nffs_format(area_descs_four);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    for (i = 0; i < 4; i++) {
+        memset(log + i * 256, 'a' + i, 256);
+        blocks[i].data = log + i * 256;
+        blocks[i].data_len = 256;
+    }
+    nffs_test_util_create_file_blocks("/log.txt", blocks, 4);
+    for (i = 0; i < 8; i++) {
+        memset(hot, '0' + i, sizeof hot);
+        nffs_test_util_create_file("/hot.txt", hot, sizeof hot);
+    }
+
+    rc = nffs_path_find_inode_entry("/log.txt", &inode_entry);
+    TEST_ASSERT_FATAL(rc == 0);
+    nffs_flash_loc_expand(inode_entry->nie_last_block_entry->nhe_flash_loc,
+                          &log_area_idx, &area_offset);
+
+    /*** Step until the file's blocks are collated into the destination. */
+    do {
+        rc = nffs_gc_step(&done);
+        TEST_ASSERT_FATAL(rc == 0);
+        TEST_ASSERT_FATAL(nffs_gc_from_area_idx == log_area_idx);
+
+        nffs_flash_loc_expand(
+            inode_entry->nie_last_block_entry->nhe_flash_loc,
+            &area_idx, &area_offset);
+    } while (area_idx != nffs_scratch_area_idx);
+    TEST_ASSERT(nffs_test_util_num_blocks("/log.txt") == 1);
+
+    /*** Overwriting the collated block completes the cycle. */
+    rc = fs_open("/log.txt", FS_ACCESS_WRITE, &file);
+    TEST_ASSERT_FATAL(rc == 0);
+    memset(log, 'x', 8);
+    rc = fs_write(file, log, 8);
+    TEST_ASSERT(rc == 0);
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(nffs_gc_from_area_idx == NFFS_AREA_ID_NONE);
+
+    /*** After a reset, every block in RAM belongs to a file. */
+    rc = nffs_misc_reset();
+    TEST_ASSERT(rc == 0);
+    rc = nffs_detect(area_descs_four);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    TEST_ASSERT(nffs_test_util_num_block_entries() ==
+                nffs_test_util_num_blocks("/log.txt") +
+                nffs_test_util_num_blocks("/hot.txt"));
+
+    struct nffs_test_file_desc *expected_system =
+        (struct nffs_test_file_desc[]) { {
+            .filename = "",
+            .is_dir = 1,
+            .children = (struct nffs_test_file_desc[]) { {
+                .filename = "hot.txt",
+                .contents = hot,
+                .contents_len = sizeof hot,
+            }, {
+                .filename = "log.txt",
+                .contents = log,
+                .contents_len = sizeof log,
+            }, {
+                .filename = NULL,
+            } },
+    } };
+
+    nffs_test_assert_system(expected_system, area_descs_four);
+}
+
+TEST_CASE(nffs_test_write_buf)
+{
+    struct fs_file *files[5];
+    struct fs_file *file2;
+    struct fs_file *file;
+    uint32_t len;
+    char buf[1024];
+    char path[16];
+    int rc;
+    int i;
+
+    rc = nffs_format(nffs_area_descs);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    for (i = 0; i < sizeof buf; i++) {
+        buf[i] = i * 7;
+    }
+
+    /*** Small appends are coalesced into full-size blocks. */
+    rc = fs_open("/log.txt", FS_ACCESS_WRITE | FS_ACCESS_APPEND, &file);
+    TEST_ASSERT_FATAL(rc == 0);
+    for (i = 0; i < sizeof buf / 32; i++) {
+        rc = fs_write(file, buf + i * 32, 32);
+        TEST_ASSERT(rc == 0);
+    }
+
+    /* The file length includes buffered data. */
+    rc = fs_filelen(file, &len);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(len == sizeof buf);
+    TEST_ASSERT(fs_getpos(file) == sizeof buf);
+
+    /* Buffered data isn't visible through another handle until flushed. */
+    rc = fs_open("/log.txt", FS_ACCESS_READ, &file2);
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = fs_filelen(file2, &len);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(len < sizeof buf);
+
+    rc = fs_flush(file);
+    TEST_ASSERT(rc == 0);
+    rc = fs_filelen(file2, &len);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(len == sizeof buf);
+    rc = fs_close(file2);
+    TEST_ASSERT(rc == 0);
+
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+
+    TEST_ASSERT(nffs_test_util_num_blocks("/log.txt") ==
+                (sizeof buf + nffs_block_max_data_sz - 1) /
+                nffs_block_max_data_sz);
+    nffs_test_util_assert_contents("/log.txt", buf, sizeof buf);
+
+    /*** Reads, seeks, and overwrites through a buffered handle. */
+    rc = fs_open("/rw.txt", FS_ACCESS_READ | FS_ACCESS_WRITE, &file);
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = fs_write(file, "abcdef", 6);
+    TEST_ASSERT(rc == 0);
+    rc = fs_seek(file, 2);
+    TEST_ASSERT(rc == 0);
+    rc = fs_write(file, "XY", 2);
+    TEST_ASSERT(rc == 0);
+    rc = fs_write(file, "gh", 2);
+    TEST_ASSERT(rc == 0);
+    rc = fs_seek(file, 6);
+    TEST_ASSERT(rc == 0);
+    rc = fs_write(file, "ijk", 3);
+    TEST_ASSERT(rc == 0);
+    rc = fs_seek(file, 0);
+    TEST_ASSERT(rc == 0);
+    rc = fs_read(file, sizeof path, path, &len);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(len == 9);
+    TEST_ASSERT(memcmp(path, "abXYghijk", 9) == 0);
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+
+    /*** More writers than buffers; the extra handles are unbuffered. */
+    for (i = 0; i < nffs_config.nc_num_files - 1; i++) {
+        snprintf(path, sizeof path, "/f%d", i);
+        rc = fs_open(path, FS_ACCESS_WRITE, files + i);
+        TEST_ASSERT_FATAL(rc == 0);
+    }
+    for (i = 0; i < nffs_config.nc_num_files - 1; i++) {
+        rc = fs_write(files[i], buf, 10);
+        TEST_ASSERT(rc == 0);
+        rc = fs_write(files[i], buf + 10, 10);
+        TEST_ASSERT(rc == 0);
+    }
+    for (i = 0; i < nffs_config.nc_num_files - 1; i++) {
+        rc = fs_close(files[i]);
+        TEST_ASSERT(rc == 0);
+
+        snprintf(path, sizeof path, "/f%d", i);
+        nffs_test_util_assert_contents(path, buf, 20);
+    }
+    TEST_ASSERT(nffs_write_buf_pool.mp_num_free ==
+                nffs_config.nc_num_write_bufs);
+}
+
+TEST_SUITE(nffs_suite_write_buf)
+{
+    int rc;
+
+    memset(&nffs_config, 0, sizeof nffs_config);
+    nffs_config.nc_num_files = 4;
+    nffs_config.nc_num_write_bufs = 2;
+
+    rc = nffs_init();
+    TEST_ASSERT(rc == 0);
+
+    nffs_test_write_buf();
+}
+
+/**
+ * Runs garbage collection cycles with the specified bulk buffer size and
+ * returns the number of flash reads they took.  Each cycle copies every file
+ * from one area to the other.
+ */
+static uint32_t
+nffs_test_gc_bulk_buf_run(uint32_t bulk_buf_size)
+{
+    static uint8_t data[12 * 1024];
+    uint32_t num_reads;
+    char path[16];
+    int rc;
+    int i;
+
+    static const struct nffs_area_desc area_descs_two[] = {
+        { 0x00020000, 128 * 1024 },
+        { 0x00040000, 128 * 1024 },
+        { 0, 0 },
+    };
+
+    memset(&nffs_config, 0, sizeof nffs_config);
+    nffs_config.nc_bulk_buf_size = bulk_buf_size;
+    rc = nffs_init();
+    TEST_ASSERT_FATAL(rc == 0);
+
+    rc = nffs_format(area_descs_two);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    nffs_test_cache_index_fill(data, 0, sizeof data);
+    for (i = 0; i < 8; i++) {
+        snprintf(path, sizeof path, "/f%d", i);
+        nffs_test_util_create_file(path, (char *)data, sizeof data);
+    }
+
+    num_reads = nffs_stats.sflash_read;
+    for (i = 0; i < 16; i++) {
+        rc = nffs_gc(NULL);
+        TEST_ASSERT_FATAL(rc == 0);
+    }
+    num_reads = nffs_stats.sflash_read - num_reads;
+
+    for (i = 0; i < 8; i++) {
+        snprintf(path, sizeof path, "/f%d", i);
+        nffs_test_util_assert_contents(path, (char *)data, sizeof data);
+    }
+
+    return num_reads;
+}
+
+TEST_CASE(nffs_test_gc_bulk_buf)
+{
+    uint32_t small_reads;
+    uint32_t bulk_reads;
+
+    small_reads = nffs_test_gc_bulk_buf_run(0);
+    bulk_reads = nffs_test_gc_bulk_buf_run(4096);
+    TEST_ASSERT(bulk_reads < small_reads);
+}
+
+#define NFFS_TEST_HASH_OBJS         10000
+
+/**
+ * Initializes nffs with the specified number of hash buckets and fills the
+ * hash table with block entries having consecutive IDs.
+ *
+ * @return                      The ID of the first entry.
+ */
+static uint32_t
+nffs_test_hash_fill(uint32_t num_buckets)
+{
+    struct nffs_hash_entry *entry;
+    uint32_t first_id;
+    int rc;
+    int i;
+
+    static const struct nffs_area_desc area_descs_two[] = {
+        { 0x00020000, 128 * 1024 },
+        { 0x00040000, 128 * 1024 },
+        { 0, 0 },
+    };
+
+    memset(&nffs_config, 0, sizeof nffs_config);
+    nffs_config.nc_num_blocks = NFFS_TEST_HASH_OBJS;
+    nffs_config.nc_num_hash_buckets = num_buckets;
+    rc = nffs_init();
+    TEST_ASSERT_FATAL(rc == 0);
+
+    rc = nffs_format(area_descs_two);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    first_id = nffs_hash_next_block_id;
+    for (i = 0; i < NFFS_TEST_HASH_OBJS; i++) {
+        entry = nffs_block_entry_alloc();
+        TEST_ASSERT_FATAL(entry != NULL);
+
+        entry->nhe_id = nffs_hash_next_block_id++;
+        entry->nhe_flash_loc = NFFS_FLASH_LOC_NONE;
+        nffs_hash_insert(entry);
+    }
+
+    return first_id;
+}
+
+static int
+nffs_test_hash_max_chain(void)
+{
+    struct nffs_hash_entry *entry;
+    int max_chain;
+    int chain;
+    int i;
+
+    max_chain = 0;
+    for (i = 0; i < nffs_hash_size; i++) {
+        chain = 0;
+        SLIST_FOREACH(entry, nffs_hash + i, nhe_next) {
+            chain++;
+        }
+        if (chain > max_chain) {
+            max_chain = chain;
+        }
+    }
+
+    return max_chain;
+}
+
+static void
+nffs_test_hash_run(uint32_t num_buckets, uint16_t expected_size)
+{
+    struct nffs_hash_entry *entry;
+    uint32_t first_id;
+    int i;
+
+    first_id = nffs_test_hash_fill(num_buckets);
+    TEST_ASSERT(nffs_hash_size == expected_size);
+
+    /* Consecutive IDs spread evenly over the buckets; the root directory
+     * can add one more entry to a chain.
+     */
+    TEST_ASSERT(nffs_test_hash_max_chain() <=
+                (NFFS_TEST_HASH_OBJS + expected_size - 1) / expected_size + 1);
+
+    for (i = 0; i < NFFS_TEST_HASH_OBJS; i++) {
+        entry = nffs_hash_find_block(first_id + i);
+        TEST_ASSERT_FATAL(entry != NULL);
+        TEST_ASSERT(entry->nhe_id == first_id + i);
+    }
+}
+
+TEST_CASE(nffs_test_hash)
+{
+    /* The former fixed table size, then the size derived from the pools. */
+    nffs_test_hash_run(256, 256);
+    nffs_test_hash_run(0, NFFS_HASH_SIZE_MAX);
+}
+
+#ifdef NFFS_TEST_BENCH
+
+/*
+ * Timing benchmarks.  These take several seconds and only print their
+ * results, so they are built only when the NFFS_BENCH feature is enabled.
+ */
+
+static void
+nffs_test_hash_bench_run(uint32_t num_buckets)
+{
+    struct nffs_hash_entry *entry;
+    unsigned long usecs;
+    uint32_t first_id;
+    uint32_t num_found;
+    clock_t start;
+    int round;
+    int i;
+
+    first_id = nffs_test_hash_fill(num_buckets);
+
+    /* Look the objects up in a scattered order. */
+    num_found = 0;
+    start = clock();
+    for (round = 0; round < 10; round++) {
+        for (i = 0; i < NFFS_TEST_HASH_OBJS; i++) {
+            entry = nffs_hash_find_block(
+                first_id + (i * 7919) % NFFS_TEST_HASH_OBJS);
+            if (entry != NULL) {
+                num_found++;
+            }
+        }
+    }
+    usecs = (unsigned long)(clock() - start) * 1000000 / CLOCKS_PER_SEC;
+    TEST_ASSERT(num_found == 10 * NFFS_TEST_HASH_OBJS);
+
+    printf("hash bench: %d objects, %u buckets (max chain %d): table %u "
+           "bytes, entries %u bytes; %d lookups in %lu us\n",
+           NFFS_TEST_HASH_OBJS, (unsigned int)nffs_hash_size,
+           nffs_test_hash_max_chain(),
+           (unsigned int)(nffs_hash_size * sizeof *nffs_hash),
+           (unsigned int)(NFFS_TEST_HASH_OBJS *
+                          sizeof (struct nffs_hash_entry)),
+           10 * NFFS_TEST_HASH_OBJS, usecs);
+}
+
+TEST_CASE(nffs_test_hash_bench)
+{
+    nffs_test_hash_bench_run(256);
+    nffs_test_hash_bench_run(0);
+}
+
+#define NFFS_TEST_RW_BENCH_READERS      3
+#define NFFS_TEST_RW_BENCH_TICKS        (2 * OS_TICKS_PER_SEC)
+#define NFFS_TEST_RW_BENCH_FILE_SIZE    (16 * 1024)
+#define NFFS_TEST_RW_BENCH_STACK_SIZE   1024
+#define NFFS_TEST_RW_BENCH_PRIO         10
+
+static struct os_task nffs_test_rw_bench_tasks[NFFS_TEST_RW_BENCH_READERS + 1];
+static os_stack_t nffs_test_rw_bench_stacks[NFFS_TEST_RW_BENCH_READERS + 1]
+    [OS_STACK_ALIGN(NFFS_TEST_RW_BENCH_STACK_SIZE)];
+static uint32_t nffs_test_rw_bench_reads[NFFS_TEST_RW_BENCH_READERS];
+static os_time_t nffs_test_rw_bench_max_ticks[NFFS_TEST_RW_BENCH_READERS];
+static uint32_t nffs_test_rw_bench_writes;
+static int nffs_test_rw_bench_num_tasks;
+static int nffs_test_rw_bench_num_done;
+static os_time_t nffs_test_rw_bench_end;
+
+/**
+ * Called by each benchmark task when its time is up.  The last task to finish
+ * reports the results and ends the test case.
+ */
+static void
+nffs_test_rw_bench_task_done(void)
+{
+    uint32_t total_reads;
+    os_time_t max_ticks;
+    os_sr_t sr;
+    int last;
+    int i;
+
+    OS_ENTER_CRITICAL(sr);
+    nffs_test_rw_bench_num_done++;
+    last = nffs_test_rw_bench_num_done == nffs_test_rw_bench_num_tasks;
+    OS_EXIT_CRITICAL(sr);
+
+    if (!last) {
+        while (1) {
+            os_time_delay(OS_TICKS_PER_SEC);
+        }
+    }
+
+    total_reads = 0;
+    max_ticks = 0;
+    for (i = 0; i < NFFS_TEST_RW_BENCH_READERS; i++) {
+        TEST_ASSERT(nffs_test_rw_bench_reads[i] > 0);
+        total_reads += nffs_test_rw_bench_reads[i];
+        if (nffs_test_rw_bench_max_ticks[i] > max_ticks) {
+            max_ticks = nffs_test_rw_bench_max_ticks[i];
+        }
+    }
+
+    printf("rw bench: %d readers, %d writers, %d ticks: %u reads of %d KB "
+           "(max latency %u ticks), %u writes\n",
+           NFFS_TEST_RW_BENCH_READERS,
+           nffs_test_rw_bench_num_tasks - NFFS_TEST_RW_BENCH_READERS,
+           NFFS_TEST_RW_BENCH_TICKS, (unsigned int)total_reads,
+           NFFS_TEST_RW_BENCH_FILE_SIZE / 1024, (unsigned int)max_ticks,
+           (unsigned int)nffs_test_rw_bench_writes);
+
+    tu_restart();
+}
+
+/**
+ * Reader task: repeatedly reads the whole benchmark file, sleeping for a tick
+ * between passes so that lower priority tasks get to run.
+ */
+static void
+nffs_test_rw_bench_reader(void *arg)
+{
+    static uint8_t bufs[NFFS_TEST_RW_BENCH_READERS][256];
+    struct fs_file *file;
+    os_time_t elapsed;
+    os_time_t start;
+    uint32_t total;
+    uint32_t len;
+    uint8_t *buf;
+    int idx;
+    int rc;
+
+    idx = (int)(intptr_t)arg;
+    buf = bufs[idx];
+
+    while (OS_TIME_TICK_LT(os_time_get(), nffs_test_rw_bench_end)) {
+        start = os_time_get();
+
+        rc = fs_open("/rw/data", FS_ACCESS_READ, &file);
+        TEST_ASSERT_FATAL(rc == 0);
+
+        total = 0;
+        do {
+            rc = fs_read(file, sizeof bufs[idx], buf, &len);
+            TEST_ASSERT_FATAL(rc == 0);
+            total += len;
+        } while (len == sizeof bufs[idx]);
+        TEST_ASSERT(total == NFFS_TEST_RW_BENCH_FILE_SIZE);
+
+        rc = fs_close(file);
+        TEST_ASSERT_FATAL(rc == 0);
+
+        elapsed = os_time_get() - start;
+        if (elapsed > nffs_test_rw_bench_max_ticks[idx]) {
+            nffs_test_rw_bench_max_ticks[idx] = elapsed;
+        }
+        nffs_test_rw_bench_reads[idx]++;
+
+        os_time_delay(1);
+    }
+
+    nffs_test_rw_bench_task_done();
+}
+
+/**
+ * Writer task: appends records to a log file without pausing, rewriting the
+ * log when it gets large so that garbage collection is exercised.
+ */
+static void
+nffs_test_rw_bench_writer(void *arg)
+{
+    static const char record[128] = "rw bench record";
+    struct fs_file *file;
+    int rc;
+    int i;
+
+    while (OS_TIME_TICK_LT(os_time_get(), nffs_test_rw_bench_end)) {
+        rc = fs_open("/rw/log", FS_ACCESS_WRITE | FS_ACCESS_TRUNCATE, &file);
+        TEST_ASSERT_FATAL(rc == 0);
+
+        for (i = 0; i < 64; i++) {
+            rc = fs_write(file, record, sizeof record);
+            TEST_ASSERT_FATAL(rc == 0);
+            nffs_test_rw_bench_writes++;
+        }
+
+        rc = fs_close(file);
+        TEST_ASSERT_FATAL(rc == 0);
+    }
+
+    nffs_test_rw_bench_task_done();
+}
+
+/**
+ * Measures read throughput and latency with several reader tasks sharing one
+ * file, optionally while a lower priority task writes continuously.  This
+ * test case takes over the scheduler; it ends when the last task calls
+ * tu_restart().
+ */
+static void
+nffs_test_rw_bench_run(int with_writer)
+{
+    static uint8_t data[NFFS_TEST_RW_BENCH_FILE_SIZE];
+    int rc;
+    int i;
+
+    static const struct nffs_area_desc area_descs_two[] = {
+        { 0x00020000, 128 * 1024 },
+        { 0x00040000, 128 * 1024 },
+        { 0, 0 },
+    };
+
+    os_init();
+
+    memset(&nffs_config, 0, sizeof nffs_config);
+    rc = nffs_init();
+    TEST_ASSERT_FATAL(rc == 0);
+
+    rc = nffs_format(area_descs_two);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    rc = fs_mkdir("/rw");
+    TEST_ASSERT_FATAL(rc == 0);
+
+    nffs_test_cache_index_fill(data, 0, sizeof data);
+    nffs_test_util_create_file("/rw/data", (char *)data, sizeof data);
+
+    memset(nffs_test_rw_bench_reads, 0, sizeof nffs_test_rw_bench_reads);
+    memset(nffs_test_rw_bench_max_ticks, 0,
+           sizeof nffs_test_rw_bench_max_ticks);
+    nffs_test_rw_bench_writes = 0;
+    nffs_test_rw_bench_num_done = 0;
+    nffs_test_rw_bench_num_tasks = NFFS_TEST_RW_BENCH_READERS + !!with_writer;
+    nffs_test_rw_bench_end = os_time_get() + NFFS_TEST_RW_BENCH_TICKS;
+
+    for (i = 0; i < NFFS_TEST_RW_BENCH_READERS; i++) {
+        rc = os_task_init(nffs_test_rw_bench_tasks + i, "reader",
+                          nffs_test_rw_bench_reader, (void *)(intptr_t)i,
+                          NFFS_TEST_RW_BENCH_PRIO + i, OS_WAIT_FOREVER,
+                          nffs_test_rw_bench_stacks[i],
+                          OS_STACK_ALIGN(NFFS_TEST_RW_BENCH_STACK_SIZE));
+        TEST_ASSERT_FATAL(rc == 0);
+    }
+
+    if (with_writer) {
+        rc = os_task_init(nffs_test_rw_bench_tasks + i, "writer",
+                          nffs_test_rw_bench_writer, NULL,
+                          NFFS_TEST_RW_BENCH_PRIO + i, OS_WAIT_FOREVER,
+                          nffs_test_rw_bench_stacks[i],
+                          OS_STACK_ALIGN(NFFS_TEST_RW_BENCH_STACK_SIZE));
+        TEST_ASSERT_FATAL(rc == 0);
+    }
+
+    os_start();
+}
+
+TEST_CASE(nffs_test_rw_bench_readers)
+{
+    nffs_test_rw_bench_run(0);
+}
+
+TEST_CASE(nffs_test_rw_bench_mixed)
+{
+    nffs_test_rw_bench_run(1);
+}
+
+TEST_SUITE(nffs_suite_bench)
+{
+    nffs_test_hash_bench();
+    nffs_test_rw_bench_readers();
+    nffs_test_rw_bench_mixed();
+}
+
+#endif /* NFFS_TEST_BENCH */
+
+TEST_CASE(nffs_test_lazy_blocks)
+{
+    static uint8_t data[6][5 * 2048];
+    struct nffs_area_desc ckpt_desc;
+    struct fs_file *file;
+    char filename[8];
+    int done;
+    int rc;
+    int i;
+
+    static const struct nffs_area_desc area_descs_lazy[] = {
+        { 0x00020000, 128 * 1024 },
+        { 0x00040000, 128 * 1024 },
+        { 0x00060000, 128 * 1024 },
+        { 0, 0 },
+    };
+
+    rc = nffs_format(area_descs_lazy);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    /*** Checkpoints cannot be used with lazy block loading. */
+    ckpt_desc.nad_offset = 0x00080000;
+    ckpt_desc.nad_length = 16 * 1024;
+    ckpt_desc.nad_flash_id = 0;
+    rc = nffs_checkpoint_init(&ckpt_desc, 0);
+    TEST_ASSERT(rc == FS_ENOTSUP);
+
+    /*** Files whose blocks together exceed the block pool can be written. */
+    for (i = 0; i < 6; i++) {
+        nffs_test_cache_index_fill(data[i], i * sizeof data[i],
+                                   sizeof data[i]);
+        sprintf(filename, "/f%d", i);
+        nffs_test_util_create_file(filename, (char *)data[i], sizeof data[i]);
+    }
+    for (i = 0; i < 6; i++) {
+        sprintf(filename, "/f%d", i);
+        nffs_test_util_assert_contents(filename, (char *)data[i],
+                                       sizeof data[i]);
+        nffs_test_util_assert_block_count(filename, 5);
+    }
+
+    /*** Overwrite a file after its blocks were evicted. */
+    memset(data[0] + 3000, 0xa5, 3000);
+    rc = fs_open("/f0", FS_ACCESS_WRITE, &file);
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = fs_seek(file, 3000);
+    TEST_ASSERT(rc == 0);
+    rc = fs_write(file, data[0] + 3000, 3000);
+    TEST_ASSERT(rc == 0);
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+    nffs_test_util_assert_contents("/f0", (char *)data[0], sizeof data[0]);
+
+    /*** No block entries are resident after a restore. */
+    rc = nffs_detect(area_descs_lazy);
+    TEST_ASSERT_FATAL(rc == 0);
+    TEST_ASSERT(nffs_block_entry_pool.mp_num_free ==
+                nffs_config.nc_num_blocks);
+
+    nffs_test_util_assert_contents("/f3", (char *)data[3], sizeof data[3]);
+    TEST_ASSERT(nffs_block_entry_pool.mp_num_free ==
+                nffs_config.nc_num_blocks - 5);
+
+    /*** Garbage collection copies the blocks of unloaded files. */
+    rc = nffs_gc_step(&done);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(!done);
+    nffs_test_util_assert_contents("/f5", (char *)data[5], sizeof data[5]);
+    rc = nffs_gc(NULL);
+    TEST_ASSERT(rc == 0);
+    rc = nffs_gc(NULL);
+    TEST_ASSERT(rc == 0);
+
+    for (i = 0; i < 6; i++) {
+        sprintf(filename, "/f%d", i);
+        nffs_test_util_assert_contents(filename, (char *)data[i],
+                                       sizeof data[i]);
+    }
+
+    rc = nffs_detect(area_descs_lazy);
+    TEST_ASSERT_FATAL(rc == 0);
+    for (i = 0; i < 6; i++) {
+        sprintf(filename, "/f%d", i);
+        nffs_test_util_assert_contents(filename, (char *)data[i],
+                                       sizeof data[i]);
+    }
+}
+
+TEST_CASE(nffs_test_large_blocks)
+{
+    static uint8_t data[40000];
+    struct fs_file *file;
+    uint16_t num_free;
+    int rc;
+    int i;
+
+    static const struct nffs_area_desc area_descs_two[] = {
+        { 0x00020000, 128 * 1024 },
+        { 0x00040000, 128 * 1024 },
+        { 0, 0 },
+    };
+
+    rc = nffs_format(area_descs_two);
+    TEST_ASSERT_FATAL(rc == 0);
+    TEST_ASSERT(nffs_block_max_data_sz == 16384);
+
+    nffs_test_cache_index_fill(data, 0, sizeof data);
+
+    /*** A large write is split into maximum-size blocks. */
+    nffs_test_util_create_file("/big", (char *)data, sizeof data);
+    nffs_test_util_assert_block_count("/big", 3);
+
+    /*** Small appends produce small blocks... */
+    rc = fs_open("/log", FS_ACCESS_WRITE, &file);
+    TEST_ASSERT_FATAL(rc == 0);
+    for (i = 0; i < 64; i++) {
+        rc = fs_write(file, data + i * 512, 512);
+        TEST_ASSERT(rc == 0);
+    }
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+    nffs_test_util_assert_block_count("/log", 64);
+
+    /*** ...which garbage collection merges, a bounded number at a time. */
+    num_free = nffs_block_entry_pool.mp_num_free;
+    rc = nffs_gc(NULL);
+    TEST_ASSERT(rc == 0);
+    nffs_test_util_assert_block_count("/log", 64 / NFFS_GC_COLLATE_MAX_BLOCKS);
+    TEST_ASSERT(nffs_block_entry_pool.mp_num_free ==
+                num_free + 64 - 64 / NFFS_GC_COLLATE_MAX_BLOCKS);
+    nffs_test_util_assert_contents("/log", (char *)data, 64 * 512);
+
+    rc = nffs_gc(NULL);
+    TEST_ASSERT(rc == 0);
+    nffs_test_util_assert_block_count("/log", 2);
+    nffs_test_util_assert_contents("/log", (char *)data, 64 * 512);
+    nffs_test_util_assert_contents("/big", (char *)data, sizeof data);
+
+    /*** The merged blocks survive a restore. */
+    rc = nffs_detect(area_descs_two);
+    TEST_ASSERT_FATAL(rc == 0);
+    TEST_ASSERT(nffs_block_max_data_sz == 16384);
+    nffs_test_util_assert_block_count("/log", 2);
+    nffs_test_util_assert_contents("/log", (char *)data, 64 * 512);
+    nffs_test_util_assert_contents("/big", (char *)data, sizeof data);
+}
+
+/**
+ * Returns the total number of bytes written to the non-scratch areas.
+ */
+static uint32_t
+nffs_test_util_bytes_written(void)
+{
+    uint32_t total;
+    int i;
+
+    total = 0;
+    for (i = 0; i < nffs_num_areas; i++) {
+        if (i != nffs_scratch_area_idx) {
+            total += nffs_areas[i].na_cur;
+        }
+    }
+
+    return total;
+}
+
+static void
+nffs_test_compress_fill_log(char *buf, int len)
+{
+    char line[64];
+    int line_len;
+    int off;
+    int i;
+
+    off = 0;
+    for (i = 0; off < len; i++) {
+        line_len = sprintf(line, "12:%02d:%02d INFO sensor=%d temp=%d.%d\n",
+                           i / 60 % 60, i % 60, i % 7, 20 + i % 5, i % 10);
+        if (line_len > len - off) {
+            line_len = len - off;
+        }
+        memcpy(buf + off, line, line_len);
+        off += line_len;
+    }
+}
+
+TEST_CASE(nffs_test_compress)
+{
+    static char data[16 * 1024];
+    static char expected[16 * 1024 + 200];
+    static char noise[4096];
+    static char zeros[2048];
+    struct fs_file *file;
+    const void *ptr;
+    uint32_t ptr_len;
+    uint32_t written;
+    uint32_t before;
+    int rc;
+    int i;
+
+    static const struct nffs_area_desc area_descs_two[] = {
+        { 0x00020000, 128 * 1024 },
+        { 0x00040000, 128 * 1024 },
+        { 0, 0 },
+    };
+
+    rc = nffs_format(area_descs_two);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    nffs_test_compress_fill_log(data, sizeof data);
+    for (i = 0; i < sizeof noise; i++) {
+        noise[i] = rand();
+    }
+
+    /*** The compression flag requires write access. */
+    rc = fs_open("/log", FS_ACCESS_READ | FS_ACCESS_COMPRESS, &file);
+    TEST_ASSERT(rc == FS_EINVAL);
+
+    /*** A compressed file occupies far less flash than a plain one. */
+    before = nffs_test_util_bytes_written();
+    nffs_test_util_create_file("/plain", data, sizeof data);
+    written = nffs_test_util_bytes_written() - before;
+
+    before = nffs_test_util_bytes_written();
+    rc = fs_open("/log", FS_ACCESS_WRITE | FS_ACCESS_COMPRESS, &file);
+    TEST_ASSERT_FATAL(rc == 0);
+    for (i = 0; i < sizeof data; i += 2048) {
+        rc = fs_write(file, data + i, 2048);
+        TEST_ASSERT(rc == 0);
+    }
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(nffs_test_util_bytes_written() - before < written / 2);
+
+    nffs_test_util_assert_contents("/plain", data, sizeof data);
+    nffs_test_util_assert_contents("/log", data, sizeof data);
+    nffs_test_util_assert_block_count("/log", 8);
+
+    /*** Overwrite data spanning two compressed blocks. */
+    memset(data + 3000, '#', 2000);
+    rc = fs_open("/log", FS_ACCESS_WRITE, &file);
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = fs_seek(file, 3000);
+    TEST_ASSERT(rc == 0);
+    rc = fs_write(file, data + 3000, 2000);
+    TEST_ASSERT(rc == 0);
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+    nffs_test_util_assert_contents("/log", data, sizeof data);
+    nffs_test_util_assert_block_count("/log", 8);
+
+    /*** Extend the last block past the compressible length. */
+    memset(data + sizeof data - 100, '$', 100);
+    rc = fs_open("/log", FS_ACCESS_WRITE, &file);
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = fs_seek(file, sizeof data - 100);
+    TEST_ASSERT(rc == 0);
+    rc = fs_write(file, data + sizeof data - 100, 100);
+    TEST_ASSERT(rc == 0);
+    rc = fs_write(file, data, 200);
+    TEST_ASSERT(rc == 0);
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+    memcpy(expected, data, sizeof data);
+    memcpy(expected + sizeof data, data, 200);
+    nffs_test_util_assert_contents("/log", expected, sizeof expected);
+
+    /*** Incompressible and highly repetitive data. */
+    rc = fs_open("/noise", FS_ACCESS_WRITE | FS_ACCESS_COMPRESS, &file);
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = fs_write(file, noise, sizeof noise);
+    TEST_ASSERT(rc == 0);
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+
+    before = nffs_test_util_bytes_written();
+    rc = fs_open("/zeros", FS_ACCESS_WRITE | FS_ACCESS_COMPRESS, &file);
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = fs_write(file, zeros, sizeof zeros);
+    TEST_ASSERT(rc == 0);
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(nffs_test_util_bytes_written() - before < 128);
+
+    nffs_test_util_assert_contents("/noise", noise, sizeof noise);
+    nffs_test_util_assert_contents("/zeros", zeros, sizeof zeros);
+
+    /*** Compressed data cannot be read in place. */
+    rc = fs_open("/zeros", FS_ACCESS_READ, &file);
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = fs_read_ptr(file, 16, &ptr, &ptr_len);
+    TEST_ASSERT(rc == FS_ENOTSUP);
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+
+    /*** Compressed blocks survive garbage collection and a restore. */
+    rc = nffs_gc(NULL);
+    TEST_ASSERT(rc == 0);
+    rc = nffs_gc(NULL);
+    TEST_ASSERT(rc == 0);
+    rc = nffs_detect(area_descs_two);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    nffs_test_util_assert_contents("/log", expected, sizeof expected);
+    nffs_test_util_assert_contents("/noise", noise, sizeof noise);
+    nffs_test_util_assert_contents("/zeros", zeros, sizeof zeros);
+
+    /*** The flag persists across a rename and a restore. */
+    rc = fs_rename("/zeros", "/zeros2");
+    TEST_ASSERT(rc == 0);
+    rc = nffs_detect(area_descs_two);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    before = nffs_test_util_bytes_written();
+    rc = fs_open("/zeros2", FS_ACCESS_WRITE | FS_ACCESS_APPEND, &file);
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = fs_write(file, zeros, sizeof zeros);
+    TEST_ASSERT(rc == 0);
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(nffs_test_util_bytes_written() - before < 128);
+}
+
+TEST_CASE(nffs_test_compress_legacy_inode)
+{
+    struct nffs_inode_entry *inode_entry;
+    struct nffs_disk_inode disk_inode;
+    struct nffs_disk_block disk_block;
+    struct nffs_inode inode;
+    uint32_t area_offset;
+    uint8_t area_idx;
+    char data[1024];
+    int rc;
+
+    static const struct nffs_area_desc area_descs_two[] = {
+        { 0x00020000, 128 * 1024 },
+        { 0x00040000, 128 * 1024 },
+        { 0, 0 },
+    };
+
+    rc = nffs_format(area_descs_two);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    memset(data, 'a', sizeof data);
+    nffs_test_util_create_file("/old", data, 16);
+
+    rc = nffs_path_find_inode_entry("/old", &inode_entry);
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = nffs_inode_from_entry(&inode, inode_entry);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    /*** Write a rename record the way older nffs did; the reserved byte is
+     *   left uninitialized and happens to have the compression bit set.
+     */
+    disk_inode.ndi_magic = NFFS_INODE_MAGIC;
+    disk_inode.ndi_id = inode_entry->nie_hash_entry.nhe_id;
+    disk_inode.ndi_seq = inode.ni_seq + 1;
+    disk_inode.ndi_parent_id = nffs_inode_parent_id(&inode);
+    disk_inode.ndi_flags = 0x5b;
+    disk_inode.ndi_filename_len = 3;
+    nffs_crc_disk_inode_fill(&disk_inode, "new");
+
+    rc = nffs_misc_reserve_space(sizeof disk_inode + 3,
+                                 &area_idx, &area_offset);
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = nffs_inode_write_disk(&disk_inode, "new", area_idx, area_offset);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    rc = nffs_misc_reset();
+    TEST_ASSERT(rc == 0);
+    rc = nffs_detect(area_descs_two);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    /*** The file is not treated as compressed. */
+    rc = nffs_path_find_inode_entry("/new", &inode_entry);
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = nffs_inode_from_entry(&inode, inode_entry);
+    TEST_ASSERT_FATAL(rc == 0);
+    TEST_ASSERT(inode.ni_flags == 0);
+
+    nffs_test_util_append_file("/new", data + 16, sizeof data - 16);
+    nffs_test_util_assert_contents("/new", data, sizeof data);
+
+    nffs_flash_loc_expand(inode_entry->nie_last_block_entry->nhe_flash_loc,
+                          &area_idx, &area_offset);
+    rc = nffs_block_read_disk(area_idx, area_offset, &disk_block);
+    TEST_ASSERT_FATAL(rc == 0);
+    TEST_ASSERT(disk_block.ndb_magic == NFFS_BLOCK_MAGIC);
+}
+
+TEST_SUITE(nffs_suite_large_blocks)
+{
+    int rc;
+
+    memset(&nffs_config, 0, sizeof nffs_config);
+    nffs_config.nc_block_max_data_sz = 16384;
+
+    rc = nffs_init();
+    TEST_ASSERT(rc == 0);
+
+    nffs_test_large_blocks();
+}
+
+TEST_SUITE(nffs_suite_lazy_blocks)
+{
+    int rc;
+
+    memset(&nffs_config, 0, sizeof nffs_config);
+    nffs_config.nc_num_blocks = 24;
+    nffs_config.nc_lazy_blocks = 1;
+
+    rc = nffs_init();
+    TEST_ASSERT(rc == 0);
+
+    nffs_test_lazy_blocks();
+}
+
+TEST_SUITE(nffs_suite_compress)
+{
+    int rc;
+
+    memset(&nffs_config, 0, sizeof nffs_config);
+    nffs_config.nc_compress = 1;
+
+    rc = nffs_init();
+    TEST_ASSERT(rc == 0);
+
+    nffs_test_compress();
+    nffs_test_compress_legacy_inode();
+}
+
+#define NFFS_TEST_ASYNC_MAX_REQS        4
+#define NFFS_TEST_ASYNC_STACK_SIZE      1024
+#define NFFS_TEST_ASYNC_EV_T            (OS_EVENT_T_PERUSER + 1)
+
+/* A flash sector outside of the nffs areas. */
+#define NFFS_TEST_ASYNC_ERASE_ADDR      0x00008000
+
+static struct os_task nffs_test_async_tasks[2];
+static os_stack_t nffs_test_async_stacks[2]
+    [OS_STACK_ALIGN(NFFS_TEST_ASYNC_STACK_SIZE)];
+static struct os_eventq nffs_test_async_evq;
+static int nffs_test_async_erase_rc;
+
+static void
+nffs_test_async_erase_done(void *arg, int rc)
+{
+    nffs_test_async_erase_rc = rc;
+}
+
+/**
+ * Submits requests to the lower priority worker task and checks their
+ * completions, then ends the test case.
+ */
+static void
+nffs_test_async_caller(void *arg)
+{
+    static struct fs_async_req reqs[NFFS_TEST_ASYNC_MAX_REQS + 1];
+    static char bufs[NFFS_TEST_ASYNC_MAX_REQS][8];
+    struct fs_async_req *req;
+    struct fs_file *file;
+    struct os_event *ev;
+    os_time_t start;
+    char data[NFFS_TEST_ASYNC_MAX_REQS * 8];
+    char expected[(NFFS_TEST_ASYNC_MAX_REQS + 1) * 8];
+    int rc;
+    int i;
+
+    rc = fs_open("/async", FS_ACCESS_WRITE | FS_ACCESS_TRUNCATE, &file);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    memset(reqs, 0, sizeof reqs);
+    start = os_time_get();
+
+    /* The worker doesn't run until this task blocks. */
+    for (i = 0; i < NFFS_TEST_ASYNC_MAX_REQS; i++) {
+        memset(bufs[i], 'a' + i, sizeof bufs[i]);
+        rc = fs_write_async(file, bufs[i], sizeof bufs[i],
+                            &nffs_test_async_evq, reqs + i);
+        TEST_ASSERT_FATAL(rc == 0);
+    }
+    rc = fs_write_async(file, bufs[0], sizeof bufs[0], &nffs_test_async_evq,
+                        reqs + i);
+    TEST_ASSERT(rc == FS_EBUSY);
+
+    /* Keep the worker waiting for two ticks. */
+    while (OS_TIME_TICK_LT(os_time_get(), start + 2)) {
+    }
+
+    /* Completions arrive in submission order. */
+    for (i = 0; i < NFFS_TEST_ASYNC_MAX_REQS; i++) {
+        ev = os_eventq_get(&nffs_test_async_evq);
+        TEST_ASSERT_FATAL(ev->ev_arg == reqs + i);
+        TEST_ASSERT(ev->ev_type == FS_EVENT_T_ASYNC_DONE);
+
+        req = ev->ev_arg;
+        TEST_ASSERT(req->far_rc == 0);
+        TEST_ASSERT(req->far_submit_time == start);
+        TEST_ASSERT(req->far_latency >= 2);
+    }
+
+    TEST_ASSERT(fs_async_stats.STATS_SECT_VAR(submitted) ==
+                NFFS_TEST_ASYNC_MAX_REQS);
+    TEST_ASSERT(fs_async_stats.STATS_SECT_VAR(rejected) == 1);
+    TEST_ASSERT(fs_async_stats.STATS_SECT_VAR(completed) ==
+                NFFS_TEST_ASYNC_MAX_REQS);
+    TEST_ASSERT(fs_async_stats.STATS_SECT_VAR(failed) == 0);
+    TEST_ASSERT(fs_async_stats.STATS_SECT_VAR(latency_total) >=
+                2 * NFFS_TEST_ASYNC_MAX_REQS);
+    TEST_ASSERT(fs_async_stats.STATS_SECT_VAR(latency_max) >= 2);
+    TEST_ASSERT(fs_async_stats.STATS_SECT_VAR(queue_max) ==
+                NFFS_TEST_ASYNC_MAX_REQS);
+
+    /* A failing request, completed with the caller's event type. */
+    req = reqs + NFFS_TEST_ASYNC_MAX_REQS;
+    req->far_ev_type = NFFS_TEST_ASYNC_EV_T;
+    rc = fs_read_async(file, sizeof data, data, &nffs_test_async_evq, req);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    ev = os_eventq_get(&nffs_test_async_evq);
+    TEST_ASSERT_FATAL(ev->ev_arg == req);
+    TEST_ASSERT(ev->ev_type == NFFS_TEST_ASYNC_EV_T);
+    TEST_ASSERT(req->far_rc != 0);
+    TEST_ASSERT(fs_async_stats.STATS_SECT_VAR(completed) ==
+                NFFS_TEST_ASYNC_MAX_REQS + 1);
+    TEST_ASSERT(fs_async_stats.STATS_SECT_VAR(failed) == 1);
+
+    /* A request that the worker has dequeued cannot be resubmitted.  Hold
+     * the flash device so that the worker blocks in the middle of a write.
+     */
+    native_flash_emu_init(NULL, NATIVE_FLASH_EMU_F_ASYNC);
+    nffs_test_async_erase_rc = -1;
+    rc = hal_flash_erase_sector_async(0, NFFS_TEST_ASYNC_ERASE_ADDR,
+                                      nffs_test_async_erase_done, NULL);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    req = reqs;
+    rc = fs_write_async(file, bufs[0], sizeof bufs[0], &nffs_test_async_evq,
+                        req);
+    TEST_ASSERT_FATAL(rc == 0);
+    os_time_delay(1);
+    TEST_ASSERT(!OS_EVENT_QUEUED(&req->far_ev));
+
+    rc = fs_write_async(file, bufs[1], sizeof bufs[1], &nffs_test_async_evq,
+                        req);
+    TEST_ASSERT(rc == FS_EBUSY);
+    TEST_ASSERT(req->far_data == bufs[0]);
+    TEST_ASSERT(fs_async_stats.STATS_SECT_VAR(rejected) == 2);
+
+    rc = native_flash_emu_complete();
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(nffs_test_async_erase_rc == 0);
+
+    ev = os_eventq_get(&nffs_test_async_evq);
+    TEST_ASSERT_FATAL(ev->ev_arg == req);
+    TEST_ASSERT(req->far_rc == 0);
+    native_flash_emu_init(NULL, 0);
+
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+
+    for (i = 0; i < NFFS_TEST_ASYNC_MAX_REQS; i++) {
+        memcpy(expected + i * 8, bufs[i], 8);
+    }
+    memcpy(expected + i * 8, bufs[0], 8);
+    nffs_test_util_assert_contents("/async", expected, sizeof expected);
+
+    tu_restart();
+}
+
+TEST_CASE(nffs_test_async)
+{
+    int rc;
+
+    static const struct nffs_area_desc area_descs_two[] = {
+        { 0x00020000, 128 * 1024 },
+        { 0x00040000, 128 * 1024 },
+        { 0, 0 },
+    };
+
+    os_init();
+
+    memset(&nffs_config, 0, sizeof nffs_config);
+    rc = nffs_init();
+    TEST_ASSERT_FATAL(rc == 0);
+
+    rc = nffs_format(area_descs_two);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    os_eventq_init(&nffs_test_async_evq);
+
+    rc = os_task_init(nffs_test_async_tasks, "caller",
+                      nffs_test_async_caller, NULL, 10, OS_WAIT_FOREVER,
+                      nffs_test_async_stacks[0],
+                      OS_STACK_ALIGN(NFFS_TEST_ASYNC_STACK_SIZE));
+    TEST_ASSERT_FATAL(rc == 0);
+
+    rc = fs_async_init(11, nffs_test_async_stacks[1],
+                       OS_STACK_ALIGN(NFFS_TEST_ASYNC_STACK_SIZE),
+                       NFFS_TEST_ASYNC_MAX_REQS);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    os_start();
+}
+
+#define NFFS_TEST_LOCK_STACK_SIZE       1024
+#define NFFS_TEST_LOCK_FILE_SIZE        1024
+
+/* A flash sector outside of the nffs areas. */
+#define NFFS_TEST_LOCK_ERASE_ADDR       0x00008000
+
+static struct os_task nffs_test_lock_tasks[4];
+static os_stack_t nffs_test_lock_stacks[4]
+    [OS_STACK_ALIGN(NFFS_TEST_LOCK_STACK_SIZE)];
+static struct fs_file *nffs_test_lock_read_files[2];
+static struct fs_file *nffs_test_lock_write_file;
+static uint8_t nffs_test_lock_data[NFFS_TEST_LOCK_FILE_SIZE];
+static int nffs_test_lock_erase_rc;
+static int nffs_test_lock_reader_done;
+static int nffs_test_lock_reader2_done;
+static int nffs_test_lock_writer_done;
+
+static void
+nffs_test_lock_idle(void)
+{
+    while (1) {
+        os_time_delay(OS_TICKS_PER_SEC);
+    }
+}
+
+static void
+nffs_test_lock_erase_done(void *arg, int rc)
+{
+    nffs_test_lock_erase_rc = rc;
+}
+
+/**
+ * First reader: starts an erase that holds the flash device, then reads the
+ * file.  The read blocks in the flash driver with the shared lock held.
+ */
+static void
+nffs_test_lock_reader(void *arg)
+{
+    static uint8_t buf[NFFS_TEST_LOCK_FILE_SIZE];
+    uint32_t len;
+    int rc;
+
+    rc = hal_flash_erase_sector_async(0, NFFS_TEST_LOCK_ERASE_ADDR,
+                                      nffs_test_lock_erase_done, NULL);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    rc = fs_read(nffs_test_lock_read_files[0], sizeof buf, buf, &len);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(len == sizeof buf);
+    TEST_ASSERT(memcmp(buf, nffs_test_lock_data, sizeof buf) == 0);
+
+    /* The writer is waiting for this read to finish. */
+    TEST_ASSERT(nffs_test_lock_writer_done == 0);
+    nffs_test_lock_reader_done = 1;
+
+    nffs_test_lock_idle();
+}
+
+/**
+ * Second reader: gets shared access while the first reader holds it.
+ */
+static void
+nffs_test_lock_reader2(void *arg)
+{
+    uint32_t len;
+    int rc;
+
+    TEST_ASSERT(nffs_test_lock_reader_done == 0);
+
+    rc = fs_filelen(nffs_test_lock_read_files[1], &len);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(len == NFFS_TEST_LOCK_FILE_SIZE);
+    nffs_test_lock_reader2_done = 1;
+
+    nffs_test_lock_idle();
+}
+
+/**
+ * Writer: needs exclusive access, so it waits for the first reader.
+ */
+static void
+nffs_test_lock_writer(void *arg)
+{
+    int rc;
+
+    rc = fs_write(nffs_test_lock_write_file, "abc", 3);
+    TEST_ASSERT(rc == 0);
+
+    TEST_ASSERT(nffs_test_lock_reader_done == 1);
+    nffs_test_lock_writer_done = 1;
+
+    nffs_test_lock_idle();
+}
+
+/**
+ * Runs once every other task is blocked.  Checks that only the second reader
+ * got through, then completes the erase to let the others finish.
+ */
+static void
+nffs_test_lock_control(void *arg)
+{
+    int rc;
+
+    TEST_ASSERT(nffs_test_lock_reader_done == 0);
+    TEST_ASSERT(nffs_test_lock_reader2_done == 1);
+    TEST_ASSERT(nffs_test_lock_writer_done == 0);
+
+    rc = native_flash_emu_complete();
+    TEST_ASSERT_FATAL(rc == 0);
+
+    /* Let the higher priority tasks finish. */
+    os_time_delay(1);
+
+    TEST_ASSERT(nffs_test_lock_erase_rc == 0);
+    TEST_ASSERT(nffs_test_lock_reader_done == 1);
+    TEST_ASSERT(nffs_test_lock_writer_done == 1);
+
+    native_flash_emu_init(NULL, 0);
+
+    rc = fs_close(nffs_test_lock_write_file);
+    TEST_ASSERT(rc == 0);
+    rc = fs_close(nffs_test_lock_read_files[0]);
+    TEST_ASSERT(rc == 0);
+    rc = fs_close(nffs_test_lock_read_files[1]);
+    TEST_ASSERT(rc == 0);
+    nffs_test_util_assert_contents("/log", "abc", 3);
+
+    tu_restart();
+}
+
+TEST_CASE(nffs_test_lock)
+{
+    uint32_t len;
+    int rc;
+    int i;
+
+    static const struct nffs_area_desc area_descs_two[] = {
+        { 0x00020000, 128 * 1024 },
+        { 0x00040000, 128 * 1024 },
+        { 0, 0 },
+    };
+
+    static const os_task_func_t funcs[4] = {
+        nffs_test_lock_reader,
+        nffs_test_lock_reader2,
+        nffs_test_lock_writer,
+        nffs_test_lock_control,
+    };
+
+    os_init();
+
+    memset(&nffs_config, 0, sizeof nffs_config);
+    rc = nffs_init();
+    TEST_ASSERT_FATAL(rc == 0);
+
+    rc = nffs_format(area_descs_two);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    nffs_test_cache_index_fill(nffs_test_lock_data, 0,
+                               sizeof nffs_test_lock_data);
+    nffs_test_util_create_file("/data", (char *)nffs_test_lock_data,
+                               sizeof nffs_test_lock_data);
+
+    /* Load the file's blocks into the cache so that the readers only need
+     * the flash for file data.
+     */
+    for (i = 0; i < 2; i++) {
+        rc = fs_open("/data", FS_ACCESS_READ, nffs_test_lock_read_files + i);
+        TEST_ASSERT_FATAL(rc == 0);
+        rc = fs_filelen(nffs_test_lock_read_files[i], &len);
+        TEST_ASSERT_FATAL(rc == 0);
     }
+    rc = fs_open("/log", FS_ACCESS_WRITE | FS_ACCESS_TRUNCATE,
+                 &nffs_test_lock_write_file);
+    TEST_ASSERT_FATAL(rc == 0);
 
-    for (i = 0; i < 256; i++) {
-        nffs_test_util_create_file("/myfile.txt", data, sizeof data);
-        rc = fs_unlink("/myfile.txt");
-        TEST_ASSERT(rc == 0);
+    nffs_test_lock_erase_rc = -1;
+    nffs_test_lock_reader_done = 0;
+    nffs_test_lock_reader2_done = 0;
+    nffs_test_lock_writer_done = 0;
+    native_flash_emu_init(NULL, NATIVE_FLASH_EMU_F_ASYNC);
+
+    for (i = 0; i < 4; i++) {
+        rc = os_task_init(nffs_test_lock_tasks + i, "lock", funcs[i], NULL,
+                          10 + i, OS_WAIT_FOREVER, nffs_test_lock_stacks[i],
+                          OS_STACK_ALIGN(NFFS_TEST_LOCK_STACK_SIZE));
+        TEST_ASSERT_FATAL(rc == 0);
     }
 
-    nffs_test_util_create_file("/myfile.txt", data, sizeof data);
+    os_start();
+}
 
-    struct nffs_test_file_desc *expected_system =
-        (struct nffs_test_file_desc[]) { {
-            .filename = "",
-            .is_dir = 1,
-            .children = (struct nffs_test_file_desc[]) { {
-                .filename = "myfile.txt",
-                .contents = data,
-                .contents_len = sizeof data,
-            }, {
-                .filename = NULL,
-            } },
-    } };
+static struct os_task nffs_test_lat_task;
+static os_stack_t nffs_test_lat_stack[OS_STACK_ALIGN(1024)];
 
-    nffs_test_assert_system(expected_system, area_descs_two);
+/**
+ * Performs each file operation once and checks that it lands in exactly one
+ * latency bucket.
+ */
+static void
+nffs_test_lat_task_func(void *arg)
+{
+    struct fs_iovec iov[2];
+    struct fs_file *file;
+    uint32_t writes;
+    uint32_t reads;
+    uint32_t len;
+    char data[] = "abcdefgh";
+    uint8_t buf[8];
+    int rc;
+
+    rc = fs_open("/lat", FS_ACCESS_WRITE | FS_ACCESS_TRUNCATE, &file);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    writes = nffs_test_util_lat_count(&nffs_stats.swrite_lat_100us);
+    rc = fs_write(file, data, 4);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(nffs_test_util_lat_count(&nffs_stats.swrite_lat_100us) ==
+                writes + 1);
+
+    iov[0].fi_base = data + 4;
+    iov[0].fi_len = 2;
+    iov[1].fi_base = data + 6;
+    iov[1].fi_len = 2;
+    rc = fs_writev(file, iov, 2);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(nffs_test_util_lat_count(&nffs_stats.swrite_lat_100us) ==
+                writes + 2);
+
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+
+    rc = fs_open("/lat", FS_ACCESS_READ, &file);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    reads = nffs_test_util_lat_count(&nffs_stats.sread_lat_100us);
+    rc = fs_read(file, 4, buf, &len);
+    TEST_ASSERT(rc == 0 && len == 4);
+    TEST_ASSERT(nffs_test_util_lat_count(&nffs_stats.sread_lat_100us) ==
+                reads + 1);
+
+    iov[0].fi_base = buf + 4;
+    iov[0].fi_len = 2;
+    iov[1].fi_base = buf + 6;
+    iov[1].fi_len = 2;
+    rc = fs_readv(file, iov, 2, &len);
+    TEST_ASSERT(rc == 0 && len == 4);
+    TEST_ASSERT(nffs_test_util_lat_count(&nffs_stats.sread_lat_100us) ==
+                reads + 2);
+    TEST_ASSERT(memcmp(buf, data, 8) == 0);
+
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+
+    tu_restart();
+}
+
+TEST_CASE(nffs_test_stats_lat)
+{
+    int rc;
+
+    static const struct nffs_area_desc area_descs_two[] = {
+        { 0x00020000, 128 * 1024 },
+        { 0x00040000, 128 * 1024 },
+        { 0, 0 },
+    };
+
+    os_init();
+
+    /* Latencies are only recorded while cputime runs. */
+    rc = cputime_init(1000000);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    memset(&nffs_config, 0, sizeof nffs_config);
+    rc = nffs_init();
+    TEST_ASSERT_FATAL(rc == 0);
+
+    rc = nffs_format(area_descs_two);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    rc = os_task_init(&nffs_test_lat_task, "lat", nffs_test_lat_task_func,
+                      NULL, 10, OS_WAIT_FOREVER, nffs_test_lat_stack,
+                      OS_STACK_ALIGN(1024));
+    TEST_ASSERT_FATAL(rc == 0);
+
+    os_start();
+}
+
+TEST_SUITE(nffs_suite_async)
+{
+    nffs_test_async();
+}
+
+TEST_SUITE(nffs_suite_stats_lat)
+{
+    nffs_test_stats_lat();
+}
+
+TEST_SUITE(nffs_suite_lock)
+{
+    nffs_test_lock();
+}
+
+TEST_SUITE(nffs_suite_gc)
+{
+    nffs_test_gc_bulk_buf();
+}
+
+TEST_SUITE(nffs_suite_hash)
+{
+    nffs_test_hash();
+}
+
+TEST_SUITE(nffs_suite_path_cache)
+{
+    int rc;
+
+    memset(&nffs_config, 0, sizeof nffs_config);
+    nffs_config.nc_num_cache_paths = 8;
+
+    rc = nffs_init();
+    TEST_ASSERT(rc == 0);
+
+    nffs_test_path_cache();
+
+    nffs_config.nc_num_cache_paths = 0;
+
+    rc = nffs_init();
+    TEST_ASSERT(rc == 0);
+
+    nffs_test_path_cache_off();
 }
 
 TEST_SUITE(nffs_suite_cache)
@@ -2416,11 +5145,14 @@ TEST_SUITE(nffs_suite_cache)
     memset(&nffs_config, 0, sizeof nffs_config);
     nffs_config.nc_num_cache_inodes = 4;
     nffs_config.nc_num_cache_blocks = 64;
+    nffs_config.nc_num_cache_indexes = 2;
 
     rc = nffs_init();
     TEST_ASSERT(rc == 0);
 
     nffs_test_cache_large_file();
+    nffs_test_cache_index();
+    nffs_test_cache_readahead();
 }
 
 static void
@@ -2437,6 +5169,7 @@ nffs_test_gen(void)
     nffs_test_truncate();
     nffs_test_append();
     nffs_test_read();
+    nffs_test_read_ptr();
     nffs_test_open();
     nffs_test_overwrite_one();
     nffs_test_overwrite_two();
@@ -2447,6 +5180,9 @@ nffs_test_gen(void)
     nffs_test_many_children();
     nffs_test_gc();
     nffs_test_wear_level();
+    nffs_test_gc_cost_benefit();
+    nffs_test_gc_incremental();
+    nffs_test_gc_incremental_reset();
     nffs_test_corrupt_scratch();
     nffs_test_incomplete_block();
     nffs_test_corrupt_block();
@@ -2454,7 +5190,11 @@ nffs_test_gen(void)
     nffs_test_large_system();
     nffs_test_lost_found();
     nffs_test_readdir();
+    nffs_test_readdir_stat();
+    nffs_test_vectored_io();
     nffs_test_split_file();
+    nffs_test_checkpoint();
+    nffs_test_stats();
 }
 
 TEST_SUITE(gen_1_1)
@@ -2468,6 +5208,8 @@ TEST_SUITE(gen_4_32)
 {
     nffs_config.nc_num_cache_inodes = 4;
     nffs_config.nc_num_cache_blocks = 32;
+    nffs_config.nc_num_cache_indexes = 2;
+    nffs_config.nc_num_cache_paths = 8;
     nffs_test_gen();
 }
 
@@ -2475,6 +5217,7 @@ TEST_SUITE(gen_32_1024)
 {
     nffs_config.nc_num_cache_inodes = 32;
     nffs_config.nc_num_cache_blocks = 1024;
+    nffs_config.nc_bulk_buf_size = 4096;
     nffs_test_gen();
 }
 
@@ -2484,7 +5227,20 @@ nffs_test_all(void)
     gen_1_1();
     gen_4_32();
     gen_32_1024();
+    nffs_suite_path_cache();
     nffs_suite_cache();
+    nffs_suite_write_buf();
+    nffs_suite_large_blocks();
+    nffs_suite_lazy_blocks();
+    nffs_suite_compress();
+    nffs_suite_async();
+    nffs_suite_lock();
+    nffs_suite_stats_lat();
+    nffs_suite_gc();
+    nffs_suite_hash();
+#ifdef NFFS_TEST_BENCH
+    nffs_suite_bench();
+#endif
 
     return tu_any_failed;
 }
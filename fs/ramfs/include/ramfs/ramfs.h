@@ -0,0 +1,51 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef H_RAMFS_
+#define H_RAMFS_
+
+#include <inttypes.h>
+
+#define RAMFS_FILENAME_MAX_LEN  31  /* Does not require null terminator. */
+
+struct ramfs_config {
+    /** Maximum number of files and directories; default=32. */
+    uint32_t rc_num_inodes;
+
+    /**
+     * Number of data blocks; default=64.  The file system holds at most
+     * rc_num_blocks * rc_block_size bytes of file data.
+     */
+    uint32_t rc_num_blocks;
+
+    /** Size of a data block, in bytes; default=256. */
+    uint32_t rc_block_size;
+
+    /** Maximum number of open files; default=4. */
+    uint32_t rc_num_files;
+
+    /** Maximum number of open directories; default=2. */
+    uint32_t rc_num_dirs;
+};
+
+extern struct ramfs_config ramfs_config;
+
+int ramfs_init(const char *mount_point);
+
+#endif
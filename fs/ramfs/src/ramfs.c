@@ -0,0 +1,1214 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/**
+ * RAM-backed file system.  Files and directories live in a tree of inodes;
+ * file data is kept in a list of fixed-size blocks per file.  All storage
+ * comes from memory pools sized by ramfs_config, so the file system's
+ * capacity is fixed at init time.  Contents do not survive a reset.
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "os/os.h"
+#include "os/queue.h"
+#include "fs/fs.h"
+#include "fs/fs_if.h"
+#include "ramfs/ramfs.h"
+
+struct ramfs_block {
+    SLIST_ENTRY(ramfs_block) rb_next;
+    /* ramfs_config.rc_block_size bytes of data follow. */
+};
+
+#define RAMFS_BLOCK_DATA(block)     ((uint8_t *)((block) + 1))
+
+SLIST_HEAD(ramfs_block_list, ramfs_block);
+SLIST_HEAD(ramfs_inode_list, ramfs_inode);
+
+struct ramfs_inode {
+    SLIST_ENTRY(ramfs_inode) ri_sibling_next;
+    struct ramfs_inode *ri_parent;      /* NULL if root or unlinked. */
+    struct ramfs_inode_list ri_child_list;  /* Directories only; sorted. */
+    struct ramfs_block_list ri_block_list;  /* Files only. */
+    uint32_t ri_size;
+    uint16_t ri_refcnt;
+    uint8_t ri_is_dir;
+    uint8_t ri_name_len;
+    char ri_name[RAMFS_FILENAME_MAX_LEN];
+};
+
+struct ramfs_file {
+    const struct fs_ops *rf_fops;       /* Must be first; see fs_if.h. */
+    struct ramfs_inode *rf_inode;
+    uint32_t rf_offset;
+    uint8_t rf_access_flags;
+};
+
+struct ramfs_dirent {
+    const struct fs_ops *rde_fops;      /* Must be first; see fs_if.h. */
+    struct ramfs_inode *rde_inode;
+};
+
+struct ramfs_dir {
+    const struct fs_ops *rd_fops;       /* Must be first; see fs_if.h. */
+    struct ramfs_inode *rd_parent;
+    struct ramfs_dirent rd_dirent;
+};
+
+/** The result of a path lookup. */
+struct ramfs_path {
+    struct ramfs_inode *rp_inode;       /* NULL if not found. */
+    struct ramfs_inode *rp_parent;      /* Directory holding the last path
+                                           component; NULL if an
+                                           intermediate directory is
+                                           missing. */
+    const char *rp_name;                /* Last path component. */
+    uint8_t rp_name_len;
+};
+
+struct ramfs_config ramfs_config;
+
+static const struct ramfs_config ramfs_config_dflt = {
+    .rc_num_inodes = 32,
+    .rc_num_blocks = 64,
+    .rc_block_size = 256,
+    .rc_num_files = 4,
+    .rc_num_dirs = 2,
+};
+
+static struct os_mutex ramfs_mutex;
+
+static struct os_mempool ramfs_inode_pool;
+static struct os_mempool ramfs_block_pool;
+static struct os_mempool ramfs_file_pool;
+static struct os_mempool ramfs_dir_pool;
+
+static void *ramfs_inode_mem;
+static void *ramfs_block_mem;
+static void *ramfs_file_mem;
+static void *ramfs_dir_mem;
+
+static struct ramfs_inode *ramfs_root_dir;
+
+static int ramfs_open(const char *path, uint8_t access_flags,
+  struct fs_file **out_file);
+static int ramfs_close(struct fs_file *fs_file);
+static int ramfs_read(struct fs_file *fs_file, uint32_t len, void *out_data,
+  uint32_t *out_len);
+static int ramfs_write(struct fs_file *fs_file, const void *data, int len);
+static int ramfs_seek(struct fs_file *fs_file, uint32_t offset);
+static uint32_t ramfs_getpos(const struct fs_file *fs_file);
+static int ramfs_file_len(const struct fs_file *fs_file, uint32_t *out_len);
+static int ramfs_unlink(const char *path);
+static int ramfs_rename(const char *from, const char *to);
+static int ramfs_mkdir(const char *path);
+static int ramfs_opendir(const char *path, struct fs_dir **out_fs_dir);
+static int ramfs_readdir(struct fs_dir *fs_dir,
+  struct fs_dirent **out_fs_dirent);
+static int ramfs_readdir_stat(struct fs_dir *fs_dir,
+  struct fs_dirent_stat *out_stats, int max_stats, int *out_num_stats);
+static int ramfs_closedir(struct fs_dir *fs_dir);
+static int ramfs_dirent_name(const struct fs_dirent *fs_dirent, size_t max_len,
+  char *out_name, uint8_t *out_name_len);
+static int ramfs_dirent_is_dir(const struct fs_dirent *fs_dirent);
+
+static const struct fs_ops ramfs_ops = {
+    .f_open = ramfs_open,
+    .f_close = ramfs_close,
+    .f_read = ramfs_read,
+    .f_write = ramfs_write,
+
+    .f_seek = ramfs_seek,
+    .f_getpos = ramfs_getpos,
+    .f_filelen = ramfs_file_len,
+
+    .f_unlink = ramfs_unlink,
+    .f_rename = ramfs_rename,
+    .f_mkdir = ramfs_mkdir,
+
+    .f_opendir = ramfs_opendir,
+    .f_readdir = ramfs_readdir,
+    .f_readdir_stat = ramfs_readdir_stat,
+    .f_closedir = ramfs_closedir,
+
+    .f_dirent_name = ramfs_dirent_name,
+    .f_dirent_is_dir = ramfs_dirent_is_dir,
+
+    .f_name = "ramfs"
+};
+
+static void
+ramfs_lock(void)
+{
+    int rc;
+
+    rc = os_mutex_pend(&ramfs_mutex, 0xffffffff);
+    assert(rc == 0 || rc == OS_NOT_STARTED);
+}
+
+static void
+ramfs_unlock(void)
+{
+    int rc;
+
+    rc = os_mutex_release(&ramfs_mutex);
+    assert(rc == 0 || rc == OS_NOT_STARTED);
+}
+
+static int
+ramfs_ready(void)
+{
+    return ramfs_root_dir != NULL;
+}
+
+static int
+ramfs_name_cmp(const struct ramfs_inode *inode, const char *name,
+               uint8_t name_len)
+{
+    int min_len;
+    int rc;
+
+    if (inode->ri_name_len < name_len) {
+        min_len = inode->ri_name_len;
+    } else {
+        min_len = name_len;
+    }
+
+    rc = memcmp(inode->ri_name, name, min_len);
+    if (rc != 0) {
+        return rc;
+    }
+    return (int)inode->ri_name_len - (int)name_len;
+}
+
+static uint32_t
+ramfs_num_blocks(uint32_t size)
+{
+    return (size + ramfs_config.rc_block_size - 1) /
+           ramfs_config.rc_block_size;
+}
+
+/**
+ * Releases all of a file's data blocks.
+ */
+static void
+ramfs_inode_truncate(struct ramfs_inode *inode)
+{
+    struct ramfs_block *block;
+
+    while ((block = SLIST_FIRST(&inode->ri_block_list)) != NULL) {
+        SLIST_REMOVE_HEAD(&inode->ri_block_list, rb_next);
+        os_memblock_put(&ramfs_block_pool, block);
+    }
+    inode->ri_size = 0;
+}
+
+static void
+ramfs_inode_dec_refcnt(struct ramfs_inode *inode)
+{
+    assert(inode->ri_refcnt > 0);
+    inode->ri_refcnt--;
+    if (inode->ri_refcnt == 0) {
+        assert(inode->ri_parent == NULL);
+        assert(SLIST_EMPTY(&inode->ri_child_list));
+        ramfs_inode_truncate(inode);
+        os_memblock_put(&ramfs_inode_pool, inode);
+    }
+}
+
+/**
+ * Links an inode into a directory, keeping the directory's children sorted
+ * by name.
+ */
+static void
+ramfs_inode_add_child(struct ramfs_inode *parent, struct ramfs_inode *child)
+{
+    struct ramfs_inode *prev;
+    struct ramfs_inode *cur;
+
+    assert(parent->ri_is_dir);
+
+    prev = NULL;
+    SLIST_FOREACH(cur, &parent->ri_child_list, ri_sibling_next) {
+        if (ramfs_name_cmp(cur, child->ri_name, child->ri_name_len) > 0) {
+            break;
+        }
+        prev = cur;
+    }
+
+    if (prev == NULL) {
+        SLIST_INSERT_HEAD(&parent->ri_child_list, child, ri_sibling_next);
+    } else {
+        SLIST_INSERT_AFTER(prev, child, ri_sibling_next);
+    }
+    child->ri_parent = parent;
+}
+
+static void
+ramfs_inode_remove_child(struct ramfs_inode *child)
+{
+    SLIST_REMOVE(&child->ri_parent->ri_child_list, child, ramfs_inode,
+                 ri_sibling_next);
+    child->ri_parent = NULL;
+}
+
+/**
+ * Removes an inode from the tree.  A directory's descendants are unlinked
+ * recursively.  The inode is freed once its last handle is closed.
+ */
+static void
+ramfs_inode_unlink(struct ramfs_inode *inode)
+{
+    struct ramfs_inode *child;
+
+    while ((child = SLIST_FIRST(&inode->ri_child_list)) != NULL) {
+        ramfs_inode_unlink(child);
+    }
+
+    ramfs_inode_remove_child(inode);
+    ramfs_inode_dec_refcnt(inode);
+}
+
+static int
+ramfs_inode_new(struct ramfs_inode *parent, const char *name,
+                uint8_t name_len, int is_dir, struct ramfs_inode **out_inode)
+{
+    struct ramfs_inode *inode;
+
+    inode = os_memblock_get(&ramfs_inode_pool);
+    if (inode == NULL) {
+        return FS_ENOMEM;
+    }
+
+    memset(inode, 0, sizeof *inode);
+    SLIST_INIT(&inode->ri_child_list);
+    SLIST_INIT(&inode->ri_block_list);
+    inode->ri_refcnt = 1;
+    inode->ri_is_dir = is_dir;
+    inode->ri_name_len = name_len;
+    memcpy(inode->ri_name, name, name_len);
+
+    if (parent != NULL) {
+        ramfs_inode_add_child(parent, inode);
+    }
+
+    *out_inode = inode;
+    return 0;
+}
+
+/**
+ * Indicates whether one inode is the other, or one of its ancestors.
+ */
+static int
+ramfs_inode_is_ancestor(const struct ramfs_inode *anc,
+                        const struct ramfs_inode *inode)
+{
+    for (; inode != NULL; inode = inode->ri_parent) {
+        if (inode == anc) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Looks up an absolute path.
+ *
+ * @param path                  The path to look up.
+ * @param out_path              The result of the lookup gets written here.
+ *
+ * @return                      0 if the path exists;
+ *                              FS_ENOENT if it does not (rp_parent
+ *                                  indicates whether only the last
+ *                                  component is missing);
+ *                              FS_EINVAL if the path is malformed.
+ */
+static int
+ramfs_path_find(const char *path, struct ramfs_path *out_path)
+{
+    struct ramfs_inode *parent;
+    struct ramfs_inode *cur;
+    const char *token;
+    size_t token_len;
+
+    if (path[0] != '/') {
+        return FS_EINVAL;
+    }
+
+    parent = NULL;
+    cur = ramfs_root_dir;
+    token = NULL;
+    token_len = 0;
+
+    while (1) {
+        while (*path == '/') {
+            path++;
+        }
+        if (*path == '\0') {
+            break;
+        }
+
+        token = path;
+        token_len = strcspn(path, "/");
+        path += token_len;
+        if (token_len > RAMFS_FILENAME_MAX_LEN) {
+            return FS_EINVAL;
+        }
+
+        if (cur == NULL || !cur->ri_is_dir) {
+            /* An intermediate directory is missing. */
+            parent = NULL;
+            cur = NULL;
+            continue;
+        }
+
+        parent = cur;
+        SLIST_FOREACH(cur, &parent->ri_child_list, ri_sibling_next) {
+            if (ramfs_name_cmp(cur, token, token_len) == 0) {
+                break;
+            }
+        }
+    }
+
+    out_path->rp_inode = cur;
+    out_path->rp_parent = parent;
+    out_path->rp_name = token;
+    out_path->rp_name_len = token_len;
+
+    if (cur == NULL) {
+        return FS_ENOENT;
+    }
+    return 0;
+}
+
+/**
+ * Opens a file at the specified path.  The access flags are interpreted as
+ * they are by NFFS; FS_ACCESS_COMPRESS is not supported.
+ */
+static int
+ramfs_open(const char *path, uint8_t access_flags, struct fs_file **out_fs_file)
+{
+    struct ramfs_path rp;
+    struct ramfs_inode *inode;
+    struct ramfs_file *file;
+    int rc;
+
+    file = NULL;
+    ramfs_lock();
+
+    if (!ramfs_ready()) {
+        rc = FS_EUNINIT;
+        goto err;
+    }
+
+    /* Reject invalid access flag combinations. */
+    if (!(access_flags & (FS_ACCESS_READ | FS_ACCESS_WRITE))) {
+        rc = FS_EINVAL;
+        goto err;
+    }
+    if (access_flags & (FS_ACCESS_APPEND | FS_ACCESS_TRUNCATE) &&
+        !(access_flags & FS_ACCESS_WRITE)) {
+
+        rc = FS_EINVAL;
+        goto err;
+    }
+    if (access_flags & FS_ACCESS_APPEND &&
+        access_flags & FS_ACCESS_TRUNCATE) {
+
+        rc = FS_EINVAL;
+        goto err;
+    }
+    if (access_flags & FS_ACCESS_COMPRESS) {
+        rc = FS_ENOTSUP;
+        goto err;
+    }
+
+    file = os_memblock_get(&ramfs_file_pool);
+    if (file == NULL) {
+        rc = FS_ENOMEM;
+        goto err;
+    }
+
+    rc = ramfs_path_find(path, &rp);
+    switch (rc) {
+    case 0:
+        inode = rp.rp_inode;
+        if (inode->ri_is_dir) {
+            rc = FS_EINVAL;
+            goto err;
+        }
+        if (access_flags & FS_ACCESS_TRUNCATE) {
+            ramfs_inode_truncate(inode);
+        }
+        break;
+
+    case FS_ENOENT:
+        /* Only the last path component may be missing, and only writers
+         * create files.
+         */
+        if (rp.rp_parent == NULL || !(access_flags & FS_ACCESS_WRITE)) {
+            goto err;
+        }
+        rc = ramfs_inode_new(rp.rp_parent, rp.rp_name, rp.rp_name_len, 0,
+                             &inode);
+        if (rc != 0) {
+            goto err;
+        }
+        /* The new inode's reference belongs to its directory. */
+        break;
+
+    default:
+        goto err;
+    }
+
+    inode->ri_refcnt++;
+
+    file->rf_fops = &ramfs_ops;
+    file->rf_inode = inode;
+    file->rf_access_flags = access_flags;
+    if (access_flags & FS_ACCESS_APPEND) {
+        file->rf_offset = inode->ri_size;
+    } else {
+        file->rf_offset = 0;
+    }
+
+    ramfs_unlock();
+
+    *out_fs_file = (struct fs_file *)file;
+    return 0;
+
+err:
+    if (file != NULL) {
+        os_memblock_put(&ramfs_file_pool, file);
+    }
+    ramfs_unlock();
+    *out_fs_file = NULL;
+    return rc;
+}
+
+static int
+ramfs_close(struct fs_file *fs_file)
+{
+    struct ramfs_file *file = (struct ramfs_file *)fs_file;
+
+    if (file == NULL) {
+        return 0;
+    }
+
+    ramfs_lock();
+    ramfs_inode_dec_refcnt(file->rf_inode);
+    os_memblock_put(&ramfs_file_pool, file);
+    ramfs_unlock();
+
+    return 0;
+}
+
+/**
+ * Finds the data block containing the specified file offset.
+ */
+static struct ramfs_block *
+ramfs_block_find(const struct ramfs_inode *inode, uint32_t offset)
+{
+    struct ramfs_block *block;
+    uint32_t idx;
+
+    idx = offset / ramfs_config.rc_block_size;
+    SLIST_FOREACH(block, &inode->ri_block_list, rb_next) {
+        if (idx == 0) {
+            break;
+        }
+        idx--;
+    }
+
+    return block;
+}
+
+static int
+ramfs_read(struct fs_file *fs_file, uint32_t len, void *out_data,
+           uint32_t *out_len)
+{
+    struct ramfs_file *file = (struct ramfs_file *)fs_file;
+    struct ramfs_inode *inode;
+    struct ramfs_block *block;
+    uint32_t block_off;
+    uint32_t chunk_len;
+    uint32_t bytes_read;
+    uint8_t *dst;
+
+    if (!(file->rf_access_flags & FS_ACCESS_READ)) {
+        return FS_EACCESS;
+    }
+
+    ramfs_lock();
+
+    inode = file->rf_inode;
+
+    /* Another handle may have truncated the file. */
+    if (file->rf_offset > inode->ri_size) {
+        file->rf_offset = inode->ri_size;
+    }
+    if (len > inode->ri_size - file->rf_offset) {
+        len = inode->ri_size - file->rf_offset;
+    }
+
+    dst = out_data;
+    bytes_read = 0;
+    block = ramfs_block_find(inode, file->rf_offset);
+    block_off = file->rf_offset % ramfs_config.rc_block_size;
+    while (bytes_read < len) {
+        assert(block != NULL);
+
+        chunk_len = ramfs_config.rc_block_size - block_off;
+        if (chunk_len > len - bytes_read) {
+            chunk_len = len - bytes_read;
+        }
+        memcpy(dst + bytes_read, RAMFS_BLOCK_DATA(block) + block_off,
+               chunk_len);
+
+        bytes_read += chunk_len;
+        block_off = 0;
+        block = SLIST_NEXT(block, rb_next);
+    }
+
+    file->rf_offset += bytes_read;
+
+    ramfs_unlock();
+
+    if (out_len != NULL) {
+        *out_len = bytes_read;
+    }
+    return 0;
+}
+
+/**
+ * Writes to a file.  Either the whole write succeeds, or the file is left
+ * unchanged; FS_EFULL indicates the data block pool is exhausted.
+ */
+static int
+ramfs_write(struct fs_file *fs_file, const void *data, int len)
+{
+    struct ramfs_file *file = (struct ramfs_file *)fs_file;
+    struct ramfs_inode *inode;
+    struct ramfs_block *block;
+    struct ramfs_block *last;
+    const uint8_t *src;
+    uint32_t num_blocks;
+    uint32_t block_off;
+    uint32_t chunk_len;
+    uint32_t written;
+    uint32_t end;
+    uint32_t i;
+
+    if (!(file->rf_access_flags & FS_ACCESS_WRITE)) {
+        return FS_EACCESS;
+    }
+    if (len <= 0) {
+        return 0;
+    }
+
+    ramfs_lock();
+
+    inode = file->rf_inode;
+    if (file->rf_access_flags & FS_ACCESS_APPEND ||
+        file->rf_offset > inode->ri_size) {
+
+        file->rf_offset = inode->ri_size;
+    }
+    end = file->rf_offset + len;
+
+    /* Make sure all the required blocks are available before changing
+     * anything.
+     */
+    num_blocks = ramfs_num_blocks(inode->ri_size);
+    if (ramfs_num_blocks(end) > num_blocks) {
+        if (ramfs_num_blocks(end) - num_blocks >
+            (uint32_t)ramfs_block_pool.mp_num_free) {
+
+            ramfs_unlock();
+            return FS_EFULL;
+        }
+
+        last = NULL;
+        SLIST_FOREACH(block, &inode->ri_block_list, rb_next) {
+            last = block;
+        }
+        for (i = num_blocks; i < ramfs_num_blocks(end); i++) {
+            block = os_memblock_get(&ramfs_block_pool);
+            assert(block != NULL);
+            if (last == NULL) {
+                SLIST_INSERT_HEAD(&inode->ri_block_list, block, rb_next);
+            } else {
+                SLIST_INSERT_AFTER(last, block, rb_next);
+            }
+            last = block;
+        }
+    }
+
+    src = data;
+    written = 0;
+    block = ramfs_block_find(inode, file->rf_offset);
+    block_off = file->rf_offset % ramfs_config.rc_block_size;
+    while (written < len) {
+        chunk_len = ramfs_config.rc_block_size - block_off;
+        if (chunk_len > len - written) {
+            chunk_len = len - written;
+        }
+        memcpy(RAMFS_BLOCK_DATA(block) + block_off, src + written, chunk_len);
+
+        written += chunk_len;
+        block_off = 0;
+        block = SLIST_NEXT(block, rb_next);
+    }
+
+    file->rf_offset = end;
+    if (end > inode->ri_size) {
+        inode->ri_size = end;
+    }
+
+    ramfs_unlock();
+
+    return 0;
+}
+
+static int
+ramfs_seek(struct fs_file *fs_file, uint32_t offset)
+{
+    struct ramfs_file *file = (struct ramfs_file *)fs_file;
+    int rc;
+
+    ramfs_lock();
+    if (offset > file->rf_inode->ri_size) {
+        rc = FS_EOFFSET;
+    } else {
+        file->rf_offset = offset;
+        rc = 0;
+    }
+    ramfs_unlock();
+
+    return rc;
+}
+
+static uint32_t
+ramfs_getpos(const struct fs_file *fs_file)
+{
+    const struct ramfs_file *file = (const struct ramfs_file *)fs_file;
+
+    return file->rf_offset;
+}
+
+static int
+ramfs_file_len(const struct fs_file *fs_file, uint32_t *out_len)
+{
+    const struct ramfs_file *file = (const struct ramfs_file *)fs_file;
+
+    ramfs_lock();
+    *out_len = file->rf_inode->ri_size;
+    ramfs_unlock();
+
+    return 0;
+}
+
+/**
+ * Unlinks the file or directory at the specified path.  A directory's
+ * descendants are unlinked recursively.  Open handles remain usable until
+ * closed.
+ */
+static int
+ramfs_unlink(const char *path)
+{
+    struct ramfs_path rp;
+    int rc;
+
+    ramfs_lock();
+
+    if (!ramfs_ready()) {
+        rc = FS_EUNINIT;
+        goto done;
+    }
+
+    rc = ramfs_path_find(path, &rp);
+    if (rc != 0) {
+        goto done;
+    }
+    if (rp.rp_inode == ramfs_root_dir) {
+        rc = FS_EINVAL;
+        goto done;
+    }
+
+    ramfs_inode_unlink(rp.rp_inode);
+
+done:
+    ramfs_unlock();
+    return rc;
+}
+
+/**
+ * Renames a file or directory.  An existing destination of the same type is
+ * replaced.
+ */
+static int
+ramfs_rename(const char *from, const char *to)
+{
+    struct ramfs_inode *inode;
+    struct ramfs_path rp;
+    int rc;
+
+    ramfs_lock();
+
+    if (!ramfs_ready()) {
+        rc = FS_EUNINIT;
+        goto done;
+    }
+
+    rc = ramfs_path_find(from, &rp);
+    if (rc != 0) {
+        goto done;
+    }
+    inode = rp.rp_inode;
+    if (inode == ramfs_root_dir) {
+        rc = FS_EINVAL;
+        goto done;
+    }
+
+    rc = ramfs_path_find(to, &rp);
+    switch (rc) {
+    case 0:
+        if (rp.rp_inode == inode) {
+            goto done;
+        }
+
+        /* Cannot clobber one type of file with another, or a directory
+         * containing the source.
+         */
+        if (rp.rp_inode->ri_is_dir != inode->ri_is_dir ||
+            ramfs_inode_is_ancestor(rp.rp_inode, inode)) {
+
+            rc = FS_EINVAL;
+            goto done;
+        }
+        break;
+
+    case FS_ENOENT:
+        if (rp.rp_parent == NULL) {
+            /* Intermediate directory doesn't exist. */
+            rc = FS_EINVAL;
+            goto done;
+        }
+        break;
+
+    default:
+        goto done;
+    }
+
+    /* A directory cannot be moved into itself. */
+    if (ramfs_inode_is_ancestor(inode, rp.rp_parent)) {
+        rc = FS_EINVAL;
+        goto done;
+    }
+
+    if (rp.rp_inode != NULL) {
+        ramfs_inode_unlink(rp.rp_inode);
+    }
+
+    ramfs_inode_remove_child(inode);
+    inode->ri_name_len = rp.rp_name_len;
+    memcpy(inode->ri_name, rp.rp_name, rp.rp_name_len);
+    ramfs_inode_add_child(rp.rp_parent, inode);
+    rc = 0;
+
+done:
+    ramfs_unlock();
+    return rc;
+}
+
+static int
+ramfs_mkdir(const char *path)
+{
+    struct ramfs_inode *inode;
+    struct ramfs_path rp;
+    int rc;
+
+    ramfs_lock();
+
+    if (!ramfs_ready()) {
+        rc = FS_EUNINIT;
+        goto done;
+    }
+
+    rc = ramfs_path_find(path, &rp);
+    switch (rc) {
+    case 0:
+        rc = FS_EEXIST;
+        break;
+
+    case FS_ENOENT:
+        if (rp.rp_parent != NULL) {
+            rc = ramfs_inode_new(rp.rp_parent, rp.rp_name, rp.rp_name_len, 1,
+                                 &inode);
+        }
+        break;
+
+    default:
+        break;
+    }
+
+done:
+    ramfs_unlock();
+    return rc;
+}
+
+static int
+ramfs_opendir(const char *path, struct fs_dir **out_fs_dir)
+{
+    struct ramfs_path rp;
+    struct ramfs_dir *dir;
+    int rc;
+
+    ramfs_lock();
+
+    if (!ramfs_ready()) {
+        rc = FS_EUNINIT;
+        goto done;
+    }
+
+    rc = ramfs_path_find(path, &rp);
+    if (rc != 0) {
+        goto done;
+    }
+    if (!rp.rp_inode->ri_is_dir) {
+        rc = FS_EINVAL;
+        goto done;
+    }
+
+    dir = os_memblock_get(&ramfs_dir_pool);
+    if (dir == NULL) {
+        rc = FS_ENOMEM;
+        goto done;
+    }
+
+    dir->rd_fops = &ramfs_ops;
+    dir->rd_parent = rp.rp_inode;
+    dir->rd_parent->ri_refcnt++;
+    dir->rd_dirent.rde_fops = &ramfs_ops;
+    dir->rd_dirent.rde_inode = NULL;
+
+    *out_fs_dir = (struct fs_dir *)dir;
+
+done:
+    ramfs_unlock();
+    return rc;
+}
+
+/**
+ * Finds the entry following a directory handle's current position.  If the
+ * current entry has been unlinked or moved since it was read, iteration
+ * resumes with the first entry that sorts after it.
+ */
+static struct ramfs_inode *
+ramfs_dir_peek(const struct ramfs_dir *dir)
+{
+    struct ramfs_inode *cur;
+    struct ramfs_inode *child;
+
+    cur = dir->rd_dirent.rde_inode;
+    if (cur == NULL) {
+        return SLIST_FIRST(&dir->rd_parent->ri_child_list);
+    }
+    if (cur->ri_parent == dir->rd_parent) {
+        return SLIST_NEXT(cur, ri_sibling_next);
+    }
+
+    SLIST_FOREACH(child, &dir->rd_parent->ri_child_list, ri_sibling_next) {
+        if (ramfs_name_cmp(child, cur->ri_name, cur->ri_name_len) > 0) {
+            break;
+        }
+    }
+    return child;
+}
+
+/**
+ * Moves a directory handle to the specified entry.  The handle holds a
+ * reference to its current entry so that it stays valid if unlinked.
+ */
+static void
+ramfs_dir_set(struct ramfs_dir *dir, struct ramfs_inode *child)
+{
+    if (child != NULL) {
+        child->ri_refcnt++;
+    }
+    if (dir->rd_dirent.rde_inode != NULL) {
+        ramfs_inode_dec_refcnt(dir->rd_dirent.rde_inode);
+    }
+    dir->rd_dirent.rde_inode = child;
+}
+
+static int
+ramfs_readdir(struct fs_dir *fs_dir, struct fs_dirent **out_fs_dirent)
+{
+    struct ramfs_dir *dir = (struct ramfs_dir *)fs_dir;
+    int rc;
+
+    ramfs_lock();
+
+    ramfs_dir_set(dir, ramfs_dir_peek(dir));
+    if (dir->rd_dirent.rde_inode == NULL) {
+        rc = FS_ENOENT;
+    } else {
+        *out_fs_dirent = (struct fs_dirent *)&dir->rd_dirent;
+        rc = 0;
+    }
+
+    ramfs_unlock();
+    return rc;
+}
+
+static int
+ramfs_readdir_stat(struct fs_dir *fs_dir, struct fs_dirent_stat *out_stats,
+                   int max_stats, int *out_num_stats)
+{
+    struct ramfs_dir *dir = (struct ramfs_dir *)fs_dir;
+    struct fs_dirent_stat *stat;
+    struct ramfs_inode *child;
+    int num_stats;
+    int name_len;
+
+    if (max_stats <= 0) {
+        return FS_EINVAL;
+    }
+
+    ramfs_lock();
+
+    /* Leave the handle on the last entry reported, as though it had been
+     * returned by ramfs_readdir().
+     */
+    num_stats = 0;
+    while (num_stats < max_stats) {
+        child = ramfs_dir_peek(dir);
+        if (child == NULL) {
+            break;
+        }
+        ramfs_dir_set(dir, child);
+
+        stat = out_stats + num_stats;
+        stat->fds_is_dir = child->ri_is_dir;
+        stat->fds_size = child->ri_is_dir ? 0 : child->ri_size;
+        stat->fds_name_len = child->ri_name_len;
+        name_len = child->ri_name_len;
+        if (name_len > FS_DIRENT_STAT_NAME_MAX) {
+            name_len = FS_DIRENT_STAT_NAME_MAX;
+        }
+        memcpy(stat->fds_name, child->ri_name, name_len);
+        stat->fds_name[name_len] = '\0';
+
+        num_stats++;
+    }
+
+    ramfs_unlock();
+
+    *out_num_stats = num_stats;
+    if (num_stats == 0) {
+        return FS_ENOENT;
+    }
+    return 0;
+}
+
+static int
+ramfs_closedir(struct fs_dir *fs_dir)
+{
+    struct ramfs_dir *dir = (struct ramfs_dir *)fs_dir;
+
+    if (dir == NULL) {
+        return 0;
+    }
+
+    ramfs_lock();
+    ramfs_dir_set(dir, NULL);
+    ramfs_inode_dec_refcnt(dir->rd_parent);
+    os_memblock_put(&ramfs_dir_pool, dir);
+    ramfs_unlock();
+
+    return 0;
+}
+
+/**
+ * Retrieves the filename of the specified directory entry.  The retrieved
+ * filename is always null-terminated.
+ */
+static int
+ramfs_dirent_name(const struct fs_dirent *fs_dirent, size_t max_len,
+                  char *out_name, uint8_t *out_name_len)
+{
+    const struct ramfs_dirent *dirent = (const struct ramfs_dirent *)fs_dirent;
+    const struct ramfs_inode *inode;
+    size_t copy_len;
+
+    if (max_len == 0) {
+        return FS_EINVAL;
+    }
+
+    ramfs_lock();
+
+    inode = dirent->rde_inode;
+    assert(inode != NULL);
+
+    copy_len = inode->ri_name_len;
+    if (copy_len > max_len - 1) {
+        copy_len = max_len - 1;
+    }
+    memcpy(out_name, inode->ri_name, copy_len);
+    out_name[copy_len] = '\0';
+    if (out_name_len != NULL) {
+        *out_name_len = inode->ri_name_len;
+    }
+
+    ramfs_unlock();
+
+    return 0;
+}
+
+static int
+ramfs_dirent_is_dir(const struct fs_dirent *fs_dirent)
+{
+    const struct ramfs_dirent *dirent = (const struct ramfs_dirent *)fs_dirent;
+
+    assert(dirent->rde_inode != NULL);
+    return dirent->rde_inode->ri_is_dir;
+}
+
+static void
+ramfs_config_init(void)
+{
+    if (ramfs_config.rc_num_inodes == 0) {
+        ramfs_config.rc_num_inodes = ramfs_config_dflt.rc_num_inodes;
+    }
+    if (ramfs_config.rc_num_blocks == 0) {
+        ramfs_config.rc_num_blocks = ramfs_config_dflt.rc_num_blocks;
+    }
+    if (ramfs_config.rc_block_size == 0) {
+        ramfs_config.rc_block_size = ramfs_config_dflt.rc_block_size;
+    }
+    if (ramfs_config.rc_num_files == 0) {
+        ramfs_config.rc_num_files = ramfs_config_dflt.rc_num_files;
+    }
+    if (ramfs_config.rc_num_dirs == 0) {
+        ramfs_config.rc_num_dirs = ramfs_config_dflt.rc_num_dirs;
+    }
+}
+
+/**
+ * Initializes an empty RAM file system and makes it available under the
+ * specified mount point (e.g., "/ram").  The pools are sized from
+ * ramfs_config; any previous contents are discarded, so all handles must be
+ * closed first.
+ *
+ * @param mount_point           The absolute path to mount the file system
+ *                                  at; "/" to make it the root file system.
+ *                                  Must remain valid.
+ *
+ * @return                      0 on success; nonzero on failure.
+ */
+int
+ramfs_init(const char *mount_point)
+{
+    int rc;
+
+    ramfs_config_init();
+    ramfs_root_dir = NULL;
+
+    rc = os_mutex_init(&ramfs_mutex);
+    if (rc != 0) {
+        return FS_EOS;
+    }
+
+    free(ramfs_inode_mem);
+    ramfs_inode_mem = malloc(
+        OS_MEMPOOL_BYTES(ramfs_config.rc_num_inodes,
+                         sizeof (struct ramfs_inode)));
+    if (ramfs_inode_mem == NULL) {
+        return FS_ENOMEM;
+    }
+
+    free(ramfs_block_mem);
+    ramfs_block_mem = malloc(
+        OS_MEMPOOL_BYTES(ramfs_config.rc_num_blocks,
+                         sizeof (struct ramfs_block) +
+                         ramfs_config.rc_block_size));
+    if (ramfs_block_mem == NULL) {
+        return FS_ENOMEM;
+    }
+
+    free(ramfs_file_mem);
+    ramfs_file_mem = malloc(
+        OS_MEMPOOL_BYTES(ramfs_config.rc_num_files,
+                         sizeof (struct ramfs_file)));
+    if (ramfs_file_mem == NULL) {
+        return FS_ENOMEM;
+    }
+
+    free(ramfs_dir_mem);
+    ramfs_dir_mem = malloc(
+        OS_MEMPOOL_BYTES(ramfs_config.rc_num_dirs, sizeof (struct ramfs_dir)));
+    if (ramfs_dir_mem == NULL) {
+        return FS_ENOMEM;
+    }
+
+    rc = os_mempool_init(&ramfs_inode_pool, ramfs_config.rc_num_inodes,
+                         sizeof (struct ramfs_inode), ramfs_inode_mem,
+                         "ramfs_inode_pool");
+    if (rc != 0) {
+        return FS_EOS;
+    }
+
+    rc = os_mempool_init(&ramfs_block_pool, ramfs_config.rc_num_blocks,
+                         sizeof (struct ramfs_block) +
+                         ramfs_config.rc_block_size,
+                         ramfs_block_mem, "ramfs_block_pool");
+    if (rc != 0) {
+        return FS_EOS;
+    }
+
+    rc = os_mempool_init(&ramfs_file_pool, ramfs_config.rc_num_files,
+                         sizeof (struct ramfs_file), ramfs_file_mem,
+                         "ramfs_file_pool");
+    if (rc != 0) {
+        return FS_EOS;
+    }
+
+    rc = os_mempool_init(&ramfs_dir_pool, ramfs_config.rc_num_dirs,
+                         sizeof (struct ramfs_dir), ramfs_dir_mem,
+                         "ramfs_dir_pool");
+    if (rc != 0) {
+        return FS_EOS;
+    }
+
+    rc = ramfs_inode_new(NULL, "", 0, 1, &ramfs_root_dir);
+    if (rc != 0) {
+        return rc;
+    }
+
+    /* Re-initializing an already-mounted file system is allowed. */
+    rc = fs_mount(&ramfs_ops, mount_point);
+    if (rc != 0 && rc != FS_EEXIST) {
+        return rc;
+    }
+
+    return 0;
+}
@@ -0,0 +1,457 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "testutil/testutil.h"
+#include "fs/fs.h"
+#include "fs/fs_if.h"
+#include "ramfs/ramfs.h"
+#include "ramfs/ramfs_test.h"
+
+#define RAMFS_TEST_MOUNT    "/ram"
+
+static void
+ramfs_test_util_create_file(const char *path, const void *data, int len)
+{
+    struct fs_file *file;
+    int rc;
+
+    rc = fs_open(path, FS_ACCESS_WRITE, &file);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    rc = fs_write(file, data, len);
+    TEST_ASSERT(rc == 0);
+
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+}
+
+static void
+ramfs_test_util_assert_contents(const char *path, const void *contents,
+                                int contents_len)
+{
+    struct fs_file *file;
+    uint32_t bytes_read;
+    uint32_t len;
+    char buf[1100];
+    int rc;
+
+    TEST_ASSERT_FATAL(contents_len < sizeof buf);
+
+    rc = fs_open(path, FS_ACCESS_READ, &file);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    rc = fs_filelen(file, &len);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(len == contents_len);
+
+    rc = fs_read(file, sizeof buf, buf, &bytes_read);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(bytes_read == contents_len);
+    TEST_ASSERT(memcmp(buf, contents, contents_len) == 0);
+
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+}
+
+static void
+ramfs_test_util_init(void)
+{
+    int rc;
+
+    memset(&ramfs_config, 0, sizeof ramfs_config);
+    ramfs_config.rc_num_blocks = 16;
+    ramfs_config.rc_block_size = 64;
+
+    rc = ramfs_init(RAMFS_TEST_MOUNT);
+    TEST_ASSERT_FATAL(rc == 0);
+}
+
+TEST_CASE(ramfs_test_read_write)
+{
+    struct fs_file *file;
+    uint32_t bytes_read;
+    uint32_t len;
+    char data[300];
+    char buf[16];
+    int rc;
+    int i;
+
+    ramfs_test_util_init();
+
+    for (i = 0; i < sizeof data; i++) {
+        data[i] = i;
+    }
+
+    /* Files span several blocks. */
+    ramfs_test_util_create_file("/ram/myfile.txt", data, 150);
+    ramfs_test_util_assert_contents("/ram/myfile.txt", data, 150);
+
+    /* Append. */
+    rc = fs_open("/ram/myfile.txt", FS_ACCESS_WRITE | FS_ACCESS_APPEND,
+                 &file);
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = fs_write(file, data + 150, 150);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(fs_getpos(file) == 300);
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+    ramfs_test_util_assert_contents("/ram/myfile.txt", data, 300);
+
+    /* Overwrite in the middle, across a block boundary. */
+    rc = fs_open("/ram/myfile.txt", FS_ACCESS_WRITE, &file);
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = fs_seek(file, 60);
+    TEST_ASSERT(rc == 0);
+    rc = fs_write(file, "abcdefgh", 8);
+    TEST_ASSERT(rc == 0);
+    rc = fs_seek(file, 301);
+    TEST_ASSERT(rc == FS_EOFFSET);
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+    memcpy(data + 60, "abcdefgh", 8);
+    ramfs_test_util_assert_contents("/ram/myfile.txt", data, 300);
+
+    /* Seek and read. */
+    rc = fs_open("/ram/myfile.txt", FS_ACCESS_READ, &file);
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = fs_seek(file, 58);
+    TEST_ASSERT(rc == 0);
+    rc = fs_read(file, 12, buf, &bytes_read);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(bytes_read == 12);
+    TEST_ASSERT(memcmp(buf, data + 58, 12) == 0);
+    rc = fs_write(file, "x", 1);
+    TEST_ASSERT(rc == FS_EACCESS);
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+
+    /* Truncate. */
+    rc = fs_open("/ram/myfile.txt", FS_ACCESS_WRITE | FS_ACCESS_TRUNCATE,
+                 &file);
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = fs_filelen(file, &len);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(len == 0);
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+
+    /* Invalid opens. */
+    rc = fs_open("/ram/nofile", FS_ACCESS_READ, &file);
+    TEST_ASSERT(rc == FS_ENOENT);
+    TEST_ASSERT(file == NULL);
+    rc = fs_open("/ram/nodir/file", FS_ACCESS_WRITE, &file);
+    TEST_ASSERT(rc == FS_ENOENT);
+    rc = fs_open("/ram/myfile.txt", FS_ACCESS_READ | FS_ACCESS_TRUNCATE,
+                 &file);
+    TEST_ASSERT(rc == FS_EINVAL);
+    rc = fs_open("/ram", FS_ACCESS_READ, &file);
+    TEST_ASSERT(rc == FS_EINVAL);
+}
+
+TEST_CASE(ramfs_test_capacity)
+{
+    struct fs_file *file;
+    struct fs_file *files[5];
+    char data[1024];
+    int rc;
+    int i;
+
+    ramfs_test_util_init();
+    memset(data, 0xa5, sizeof data);
+
+    /* 16 blocks of 64 bytes. */
+    rc = fs_open("/ram/big", FS_ACCESS_WRITE, &file);
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = fs_write(file, data, 1000);
+    TEST_ASSERT(rc == 0);
+
+    /* A write that does not fit leaves the file unchanged. */
+    rc = fs_write(file, data, 100);
+    TEST_ASSERT(rc == FS_EFULL);
+    rc = fs_write(file, data, 24);
+    TEST_ASSERT(rc == 0);
+    rc = fs_write(file, data, 1);
+    TEST_ASSERT(rc == FS_EFULL);
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+    ramfs_test_util_assert_contents("/ram/big", data, 1024);
+
+    /* Unlinking frees the space. */
+    rc = fs_unlink("/ram/big");
+    TEST_ASSERT(rc == 0);
+    ramfs_test_util_create_file("/ram/big2", data, 1024);
+    ramfs_test_util_assert_contents("/ram/big2", data, 1024);
+
+    /* An unlinked file stays readable until its last handle is closed. */
+    rc = fs_open("/ram/big2", FS_ACCESS_READ, &file);
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = fs_unlink("/ram/big2");
+    TEST_ASSERT(rc == 0);
+    rc = fs_read(file, sizeof data, data, NULL);
+    TEST_ASSERT(rc == 0);
+    rc = fs_open("/ram/other", FS_ACCESS_WRITE, &files[0]);
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = fs_write(files[0], data, 1);
+    TEST_ASSERT(rc == FS_EFULL);
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+    rc = fs_write(files[0], data, 1);
+    TEST_ASSERT(rc == 0);
+    rc = fs_close(files[0]);
+    TEST_ASSERT(rc == 0);
+
+    /* Open file handles are limited by the pool. */
+    for (i = 0; i < 4; i++) {
+        rc = fs_open("/ram/other", FS_ACCESS_READ, &files[i]);
+        TEST_ASSERT_FATAL(rc == 0);
+    }
+    rc = fs_open("/ram/other", FS_ACCESS_READ, &files[4]);
+    TEST_ASSERT(rc == FS_ENOMEM);
+    for (i = 0; i < 4; i++) {
+        rc = fs_close(files[i]);
+        TEST_ASSERT(rc == 0);
+    }
+}
+
+TEST_CASE(ramfs_test_dir)
+{
+    struct fs_dirent_stat stats[3];
+    struct fs_dirent *dirent;
+    struct fs_dir *dir;
+    char name[RAMFS_FILENAME_MAX_LEN + 1];
+    uint8_t name_len;
+    int num_stats;
+    int rc;
+
+    ramfs_test_util_init();
+
+    rc = fs_mkdir("/ram/dir");
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = fs_mkdir("/ram/dir");
+    TEST_ASSERT(rc == FS_EEXIST);
+    rc = fs_mkdir("/ram/a/b");
+    TEST_ASSERT(rc == FS_ENOENT);
+    rc = fs_mkdir("/ram/dir/sub");
+    TEST_ASSERT_FATAL(rc == 0);
+
+    ramfs_test_util_create_file("/ram/dir/c", "ccc", 3);
+    ramfs_test_util_create_file("/ram/dir/a", "a", 1);
+    ramfs_test_util_create_file("/ram/dir/b", "bb", 2);
+    ramfs_test_util_create_file("/ram/dir/sub/x", "x", 1);
+
+    /* Entries are listed in name order. */
+    rc = fs_opendir("/ram/dir", &dir);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    rc = fs_readdir(dir, &dirent);
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = fs_dirent_name(dirent, sizeof name, name, &name_len);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(strcmp(name, "a") == 0 && name_len == 1);
+    TEST_ASSERT(!fs_dirent_is_dir(dirent));
+
+    /* Unlinking the current entry does not disturb iteration. */
+    rc = fs_unlink("/ram/dir/a");
+    TEST_ASSERT(rc == 0);
+
+    rc = fs_readdir_stat(dir, stats, 3, &num_stats);
+    TEST_ASSERT_FATAL(rc == 0);
+    TEST_ASSERT(num_stats == 3);
+    TEST_ASSERT(strcmp(stats[0].fds_name, "b") == 0);
+    TEST_ASSERT(stats[0].fds_size == 2 && !stats[0].fds_is_dir);
+    TEST_ASSERT(strcmp(stats[1].fds_name, "c") == 0);
+    TEST_ASSERT(stats[1].fds_size == 3 && !stats[1].fds_is_dir);
+    TEST_ASSERT(strcmp(stats[2].fds_name, "sub") == 0);
+    TEST_ASSERT(stats[2].fds_size == 0 && stats[2].fds_is_dir);
+
+    rc = fs_readdir_stat(dir, stats, 3, &num_stats);
+    TEST_ASSERT(rc == FS_ENOENT);
+    TEST_ASSERT(num_stats == 0);
+
+    rc = fs_closedir(dir);
+    TEST_ASSERT(rc == 0);
+
+    /* Rename moves entries between directories and replaces files. */
+    rc = fs_rename("/ram/dir/b", "/ram/dir/sub/x");
+    TEST_ASSERT(rc == 0);
+    ramfs_test_util_assert_contents("/ram/dir/sub/x", "bb", 2);
+    rc = fs_rename("/ram/dir/c", "/ram/dir/sub");
+    TEST_ASSERT(rc == FS_EINVAL);
+    rc = fs_rename("/ram/dir", "/ram/dir/sub/dir");
+    TEST_ASSERT(rc == FS_EINVAL);
+    rc = fs_rename("/ram/dir/sub", "/ram/sub2");
+    TEST_ASSERT(rc == 0);
+    ramfs_test_util_assert_contents("/ram/sub2/x", "bb", 2);
+
+    /* Unlinking a directory removes its contents. */
+    rc = fs_unlink("/ram/sub2");
+    TEST_ASSERT(rc == 0);
+    rc = fs_opendir("/ram/sub2", &dir);
+    TEST_ASSERT(rc == FS_ENOENT);
+
+    rc = fs_opendir("/ram", &dir);
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = fs_readdir(dir, &dirent);
+    TEST_ASSERT_FATAL(rc == 0);
+    rc = fs_dirent_name(dirent, sizeof name, name, &name_len);
+    TEST_ASSERT(strcmp(name, "dir") == 0);
+    TEST_ASSERT(fs_dirent_is_dir(dirent));
+    rc = fs_readdir(dir, &dirent);
+    TEST_ASSERT(rc == FS_ENOENT);
+    rc = fs_closedir(dir);
+    TEST_ASSERT(rc == 0);
+}
+
+TEST_CASE(ramfs_test_vectored_io)
+{
+    struct fs_iovec iov[2];
+    struct fs_file *file;
+    uint32_t bytes_read;
+    char buf[100];
+    int rc;
+
+    ramfs_test_util_init();
+
+    /* ramfs relies on the generic fallback to f_read and f_write. */
+    rc = fs_open("/ram/f", FS_ACCESS_WRITE, &file);
+    TEST_ASSERT_FATAL(rc == 0);
+    iov[0].fi_base = "hello ";
+    iov[0].fi_len = 6;
+    iov[1].fi_base = "world";
+    iov[1].fi_len = 5;
+    rc = fs_writev(file, iov, 2);
+    TEST_ASSERT(rc == 0);
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+    ramfs_test_util_assert_contents("/ram/f", "hello world", 11);
+
+    rc = fs_open("/ram/f", FS_ACCESS_READ, &file);
+    TEST_ASSERT_FATAL(rc == 0);
+    iov[0].fi_base = buf;
+    iov[0].fi_len = 3;
+    iov[1].fi_base = buf + 3;
+    iov[1].fi_len = sizeof buf - 3;
+    rc = fs_readv(file, iov, 2, &bytes_read);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(bytes_read == 11);
+    TEST_ASSERT(memcmp(buf, "hello world", 11) == 0);
+    rc = fs_close(file);
+    TEST_ASSERT(rc == 0);
+}
+
+/*
+ * A second file system that only records the paths it is asked to open.
+ */
+static char ramfs_test_stub_path[32];
+
+static int
+ramfs_test_stub_open(const char *path, uint8_t access_flags,
+                     struct fs_file **out_file)
+{
+    snprintf(ramfs_test_stub_path, sizeof ramfs_test_stub_path, "%s", path);
+    *out_file = NULL;
+    return FS_ENOENT;
+}
+
+static int
+ramfs_test_stub_rename(const char *from, const char *to)
+{
+    return 0;
+}
+
+static const struct fs_ops ramfs_test_stub_ops = {
+    .f_open = ramfs_test_stub_open,
+    .f_rename = ramfs_test_stub_rename,
+    .f_name = "stub",
+};
+
+TEST_CASE(ramfs_test_mount)
+{
+    struct fs_file *file;
+    int rc;
+
+    ramfs_test_util_init();
+
+    rc = fs_mount(&ramfs_test_stub_ops, "/stub");
+    TEST_ASSERT(rc == 0 || rc == FS_EEXIST);
+    rc = fs_mount(&ramfs_test_stub_ops, RAMFS_TEST_MOUNT);
+    TEST_ASSERT(rc == FS_EEXIST);
+    rc = fs_mount(&ramfs_test_stub_ops, "relative");
+    TEST_ASSERT(rc == FS_EINVAL);
+    rc = fs_mount(&ramfs_test_stub_ops, "/trailing/");
+    TEST_ASSERT(rc == FS_EINVAL);
+
+    /* Paths are passed on relative to the mount point. */
+    rc = fs_open("/stub/a/b", FS_ACCESS_READ, &file);
+    TEST_ASSERT(rc == FS_ENOENT);
+    TEST_ASSERT(strcmp(ramfs_test_stub_path, "/a/b") == 0);
+    rc = fs_open("/stub", FS_ACCESS_READ, &file);
+    TEST_ASSERT(rc == FS_ENOENT);
+    TEST_ASSERT(strcmp(ramfs_test_stub_path, "/") == 0);
+
+    /* A mount point only matches whole path components. */
+    ramfs_test_stub_path[0] = '\0';
+    rc = fs_open("/stubx/a", FS_ACCESS_READ, &file);
+    TEST_ASSERT(strcmp(ramfs_test_stub_path, "") == 0);
+
+    /* Handles are routed to the file system that created them. */
+    ramfs_test_util_create_file("/ram/f", "hello", 5);
+    ramfs_test_util_assert_contents("/ram/f", "hello", 5);
+
+    /* Files cannot be moved between file systems. */
+    rc = fs_rename("/ram/f", "/stub/f");
+    TEST_ASSERT(rc == FS_EINVAL);
+    rc = fs_rename("/stub/f", "/stub/g");
+    TEST_ASSERT(rc == 0);
+}
+
+TEST_SUITE(ramfs_suite)
+{
+    ramfs_test_read_write();
+    ramfs_test_capacity();
+    ramfs_test_dir();
+    ramfs_test_vectored_io();
+    ramfs_test_mount();
+}
+
+int
+ramfs_test_all(void)
+{
+    ramfs_suite();
+
+    return tu_any_failed;
+}
+
+#ifdef MYNEWT_SELFTEST
+
+int
+main(void)
+{
+    tu_config.tc_print_results = 1;
+    tu_config.tc_system_assert = 1;
+    tu_init();
+
+    ramfs_test_all();
+
+    return tu_any_failed;
+}
+
+#endif
@@ -77,6 +77,19 @@ int flash_area_write(const struct flash_area *, uint32_t off, void *src,
   uint32_t len);
 int flash_area_erase(const struct flash_area *, uint32_t off, uint32_t len);
 
+/*
+ * Returns 1 if the range is erased, 0 if it is not, negative on error.
+ */
+int flash_area_is_empty(const struct flash_area *, uint32_t off,
+  uint32_t len);
+
+/*
+ * Lazy erase for writing an area front to back. Call before each write;
+ * erases the sectors the write is first to enter, unless they are empty.
+ */
+int flash_area_erase_ahead(const struct flash_area *, uint32_t off,
+  uint32_t len);
+
 /*
  * Given flash map index, return info about sectors within the area.
  */
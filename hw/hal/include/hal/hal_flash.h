@@ -22,12 +22,26 @@
 
 #include <inttypes.h>
 
+/*
+ * Completion callback of an asynchronous flash operation.  rc is 0 on
+ * success.  May be called from interrupt context.
+ */
+typedef void (*hal_flash_done_cb)(void *arg, int rc);
+
 int hal_flash_read(uint8_t flash_id, uint32_t address, void *dst,
   uint32_t num_bytes);
 int hal_flash_write(uint8_t flash_id, uint32_t address, const void *src,
   uint32_t num_bytes);
 int hal_flash_erase_sector(uint8_t flash_id, uint32_t sector_address);
 int hal_flash_erase(uint8_t flash_id, uint32_t address, uint32_t num_bytes);
+int hal_flash_write_async(uint8_t flash_id, uint32_t address, const void *src,
+  uint32_t num_bytes, hal_flash_done_cb cb, void *arg);
+int hal_flash_erase_sector_async(uint8_t flash_id, uint32_t sector_address,
+  hal_flash_done_cb cb, void *arg);
+int hal_flash_is_erased(uint8_t flash_id, uint32_t address,
+  uint32_t num_bytes);
+int hal_flash_ptr(uint8_t flash_id, uint32_t address, uint32_t num_bytes,
+  const void **out_ptr);
 uint8_t hal_flash_align(uint8_t flash_id);
 int hal_flash_init(void);
 
@@ -21,6 +21,7 @@
 #define H_HAL_FLASH_INT
 
 #include <inttypes.h>
+#include "hal/hal_flash.h"
 /*
  * API that flash driver has to implement.
  */
@@ -30,6 +31,18 @@ struct hal_flash_funcs {
     int (*hff_erase_sector)(uint32_t sector_address);
     int (*hff_sector_info)(int idx, uint32_t *address, uint32_t *size);
     int (*hff_init)(void);
+    /* Optional; only for flash that the CPU can read in place. */
+    int (*hff_ptr)(uint32_t address, const void **out_ptr);
+    /*
+     * Optional; start the operation and return without waiting for it.  The
+     * driver calls cb when the operation completes.  If the operation can't
+     * be started, return nonzero and don't call cb.  Only one operation is
+     * in progress at a time.
+     */
+    int (*hff_write_async)(uint32_t address, const void *src,
+      uint32_t num_bytes, hal_flash_done_cb cb, void *arg);
+    int (*hff_erase_sector_async)(uint32_t sector_address,
+      hal_flash_done_cb cb, void *arg);
 };
 
 struct hal_flash {
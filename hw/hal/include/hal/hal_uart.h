@@ -36,6 +36,13 @@ typedef int (*hal_uart_tx_char)(void *arg);
  */
 typedef void (*hal_uart_tx_done)(void *arg);
 
+/*
+ * Function prototype for UART driver to report that a buffer given to
+ * hal_uart_tx_buf() has been sent.
+ * Driver must call this with interrupts disabled.
+ */
+typedef void (*hal_uart_tx_buf_done)(void *arg);
+
 /*
  * Function prototype for UART driver to report incoming byte of data.
  * Returns -1 if data was dropped.
@@ -79,6 +86,17 @@ int hal_uart_config(int uart, int32_t speed, uint8_t databits, uint8_t stopbits,
  */
 void hal_uart_start_tx(int uart);
 
+/**
+ * hal uart tx buf
+ *
+ * Transmits len bytes from buf as one block, using DMA where the UART has it.
+ * Buffer must be in RAM, and must stay untouched until tx_done is called.
+ * Returns nonzero if UART is transmitting already; tx_done is not called then.
+ * hal_uart_start_tx() during block transfer takes effect after it completes.
+ */
+int hal_uart_tx_buf(int uart, const uint8_t *buf, int len,
+  hal_uart_tx_buf_done tx_done, void *arg);
+
 /**
  * hal uart start rx
  *
@@ -180,3 +180,74 @@ flash_area_erase(const struct flash_area *fa, uint32_t off, uint32_t len)
     }
     return hal_flash_erase(fa->fa_flash_id, fa->fa_off + off, len);
 }
+
+int
+flash_area_is_empty(const struct flash_area *fa, uint32_t off, uint32_t len)
+{
+    if (off > fa->fa_size || off + len > fa->fa_size) {
+        return -1;
+    }
+    return hal_flash_is_erased(fa->fa_flash_id, fa->fa_off + off, len);
+}
+
+/*
+ * Returns the index of the first sector starting at or after addr, or
+ * hf_sector_cnt if there is none. Sectors are in ascending address order.
+ */
+static int
+flash_area_sector_at(const struct hal_flash *hf, uint32_t addr)
+{
+    uint32_t start, size;
+    int lo, hi, mid;
+
+    lo = 0;
+    hi = hf->hf_sector_cnt;
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        hf->hf_itf->hff_sector_info(mid, &start, &size);
+        if (start < addr) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/*
+ * Sectors which start within [off, off + len) get erased, unless they are
+ * blank already. Ones starting before off were handled by earlier calls.
+ * This is called for every chunk of an upload, so only the sectors in range
+ * are visited.
+ */
+int
+flash_area_erase_ahead(const struct flash_area *fa, uint32_t off,
+  uint32_t len)
+{
+    const struct hal_flash *hf;
+    uint32_t start, size;
+    uint32_t end;
+    int i;
+    int rc;
+
+    if (off > fa->fa_size || off + len > fa->fa_size) {
+        return -1;
+    }
+    hf = bsp_flash_dev(fa->fa_flash_id);
+    end = fa->fa_off + off + len;
+    for (i = flash_area_sector_at(hf, fa->fa_off + off);
+         i < hf->hf_sector_cnt; i++) {
+        hf->hf_itf->hff_sector_info(i, &start, &size);
+        if (start >= end) {
+            break;
+        }
+        rc = hal_flash_is_erased(fa->fa_flash_id, start, size);
+        if (rc < 0) {
+            return -1;
+        }
+        if (rc == 0 && hal_flash_erase_sector(fa->fa_flash_id, start)) {
+            return -1;
+        }
+    }
+    return 0;
+}
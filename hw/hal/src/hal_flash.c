@@ -20,9 +20,63 @@
 #include <assert.h>
 #include <bsp/bsp.h>
 
+#include "os/os.h"
 #include "hal/hal_flash.h"
 #include "hal/hal_flash_int.h"
 
+#ifndef HAL_FLASH_MAX_DEVS
+#define HAL_FLASH_MAX_DEVS      2
+#endif
+
+/*
+ * Only one operation per flash device at a time.  Once the OS is running,
+ * the token is taken by whoever starts an operation, and given back when it
+ * completes; for asynchronous operations that happens in the driver's
+ * completion callback.
+ */
+struct hal_flash_lock {
+    struct os_sem hfl_sem;
+    uint8_t hfl_init;
+    uint8_t hfl_held;           /* token taken for async op in progress */
+    hal_flash_done_cb hfl_cb;
+    void *hfl_arg;
+};
+static struct hal_flash_lock hal_flash_locks[HAL_FLASH_MAX_DEVS];
+
+/*
+ * Returns 1 if the token was taken, 0 if the OS is not running yet.
+ */
+static int
+hal_flash_lock(uint8_t id)
+{
+    struct hal_flash_lock *hfl;
+    os_sr_t sr;
+    int rc;
+
+    assert(id < HAL_FLASH_MAX_DEVS);
+    if (!os_started()) {
+        return 0;
+    }
+    hfl = &hal_flash_locks[id];
+    OS_ENTER_CRITICAL(sr);
+    if (!hfl->hfl_init) {
+        os_sem_init(&hfl->hfl_sem, 1);
+        hfl->hfl_init = 1;
+    }
+    OS_EXIT_CRITICAL(sr);
+    rc = os_sem_pend(&hfl->hfl_sem, OS_TIMEOUT_NEVER);
+    assert(rc == 0);
+    return 1;
+}
+
+static void
+hal_flash_unlock(uint8_t id, int held)
+{
+    if (held) {
+        os_sem_release(&hal_flash_locks[id].hfl_sem);
+    }
+}
+
 int
 hal_flash_init(void)
 {
@@ -79,6 +133,8 @@ int
 hal_flash_read(uint8_t id, uint32_t address, void *dst, uint32_t num_bytes)
 {
     const struct hal_flash *hf;
+    int held;
+    int rc;
 
     hf = bsp_flash_dev(id);
     if (!hf) {
@@ -88,7 +144,10 @@ hal_flash_read(uint8_t id, uint32_t address, void *dst, uint32_t num_bytes)
       hal_flash_check_addr(hf, address + num_bytes)) {
         return -1;
     }
-    return hf->hf_itf->hff_read(address, dst, num_bytes);
+    held = hal_flash_lock(id);
+    rc = hf->hf_itf->hff_read(address, dst, num_bytes);
+    hal_flash_unlock(id, held);
+    return rc;
 }
 
 int
@@ -96,6 +155,57 @@ hal_flash_write(uint8_t id, uint32_t address, const void *src,
   uint32_t num_bytes)
 {
     const struct hal_flash *hf;
+    int held;
+    int rc;
+
+    hf = bsp_flash_dev(id);
+    if (!hf) {
+        return -1;
+    }
+    if (hal_flash_check_addr(hf, address) ||
+      hal_flash_check_addr(hf, address + num_bytes)) {
+        return -1;
+    }
+    held = hal_flash_lock(id);
+    rc = hf->hf_itf->hff_write(address, src, num_bytes);
+    hal_flash_unlock(id, held);
+    return rc;
+}
+
+/*
+ * Completion of an operation started by hal_flash_write_async() or
+ * hal_flash_erase_sector_async(); gives the device back before calling the
+ * caller's callback.
+ */
+static void
+hal_flash_async_done(void *arg, int rc)
+{
+    struct hal_flash_lock *hfl;
+    hal_flash_done_cb cb;
+    void *cb_arg;
+
+    hfl = arg;
+    cb = hfl->hfl_cb;
+    cb_arg = hfl->hfl_arg;
+    hal_flash_unlock(hfl - hal_flash_locks, hfl->hfl_held);
+    cb(cb_arg, rc);
+}
+
+/*
+ * Starts a write and returns; cb is called when the write has completed.
+ * If another operation on the device is in progress, waits for that first.
+ * If the driver has no asynchronous write, the write is performed before
+ * this function returns and cb gets called from within it.  Returns nonzero
+ * if the write could not be started, in which case cb is not called.
+ */
+int
+hal_flash_write_async(uint8_t id, uint32_t address, const void *src,
+  uint32_t num_bytes, hal_flash_done_cb cb, void *arg)
+{
+    const struct hal_flash *hf;
+    struct hal_flash_lock *hfl;
+    int held;
+    int rc;
 
     hf = bsp_flash_dev(id);
     if (!hf) {
@@ -105,7 +215,109 @@ hal_flash_write(uint8_t id, uint32_t address, const void *src,
       hal_flash_check_addr(hf, address + num_bytes)) {
         return -1;
     }
-    return hf->hf_itf->hff_write(address, src, num_bytes);
+    held = hal_flash_lock(id);
+    if (hf->hf_itf->hff_write_async) {
+        hfl = &hal_flash_locks[id];
+        hfl->hfl_held = held;
+        hfl->hfl_cb = cb;
+        hfl->hfl_arg = arg;
+        rc = hf->hf_itf->hff_write_async(address, src, num_bytes,
+          hal_flash_async_done, hfl);
+        if (rc) {
+            hal_flash_unlock(id, held);
+        }
+        return rc;
+    }
+    rc = hf->hf_itf->hff_write(address, src, num_bytes);
+    hal_flash_unlock(id, held);
+    cb(arg, rc);
+    return 0;
+}
+
+/*
+ * Sector erase counterpart of hal_flash_write_async().
+ */
+int
+hal_flash_erase_sector_async(uint8_t id, uint32_t sector_address,
+  hal_flash_done_cb cb, void *arg)
+{
+    const struct hal_flash *hf;
+    struct hal_flash_lock *hfl;
+    int held;
+    int rc;
+
+    hf = bsp_flash_dev(id);
+    if (!hf) {
+        return -1;
+    }
+    if (hal_flash_check_addr(hf, sector_address)) {
+        return -1;
+    }
+    held = hal_flash_lock(id);
+    if (hf->hf_itf->hff_erase_sector_async) {
+        hfl = &hal_flash_locks[id];
+        hfl->hfl_held = held;
+        hfl->hfl_cb = cb;
+        hfl->hfl_arg = arg;
+        rc = hf->hf_itf->hff_erase_sector_async(sector_address,
+          hal_flash_async_done, hfl);
+        if (rc) {
+            hal_flash_unlock(id, held);
+        }
+        return rc;
+    }
+    rc = hf->hf_itf->hff_erase_sector(sector_address);
+    hal_flash_unlock(id, held);
+    cb(arg, rc);
+    return 0;
+}
+
+struct hal_flash_wait {
+    struct os_sem hfw_sem;
+    int hfw_rc;
+};
+
+static void
+hal_flash_wait_done(void *arg, int rc)
+{
+    struct hal_flash_wait *wait;
+
+    wait = arg;
+    wait->hfw_rc = rc;
+    os_sem_release(&wait->hfw_sem);
+}
+
+/*
+ * Erases a sector.  If the driver can erase asynchronously and the OS is
+ * running, the calling task sleeps until the erase completes, so other tasks
+ * get to run in the meantime.  The device stays locked until then.
+ */
+static int
+hal_flash_erase_sector_wait(uint8_t id, const struct hal_flash *hf,
+  uint32_t sector_address)
+{
+    struct hal_flash_wait wait;
+    int held;
+    int rc;
+
+    held = hal_flash_lock(id);
+    if (!hf->hf_itf->hff_erase_sector_async || !held) {
+        rc = hf->hf_itf->hff_erase_sector(sector_address);
+        hal_flash_unlock(id, held);
+        return rc;
+    }
+
+    os_sem_init(&wait.hfw_sem, 0);
+    rc = hf->hf_itf->hff_erase_sector_async(sector_address,
+      hal_flash_wait_done, &wait);
+    if (rc == 0) {
+        rc = os_sem_pend(&wait.hfw_sem, OS_TIMEOUT_NEVER);
+        assert(rc == 0);
+        rc = wait.hfw_rc;
+    }
+    hal_flash_unlock(id, held);
+
+    return rc;
 }
 
 int
@@ -120,7 +332,7 @@ hal_flash_erase_sector(uint8_t id, uint32_t sector_address)
     if (hal_flash_check_addr(hf, sector_address)) {
         return -1;
     }
-    return hf->hf_itf->hff_erase_sector(sector_address);
+    return hal_flash_erase_sector_wait(id, hf, sector_address);
 }
 
 int
@@ -159,10 +371,118 @@ hal_flash_erase(uint8_t id, uint32_t address, uint32_t num_bytes)
              * If some region of eraseable area falls inside sector,
              * erase the sector.
              */
-            if (hf->hf_itf->hff_erase_sector(start)) {
+            if (hal_flash_erase_sector_wait(id, hf, start)) {
                 return -1;
             }
         }
     }
     return 0;
 }
+
+/*
+ * Returns a pointer through which the CPU can read the given flash range
+ * directly.  Fails if the flash is not memory-mapped.  The pointer stays
+ * valid until the sector containing it is erased.
+ */
+int
+hal_flash_ptr(uint8_t id, uint32_t address, uint32_t num_bytes,
+  const void **out_ptr)
+{
+    const struct hal_flash *hf;
+
+    hf = bsp_flash_dev(id);
+    if (!hf) {
+        return -1;
+    }
+    if (hal_flash_check_addr(hf, address) ||
+      hal_flash_check_addr(hf, address + num_bytes)) {
+        return -1;
+    }
+    if (!hf->hf_itf->hff_ptr) {
+        return -1;
+    }
+    return hf->hf_itf->hff_ptr(address, out_ptr);
+}
+
+/*
+ * Word-wise check that a buffer holds nothing but erased (0xff) bytes.
+ */
+static int
+hal_flash_buf_erased(const uint8_t *buf, uint32_t num_bytes)
+{
+    const uint32_t *word;
+
+    while (num_bytes && ((uintptr_t)buf & 3)) {
+        if (*buf != 0xff) {
+            return 0;
+        }
+        buf++;
+        num_bytes--;
+    }
+    word = (const uint32_t *)buf;
+    while (num_bytes >= 4) {
+        if (*word != 0xffffffff) {
+            return 0;
+        }
+        word++;
+        num_bytes -= 4;
+    }
+    buf = (const uint8_t *)word;
+    while (num_bytes) {
+        if (*buf != 0xff) {
+            return 0;
+        }
+        buf++;
+        num_bytes--;
+    }
+    return 1;
+}
+
+/*
+ * Returns 1 if the given flash range is in erased state, 0 if it is not, and
+ * -1 on error.  Memory-mapped flash is scanned in place.
+ */
+int
+hal_flash_is_erased(uint8_t id, uint32_t address, uint32_t num_bytes)
+{
+    const struct hal_flash *hf;
+    const void *ptr;
+    uint32_t buf[16];
+    uint32_t chunk;
+    int held;
+    int rc;
+
+    hf = bsp_flash_dev(id);
+    if (!hf) {
+        return -1;
+    }
+    if (hal_flash_check_addr(hf, address) ||
+      hal_flash_check_addr(hf, address + num_bytes)) {
+        return -1;
+    }
+    held = hal_flash_lock(id);
+    if (hf->hf_itf->hff_ptr && !hf->hf_itf->hff_ptr(address, &ptr)) {
+        rc = hal_flash_buf_erased(ptr, num_bytes);
+        hal_flash_unlock(id, held);
+        return rc;
+    }
+    rc = 1;
+    while (num_bytes) {
+        chunk = num_bytes;
+        if (chunk > sizeof(buf)) {
+            chunk = sizeof(buf);
+        }
+        if (hf->hf_itf->hff_read(address, buf, chunk)) {
+            rc = -1;
+            break;
+        }
+        if (!hal_flash_buf_erased((uint8_t *)buf, chunk)) {
+            rc = 0;
+            break;
+        }
+        address += chunk;
+        num_bytes -= chunk;
+    }
+    hal_flash_unlock(id, held);
+    return rc;
+}
@@ -25,6 +25,9 @@
 
 #include "hal/hal_flash.h"
 #include "hal/hal_flash_int.h"
+#ifdef ARCH_sim
+#include "mcu/mcu_sim.h"
+#endif
 
 /*
  * Test flash_area_to_sectors()
@@ -147,10 +150,364 @@ TEST_CASE(flash_map_test_case_2)
     }
 }
 
+#ifdef ARCH_sim
+/*
+ * Test native flash timing and wear emulation
+ */
+TEST_CASE(flash_map_test_case_3)
+{
+    static const struct native_flash_profile worn = {
+        .nfp_name = "worn",
+        .nfp_endurance = 2,
+    };
+    struct native_flash_emu_stats stats;
+    const struct native_flash_profile *profile;
+    uint8_t buf[256];
+    uint32_t addr;
+    uint32_t size;
+    int rc;
+
+    os_init();
+
+    TEST_ASSERT(native_flash_profile_find("bogus") == NULL);
+    profile = native_flash_profile_find("nrf52");
+    TEST_ASSERT_FATAL(profile == &native_flash_profile_nrf52,
+      "nrf52 profile not found");
+
+    rc = hal_flash_init();
+    TEST_ASSERT_FATAL(rc == 0, "hal_flash_init() fail");
+
+    native_flash_emu_init(profile, 0);
+
+    /* Use the second sector. */
+    rc = bsp_flash_dev(0)->hf_itf->hff_sector_info(1, &addr, &size);
+    TEST_ASSERT_FATAL(rc == 0, "sector_info() fail");
+
+    rc = hal_flash_erase_sector(0, addr);
+    TEST_ASSERT_FATAL(rc == 0, "hal_flash_erase_sector() fail");
+    memset(buf, 0x5a, sizeof(buf));
+    rc = hal_flash_write(0, addr, buf, sizeof(buf));
+    TEST_ASSERT_FATAL(rc == 0, "hal_flash_write() fail");
+    rc = hal_flash_read(0, addr, buf, sizeof(buf));
+    TEST_ASSERT_FATAL(rc == 0, "hal_flash_read() fail");
+
+    native_flash_emu_stats(&stats);
+    TEST_ASSERT(stats.nfes_erases == 1);
+    TEST_ASSERT(stats.nfes_writes == 1);
+    TEST_ASSERT(stats.nfes_write_bytes == sizeof(buf));
+    TEST_ASSERT(stats.nfes_reads == 1);
+    TEST_ASSERT(stats.nfes_read_bytes == sizeof(buf));
+    TEST_ASSERT(stats.nfes_busy_usecs ==
+      (size / 1024) * profile->nfp_erase_us_per_kb +
+      (sizeof(buf) * profile->nfp_write_ns_per_byte +
+       sizeof(buf) * profile->nfp_read_ns_per_byte) / 1000);
+    TEST_ASSERT(native_flash_erase_count(1) == 1);
+    TEST_ASSERT(native_flash_erase_count(0) == 0);
+
+    /* A sector fails to erase once its endurance is used up. */
+    native_flash_emu_init(&worn, 0);
+    rc = hal_flash_erase_sector(0, addr);
+    TEST_ASSERT(rc == 0);
+    rc = hal_flash_erase_sector(0, addr);
+    TEST_ASSERT(rc == 0);
+    rc = hal_flash_erase_sector(0, addr);
+    TEST_ASSERT(rc != 0);
+    TEST_ASSERT(native_flash_erase_count(1) == 2);
+
+    native_flash_emu_init(NULL, 0);
+    rc = hal_flash_erase_sector(0, addr);
+    TEST_ASSERT(rc == 0);
+}
+#endif
+
+static int flash_map_test_done_cnt;
+static int flash_map_test_done_rc;
+
+static void
+flash_map_test_done(void *arg, int rc)
+{
+    TEST_ASSERT(arg == &flash_map_test_done_cnt);
+    flash_map_test_done_cnt++;
+    flash_map_test_done_rc = rc;
+}
+
+/*
+ * Test hal_flash_write_async() and hal_flash_erase_sector_async()
+ */
+TEST_CASE(flash_map_test_case_4)
+{
+    const struct flash_area *fa;
+    struct flash_area secs[32];
+    int sec_cnt;
+    int rc;
+    uint8_t wd[64];
+    uint8_t rd[64];
+
+    os_init();
+
+    rc = flash_area_open(FLASH_AREA_IMAGE_0, &fa);
+    TEST_ASSERT_FATAL(rc == 0, "flash_area_open() fail");
+    rc = flash_area_to_sectors(FLASH_AREA_IMAGE_0, &sec_cnt, secs);
+    TEST_ASSERT_FATAL(rc == 0, "flash_area_to_sectors failed");
+
+    flash_map_test_done_cnt = 0;
+    flash_map_test_done_rc = -1;
+    rc = hal_flash_erase_sector_async(secs[0].fa_flash_id, secs[0].fa_off,
+      flash_map_test_done, &flash_map_test_done_cnt);
+    TEST_ASSERT_FATAL(rc == 0, "hal_flash_erase_sector_async() fail");
+
+    /* The simulated flash completes requests before returning. */
+    TEST_ASSERT(flash_map_test_done_cnt == 1);
+    TEST_ASSERT(flash_map_test_done_rc == 0);
+
+    memset(wd, 0x3c, sizeof(wd));
+    flash_map_test_done_cnt = 0;
+    flash_map_test_done_rc = -1;
+    rc = hal_flash_write_async(secs[0].fa_flash_id, secs[0].fa_off, wd,
+      sizeof(wd), flash_map_test_done, &flash_map_test_done_cnt);
+    TEST_ASSERT_FATAL(rc == 0, "hal_flash_write_async() fail");
+    TEST_ASSERT(flash_map_test_done_cnt == 1);
+    TEST_ASSERT(flash_map_test_done_rc == 0);
+
+    rc = flash_area_read(fa, 0, rd, sizeof(rd));
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(memcmp(wd, rd, sizeof(rd)) == 0);
+
+    /* A request that can't be started doesn't complete. */
+    flash_map_test_done_cnt = 0;
+    rc = hal_flash_erase_sector_async(secs[0].fa_flash_id, 0xffffffff,
+      flash_map_test_done, &flash_map_test_done_cnt);
+    TEST_ASSERT(rc != 0);
+    TEST_ASSERT(flash_map_test_done_cnt == 0);
+
+    rc = flash_area_erase(fa, 0, secs[0].fa_size);
+    TEST_ASSERT(rc == 0);
+}
+
+/*
+ * Test flash_area_is_empty() and flash_area_erase_ahead()
+ */
+TEST_CASE(flash_map_test_case_5)
+{
+    const struct flash_area *fa;
+    struct flash_area secs[32];
+#ifdef ARCH_sim
+    struct native_flash_emu_stats stats;
+#endif
+    int sec_cnt;
+    uint32_t end;
+    uint32_t off;
+    uint32_t len;
+    int rc;
+    int i;
+    uint8_t wd[1000];
+    uint8_t rd[1000];
+
+    os_init();
+
+    rc = flash_area_open(FLASH_AREA_IMAGE_1, &fa);
+    TEST_ASSERT_FATAL(rc == 0, "flash_area_open() fail");
+    rc = flash_area_to_sectors(FLASH_AREA_IMAGE_1, &sec_cnt, secs);
+    TEST_ASSERT_FATAL(rc == 0 && sec_cnt >= 2, "flash_area_to_sectors fail");
+
+    rc = flash_area_erase(fa, 0, fa->fa_size);
+    TEST_ASSERT_FATAL(rc == 0, "flash_area_erase() fail");
+    TEST_ASSERT(flash_area_is_empty(fa, 0, fa->fa_size) == 1);
+    TEST_ASSERT(flash_area_is_empty(fa, 0, fa->fa_size + 1) < 0);
+
+    /* Dirty the last byte of the second sector. */
+    end = secs[0].fa_size + secs[1].fa_size;
+    wd[0] = 0;
+    rc = flash_area_write(fa, end - 1, wd, 1);
+    TEST_ASSERT_FATAL(rc == 0, "flash_area_write() fail");
+    TEST_ASSERT(flash_area_is_empty(fa, 0, secs[0].fa_size) == 1);
+    TEST_ASSERT(flash_area_is_empty(fa, 1, 5) == 1);
+    TEST_ASSERT(flash_area_is_empty(fa, secs[0].fa_size,
+      secs[1].fa_size) == 0);
+    TEST_ASSERT(flash_area_is_empty(fa, end - 3, 3) == 0);
+
+#ifdef ARCH_sim
+    native_flash_emu_init(NULL, 0);
+#endif
+
+    /* Write both sectors front to back; only the dirty one gets erased. */
+    for (off = 0; off < end; off += len) {
+        len = end - off;
+        if (len > sizeof(wd)) {
+            len = sizeof(wd);
+        }
+        for (i = 0; i < len; i++) {
+            wd[i] = off + i;
+        }
+        rc = flash_area_erase_ahead(fa, off, len);
+        TEST_ASSERT_FATAL(rc == 0, "flash_area_erase_ahead() fail");
+        rc = flash_area_write(fa, off, wd, len);
+        TEST_ASSERT_FATAL(rc == 0, "flash_area_write() fail");
+    }
+
+#ifdef ARCH_sim
+    native_flash_emu_stats(&stats);
+    TEST_ASSERT(stats.nfes_erases == 1);
+#endif
+
+    for (off = 0; off < end; off += len) {
+        len = end - off;
+        if (len > sizeof(rd)) {
+            len = sizeof(rd);
+        }
+        rc = flash_area_read(fa, off, rd, len);
+        TEST_ASSERT_FATAL(rc == 0, "flash_area_read() fail");
+        for (i = 0; i < len; i++) {
+            TEST_ASSERT_FATAL(rd[i] == (uint8_t)(off + i), "bad data");
+        }
+    }
+
+    /* Restarting from the beginning erases the first sector again. */
+    rc = flash_area_erase_ahead(fa, 0, 1);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(flash_area_is_empty(fa, 0, secs[0].fa_size) == 1);
+    TEST_ASSERT(flash_area_is_empty(fa, secs[0].fa_size, 1) == 0);
+
+    /* A range ending where the next sector starts leaves that sector be. */
+    rc = flash_area_erase_ahead(fa, 1, secs[0].fa_size - 1);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(flash_area_is_empty(fa, secs[0].fa_size, 1) == 0);
+    rc = flash_area_erase_ahead(fa, 1, secs[0].fa_size);
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(flash_area_is_empty(fa, secs[0].fa_size,
+      secs[1].fa_size) == 1);
+
+    TEST_ASSERT(flash_area_erase_ahead(fa, fa->fa_size, 1) < 0);
+
+    rc = flash_area_erase(fa, 0, fa->fa_size);
+    TEST_ASSERT(rc == 0);
+}
+
+#ifdef ARCH_sim
+/*
+ * Overlap a write with an erase that is still in progress.  The erasing task
+ * sleeps until the emulated flash interrupt; the write must wait for it
+ * rather than hit the busy controller.
+ */
+#define FLASH_MAP_TEST_STACK_SIZE       1024
+
+static struct os_task flash_map_test_tasks[3];
+static os_stack_t flash_map_test_stacks[3]
+    [OS_STACK_ALIGN(FLASH_MAP_TEST_STACK_SIZE)];
+static struct flash_area flash_map_test_secs[32];
+static uint8_t flash_map_test_wd[64];
+static int flash_map_test_erase_rc;
+static int flash_map_test_erase_done;
+static int flash_map_test_write_rc;
+static int flash_map_test_write_done;
+
+static void
+flash_map_test_erase_task(void *arg)
+{
+    flash_map_test_erase_rc =
+      hal_flash_erase_sector(flash_map_test_secs[1].fa_flash_id,
+        flash_map_test_secs[1].fa_off);
+    flash_map_test_erase_done = 1;
+    while (1) {
+        os_time_delay(1000);
+    }
+}
+
+static void
+flash_map_test_write_task(void *arg)
+{
+    flash_map_test_write_rc =
+      hal_flash_write(flash_map_test_secs[0].fa_flash_id,
+        flash_map_test_secs[0].fa_off, flash_map_test_wd,
+        sizeof(flash_map_test_wd));
+    flash_map_test_write_done = 1;
+    while (1) {
+        os_time_delay(1000);
+    }
+}
+
+static void
+flash_map_test_complete_task(void *arg)
+{
+    uint8_t rd[sizeof(flash_map_test_wd)];
+    int rc;
+
+    /* Both tasks are blocked: one on the erase, one on the device. */
+    TEST_ASSERT(flash_map_test_erase_done == 0);
+    TEST_ASSERT(flash_map_test_write_done == 0);
+
+    rc = native_flash_emu_complete();
+    TEST_ASSERT(rc == 0);
+
+    TEST_ASSERT(flash_map_test_erase_done == 1);
+    TEST_ASSERT(flash_map_test_erase_rc == 0);
+    TEST_ASSERT(flash_map_test_write_done == 1);
+    TEST_ASSERT(flash_map_test_write_rc == 0);
+
+    rc = hal_flash_read(flash_map_test_secs[0].fa_flash_id,
+      flash_map_test_secs[0].fa_off, rd, sizeof(rd));
+    TEST_ASSERT(rc == 0);
+    TEST_ASSERT(memcmp(rd, flash_map_test_wd, sizeof(rd)) == 0);
+
+    /* Nothing left pending. */
+    TEST_ASSERT(native_flash_emu_complete() == -1);
+
+    native_flash_emu_init(NULL, 0);
+    tu_restart();
+}
+
+TEST_CASE(flash_map_test_case_6)
+{
+    const struct flash_area *fa;
+    int sec_cnt;
+    int rc;
+
+    os_init();
+
+    rc = flash_area_open(FLASH_AREA_IMAGE_0, &fa);
+    TEST_ASSERT_FATAL(rc == 0, "flash_area_open() fail");
+    rc = flash_area_to_sectors(FLASH_AREA_IMAGE_0, &sec_cnt,
+      flash_map_test_secs);
+    TEST_ASSERT_FATAL(rc == 0, "flash_area_to_sectors failed");
+    TEST_ASSERT_FATAL(sec_cnt >= 2);
+
+    rc = flash_area_erase(fa, 0,
+      flash_map_test_secs[0].fa_size + flash_map_test_secs[1].fa_size);
+    TEST_ASSERT_FATAL(rc == 0);
+
+    memset(flash_map_test_wd, 0x5a, sizeof(flash_map_test_wd));
+    flash_map_test_erase_done = 0;
+    flash_map_test_write_done = 0;
+    flash_map_test_erase_rc = -1;
+    flash_map_test_write_rc = -1;
+    native_flash_emu_init(NULL, NATIVE_FLASH_EMU_F_ASYNC);
+
+    os_task_init(&flash_map_test_tasks[0], "erase", flash_map_test_erase_task,
+      NULL, 10, OS_WAIT_FOREVER, flash_map_test_stacks[0],
+      OS_STACK_ALIGN(FLASH_MAP_TEST_STACK_SIZE));
+    os_task_init(&flash_map_test_tasks[1], "write", flash_map_test_write_task,
+      NULL, 11, OS_WAIT_FOREVER, flash_map_test_stacks[1],
+      OS_STACK_ALIGN(FLASH_MAP_TEST_STACK_SIZE));
+    os_task_init(&flash_map_test_tasks[2], "complete",
+      flash_map_test_complete_task, NULL, 12, OS_WAIT_FOREVER,
+      flash_map_test_stacks[2], OS_STACK_ALIGN(FLASH_MAP_TEST_STACK_SIZE));
+
+    os_start();
+}
+#endif
+
 TEST_SUITE(flash_map_test_suite)
 {
     flash_map_test_case_1();
     flash_map_test_case_2();
+#ifdef ARCH_sim
+    flash_map_test_case_3();
+#endif
+    flash_map_test_case_4();
+    flash_map_test_case_5();
+#ifdef ARCH_sim
+    flash_map_test_case_6();
+#endif
 }
 
 #ifdef MYNEWT_SELFTEST
@@ -19,9 +19,49 @@
 #ifndef __MCU_SIM_H__
 #define __MCU_SIM_H__
 
+#include <inttypes.h>
+
 extern char *native_flash_file;
 extern char *native_uart_log_file;
 
 void mcu_sim_parse_args(int argc, char **argv);
 
+/**
+ * Timing and endurance of an emulated flash part.  A field of 0 means the
+ * corresponding operation takes no time, or that erases are unlimited.
+ */
+struct native_flash_profile {
+    const char *nfp_name;
+    uint32_t nfp_read_ns_per_byte;
+    uint32_t nfp_write_ns_per_byte;
+    uint32_t nfp_erase_us;              /* Fixed cost of each erase. */
+    uint32_t nfp_erase_us_per_kb;       /* Plus this per KB erased. */
+    uint32_t nfp_endurance;             /* Erase cycles per sector. */
+};
+
+extern const struct native_flash_profile native_flash_profile_nrf51;
+extern const struct native_flash_profile native_flash_profile_nrf52;
+extern const struct native_flash_profile native_flash_profile_stm32f4;
+
+/** Block the caller for the emulated duration of each operation. */
+#define NATIVE_FLASH_EMU_F_DELAY        0x01
+/** Hold asynchronous operations until native_flash_emu_complete(). */
+#define NATIVE_FLASH_EMU_F_ASYNC        0x02
+
+struct native_flash_emu_stats {
+    uint32_t nfes_reads;
+    uint32_t nfes_writes;
+    uint32_t nfes_erases;
+    uint64_t nfes_read_bytes;
+    uint64_t nfes_write_bytes;
+    uint64_t nfes_busy_usecs;           /* Total emulated flash time. */
+};
+
+const struct native_flash_profile *native_flash_profile_find(const char *name);
+void native_flash_emu_init(const struct native_flash_profile *profile,
+                           uint8_t flags);
+void native_flash_emu_stats(struct native_flash_emu_stats *out_stats);
+uint32_t native_flash_erase_count(int sector_idx);
+int native_flash_emu_complete(void);
+
 #endif /* __MCU_SIM_H__ */
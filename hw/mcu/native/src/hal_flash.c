@@ -19,10 +19,12 @@
 
 #include <sys/mman.h>
 #include <fcntl.h>
+#include <errno.h>
 #include <assert.h>
 #include <string.h>
 #include <inttypes.h>
 #include <stdlib.h>
+#include <time.h>
 #include "hal/hal_flash_int.h"
 #include "mcu/mcu_sim.h"
 
@@ -36,13 +38,21 @@ static int native_flash_write(uint32_t address, const void *src,
   uint32_t length);
 static int native_flash_erase_sector(uint32_t sector_address);
 static int native_flash_sector_info(int idx, uint32_t *address, uint32_t *size);
+static int native_flash_ptr(uint32_t address, const void **out_ptr);
+static int native_flash_write_async(uint32_t address, const void *src,
+  uint32_t length, hal_flash_done_cb cb, void *arg);
+static int native_flash_erase_sector_async(uint32_t sector_address,
+  hal_flash_done_cb cb, void *arg);
 
 static const struct hal_flash_funcs native_flash_funcs = {
     .hff_read = native_flash_read,
     .hff_write = native_flash_write,
     .hff_erase_sector = native_flash_erase_sector,
     .hff_sector_info = native_flash_sector_info,
-    .hff_init = native_flash_init
+    .hff_init = native_flash_init,
+    .hff_ptr = native_flash_ptr,
+    .hff_write_async = native_flash_write_async,
+    .hff_erase_sector_async = native_flash_erase_sector_async
 };
 
 static const uint32_t native_flash_sectors[] = {
@@ -71,6 +81,204 @@ const struct hal_flash native_flash_dev = {
     .hf_align = 1
 };
 
+/*
+ * Timing emulation.  Typical figures from the datasheets of each part's
+ * internal flash.  The nRF parts erase in pages (1 KB on nRF51, 4 KB on
+ * nRF52), so the native sectors are charged per KB.  STM32F4 sector erase
+ * time is roughly linear in the sector size: about 250 ms for 16 KB and 1 s
+ * for 128 KB.
+ */
+const struct native_flash_profile native_flash_profile_nrf51 = {
+    .nfp_name = "nrf51",
+    .nfp_read_ns_per_byte = 16,
+    .nfp_write_ns_per_byte = 11575,     /* 46.3 us per 32-bit word. */
+    .nfp_erase_us = 0,
+    .nfp_erase_us_per_kb = 22300,
+    .nfp_endurance = 20000,
+};
+
+const struct native_flash_profile native_flash_profile_nrf52 = {
+    .nfp_name = "nrf52",
+    .nfp_read_ns_per_byte = 4,
+    .nfp_write_ns_per_byte = 10250,     /* 41 us per 32-bit word. */
+    .nfp_erase_us = 0,
+    .nfp_erase_us_per_kb = 21250,       /* 85 ms per 4 KB page. */
+    .nfp_endurance = 10000,
+};
+
+const struct native_flash_profile native_flash_profile_stm32f4 = {
+    .nfp_name = "stm32f4",
+    .nfp_read_ns_per_byte = 2,
+    .nfp_write_ns_per_byte = 4000,      /* 16 us per 32-bit word. */
+    .nfp_erase_us = 150000,
+    .nfp_erase_us_per_kb = 6700,
+    .nfp_endurance = 10000,
+};
+
+static const struct native_flash_profile * const native_flash_profiles[] = {
+    &native_flash_profile_nrf51,
+    &native_flash_profile_nrf52,
+    &native_flash_profile_stm32f4,
+};
+
+/* Delays are batched; nanosleep() is too coarse for single-word writes. */
+#define NATIVE_FLASH_EMU_DELAY_MIN_NS   1000000
+
+static const struct native_flash_profile *native_flash_emu_profile;
+static uint8_t native_flash_emu_flags;
+static uint64_t native_flash_emu_busy_ns;
+static uint64_t native_flash_emu_debt_ns;
+static struct native_flash_emu_stats native_flash_emu_counts;
+static uint32_t native_flash_erase_counts[FLASH_NUM_AREAS];
+
+/*
+ * Asynchronous operation held back with NATIVE_FLASH_EMU_F_ASYNC; performed
+ * by native_flash_emu_complete().  Like a real controller, the flash
+ * refuses other writes and erases until then.
+ */
+static hal_flash_done_cb native_flash_async_cb;
+static void *native_flash_async_arg;
+static uint32_t native_flash_async_addr;
+static const void *native_flash_async_src;
+static uint32_t native_flash_async_len;
+static uint8_t native_flash_async_erase;
+
+/**
+ * Looks up a built-in flash profile by name.
+ *
+ * @return                      The profile on success; NULL if there is no
+ *                                  profile with the specified name.
+ */
+const struct native_flash_profile *
+native_flash_profile_find(const char *name)
+{
+    int i;
+
+    for (i = 0;
+         i < sizeof native_flash_profiles / sizeof native_flash_profiles[0];
+         i++) {
+
+        if (strcmp(native_flash_profiles[i]->nfp_name, name) == 0) {
+            return native_flash_profiles[i];
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Selects the flash part to emulate and clears all counters, including the
+ * per-sector erase counts.  Emulated time is accumulated in the statistics;
+ * with NATIVE_FLASH_EMU_F_DELAY, each operation also blocks the caller for
+ * that long.  With NATIVE_FLASH_EMU_F_ASYNC, asynchronous writes and erases
+ * stay pending until native_flash_emu_complete() is called.
+ *
+ * @param profile               The part to emulate; NULL to make flash
+ *                                  operations instantaneous again.
+ * @param flags                 NATIVE_FLASH_EMU_F_[...]
+ */
+void
+native_flash_emu_init(const struct native_flash_profile *profile,
+                      uint8_t flags)
+{
+    native_flash_emu_profile = profile;
+    native_flash_emu_flags = flags;
+    native_flash_emu_busy_ns = 0;
+    native_flash_emu_debt_ns = 0;
+    memset(&native_flash_emu_counts, 0, sizeof native_flash_emu_counts);
+    memset(native_flash_erase_counts, 0, sizeof native_flash_erase_counts);
+}
+
+void
+native_flash_emu_stats(struct native_flash_emu_stats *out_stats)
+{
+    *out_stats = native_flash_emu_counts;
+    out_stats->nfes_busy_usecs = native_flash_emu_busy_ns / 1000;
+}
+
+/**
+ * Retrieves the number of times a sector has been erased since the last
+ * call to native_flash_emu_init().
+ */
+uint32_t
+native_flash_erase_count(int sector_idx)
+{
+    assert(sector_idx >= 0 && sector_idx < FLASH_NUM_AREAS);
+    return native_flash_erase_counts[sector_idx];
+}
+
+static void
+native_flash_emu_charge(uint64_t ns)
+{
+    struct timespec ts;
+
+    native_flash_emu_busy_ns += ns;
+
+    if (native_flash_emu_flags & NATIVE_FLASH_EMU_F_DELAY) {
+        native_flash_emu_debt_ns += ns;
+        if (native_flash_emu_debt_ns >= NATIVE_FLASH_EMU_DELAY_MIN_NS) {
+            ts.tv_sec = native_flash_emu_debt_ns / 1000000000;
+            ts.tv_nsec = native_flash_emu_debt_ns % 1000000000;
+            /* The OS tick signal interrupts the sleep; finish it. */
+            while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+            }
+            native_flash_emu_debt_ns = 0;
+        }
+    }
+}
+
+static void
+native_flash_emu_read(uint32_t length)
+{
+    native_flash_emu_counts.nfes_reads++;
+    native_flash_emu_counts.nfes_read_bytes += length;
+    if (native_flash_emu_profile != NULL) {
+        native_flash_emu_charge(
+            (uint64_t)length * native_flash_emu_profile->nfp_read_ns_per_byte);
+    }
+}
+
+static void
+native_flash_emu_write(uint32_t length)
+{
+    native_flash_emu_counts.nfes_writes++;
+    native_flash_emu_counts.nfes_write_bytes += length;
+    if (native_flash_emu_profile != NULL) {
+        native_flash_emu_charge(
+            (uint64_t)length *
+            native_flash_emu_profile->nfp_write_ns_per_byte);
+    }
+}
+
+/**
+ * Accounts for a sector erase.
+ *
+ * @return                      0 if the erase may proceed;
+ *                              -1 if the sector is worn out.
+ */
+static int
+native_flash_emu_erase(int sector_idx, uint32_t len)
+{
+    const struct native_flash_profile *profile;
+
+    profile = native_flash_emu_profile;
+    if (profile != NULL && profile->nfp_endurance != 0 &&
+        native_flash_erase_counts[sector_idx] >= profile->nfp_endurance) {
+
+        return -1;
+    }
+
+    native_flash_erase_counts[sector_idx]++;
+    native_flash_emu_counts.nfes_erases++;
+    if (profile != NULL) {
+        native_flash_emu_charge(
+            ((uint64_t)profile->nfp_erase_us +
+             (uint64_t)profile->nfp_erase_us_per_kb * len / 1024) * 1000);
+    }
+
+    return 0;
+}
+
 static void
 flash_native_erase(uint32_t addr, uint32_t len)
 {
@@ -120,7 +328,6 @@ flash_native_write_internal(uint32_t address, const void *src, uint32_t length,
     uint32_t cur;
     uint32_t end;
     int chunk_sz;
-    int rc;
     int i;
 
     if (length == 0) {
@@ -139,10 +346,11 @@ flash_native_write_internal(uint32_t address, const void *src, uint32_t length,
             chunk_sz = sizeof buf;
         }
 
-        /* Ensure data is not being overwritten. */
+        /* Ensure data is not being overwritten.  This check is not an
+         * emulated flash read, so bypass native_flash_read().
+         */
         if (!allow_overwrite) {
-            rc = native_flash_read(cur, buf, chunk_sz);
-            assert(rc == 0);
+            memcpy(buf, (char *)file_loc + cur, chunk_sz);
             for (i = 0; i < chunk_sz; i++) {
                 assert(buf[i] == 0xff);
             }
@@ -159,7 +367,11 @@ flash_native_write_internal(uint32_t address, const void *src, uint32_t length,
 static int
 native_flash_write(uint32_t address, const void *src, uint32_t length)
 {
+    if (native_flash_async_cb) {
+        return -1;
+    }
     assert(address % native_flash_dev.hf_align == 0);
+    native_flash_emu_write(length);
     return flash_native_write_internal(address, src, length, 0);
 }
 
@@ -174,11 +386,21 @@ static int
 native_flash_read(uint32_t address, void *dst, uint32_t length)
 {
     flash_native_ensure_file_open();
+    native_flash_emu_read(length);
     memcpy(dst, (char *)file_loc + address, length);
 
     return 0;
 }
 
+static int
+native_flash_ptr(uint32_t address, const void **out_ptr)
+{
+    flash_native_ensure_file_open();
+    *out_ptr = (char *)file_loc + address;
+
+    return 0;
+}
+
 static int
 find_area(uint32_t address)
 {
@@ -212,6 +434,9 @@ native_flash_erase_sector(uint32_t sector_address)
     int area_id;
     uint32_t len;
 
+    if (native_flash_async_cb) {
+        return -1;
+    }
     flash_native_ensure_file_open();
 
     area_id = find_area(sector_address);
@@ -219,10 +444,86 @@ native_flash_erase_sector(uint32_t sector_address)
         return -1;
     }
     len = flash_sector_len(area_id);
+    if (native_flash_emu_erase(area_id, len) != 0) {
+        return -1;
+    }
     flash_native_erase(sector_address, len);
     return 0;
 }
 
+static int
+native_flash_async_start(int erase, uint32_t address, const void *src,
+  uint32_t length, hal_flash_done_cb cb, void *arg)
+{
+    int rc;
+
+    if (native_flash_async_cb) {
+        return -1;
+    }
+    if (!(native_flash_emu_flags & NATIVE_FLASH_EMU_F_ASYNC)) {
+        if (erase) {
+            rc = native_flash_erase_sector(address);
+        } else {
+            rc = native_flash_write(address, src, length);
+        }
+        cb(arg, rc);
+        return 0;
+    }
+    if (erase && find_area(address) == -1) {
+        return -1;
+    }
+
+    native_flash_async_cb = cb;
+    native_flash_async_arg = arg;
+    native_flash_async_addr = address;
+    native_flash_async_src = src;
+    native_flash_async_len = length;
+    native_flash_async_erase = erase;
+    return 0;
+}
+
+static int
+native_flash_write_async(uint32_t address, const void *src, uint32_t length,
+  hal_flash_done_cb cb, void *arg)
+{
+    return native_flash_async_start(0, address, src, length, cb, arg);
+}
+
+static int
+native_flash_erase_sector_async(uint32_t sector_address, hal_flash_done_cb cb,
+  void *arg)
+{
+    return native_flash_async_start(1, sector_address, NULL, 0, cb, arg);
+}
+
+/**
+ * Performs the pending asynchronous operation and calls its completion
+ * callback, as the flash interrupt would on hardware.
+ *
+ * @return                      0 on success; -1 if no operation is pending.
+ */
+int
+native_flash_emu_complete(void)
+{
+    hal_flash_done_cb cb;
+    int rc;
+
+    cb = native_flash_async_cb;
+    if (!cb) {
+        return -1;
+    }
+    native_flash_async_cb = NULL;
+
+    if (native_flash_async_erase) {
+        rc = native_flash_erase_sector(native_flash_async_addr);
+    } else {
+        rc = native_flash_write(native_flash_async_addr,
+          native_flash_async_src, native_flash_async_len);
+    }
+    cb(native_flash_async_arg, rc);
+    return 0;
+}
+
 static int
 native_flash_sector_info(int idx, uint32_t *address, uint32_t *size)
 {
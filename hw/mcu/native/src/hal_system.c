@@ -39,9 +39,11 @@ static void
 usage(char *progname, int rc)
 {
     const char msg[] =
-      "Usage: %s [-f flash_file] [-u uart_log_file]\n"
+      "Usage: %s [-f flash_file] [-t flash_profile] [-u uart_log_file]\n"
       "     -f flash_file tells where binary flash file is located. It gets\n"
       "        created if it doesn't already exist.\n"
+      "     -t flash_profile makes flash operations take as long as on a\n"
+      "        real part: nrf51, nrf52 or stm32f4.\n"
       "     -u uart_log_file puts all UART data exchanges into a logfile.\n";
 
     write(2, msg, strlen(msg));
@@ -51,14 +53,22 @@ usage(char *progname, int rc)
 void
 mcu_sim_parse_args(int argc, char **argv)
 {
+    const struct native_flash_profile *profile;
     int ch;
     char *progname = argv[0];
 
-    while ((ch = getopt(argc, argv, "hf:u:")) != -1) {
+    while ((ch = getopt(argc, argv, "hf:t:u:")) != -1) {
         switch (ch) {
         case 'f':
             native_flash_file = optarg;
             break;
+        case 't':
+            profile = native_flash_profile_find(optarg);
+            if (profile == NULL) {
+                usage(progname, -1);
+            }
+            native_flash_emu_init(profile, NATIVE_FLASH_EMU_F_DELAY);
+            break;
         case 'u':
             native_uart_log_file = optarg;
             break;
@@ -47,6 +47,10 @@ struct uart {
     hal_uart_tx_char u_tx_func;
     hal_uart_tx_done u_tx_done;
     void *u_func_arg;
+    const uint8_t *u_tx_buf;
+    int u_tx_len;
+    hal_uart_tx_buf_done u_tx_buf_done;
+    void *u_tx_buf_arg;
 };
 
 /*
@@ -128,6 +132,41 @@ uart_log_data(struct uart *u, int istx, uint8_t data)
     }
 }
 
+/*
+ * Writes pending blocks, including ones queued from the done callback, as
+ * far as the pty takes them.
+ */
+static void
+uart_tx_buf_poll(struct uart *uart)
+{
+    hal_uart_tx_buf_done done;
+    int bytes;
+    int rc;
+    int sr;
+    int i;
+
+    for (bytes = 0; uart->u_tx_buf && bytes < UART_MAX_BYTES_PER_POLL;
+         bytes += rc) {
+        rc = write(uart->u_fd, uart->u_tx_buf, uart->u_tx_len);
+        if (rc <= 0) {
+            break;
+        }
+        OS_ENTER_CRITICAL(sr);
+        for (i = 0; i < rc; i++) {
+            uart_log_data(uart, 1, uart->u_tx_buf[i]);
+        }
+        uart->u_tx_buf += rc;
+        uart->u_tx_len -= rc;
+        if (uart->u_tx_len == 0) {
+            done = uart->u_tx_buf_done;
+            uart->u_tx_buf = NULL;
+            uart->u_tx_buf_done = NULL;
+            done(uart->u_tx_buf_arg);
+        }
+        OS_EXIT_CRITICAL(sr);
+    }
+}
+
 static void
 uart_poller(void *arg)
 {
@@ -145,8 +184,11 @@ uart_poller(void *arg)
             }
             uart = &uarts[i];
 
+            if (uart->u_tx_buf) {
+                uart_tx_buf_poll(uart);
+            }
             for (bytes = 0; bytes < UART_MAX_BYTES_PER_POLL; bytes++) {
-                if (uart->u_tx_run) {
+                if (uart->u_tx_run && !uart->u_tx_buf) {
                     OS_ENTER_CRITICAL(sr);
                     rc = uart->u_tx_func(uart->u_func_arg);
                     if (rc < 0) {
@@ -282,6 +324,30 @@ hal_uart_start_tx(int port)
     OS_EXIT_CRITICAL(sr);
 }
 
+int
+hal_uart_tx_buf(int port, const uint8_t *buf, int len,
+  hal_uart_tx_buf_done tx_done, void *arg)
+{
+    struct uart *uart;
+    int sr;
+
+    if (port >= UART_CNT || uarts[port].u_open == 0 || len <= 0) {
+        return -1;
+    }
+    uart = &uarts[port];
+    OS_ENTER_CRITICAL(sr);
+    if (uart->u_tx_buf || uart->u_tx_run) {
+        OS_EXIT_CRITICAL(sr);
+        return -1;
+    }
+    uart->u_tx_buf = buf;
+    uart->u_tx_len = len;
+    uart->u_tx_buf_done = tx_done;
+    uart->u_tx_buf_arg = arg;
+    OS_EXIT_CRITICAL(sr);
+    return 0;
+}
+
 void
 hal_uart_start_rx(int port)
 {
@@ -33,13 +33,15 @@ static int nrf51_flash_write(uint32_t address, const void *src,
 static int nrf51_flash_erase_sector(uint32_t sector_address);
 static int nrf51_flash_sector_info(int idx, uint32_t *address, uint32_t *sz);
 static int nrf51_flash_init(void);
+static int nrf51_flash_ptr(uint32_t address, const void **out_ptr);
 
 static const struct hal_flash_funcs nrf51_flash_funcs = {
     .hff_read = nrf51_flash_read,
     .hff_write = nrf51_flash_write,
     .hff_erase_sector = nrf51_flash_erase_sector,
     .hff_sector_info = nrf51_flash_sector_info,
-    .hff_init = nrf51_flash_init
+    .hff_init = nrf51_flash_init,
+    .hff_ptr = nrf51_flash_ptr
 };
 
 const struct hal_flash nrf51_flash_dev = {
@@ -75,6 +77,14 @@ nrf51_flash_read(uint32_t address, void *dst, uint32_t num_bytes)
 /*
  * Flash write is done by writing 4 bytes at a time at a word boundary.
  */
+static int
+nrf51_flash_ptr(uint32_t address, const void **out_ptr)
+{
+    /* Flash is mapped into the address space. */
+    *out_ptr = (const void *)address;
+    return 0;
+}
+
 static int
 nrf51_flash_write(uint32_t address, const void *src, uint32_t num_bytes)
 {
@@ -25,6 +25,7 @@
 #include "mcu/nrf51_hal.h"
 
 #include <assert.h>
+#include <stddef.h>
 
 #define UART_INT_TXDRDY		UART_INTENSET_TXDRDY_Msk
 #define UART_INT_RXDRDY		UART_INTENSET_RXDRDY_Msk
@@ -37,11 +38,16 @@ struct hal_uart {
     uint8_t u_open:1;
     uint8_t u_rx_stall:1;
     uint8_t u_tx_started:1;
+    uint8_t u_tx_pend:1;
     uint8_t u_tx_buf;
     hal_uart_rx_char u_rx_func;
     hal_uart_tx_char u_tx_func;
     hal_uart_tx_done u_tx_done;
     void *u_func_arg;
+    const uint8_t *u_tx_ptr;	/* hal_uart_tx_buf() block being sent */
+    int u_tx_len;
+    hal_uart_tx_buf_done u_tx_buf_done;
+    void *u_tx_buf_arg;
 };
 static struct hal_uart uart;
 
@@ -72,6 +78,18 @@ hal_uart_tx_fill_buf(struct hal_uart *u)
     int i;
 
     i = 0;
+    if (u->u_tx_ptr) {
+        /*
+         * UART has no DMA; feed block from TXDRDY interrupt without going
+         * through tx_func.
+         */
+        if (u->u_tx_len > 0) {
+            u->u_tx_buf = *u->u_tx_ptr++;
+            u->u_tx_len--;
+            i = 1;
+        }
+        return i;
+    }
     data = u->u_tx_func(u->u_func_arg);
     if (data >= 0) {
         u->u_tx_buf = data;
@@ -80,6 +98,35 @@ hal_uart_tx_fill_buf(struct hal_uart *u)
     return i;
 }
 
+int
+hal_uart_tx_buf(int port, const uint8_t *buf, int len,
+  hal_uart_tx_buf_done tx_done, void *arg)
+{
+    struct hal_uart *u;
+    int sr;
+
+    u = &uart;
+    if (port != 0 || !u->u_open || len <= 0) {
+        return -1;
+    }
+    __HAL_DISABLE_INTERRUPTS(sr);
+    if (u->u_tx_started) {
+        __HAL_ENABLE_INTERRUPTS(sr);
+        return -1;
+    }
+    u->u_tx_ptr = buf;
+    u->u_tx_len = len;
+    u->u_tx_buf_done = tx_done;
+    u->u_tx_buf_arg = arg;
+    hal_uart_tx_fill_buf(u);
+    NRF_UART0->INTENSET = UART_INT_TXDRDY;
+    NRF_UART0->TXD = u->u_tx_buf;
+    NRF_UART0->TASKS_STARTTX = 1;
+    u->u_tx_started = 1;
+    __HAL_ENABLE_INTERRUPTS(sr);
+    return 0;
+}
+
 void
 hal_uart_start_tx(int port)
 {
@@ -89,7 +136,9 @@ hal_uart_start_tx(int port)
 
     u = &uart;
     __HAL_DISABLE_INTERRUPTS(sr);
-    if (u->u_tx_started == 0) {
+    if (u->u_tx_ptr) {
+        u->u_tx_pend = 1;
+    } else if (u->u_tx_started == 0) {
         rc = hal_uart_tx_fill_buf(u);
         if (rc > 0) {
             NRF_UART0->INTENSET = UART_INT_TXDRDY;
@@ -168,6 +217,16 @@ uart_irq_handler(void)
         if (rc > 0) {
             NRF_UART0->TXD = u->u_tx_buf;
             NRF_UART0->TASKS_STARTTX = 1;
+        } else if (u->u_tx_ptr) {
+            NRF_UART0->INTENCLR = UART_INT_TXDRDY;
+            NRF_UART0->TASKS_STOPTX = 1;
+            u->u_tx_ptr = NULL;
+            u->u_tx_started = 0;
+            u->u_tx_buf_done(u->u_tx_buf_arg);
+            if (u->u_tx_pend) {
+                u->u_tx_pend = 0;
+                hal_uart_start_tx(0);
+            }
         } else {
             if (u->u_tx_done) {
                 u->u_tx_done(u->u_func_arg);
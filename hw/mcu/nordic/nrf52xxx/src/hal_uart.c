@@ -25,6 +25,7 @@
 #include "mcu/nrf52_hal.h"
 
 #include <assert.h>
+#include <stddef.h>
 
 #define UARTE_INT_ENDTX		UARTE_INTEN_ENDTX_Msk
 #define UARTE_INT_ENDRX		UARTE_INTEN_ENDRX_Msk
@@ -39,12 +40,18 @@ struct hal_uart {
     uint8_t u_open:1;
     uint8_t u_rx_stall:1;
     uint8_t u_tx_started:1;
+    uint8_t u_tx_pend:1;
     uint8_t u_rx_buf;
     uint8_t u_tx_buf[8];
     hal_uart_rx_char u_rx_func;
     hal_uart_tx_char u_tx_func;
     hal_uart_tx_done u_tx_done;
     void *u_func_arg;
+    const uint8_t *u_tx_ptr;	/* hal_uart_tx_buf() block being sent */
+    int u_tx_len;
+    int u_tx_cnt;		/* bytes in current DMA transfer */
+    hal_uart_tx_buf_done u_tx_buf_done;
+    void *u_tx_buf_arg;
 };
 static struct hal_uart uart;
 
@@ -84,6 +91,49 @@ hal_uart_tx_fill_buf(struct hal_uart *u)
     return i;
 }
 
+/*
+ * Starts DMA of the next piece of the block straight from caller's buffer.
+ * TXD.MAXCNT is 8 bits wide.
+ */
+static void
+hal_uart_tx_buf_next(struct hal_uart *u)
+{
+    u->u_tx_cnt = u->u_tx_len;
+    if (u->u_tx_cnt > UARTE_TXD_MAXCNT_MAXCNT_Msk) {
+        u->u_tx_cnt = UARTE_TXD_MAXCNT_MAXCNT_Msk;
+    }
+    NRF_UARTE0->TXD.PTR = (uint32_t)u->u_tx_ptr;
+    NRF_UARTE0->TXD.MAXCNT = u->u_tx_cnt;
+    NRF_UARTE0->TASKS_STARTTX = 1;
+}
+
+int
+hal_uart_tx_buf(int port, const uint8_t *buf, int len,
+  hal_uart_tx_buf_done tx_done, void *arg)
+{
+    struct hal_uart *u;
+    int sr;
+
+    u = &uart;
+    if (port != 0 || !u->u_open || len <= 0) {
+        return -1;
+    }
+    __HAL_DISABLE_INTERRUPTS(sr);
+    if (u->u_tx_started) {
+        __HAL_ENABLE_INTERRUPTS(sr);
+        return -1;
+    }
+    u->u_tx_ptr = buf;
+    u->u_tx_len = len;
+    u->u_tx_buf_done = tx_done;
+    u->u_tx_buf_arg = arg;
+    NRF_UARTE0->INTENSET = UARTE_INT_ENDTX;
+    hal_uart_tx_buf_next(u);
+    u->u_tx_started = 1;
+    __HAL_ENABLE_INTERRUPTS(sr);
+    return 0;
+}
+
 void
 hal_uart_start_tx(int port)
 {
@@ -93,7 +143,9 @@ hal_uart_start_tx(int port)
 
     u = &uart;
     __HAL_DISABLE_INTERRUPTS(sr);
-    if (u->u_tx_started == 0) {
+    if (u->u_tx_ptr) {
+        u->u_tx_pend = 1;
+    } else if (u->u_tx_started == 0) {
         rc = hal_uart_tx_fill_buf(u);
         if (rc > 0) {
             NRF_UARTE0->INTENSET = UARTE_INT_ENDTX;
@@ -156,6 +208,29 @@ hal_uart_blocking_tx(int port, uint8_t data)
     NRF_UARTE0->TASKS_STOPTX = 1;
 }
 
+/*
+ * ENDTX of a hal_uart_tx_buf() transfer.
+ */
+static void
+uart_tx_buf_end(struct hal_uart *u)
+{
+    u->u_tx_ptr += u->u_tx_cnt;
+    u->u_tx_len -= u->u_tx_cnt;
+    if (u->u_tx_len > 0) {
+        hal_uart_tx_buf_next(u);
+        return;
+    }
+    NRF_UARTE0->INTENCLR = UARTE_INT_ENDTX;
+    NRF_UARTE0->TASKS_STOPTX = 1;
+    u->u_tx_ptr = NULL;
+    u->u_tx_started = 0;
+    u->u_tx_buf_done(u->u_tx_buf_arg);
+    if (u->u_tx_pend) {
+        u->u_tx_pend = 0;
+        hal_uart_start_tx(0);
+    }
+}
+
 static void
 uart_irq_handler(void)
 {
@@ -163,7 +238,10 @@ uart_irq_handler(void)
     int rc;
 
     u = &uart;
-    if (NRF_UARTE0->EVENTS_ENDTX) {
+    if (NRF_UARTE0->EVENTS_ENDTX && u->u_tx_ptr) {
+        NRF_UARTE0->EVENTS_ENDTX = 0;
+        uart_tx_buf_end(u);
+    } else if (NRF_UARTE0->EVENTS_ENDTX) {
         NRF_UARTE0->EVENTS_ENDTX = 0;
         rc = hal_uart_tx_fill_buf(u);
         if (rc > 0) {
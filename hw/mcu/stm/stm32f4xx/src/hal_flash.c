@@ -18,6 +18,8 @@
  */
 
 #include <string.h>
+#include "bsp/cmsis_nvic.h"
+#include "mcu/stm32f4xx.h"
 #include "mcu/stm32f4xx_hal_def.h"
 #include "mcu/stm32f4xx_hal_flash.h"
 #include "mcu/stm32f4xx_hal_flash_ex.h"
@@ -29,13 +31,21 @@ static int stm32f4_flash_write(uint32_t address, const void *src,
 static int stm32f4_flash_erase_sector(uint32_t sector_address);
 static int stm32f4_flash_sector_info(int idx, uint32_t *address, uint32_t *sz);
 static int stm32f4_flash_init(void);
+static int stm32f4_flash_ptr(uint32_t address, const void **out_ptr);
+static int stm32f4_flash_write_async(uint32_t address, const void *src,
+  uint32_t num_bytes, hal_flash_done_cb cb, void *arg);
+static int stm32f4_flash_erase_sector_async(uint32_t sector_address,
+  hal_flash_done_cb cb, void *arg);
 
 static const struct hal_flash_funcs stm32f4_flash_funcs = {
     .hff_read = stm32f4_flash_read,
     .hff_write = stm32f4_flash_write,
     .hff_erase_sector = stm32f4_flash_erase_sector,
     .hff_sector_info = stm32f4_flash_sector_info,
-    .hff_init = stm32f4_flash_init
+    .hff_init = stm32f4_flash_init,
+    .hff_ptr = stm32f4_flash_ptr,
+    .hff_write_async = stm32f4_flash_write_async,
+    .hff_erase_sector_async = stm32f4_flash_erase_sector_async
 };
 
 static const uint32_t stm32f4_flash_sectors[] = {
@@ -66,6 +76,19 @@ const struct hal_flash stm32f4_flash_dev = {
     .hf_align = 1
 };
 
+/*
+ * State of the asynchronous operation in progress, if any.  Writes program
+ * one byte per end-of-operation interrupt.  Synchronous writes and erases
+ * are refused while an asynchronous operation is in progress.
+ */
+static hal_flash_done_cb stm32f4_flash_async_cb;
+static void *stm32f4_flash_async_arg;
+static const uint8_t *stm32f4_flash_async_src;
+static uint32_t stm32f4_flash_async_addr;
+static uint32_t stm32f4_flash_async_left;
+static volatile uint8_t stm32f4_flash_async_eop;
+static volatile uint8_t stm32f4_flash_async_err;
+
 static int
 stm32f4_flash_read(uint32_t address, void *dst, uint32_t num_bytes)
 {
@@ -73,6 +96,14 @@ stm32f4_flash_read(uint32_t address, void *dst, uint32_t num_bytes)
     return 0;
 }
 
+static int
+stm32f4_flash_ptr(uint32_t address, const void **out_ptr)
+{
+    /* Flash is mapped into the address space. */
+    *out_ptr = (const void *)address;
+    return 0;
+}
+
 static int
 stm32f4_flash_write(uint32_t address, const void *src, uint32_t num_bytes)
 {
@@ -80,6 +111,10 @@ stm32f4_flash_write(uint32_t address, const void *src, uint32_t num_bytes)
     uint32_t i;
     int rc;
 
+    if (stm32f4_flash_async_cb) {
+        return -1;
+    }
+
     sptr = src;
     /*
      * Clear status of previous operation.
@@ -109,6 +144,10 @@ stm32f4_flash_erase_sector(uint32_t sector_address)
 {
     int i;
 
+    if (stm32f4_flash_async_cb) {
+        return -1;
+    }
+
     for (i = 0; i < STM32F4_FLASH_NUM_AREAS - 1; i++) {
         if (stm32f4_flash_sectors[i] == sector_address) {
             stm32f4_flash_erase_sector_id(i);
@@ -119,6 +158,140 @@ stm32f4_flash_erase_sector(uint32_t sector_address)
     return -1;
 }
 
+/*
+ * Called by HAL_FLASH_IRQHandler().
+ */
+void
+HAL_FLASH_EndOfOperationCallback(uint32_t ReturnValue)
+{
+    stm32f4_flash_async_eop = 1;
+}
+
+void
+HAL_FLASH_OperationErrorCallback(uint32_t ReturnValue)
+{
+    stm32f4_flash_async_err = 1;
+}
+
+static void
+stm32f4_flash_async_done(int rc)
+{
+    hal_flash_done_cb cb;
+
+    cb = stm32f4_flash_async_cb;
+    stm32f4_flash_async_cb = NULL;
+    cb(stm32f4_flash_async_arg, rc);
+}
+
+static int
+stm32f4_flash_async_write_next(void)
+{
+    int rc;
+
+    rc = HAL_FLASH_Program_IT(FLASH_TYPEPROGRAM_BYTE, stm32f4_flash_async_addr,
+      *stm32f4_flash_async_src);
+    if (rc != 0) {
+        return rc;
+    }
+    stm32f4_flash_async_addr++;
+    stm32f4_flash_async_src++;
+    stm32f4_flash_async_left--;
+    return 0;
+}
+
+static void
+stm32f4_flash_isr(void)
+{
+    HAL_FLASH_IRQHandler();
+
+    if (!stm32f4_flash_async_cb) {
+        return;
+    }
+    if (stm32f4_flash_async_err) {
+        stm32f4_flash_async_done(-1);
+        return;
+    }
+    if (!stm32f4_flash_async_eop) {
+        return;
+    }
+    stm32f4_flash_async_eop = 0;
+
+    if (stm32f4_flash_async_left > 0) {
+        if (stm32f4_flash_async_write_next() != 0) {
+            stm32f4_flash_async_done(-1);
+        }
+    } else {
+        stm32f4_flash_async_done(0);
+    }
+}
+
+static int
+stm32f4_flash_write_async(uint32_t address, const void *src,
+  uint32_t num_bytes, hal_flash_done_cb cb, void *arg)
+{
+    int rc;
+
+    if (stm32f4_flash_async_cb) {
+        return -1;
+    }
+    if (num_bytes == 0) {
+        cb(arg, 0);
+        return 0;
+    }
+
+    stm32f4_flash_async_cb = cb;
+    stm32f4_flash_async_arg = arg;
+    stm32f4_flash_async_src = src;
+    stm32f4_flash_async_addr = address;
+    stm32f4_flash_async_left = num_bytes;
+    stm32f4_flash_async_eop = 0;
+    stm32f4_flash_async_err = 0;
+
+    rc = stm32f4_flash_async_write_next();
+    if (rc != 0) {
+        stm32f4_flash_async_cb = NULL;
+    }
+    return rc;
+}
+
+static int
+stm32f4_flash_erase_sector_async(uint32_t sector_address,
+  hal_flash_done_cb cb, void *arg)
+{
+    FLASH_EraseInitTypeDef erase;
+    int rc;
+    int i;
+
+    if (stm32f4_flash_async_cb) {
+        return -1;
+    }
+
+    for (i = 0; i < STM32F4_FLASH_NUM_AREAS - 1; i++) {
+        if (stm32f4_flash_sectors[i] == sector_address) {
+            break;
+        }
+    }
+    if (i == STM32F4_FLASH_NUM_AREAS - 1) {
+        return -1;
+    }
+
+    stm32f4_flash_async_cb = cb;
+    stm32f4_flash_async_arg = arg;
+    stm32f4_flash_async_left = 0;
+    stm32f4_flash_async_eop = 0;
+    stm32f4_flash_async_err = 0;
+
+    erase.TypeErase = FLASH_TYPEERASE_SECTORS;
+    erase.Sector = i;
+    erase.NbSectors = 1;
+    erase.VoltageRange = FLASH_VOLTAGE_RANGE_1;
+    rc = HAL_FLASHEx_Erase_IT(&erase);
+    if (rc != 0) {
+        stm32f4_flash_async_cb = NULL;
+    }
+    return rc;
+}
+
 static int
 stm32f4_flash_sector_info(int idx, uint32_t *address, uint32_t *sz)
 {
@@ -131,5 +304,7 @@ static int
 stm32f4_flash_init(void)
 {
     HAL_FLASH_Unlock();
+    NVIC_SetVector(FLASH_IRQn, (uint32_t)stm32f4_flash_isr);
+    NVIC_EnableIRQ(FLASH_IRQn);
     return 0;
 }
@@ -29,16 +29,42 @@
 #include <assert.h>
 #include <stdlib.h>
 
+/*
+ * DMA stream used for TX of each USART (RM0090 table 42/43).
+ */
+struct hal_uart_dma {
+    USART_TypeDef *ud_uart;
+    DMA_TypeDef *ud_dma;
+    DMA_Stream_TypeDef *ud_stream;
+    uint8_t ud_stream_idx;
+    uint8_t ud_chan;
+    uint32_t ud_rcc_dev;
+};
+
+static const struct hal_uart_dma uart_tx_dmas[] = {
+    { USART1, DMA2, DMA2_Stream7, 7, 4, RCC_AHB1ENR_DMA2EN },
+    { USART2, DMA1, DMA1_Stream6, 6, 4, RCC_AHB1ENR_DMA1EN },
+    { USART3, DMA1, DMA1_Stream3, 3, 4, RCC_AHB1ENR_DMA1EN },
+    { UART4, DMA1, DMA1_Stream4, 4, 4, RCC_AHB1ENR_DMA1EN },
+    { UART5, DMA1, DMA1_Stream7, 7, 4, RCC_AHB1ENR_DMA1EN },
+    { USART6, DMA2, DMA2_Stream6, 6, 5, RCC_AHB1ENR_DMA2EN }
+};
+
 struct hal_uart {
     USART_TypeDef *u_regs;
     uint8_t u_open:1;
     uint8_t u_rx_stall:1;
     uint8_t u_tx_end:1;
+    uint8_t u_tx_dma_run:1;
+    uint8_t u_tx_pend:1;
     uint8_t u_rx_data;
     hal_uart_rx_char u_rx_func;
     hal_uart_tx_char u_tx_func;
     hal_uart_tx_done u_tx_done;
     void *u_func_arg;
+    const struct hal_uart_dma *u_tx_dma;
+    hal_uart_tx_buf_done u_tx_buf_done;
+    void *u_tx_buf_arg;
 };
 static struct hal_uart uarts[UART_CNT];
 
@@ -107,6 +133,19 @@ uart_irq_handler(int num)
         u->u_tx_end = 0;
         regs->CR1 &= ~USART_CR1_TCIE;
     }
+    if (u->u_tx_dma_run && isr & USART_SR_TC) {
+        /*
+         * Last byte of hal_uart_tx_buf() block is out.
+         */
+        regs->CR1 &= ~USART_CR1_TCIE;
+        regs->CR3 &= ~USART_CR3_DMAT;
+        u->u_tx_dma_run = 0;
+        u->u_tx_buf_done(u->u_tx_buf_arg);
+        if (u->u_tx_pend) {
+            u->u_tx_pend = 0;
+            hal_uart_start_tx(u - uarts);
+        }
+    }
 }
 
 void
@@ -128,6 +167,61 @@ hal_uart_start_rx(int port)
     }
 }
 
+int
+hal_uart_tx_buf(int port, const uint8_t *buf, int len,
+  hal_uart_tx_buf_done tx_done, void *arg)
+{
+    const struct hal_uart_dma *ud;
+    DMA_Stream_TypeDef *stream;
+    struct hal_uart *u;
+    uint32_t flags;
+    int sr;
+
+    u = &uarts[port];
+    if (port >= UART_CNT || !u->u_open || !u->u_tx_dma || len <= 0 ||
+      len > 0xffff) {
+        return -1;
+    }
+    ud = u->u_tx_dma;
+    stream = ud->ud_stream;
+
+    __HAL_DISABLE_INTERRUPTS(sr);
+    if (u->u_tx_dma_run || u->u_tx_end ||
+      u->u_regs->CR1 & USART_CR1_TXEIE) {
+        __HAL_ENABLE_INTERRUPTS(sr);
+        return -1;
+    }
+    u->u_tx_buf_done = tx_done;
+    u->u_tx_buf_arg = arg;
+    u->u_tx_dma_run = 1;
+
+    stream->CR &= ~DMA_SxCR_EN;
+    while (stream->CR & DMA_SxCR_EN);
+
+    /* FEIF, DMEIF, TEIF, HTIF and TCIF of this stream must be clear. */
+    flags = 0x3d << ((ud->ud_stream_idx & 1) * 6 +
+      (ud->ud_stream_idx & 2) * 8);
+    if (ud->ud_stream_idx < 4) {
+        ud->ud_dma->LIFCR = flags;
+    } else {
+        ud->ud_dma->HIFCR = flags;
+    }
+    stream->PAR = (uint32_t)&u->u_regs->DR;
+    stream->M0AR = (uint32_t)buf;
+    stream->NDTR = len;
+    stream->FCR = 0;
+    stream->CR = ud->ud_chan * DMA_SxCR_CHSEL_0 | DMA_SxCR_MINC |
+      DMA_SxCR_DIR_0;
+
+    u->u_regs->SR = ~USART_SR_TC;
+    u->u_regs->CR3 |= USART_CR3_DMAT;
+    stream->CR |= DMA_SxCR_EN;
+    u->u_regs->CR1 |= USART_CR1_TCIE;
+    __HAL_ENABLE_INTERRUPTS(sr);
+
+    return 0;
+}
+
 void
 hal_uart_start_tx(int port)
 {
@@ -136,6 +230,11 @@ hal_uart_start_tx(int port)
 
     u = &uarts[port];
     __HAL_DISABLE_INTERRUPTS(sr);
+    if (u->u_tx_dma_run) {
+        u->u_tx_pend = 1;
+        __HAL_ENABLE_INTERRUPTS(sr);
+        return;
+    }
     u->u_regs->CR1 &= ~USART_CR1_TCIE;
     u->u_regs->CR1 |= USART_CR1_TXEIE;
     u->u_tx_end = 0;
@@ -256,6 +355,7 @@ hal_uart_config(int port, int32_t baudrate, uint8_t databits, uint8_t stopbits,
     struct hal_uart *u;
     const struct stm32f4_uart_cfg *cfg;
     uint32_t cr1, cr2, cr3;
+    int i;
 
     if (port >= UART_CNT) {
         return -1;
@@ -361,6 +461,14 @@ hal_uart_config(int port, int32_t baudrate, uint8_t databits, uint8_t stopbits,
     (void)u->u_regs->SR;
     hal_uart_set_nvic(cfg->suc_irqn, u);
 
+    for (i = 0; i < sizeof(uart_tx_dmas) / sizeof(uart_tx_dmas[0]); i++) {
+        if (uart_tx_dmas[i].ud_uart == cfg->suc_uart) {
+            u->u_tx_dma = &uart_tx_dmas[i];
+            RCC->AHB1ENR |= u->u_tx_dma->ud_rcc_dev;
+            break;
+        }
+    }
+
     u->u_regs->CR1 |= (USART_CR1_RXNEIE | USART_CR1_UE);
     u->u_open = 1;
 
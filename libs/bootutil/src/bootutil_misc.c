@@ -171,6 +171,7 @@ boot_read_status(struct boot_status *out_status,
                  struct boot_status_entry *out_entries,
                  int num_areas)
 {
+    struct fs_iovec iov[2];
     struct fs_file *file;
     uint32_t bytes_read;
     int rc;
@@ -182,15 +183,12 @@ boot_read_status(struct boot_status *out_status,
         goto done;
     }
 
-    rc = fs_read(file, sizeof *out_status, out_status, &bytes_read);
-    if (rc != 0 || bytes_read != sizeof *out_status) {
-        rc = BOOT_EBADSTATUS;
-        goto done;
-    }
-
-    rc = fs_read(file, num_areas * sizeof *out_entries, out_entries,
-                   &bytes_read);
-    if (rc != 0 || bytes_read != num_areas * sizeof *out_entries) {
+    iov[0].fi_base = out_status;
+    iov[0].fi_len = sizeof *out_status;
+    iov[1].fi_base = out_entries;
+    iov[1].fi_len = num_areas * sizeof *out_entries;
+    rc = fs_readv(file, iov, 2, &bytes_read);
+    if (rc != 0 || bytes_read != iov[0].fi_len + iov[1].fi_len) {
         rc = BOOT_EBADSTATUS;
         goto done;
     }
@@ -241,6 +239,7 @@ boot_write_status(const struct boot_status *status,
                   const struct boot_status_entry *entries,
                   int num_areas)
 {
+    struct fs_iovec iov[2];
     struct fs_file *file;
     int rc;
 
@@ -250,13 +249,11 @@ boot_write_status(const struct boot_status *status,
         goto done;
     }
 
-    rc = fs_write(file, status, sizeof *status);
-    if (rc != 0) {
-        rc = BOOT_EFILE;
-        goto done;
-    }
-
-    rc = fs_write(file, entries, num_areas * sizeof *entries);
+    iov[0].fi_base = (void *)status;
+    iov[0].fi_len = sizeof *status;
+    iov[1].fi_base = (void *)entries;
+    iov[1].fi_len = num_areas * sizeof *entries;
+    rc = fs_writev(file, iov, 2);
     if (rc != 0) {
         rc = BOOT_EFILE;
         goto done;
@@ -207,6 +207,14 @@ boot_erase_area(int area_idx)
     int rc;
 
     area_desc = boot_req->br_area_descs + area_idx;
+
+    /* Skip the erase if the area is blank already. */
+    rc = hal_flash_is_erased(area_desc->nad_flash_id, area_desc->nad_offset,
+                             area_desc->nad_length);
+    if (rc == 1) {
+        return 0;
+    }
+
     rc = hal_flash_erase(area_desc->nad_flash_id, area_desc->nad_offset,
                          area_desc->nad_length);
     if (rc != 0) {
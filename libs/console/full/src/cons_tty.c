@@ -59,6 +59,7 @@ struct console_tty {
     uint8_t ct_rx_buf[CONSOLE_RX_BUF_SZ]; /* must be after console_ring */
     console_rx_cb ct_rx_cb;	/* callback that input is ready */
     console_write_char ct_write_char;
+    uint8_t ct_tx_len;		/* bytes from ct_tx tail handed to UART */
     uint8_t ct_echo_off:1;
     uint8_t ct_esc_seq:2;
 } console_tty;
@@ -91,6 +92,52 @@ console_pull_char_head(struct console_ring *cr)
     }
 }
 
+static void console_tx_done(void *arg);
+
+/*
+ * Hands the contiguous run of queued output at ring tail to UART as one
+ * block. Tail moves when UART reports it sent, so data stays put meanwhile.
+ * Called with interrupts disabled.
+ */
+static void
+console_tx_start(struct console_tty *ct)
+{
+    struct console_ring *cr = &ct->ct_tx;
+
+    if (ct->ct_tx_len || cr->cr_head == cr->cr_tail) {
+        return;
+    }
+    if (cr->cr_head > cr->cr_tail) {
+        ct->ct_tx_len = cr->cr_head - cr->cr_tail;
+    } else {
+        ct->ct_tx_len = cr->cr_size - cr->cr_tail;
+    }
+    if (hal_uart_tx_buf(CONSOLE_UART, cr->cr_buf + cr->cr_tail,
+        ct->ct_tx_len, console_tx_done, ct)) {
+        ct->ct_tx_len = 0;
+    }
+}
+
+/*
+ * Interrupts disabled when called.
+ */
+static void
+console_tx_done(void *arg)
+{
+    struct console_tty *ct = (struct console_tty *)arg;
+    struct console_ring *cr = &ct->ct_tx;
+
+    if (ct->ct_tx_len == 0) {
+        /*
+         * Went to blocking mode while block was in flight.
+         */
+        return;
+    }
+    cr->cr_tail = (cr->cr_tail + ct->ct_tx_len) & (cr->cr_size - 1);
+    ct->ct_tx_len = 0;
+    console_tx_start(ct);
+}
+
 static void
 console_queue_char(char ch)
 {
@@ -100,7 +147,7 @@ console_queue_char(char ch)
     OS_ENTER_CRITICAL(sr);
     while (CONSOLE_HEAD_INC(&ct->ct_tx) == ct->ct_tx.cr_tail) {
         /* TX needs to drain */
-        hal_uart_start_tx(CONSOLE_UART);
+        console_tx_start(ct);
         OS_EXIT_CRITICAL(sr);
         os_time_delay(1);
         OS_ENTER_CRITICAL(sr);
@@ -144,6 +191,7 @@ console_blocking_mode(void)
 
     OS_ENTER_CRITICAL(sr);
     ct->ct_write_char = console_blocking_tx;
+    ct->ct_tx_len = 0;
 
     console_tx_flush(ct, CONSOLE_TX_BUF_SZ);
     OS_EXIT_CRITICAL(sr);
@@ -161,6 +209,7 @@ void
 console_write(const char *str, int cnt)
 {
     struct console_tty *ct = &console_tty;
+    int sr;
     int i;
 
     i = 0;
@@ -173,7 +222,9 @@ console_write(const char *str, int cnt)
     if (cnt > 0) {
         console_is_midline = str[cnt - 1] != '\n';
     }
-    hal_uart_start_tx(CONSOLE_UART);
+    OS_ENTER_CRITICAL(sr);
+    console_tx_start(ct);
+    OS_EXIT_CRITICAL(sr);
 }
 
 int
@@ -204,24 +255,6 @@ console_read(char *str, int cnt)
     return i;
 }
 
-/*
- * Interrupts disabled when console_tx_char/console_rx_char are called.
- */
-static int
-console_tx_char(void *arg)
-{
-    struct console_tty *ct = (struct console_tty *)arg;
-    struct console_ring *cr = &ct->ct_tx;
-
-    if (cr->cr_head == cr->cr_tail) {
-        /*
-         * No more data.
-         */
-        return -1;
-    }
-    return console_pull_char(cr);
-}
-
 static int
 console_buf_space(struct console_ring *cr)
 {
@@ -231,6 +264,9 @@ console_buf_space(struct console_ring *cr)
     return space - 1;
 }
 
+/*
+ * Interrupts disabled when console_rx_char is called.
+ */
 static int
 console_rx_char(void *arg, uint8_t data)
 {
@@ -328,12 +364,18 @@ queue_char:
     }
     if (!ct->ct_echo_off) {
         if (console_buf_space(tx) < tx_space) {
+            if (ct->ct_tx_len) {
+                /*
+                 * Ring tail is being sent; can't flush past it. Drop echo.
+                 */
+                goto out;
+            }
             console_tx_flush(ct, tx_space);
         }
         for (i = 0; i < tx_space; i++) {
             console_add_char(tx, tx_buf[i]);
         }
-        hal_uart_start_tx(CONSOLE_UART);
+        console_tx_start(ct);
     }
 out:
     return 0;
@@ -351,8 +393,7 @@ console_init(console_rx_cb rx_cb)
     struct console_tty *ct = &console_tty;
     int rc;
 
-    rc = hal_uart_init_cbs(CONSOLE_UART, console_tx_char, NULL,
-            console_rx_char, ct);
+    rc = hal_uart_init_cbs(CONSOLE_UART, NULL, NULL, console_rx_char, ct);
     if (rc) {
         return rc;
     }
@@ -238,10 +238,8 @@ imgr_upload(struct nmgr_jbuf *njb)
             rc = flash_area_open(best, &imgr_state.upload.fa);
             assert(rc == 0);
             /*
-             * XXXX only erase if needed.
+             * Sectors get erased as the upload reaches them.
              */
-            rc = flash_area_erase(imgr_state.upload.fa, 0,
-              imgr_state.upload.fa->fa_size);
         } else {
             /*
              * No slot where to upload!
@@ -259,6 +257,9 @@ imgr_upload(struct nmgr_jbuf *njb)
     }
 
     if (len && imgr_state.upload.fa) {
+        rc = flash_area_erase_ahead(imgr_state.upload.fa,
+          imgr_state.upload.off, len);
+        assert(rc == 0);
         rc = flash_area_write(imgr_state.upload.fa, imgr_state.upload.off,
           img_data, len);
         assert(rc == 0);
@@ -77,20 +77,27 @@ os_mutex_release(struct os_mutex *mu)
         return OS_INVALID_PARM;
     }
 
+    /*
+     * The level and owner must change together; if the level reached zero
+     * before the critical section, a preempting task could take the mutex
+     * and then lose it when the owner below is overwritten.
+     */
+    OS_ENTER_CRITICAL(sr);
+
     /* We better own this mutex! */
     current = os_sched_get_current_task();
     if ((mu->mu_level == 0) || (mu->mu_owner != current)) {
+        OS_EXIT_CRITICAL(sr);
         return (OS_BAD_MUTEX);
     }
 
     /* Decrement nesting level by 1. If not zero, nested (so dont release!) */
     --mu->mu_level;
     if (mu->mu_level != 0) {
+        OS_EXIT_CRITICAL(sr);
         return (OS_OK);
     }
 
-    OS_ENTER_CRITICAL(sr);
-
     /* Restore owner task's priority; resort list if different  */
     if (current->t_prio != mu->mu_prio) {
         current->t_prio = mu->mu_prio;
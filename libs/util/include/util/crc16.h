@@ -30,6 +30,20 @@
 
 #include <inttypes.h>
 
-unsigned short crc16_ccitt(uint16_t initial_crc, const void *buf, int len);
+#define CRC16_INITIAL_CRC       0
+
+/**
+ * Calculates the CRC16-CCITT (polynomial 0x1021) of a buffer.  A CRC can be
+ * computed incrementally by passing the result of one call as the initial CRC
+ * of the next.
+ *
+ * @param initial_crc           The CRC of the preceding data, or
+ *                                  CRC16_INITIAL_CRC.
+ * @param buf                   The data to process.
+ * @param len                   The number of bytes to process.
+ *
+ * @return                      The updated CRC.
+ */
+uint16_t crc16_ccitt(uint16_t initial_crc, const void *buf, int len);
 
 #endif /* _CRC16_H_ */
@@ -0,0 +1,114 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ * 
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#include "testutil/testutil.h"
+#include "util/crc16.h"
+#include "util_test_priv.h"
+
+static const uint8_t crc16_test_check_str[] = "123456789";
+
+/* Bit-at-a-time reference implementation. */
+static uint16_t
+crc16_test_ref(uint16_t crc, const uint8_t *buf, int len)
+{
+    int i;
+
+    while (len-- > 0) {
+        crc ^= *buf++ << 8;
+        for (i = 0; i < 8; i++) {
+            if (crc & 0x8000) {
+                crc = (crc << 1) ^ 0x1021;
+            } else {
+                crc <<= 1;
+            }
+        }
+    }
+
+    return crc;
+}
+
+static void
+crc16_test_fill(uint8_t *buf, int len)
+{
+    uint32_t x;
+    int i;
+
+    x = 0x12345678;
+    for (i = 0; i < len; i++) {
+        x = x * 1103515245 + 12345;
+        buf[i] = x >> 16;
+    }
+}
+
+TEST_CASE(crc16_test_check_values)
+{
+    /* Standard check values for the CCITT polynomial with various initial
+     * values (XMODEM, CCITT-FALSE, AUG-CCITT).
+     */
+    TEST_ASSERT(crc16_ccitt(CRC16_INITIAL_CRC, crc16_test_check_str, 9) ==
+                0x31c3);
+    TEST_ASSERT(crc16_ccitt(0xffff, crc16_test_check_str, 9) == 0x29b1);
+    TEST_ASSERT(crc16_ccitt(0x1d0f, crc16_test_check_str, 9) == 0xe5cc);
+
+    TEST_ASSERT(crc16_ccitt(0x1234, crc16_test_check_str, 0) == 0x1234);
+}
+
+TEST_CASE(crc16_test_reference)
+{
+    uint8_t buf[256];
+    uint16_t expected;
+    uint16_t crc;
+    int off;
+    int len;
+
+    crc16_test_fill(buf, sizeof buf);
+
+    /* All short lengths at every alignment. */
+    for (off = 0; off < 8; off++) {
+        for (len = 0; len <= 128; len++) {
+            expected = crc16_test_ref(0xffff, buf + off, len);
+            crc = crc16_ccitt(0xffff, buf + off, len);
+            TEST_ASSERT_FATAL(crc == expected, "off=%d len=%d", off, len);
+        }
+    }
+}
+
+TEST_CASE(crc16_test_incremental)
+{
+    uint8_t buf[200];
+    uint16_t expected;
+    uint16_t crc;
+    int split;
+
+    crc16_test_fill(buf, sizeof buf);
+    expected = crc16_ccitt(CRC16_INITIAL_CRC, buf, sizeof buf);
+
+    for (split = 0; split <= sizeof buf; split++) {
+        crc = crc16_ccitt(CRC16_INITIAL_CRC, buf, split);
+        crc = crc16_ccitt(crc, buf + split, sizeof buf - split);
+        TEST_ASSERT_FATAL(crc == expected, "split=%d", split);
+    }
+}
+
+TEST_SUITE(crc16_test_suite)
+{
+    crc16_test_check_values();
+    crc16_test_reference();
+    crc16_test_incremental();
+}
@@ -21,5 +21,6 @@
 #define __UTIL_TEST_PRIV_
 
 int cbmem_test_suite(void);
+int crc16_test_suite(void);
 
 #endif